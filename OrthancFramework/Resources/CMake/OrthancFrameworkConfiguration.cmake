@@ -95,6 +95,11 @@ if (NOT ENABLE_ZLIB)
   add_definitions(-DORTHANC_ENABLE_ZLIB=0)
 endif()
 
+if (NOT ENABLE_ZSTD)
+  unset(USE_SYSTEM_ZSTD CACHE)
+  add_definitions(-DORTHANC_ENABLE_ZSTD=0)
+endif()
+
 if (NOT ENABLE_PNG)
   unset(USE_SYSTEM_LIBPNG CACHE)
   add_definitions(-DORTHANC_ENABLE_PNG=0)
@@ -314,6 +319,7 @@ if (ENABLE_WEB_SERVER)
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/HttpServer/HttpServer.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/HttpServer/HttpStreamTranscoder.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/HttpServer/IHttpHandler.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/../../Sources/HttpServer/MemoryBufferHttpSender.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/HttpServer/StringHttpOutput.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/RestApi/RestApi.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/RestApi/RestApiCall.cpp
@@ -382,6 +388,7 @@ if (ENABLE_ZLIB)
 
   if (NOT ORTHANC_SANDBOXED)
     list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+      ${CMAKE_CURRENT_LIST_DIR}/../../Sources/Compression/ChunkedZlibCompressor.cpp
       ${CMAKE_CURRENT_LIST_DIR}/../../Sources/Compression/HierarchicalZipWriter.cpp
       ${CMAKE_CURRENT_LIST_DIR}/../../Sources/Compression/ZipWriter.cpp
       ${CMAKE_CURRENT_LIST_DIR}/../../Sources/FileStorage/StorageAccessor.cpp
@@ -390,6 +397,20 @@ if (ENABLE_ZLIB)
 endif()
 
 
+##
+## zstd support (new in Orthanc 1.9.6)
+##
+
+if (ENABLE_ZSTD)
+  include(${CMAKE_CURRENT_LIST_DIR}/ZstdConfiguration.cmake)
+  add_definitions(-DORTHANC_ENABLE_ZSTD=1)
+
+  list(APPEND ORTHANC_CORE_SOURCES_INTERNAL
+    ${CMAKE_CURRENT_LIST_DIR}/../../Sources/Compression/ZstdCompressor.cpp
+    )
+endif()
+
+
 ##
 ## PNG support: libpng (in conjunction with zlib)
 ##
@@ -624,7 +645,9 @@ else()
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/Cache/SharedArchive.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/FileBuffer.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/FileStorage/FilesystemStorage.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MappedFileMemoryBuffer.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MetricsRegistry.cpp
+    ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MultiThreading/FairRunnablesPool.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MultiThreading/RunnableWorkersPool.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MultiThreading/Semaphore.cpp
     ${CMAKE_CURRENT_LIST_DIR}/../../Sources/MultiThreading/SharedMessageQueue.cpp
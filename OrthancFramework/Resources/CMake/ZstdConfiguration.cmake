@@ -0,0 +1,38 @@
+# Orthanc - A Lightweight, RESTful DICOM Store
+# Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+# Department, University Hospital of Liege, Belgium
+# Copyright (C) 2017-2021 Osimis S.A., Belgium
+#
+# This program is free software: you can redistribute it and/or
+# modify it under the terms of the GNU Lesser General Public License
+# as published by the Free Software Foundation, either version 3 of
+# the License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# Lesser General Public License for more details.
+#
+# You should have received a copy of the GNU Lesser General Public
+# License along with this program. If not, see
+# <http://www.gnu.org/licenses/>.
+
+
+# No static build of zstd is provided yet, as its source package is
+# not mirrored on "orthanc.uclouvain.be" (new in Orthanc 1.9.6)
+
+if (STATIC_BUILD OR NOT USE_SYSTEM_ZSTD)
+  message(FATAL_ERROR "Support for zstd is only available using the system version of zstd")
+endif()
+
+CHECK_INCLUDE_FILE_CXX(zstd.h HAVE_ZSTD_H)
+if (NOT HAVE_ZSTD_H)
+  message(FATAL_ERROR "Please install the libzstd-dev package")
+endif()
+
+CHECK_LIBRARY_EXISTS(zstd ZSTD_compress "" HAVE_ZSTD_LIB)
+if (NOT HAVE_ZSTD_LIB)
+  message(FATAL_ERROR "Please install the libzstd-dev package")
+endif()
+
+link_libraries(zstd)
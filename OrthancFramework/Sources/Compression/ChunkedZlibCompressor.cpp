@@ -0,0 +1,612 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "ChunkedZlibCompressor.h"
+
+#include "../Endianness.h"
+#include "../OrthancException.h"
+
+#include <boost/thread.hpp>
+#include <string.h>
+#include <zlib.h>
+
+
+static const size_t  FOOTER_SIZE = 24;
+static const char    MAGIC[8] = { 'O', 'Z', 'C', 'H', 'U', 'N', 'K', '1' };
+
+
+namespace Orthanc
+{
+  static uint64_t ReadUInt64(const void* source)
+  {
+    uint64_t value;
+    memcpy(&value, source, sizeof(uint64_t));
+    return le64toh(value);
+  }
+
+
+  static uint32_t ReadUInt32(const void* source)
+  {
+    uint32_t value;
+    memcpy(&value, source, sizeof(uint32_t));
+    return le32toh(value);
+  }
+
+
+  static void WriteUInt64(void* target,
+                          uint64_t value)
+  {
+    value = htole64(value);
+    memcpy(target, &value, sizeof(uint64_t));
+  }
+
+
+  static void WriteUInt32(void* target,
+                          uint32_t value)
+  {
+    value = htole32(value);
+    memcpy(target, &value, sizeof(uint32_t));
+  }
+
+
+  static void CheckZlibError(int error)
+  {
+    switch (error)
+    {
+      case Z_OK:
+        return;
+
+      case Z_DATA_ERROR:
+      case Z_BUF_ERROR:
+        throw OrthancException(ErrorCode_CorruptedFile);
+
+      case Z_MEM_ERROR:
+        throw OrthancException(ErrorCode_NotEnoughMemory);
+
+      default:
+        throw OrthancException(ErrorCode_InternalError);
+    }
+  }
+
+
+  uint64_t ChunkedZlibCompressor::Index::ParseFooter(const void* footer,
+                                                     uint64_t compressedSize)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(footer);
+
+    if (compressedSize < FOOTER_SIZE ||
+        memcmp(p + 16, MAGIC, sizeof(MAGIC)) != 0)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Not a chunked zlib buffer");
+    }
+
+    uncompressedSize_ = ReadUInt64(p);
+    chunkSize_ = ReadUInt32(p + 8);
+
+    const uint32_t count = ReadUInt32(p + 12);
+    const uint64_t indexSize = (static_cast<uint64_t>(count) + 1) * sizeof(uint64_t);
+
+    if ((uncompressedSize_ == 0 && count != 0) ||
+        (uncompressedSize_ != 0 &&
+         (chunkSize_ == 0 ||
+          (uncompressedSize_ + chunkSize_ - 1) / chunkSize_ != count)) ||
+        indexSize + FOOTER_SIZE > compressedSize)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Bad footer in a chunked zlib buffer");
+    }
+
+    offsets_.resize(count + 1);
+
+    return compressedSize - FOOTER_SIZE - indexSize;
+  }
+
+
+  void ChunkedZlibCompressor::Index::ParseOffsets(const void* index,
+                                                  uint64_t indexStart)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(index);
+
+    for (size_t i = 0; i < offsets_.size(); i++)
+    {
+      offsets_[i] = ReadUInt64(p + i * sizeof(uint64_t));
+
+      if ((i == 0 && offsets_[i] != 0) ||
+          (i > 0 && offsets_[i] <= offsets_[i - 1]))
+      {
+        throw OrthancException(ErrorCode_CorruptedFile, "Bad index in a chunked zlib buffer");
+      }
+    }
+
+    if (offsets_.back() != indexStart)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Bad index in a chunked zlib buffer");
+    }
+  }
+
+
+  ChunkedZlibCompressor::Index::Index(const void* compressed,
+                                      size_t compressedSize)
+  {
+    if (compressedSize < FOOTER_SIZE)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Not a chunked zlib buffer");
+    }
+
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(compressed);
+    uint64_t indexStart = ParseFooter(p + compressedSize - FOOTER_SIZE, compressedSize);
+    ParseOffsets(p + indexStart, indexStart);
+  }
+
+
+  ChunkedZlibCompressor::Index::Index(IRangeReader& reader,
+                                      uint64_t compressedSize)
+  {
+    if (compressedSize < FOOTER_SIZE)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Not a chunked zlib buffer");
+    }
+
+    std::string footer;
+    reader.ReadRange(footer, compressedSize - FOOTER_SIZE, compressedSize);
+
+    if (footer.size() != FOOTER_SIZE)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    uint64_t indexStart = ParseFooter(footer.c_str(), compressedSize);
+
+    std::string index;
+    reader.ReadRange(index, indexStart, compressedSize - FOOTER_SIZE);
+
+    if (index.size() != offsets_.size() * sizeof(uint64_t))
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    ParseOffsets(index.c_str(), indexStart);
+  }
+
+
+  void ChunkedZlibCompressor::Index::GetCompressedRange(uint64_t& start,
+                                                        uint64_t& end,
+                                                        size_t chunk) const
+  {
+    if (chunk >= GetChunksCount())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    start = offsets_[chunk];
+    end = offsets_[chunk + 1];
+  }
+
+
+  void ChunkedZlibCompressor::Index::GetUncompressedRange(uint64_t& start,
+                                                          uint64_t& end,
+                                                          size_t chunk) const
+  {
+    if (chunk >= GetChunksCount())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    start = static_cast<uint64_t>(chunk) * chunkSize_;
+    end = std::min(start + chunkSize_, uncompressedSize_);
+  }
+
+
+  size_t ChunkedZlibCompressor::Index::LookupChunk(uint64_t uncompressedOffset) const
+  {
+    if (uncompressedOffset >= uncompressedSize_)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    return static_cast<size_t>(uncompressedOffset / chunkSize_);
+  }
+
+
+  namespace
+  {
+    // Compresses the chunks of one buffer, possibly from several threads
+    class ChunksCompression : public boost::noncopyable
+    {
+    private:
+      const uint8_t*              source_;
+      size_t                      sourceSize_;
+      size_t                      chunkSize_;
+      uint8_t*                    target_;
+      const std::vector<size_t>&  targetOffsets_;  // Position of each chunk before compaction
+      std::vector<size_t>&        targetSizes_;    // In: Capacity, out: Actual size
+      uint8_t                     level_;
+
+      boost::mutex                mutex_;
+      size_t                      next_;
+      bool                        failed_;
+      ErrorCode                   error_;
+
+      void CompressChunk(size_t chunk)
+      {
+        const size_t start = chunk * chunkSize_;
+        const size_t size = std::min(chunkSize_, sourceSize_ - start);
+
+        uLongf compressedSize = static_cast<uLongf>(targetSizes_[chunk]);
+
+        CheckZlibError(compress2(target_ + targetOffsets_[chunk], &compressedSize,
+                                 source_ + start, static_cast<uLong>(size), level_));
+
+        targetSizes_[chunk] = static_cast<size_t>(compressedSize);
+      }
+
+      static void Worker(ChunksCompression* that)
+      {
+        for (;;)
+        {
+          size_t chunk;
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+
+            if (that->failed_ ||
+                that->next_ == that->targetSizes_.size())
+            {
+              return;
+            }
+
+            chunk = that->next_;
+            that->next_++;
+          }
+
+          try
+          {
+            that->CompressChunk(chunk);
+          }
+          catch (OrthancException& e)
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+            that->failed_ = true;
+            that->error_ = e.GetErrorCode();
+          }
+          catch (...)
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+            that->failed_ = true;
+            that->error_ = ErrorCode_InternalError;
+          }
+        }
+      }
+
+    public:
+      ChunksCompression(const uint8_t* source,
+                        size_t sourceSize,
+                        size_t chunkSize,
+                        uint8_t* target,
+                        const std::vector<size_t>& targetOffsets,
+                        std::vector<size_t>& targetSizes,
+                        uint8_t level) :
+        source_(source),
+        sourceSize_(sourceSize),
+        chunkSize_(chunkSize),
+        target_(target),
+        targetOffsets_(targetOffsets),
+        targetSizes_(targetSizes),
+        level_(level),
+        next_(0),
+        failed_(false),
+        error_(ErrorCode_Success)
+      {
+      }
+
+      void Run(unsigned int threadsCount)
+      {
+        if (threadsCount <= 1)
+        {
+          for (size_t i = 0; i < targetSizes_.size(); i++)
+          {
+            CompressChunk(i);
+          }
+        }
+        else
+        {
+          std::vector<boost::thread*> threads;
+          threads.reserve(threadsCount);
+
+          for (unsigned int i = 0; i < threadsCount; i++)
+          {
+            threads.push_back(new boost::thread(Worker, this));
+          }
+
+          for (size_t i = 0; i < threads.size(); i++)
+          {
+            if (threads[i]->joinable())
+            {
+              threads[i]->join();
+            }
+
+            delete threads[i];
+          }
+
+          if (failed_)
+          {
+            throw OrthancException(error_);
+          }
+        }
+      }
+    };
+  }
+
+
+  ChunkedZlibCompressor::ChunkedZlibCompressor() :
+    chunkSize_(1024 * 1024),
+    threadsCount_(1),
+    compressionLevel_(6)
+  {
+  }
+
+
+  void ChunkedZlibCompressor::SetChunkSize(size_t size)
+  {
+    if (size == 0 ||
+        static_cast<uint64_t>(size) > static_cast<uint64_t>(0xffffffffu))
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      chunkSize_ = size;
+    }
+  }
+
+
+  void ChunkedZlibCompressor::SetThreadsCount(unsigned int count)
+  {
+    if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      threadsCount_ = count;
+    }
+  }
+
+
+  void ChunkedZlibCompressor::SetCompressionLevel(uint8_t level)
+  {
+    if (level >= 10)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "Zlib compression level must be between 0 (no compression) and 9 (highest compression)");
+    }
+    else
+    {
+      compressionLevel_ = level;
+    }
+  }
+
+
+  void ChunkedZlibCompressor::Compress(std::string& compressed,
+                                       const void* uncompressed,
+                                       size_t uncompressedSize)
+  {
+    const size_t count = (uncompressedSize + chunkSize_ - 1) / chunkSize_;
+
+    if (static_cast<uint64_t>(count) >= static_cast<uint64_t>(0xffffffffu))
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    /**
+     * The chunks are compressed in place into one single buffer, at
+     * positions that are given by their worst-case compressed size,
+     * then are compacted. This avoids to hold a second copy of the
+     * compressed content.
+     **/
+    std::vector<size_t> targetOffsets(count);
+    std::vector<size_t> targetSizes(count);
+
+    size_t capacity = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      const size_t size = std::min(chunkSize_, uncompressedSize - i * chunkSize_);
+      targetOffsets[i] = capacity;
+      targetSizes[i] = compressBound(static_cast<uLong>(size));
+      capacity += targetSizes[i];
+    }
+
+    const size_t indexSize = (count + 1) * sizeof(uint64_t);
+
+    try
+    {
+      compressed.resize(capacity + indexSize + FOOTER_SIZE);
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    uint8_t* target = reinterpret_cast<uint8_t*>(&compressed[0]);
+
+    if (count > 0)
+    {
+      ChunksCompression compression(reinterpret_cast<const uint8_t*>(uncompressed), uncompressedSize,
+                                    chunkSize_, target, targetOffsets, targetSizes, compressionLevel_);
+      compression.Run(static_cast<unsigned int>(std::min(static_cast<size_t>(threadsCount_), count)));
+    }
+
+    size_t position = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      assert(position <= targetOffsets[i]);
+      memmove(target + position, target + targetOffsets[i], targetSizes[i]);
+      WriteUInt64(target + capacity + i * sizeof(uint64_t), position);  // Temporary location of the index
+      position += targetSizes[i];
+    }
+
+    // Move the index and write the footer
+    memmove(target + position, target + capacity, count * sizeof(uint64_t));
+    WriteUInt64(target + position + count * sizeof(uint64_t), position);
+
+    uint8_t* footer = target + position + indexSize;
+    WriteUInt64(footer, uncompressedSize);
+    WriteUInt32(footer + 8, static_cast<uint32_t>(chunkSize_));
+    WriteUInt32(footer + 12, static_cast<uint32_t>(count));
+    memcpy(footer + 16, MAGIC, sizeof(MAGIC));
+
+    compressed.resize(position + indexSize + FOOTER_SIZE);
+  }
+
+
+  void ChunkedZlibCompressor::Uncompress(std::string& uncompressed,
+                                         const void* compressed,
+                                         size_t compressedSize)
+  {
+    Index index(compressed, compressedSize);
+
+    try
+    {
+      uncompressed.resize(static_cast<size_t>(index.GetUncompressedSize()));
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    if (static_cast<uint64_t>(uncompressed.size()) != index.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_InternalError,
+                             "Uncompressing a buffer that is too large for a 32bit architecture");
+    }
+
+    const uint8_t* source = reinterpret_cast<const uint8_t*>(compressed);
+
+    for (size_t i = 0; i < index.GetChunksCount(); i++)
+    {
+      uint64_t compressedStart, compressedEnd, uncompressedStart, uncompressedEnd;
+      index.GetCompressedRange(compressedStart, compressedEnd, i);
+      index.GetUncompressedRange(uncompressedStart, uncompressedEnd, i);
+
+      uLongf size = static_cast<uLongf>(uncompressedEnd - uncompressedStart);
+
+      CheckZlibError(uncompress(reinterpret_cast<uint8_t*>(&uncompressed[uncompressedStart]), &size,
+                                source + compressedStart, static_cast<uLong>(compressedEnd - compressedStart)));
+
+      if (size != uncompressedEnd - uncompressedStart)
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+    }
+  }
+
+
+  void ChunkedZlibCompressor::UncompressChunk(std::string& target,
+                                              const Index& index,
+                                              size_t chunk,
+                                              const void* compressedChunk,
+                                              size_t compressedChunkSize)
+  {
+    uint64_t start, end;
+    index.GetUncompressedRange(start, end, chunk);
+
+    target.resize(static_cast<size_t>(end - start));
+
+    uLongf size = static_cast<uLongf>(target.size());
+
+    if (size > 0)
+    {
+      CheckZlibError(uncompress(reinterpret_cast<uint8_t*>(&target[0]), &size,
+                                reinterpret_cast<const uint8_t*>(compressedChunk),
+                                static_cast<uLong>(compressedChunkSize)));
+    }
+
+    if (size != target.size())
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+  }
+
+
+  void ChunkedZlibCompressor::ReadRange(std::string& target,
+                                        IRangeReader& reader,
+                                        uint64_t compressedSize,
+                                        uint64_t start,
+                                        uint64_t end)
+  {
+    if (start > end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    Index index(reader, compressedSize);
+
+    if (end > index.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "Reading beyond the end of a compressed buffer");
+    }
+
+    target.clear();
+
+    if (start == end)
+    {
+      return;
+    }
+
+    target.reserve(static_cast<size_t>(end - start));
+
+    const size_t firstChunk = index.LookupChunk(start);
+    const size_t lastChunk = index.LookupChunk(end - 1);
+
+    // Read all the chunks that overlap the range at once
+    uint64_t compressedStart, compressedEnd, tmp;
+    index.GetCompressedRange(compressedStart, tmp, firstChunk);
+    index.GetCompressedRange(tmp, compressedEnd, lastChunk);
+
+    std::string compressed;
+    reader.ReadRange(compressed, compressedStart, compressedEnd);
+
+    if (compressed.size() != compressedEnd - compressedStart)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    std::string chunk;
+
+    for (size_t i = firstChunk; i <= lastChunk; i++)
+    {
+      uint64_t chunkStart, chunkEnd;
+      index.GetCompressedRange(chunkStart, chunkEnd, i);
+      UncompressChunk(chunk, index, i, compressed.c_str() + (chunkStart - compressedStart),
+                      static_cast<size_t>(chunkEnd - chunkStart));
+
+      uint64_t uncompressedStart, uncompressedEnd;
+      index.GetUncompressedRange(uncompressedStart, uncompressedEnd, i);
+
+      const uint64_t from = std::max(start, uncompressedStart);
+      const uint64_t to = std::min(end, uncompressedEnd);
+      target.append(chunk, static_cast<size_t>(from - uncompressedStart), static_cast<size_t>(to - from));
+    }
+  }
+}
@@ -0,0 +1,175 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IBufferCompressor.h"
+#include "../Compatibility.h"  // For ORTHANC_OVERRIDE
+
+#if !defined(ORTHANC_ENABLE_ZLIB)
+#  error The macro ORTHANC_ENABLE_ZLIB must be defined
+#endif
+
+#if ORTHANC_ENABLE_ZLIB != 1
+#  error ZLIB support must be enabled to include this file
+#endif
+
+#include <stdint.h>
+#include <vector>
+
+
+namespace Orthanc
+{
+  /**
+   * Block-compressed format that is internal to Orthanc (new in
+   * Orthanc 1.9.6), cf. "CompressionType_ZlibChunked". The buffer is
+   * cut into chunks of fixed size that are independently compressed
+   * with zlib, followed by an index and by a footer:
+   *
+   *   [chunk 0] ... [chunk N-1]
+   *   [index: (N + 1) x uint64_t, offsets of the chunks and of the index]
+   *   [footer: uncompressed size (uint64_t), chunk size (uint32_t),
+   *            N (uint32_t), magic (8 bytes)]
+   *
+   * All the integers are little-endian. As the index is written after
+   * the chunks, the chunks can be compressed in parallel and written
+   * in a streaming fashion. A range of the uncompressed buffer can be
+   * read by only accessing the footer, the index and the chunks that
+   * overlap the range.
+   **/
+  class ORTHANC_PUBLIC ChunkedZlibCompressor : public IBufferCompressor
+  {
+  public:
+    class ORTHANC_PUBLIC IRangeReader : public boost::noncopyable
+    {
+    public:
+      virtual ~IRangeReader()
+      {
+      }
+
+      // Reads the bytes [start, end) of the compressed buffer
+      virtual void ReadRange(std::string& target,
+                             uint64_t start,
+                             uint64_t end) = 0;
+    };
+
+    // Index of a compressed buffer
+    class ORTHANC_PUBLIC Index : public boost::noncopyable
+    {
+    private:
+      uint64_t               uncompressedSize_;
+      uint32_t               chunkSize_;
+      std::vector<uint64_t>  offsets_;
+
+      // Returns the offset of the index in the compressed buffer
+      uint64_t ParseFooter(const void* footer,
+                           uint64_t compressedSize);
+
+      void ParseOffsets(const void* index,
+                        uint64_t indexStart);
+
+    public:
+      // Parses the index of a compressed buffer that is entirely in memory
+      Index(const void* compressed,
+            size_t compressedSize);
+
+      // Parses the index by reading the footer, then the index
+      Index(IRangeReader& reader,
+            uint64_t compressedSize);
+
+      uint64_t GetUncompressedSize() const
+      {
+        return uncompressedSize_;
+      }
+
+      size_t GetChunksCount() const
+      {
+        return offsets_.size() - 1;
+      }
+
+      // Bytes [start, end) of the chunk in the compressed buffer
+      void GetCompressedRange(uint64_t& start,
+                              uint64_t& end,
+                              size_t chunk) const;
+
+      // Bytes [start, end) of the chunk in the uncompressed buffer
+      void GetUncompressedRange(uint64_t& start,
+                                uint64_t& end,
+                                size_t chunk) const;
+
+      size_t LookupChunk(uint64_t uncompressedOffset) const;
+    };
+
+  private:
+    size_t        chunkSize_;
+    unsigned int  threadsCount_;
+    uint8_t       compressionLevel_;
+
+  public:
+    ChunkedZlibCompressor();
+
+    void SetChunkSize(size_t size);
+
+    size_t GetChunkSize() const
+    {
+      return chunkSize_;
+    }
+
+    // Number of threads that compress the chunks in parallel
+    void SetThreadsCount(unsigned int count);
+
+    unsigned int GetThreadsCount() const
+    {
+      return threadsCount_;
+    }
+
+    void SetCompressionLevel(uint8_t level);
+
+    uint8_t GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    virtual void Compress(std::string& compressed,
+                          const void* uncompressed,
+                          size_t uncompressedSize) ORTHANC_OVERRIDE;
+
+    virtual void Uncompress(std::string& uncompressed,
+                            const void* compressed,
+                            size_t compressedSize) ORTHANC_OVERRIDE;
+
+    // "target" receives the uncompressed content of one chunk
+    static void UncompressChunk(std::string& target,
+                                const Index& index,
+                                size_t chunk,
+                                const void* compressedChunk,
+                                size_t compressedChunkSize);
+
+    // Reads the bytes [start, end) of the uncompressed buffer
+    static void ReadRange(std::string& target,
+                          IRangeReader& reader,
+                          uint64_t compressedSize,
+                          uint64_t start,
+                          uint64_t end);
+  };
+}
@@ -187,6 +187,16 @@ namespace Orthanc
     return writer_.GetCompressionLevel();
   }
 
+  void HierarchicalZipWriter::SetCompressionThreads(unsigned int threads)
+  {
+    writer_.SetCompressionThreads(threads);
+  }
+
+  unsigned int HierarchicalZipWriter::GetCompressionThreads() const
+  {
+    return writer_.GetCompressionThreads();
+  }
+
   void HierarchicalZipWriter::SetAppendToExisting(bool append)
   {
     writer_.SetAppendToExisting(append);
@@ -203,6 +213,13 @@ namespace Orthanc
     writer_.OpenFile(p.c_str());
   }
 
+  void HierarchicalZipWriter::OpenFile(const char* name,
+                                       uint8_t compressionLevel)
+  {
+    std::string p = indexer_.OpenFile(name);
+    writer_.OpenFile(p.c_str(), compressionLevel);
+  }
+
   void HierarchicalZipWriter::OpenDirectory(const char* name)
   {
     indexer_.OpenDirectory(name);
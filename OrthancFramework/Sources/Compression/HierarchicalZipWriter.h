@@ -96,12 +96,19 @@ namespace Orthanc
 
     uint8_t GetCompressionLevel() const;
 
+    void SetCompressionThreads(unsigned int threads);
+
+    unsigned int GetCompressionThreads() const;
+
     void SetAppendToExisting(bool append);
     
     bool IsAppendToExisting() const;
     
     void OpenFile(const char* name);
 
+    void OpenFile(const char* name,
+                  uint8_t compressionLevel);
+
     void OpenDirectory(const char* name);
 
     void CloseDirectory();
@@ -28,9 +28,11 @@
 
 #include "ZipWriter.h"
 
+#include <deque>
 #include <limits>
 #include <boost/filesystem.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
 
 #include "../../Resources/ThirdParty/minizip/zip.h"
 #include "../Logging.h"
@@ -38,6 +40,10 @@
 #include "../SystemToolbox.h"
 
 
+// Size of the chunks that are compressed in parallel (new in Orthanc 1.9.6)
+static const size_t PARALLEL_CHUNK_SIZE = 1024 * 1024;
+
+
 static void PrepareFileInfo(zip_fileinfo& zfi)
 {
   memset(&zfi, 0, sizeof(zfi));
@@ -422,16 +428,330 @@ namespace Orthanc
   };
   
 
+  /**
+   * Pool of threads that compress the chunks of the files to be added
+   * to the ZIP archive (new in Orthanc 1.9.6). Each chunk is deflated
+   * as a "raw" deflate stream (no zlib header). All the chunks, except
+   * the last one of each file, are terminated by "Z_SYNC_FLUSH", which
+   * aligns them on a byte boundary: The concatenation of the chunks is
+   * a valid deflate stream, as in "pigz". The CRC-32 of the full file
+   * is obtained by combining the CRC-32 of the chunks.
+   **/
+  class ZipWriter::ParallelCompressor : public boost::noncopyable
+  {
+  public:
+    class Chunk : public boost::noncopyable
+    {
+    private:
+      std::string  data_;  // Uncompressed before "Compress()", compressed afterward
+      uint8_t      level_;
+      bool         isLast_;
+      size_t       uncompressedSize_;
+      uLong        crc32_;
+      bool         success_;
+      bool         isDone_;  // Protected by the mutex of the compressor
+
+    public:
+      Chunk(std::string& data,  // Emptied by this constructor
+            uint8_t level,
+            bool isLast) :
+        level_(level),
+        isLast_(isLast),
+        uncompressedSize_(data.size()),
+        crc32_(0),
+        success_(false),
+        isDone_(false)
+      {
+        data_.swap(data);
+      }
+
+      void Compress()
+      {
+        crc32_ = crc32(0L, Z_NULL, 0);
+
+        if (!data_.empty())
+        {
+          crc32_ = crc32(crc32_, reinterpret_cast<const Bytef*>(data_.c_str()), static_cast<uInt>(data_.size()));
+        }
+
+        if (level_ == 0)
+        {
+          // Stored file, no compression
+          success_ = true;
+          return;
+        }
+
+        z_stream stream;
+        memset(&stream, 0, sizeof(stream));
+
+        if (deflateInit2(&stream, level_, Z_DEFLATED, -MAX_WBITS /* raw deflate */,
+                         8 /* default memory level */, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+          success_ = false;
+          return;
+        }
+
+        std::string compressed;
+        compressed.resize(deflateBound(&stream, static_cast<uLong>(data_.size())) + 64);
+
+        stream.next_in = reinterpret_cast<Bytef*>(data_.empty() ? NULL : &data_[0]);
+        stream.avail_in = static_cast<uInt>(data_.size());
+
+        const int flush = (isLast_ ? Z_FINISH : Z_SYNC_FLUSH);
+        size_t produced = 0;
+        success_ = false;
+
+        for (;;)
+        {
+          stream.next_out = reinterpret_cast<Bytef*>(&compressed[produced]);
+          stream.avail_out = static_cast<uInt>(compressed.size() - produced);
+
+          int code = deflate(&stream, flush);
+          produced = compressed.size() - stream.avail_out;
+
+          if (code != Z_OK &&
+              code != Z_STREAM_END &&
+              code != Z_BUF_ERROR)
+          {
+            break;  // Error
+          }
+          else if (isLast_ ?
+                   (code == Z_STREAM_END) :
+                   (stream.avail_in == 0 && stream.avail_out != 0))
+          {
+            success_ = true;
+            break;
+          }
+          else
+          {
+            // Not enough room in the output buffer
+            compressed.resize(2 * compressed.size());
+          }
+        }
+
+        deflateEnd(&stream);
+
+        compressed.resize(produced);
+        data_.swap(compressed);
+      }
+
+      const std::string& GetData() const
+      {
+        return data_;
+      }
+
+      size_t GetUncompressedSize() const
+      {
+        return uncompressedSize_;
+      }
+
+      uLong GetCrc32() const
+      {
+        return crc32_;
+      }
+
+      bool IsSuccess() const
+      {
+        return success_;
+      }
+
+      bool IsDone() const
+      {
+        return isDone_;
+      }
+
+      void SetDone()
+      {
+        isDone_ = true;
+      }
+    };
+
+    // File whose chunks are being compressed
+    struct File : public boost::noncopyable
+    {
+      std::string        path_;
+      zip_fileinfo       zfi_;
+      uint8_t            level_;
+      std::deque<Chunk*> chunks_;            // Chunks that are not written yet
+      bool               isClosed_;          // All the chunks have been submitted
+      bool               isOpenInZip_;
+      uint64_t           uncompressedSize_;  // Of the chunks that are written
+      uLong              crc32_;             // Of the chunks that are written
+
+      File(const std::string& path,
+           uint8_t level) :
+        path_(path),
+        level_(level),
+        isClosed_(false),
+        isOpenInZip_(false),
+        uncompressedSize_(0),
+        crc32_(crc32(0L, Z_NULL, 0))
+      {
+        PrepareFileInfo(zfi_);
+      }
+
+      ~File()
+      {
+        for (std::deque<Chunk*>::iterator it = chunks_.begin(); it != chunks_.end(); ++it)
+        {
+          delete *it;
+        }
+      }
+    };
+
+  private:
+    boost::mutex                 mutex_;
+    boost::condition_variable    queueCondition_;
+    boost::condition_variable    doneCondition_;
+    std::deque<Chunk*>           queue_;
+    bool                         done_;
+    std::vector<boost::thread*>  workers_;
+
+    static void Worker(ParallelCompressor* that)
+    {
+      for (;;)
+      {
+        Chunk* chunk = NULL;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (that->queue_.empty() &&
+                 !that->done_)
+          {
+            that->queueCondition_.wait(lock);
+          }
+
+          if (that->done_)
+          {
+            return;
+          }
+
+          chunk = that->queue_.front();
+          that->queue_.pop_front();
+        }
+
+        assert(chunk != NULL);
+        chunk->Compress();
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          chunk->SetDone();
+        }
+
+        that->doneCondition_.notify_all();
+      }
+    }
+
+  public:
+    explicit ParallelCompressor(unsigned int threads) :
+      done_(false)
+    {
+      if (threads == 0)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      workers_.resize(threads);
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        workers_[i] = new boost::thread(Worker, this);
+      }
+    }
+
+    ~ParallelCompressor()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = true;
+      }
+
+      queueCondition_.notify_all();
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        if (workers_[i] != NULL)
+        {
+          if (workers_[i]->joinable())
+          {
+            workers_[i]->join();
+          }
+
+          delete workers_[i];
+        }
+      }
+    }
+
+    // The chunk is *not* owned by the compressor
+    void Submit(Chunk& chunk)
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        queue_.push_back(&chunk);
+      }
+
+      queueCondition_.notify_one();
+    }
+
+    bool IsDone(const Chunk& chunk)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return chunk.IsDone();
+    }
+
+    void WaitDone(const Chunk& chunk)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (!chunk.IsDone())
+      {
+        doneCondition_.wait(lock);
+      }
+    }
+  };
+
+
   struct ZipWriter::PImpl : public boost::noncopyable
   {
+    typedef ParallelCompressor::File  ParallelFile;
+
     zipFile file_;
     std::unique_ptr<StreamBuffer> streamBuffer_;
     uint64_t  archiveSize_;
 
+    // New in Orthanc 1.9.6
+    std::unique_ptr<ParallelCompressor>  compressor_;
+    std::deque<ParallelFile*>            parallelFiles_;  // In the order of the archive
+    std::string                          currentChunk_;   // Not submitted yet
+    size_t                               pendingChunks_;
+
     PImpl() :
       file_(NULL),
-      archiveSize_(0)
+      archiveSize_(0),
+      pendingChunks_(0)
+    {
+    }
+
+    ~PImpl()
+    {
+      ClearParallelFiles();
+    }
+
+    void ClearParallelFiles()
     {
+      // First stop the workers, as they have references to the chunks
+      compressor_.reset(NULL);
+
+      for (std::deque<ParallelFile*>::iterator it = parallelFiles_.begin();
+           it != parallelFiles_.end(); ++it)
+      {
+        delete *it;
+      }
+
+      parallelFiles_.clear();
+      currentChunk_.clear();
+      pendingChunks_ = 0;
     }
   };
 
@@ -440,7 +760,8 @@ namespace Orthanc
     isZip64_(false),
     hasFileInZip_(false),
     append_(false),
-    compressionLevel_(6)
+    compressionLevel_(6),
+    compressionThreads_(0)
   {
   }
 
@@ -460,12 +781,39 @@ namespace Orthanc
   {
     if (IsOpen())
     {
+      std::unique_ptr<OrthancException> error;
+
+      if (pimpl_->compressor_.get() != NULL)
+      {
+        try
+        {
+          CloseParallelFile();
+          WriteParallelFiles(0);  // Wait for all the chunks to be compressed
+        }
+        catch (OrthancException& e)
+        {
+          // This is notably the case if the output stream was canceled
+          LOG(ERROR) << "Cannot write the files compressed in parallel to the ZIP archive: " << e.What();
+          error.reset(new OrthancException(e));
+        }
+
+        pimpl_->ClearParallelFiles();
+      }
+
       zipClose(pimpl_->file_, "Created by Orthanc");
       pimpl_->file_ = NULL;
       hasFileInZip_ = false;
 
       pimpl_->streamBuffer_.reset(NULL);
 
+      if (error.get() != NULL)
+      {
+        // The archive is incomplete: The output stream is not
+        // finalized, and the caller must not report a success
+        outputStream_.reset(NULL);
+        throw *error;
+      }
+
       if (outputStream_.get() != NULL)
       {
         outputStream_->Close();
@@ -601,13 +949,60 @@ namespace Orthanc
     return compressionLevel_;
   }
 
+  void ZipWriter::SetCompressionThreads(unsigned int threads)
+  {
+    if (hasFileInZip_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls,
+                             "SetCompressionThreads() must be called before OpenFile()");
+    }
+    else
+    {
+      compressionThreads_ = threads;
+    }
+  }
+
+  unsigned int ZipWriter::GetCompressionThreads() const
+  {
+    return compressionThreads_;
+  }
+
   void ZipWriter::OpenFile(const char* path)
   {
+    OpenFile(path, compressionLevel_);
+  }
+
+  void ZipWriter::OpenFile(const char* path,
+                           uint8_t compressionLevel)
+  {
+    if (compressionLevel >= 10)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
     Open();
 
+    if (compressionThreads_ != 0)
+    {
+      // The file will be written once its chunks are compressed
+      CloseParallelFile();
+
+      if (pimpl_->compressor_.get() == NULL)
+      {
+        pimpl_->compressor_.reset(new ParallelCompressor(compressionThreads_));
+      }
+
+      pimpl_->parallelFiles_.push_back(new PImpl::ParallelFile(path, compressionLevel));
+      hasFileInZip_ = true;
+      return;
+    }
+
     zip_fileinfo zfi;
     PrepareFileInfo(zfi);
 
+    // Level "0" corresponds to the "stored" method (new in Orthanc 1.9.6)
+    const int method = (compressionLevel == 0 ? 0 : Z_DEFLATED);
+
     int result;
 
     if (isZip64_)
@@ -617,8 +1012,8 @@ namespace Orthanc
                                      NULL,   0,
                                      NULL,   0,
                                      "",  // Comment
-                                     Z_DEFLATED,
-                                     compressionLevel_, 1);
+                                     method,
+                                     compressionLevel, 1);
     }
     else
     {
@@ -627,8 +1022,8 @@ namespace Orthanc
                                    NULL,   0,
                                    NULL,   0,
                                    "",  // Comment
-                                   Z_DEFLATED,
-                                   compressionLevel_);
+                                   method,
+                                   compressionLevel);
     }
 
     if (result != 0)
@@ -657,6 +1052,28 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls, "Call first OpenFile()");
     }
 
+    if (pimpl_->compressor_.get() != NULL)
+    {
+      const char* p = reinterpret_cast<const char*>(data);
+
+      while (length > 0)
+      {
+        assert(pimpl_->currentChunk_.size() < PARALLEL_CHUNK_SIZE);
+        size_t bytes = std::min(length, PARALLEL_CHUNK_SIZE - pimpl_->currentChunk_.size());
+        pimpl_->currentChunk_.append(p, bytes);
+
+        if (pimpl_->currentChunk_.size() == PARALLEL_CHUNK_SIZE)
+        {
+          SubmitParallelChunk(false);
+        }
+
+        p += bytes;
+        length -= bytes;
+      }
+
+      return;
+    }
+
     const size_t maxBytesInAStep = std::numeric_limits<int32_t>::max();
 
     const char* p = reinterpret_cast<const char*>(data);
@@ -677,6 +1094,128 @@ namespace Orthanc
   }
 
 
+  void ZipWriter::SubmitParallelChunk(bool isLast)
+  {
+    assert(pimpl_->compressor_.get() != NULL &&
+           !pimpl_->parallelFiles_.empty());
+
+    PImpl::ParallelFile& file = *pimpl_->parallelFiles_.back();
+    assert(!file.isClosed_);
+
+    std::unique_ptr<ParallelCompressor::Chunk> chunk(
+      new ParallelCompressor::Chunk(pimpl_->currentChunk_, file.level_, isLast));
+    file.chunks_.push_back(chunk.release());
+    pimpl_->pendingChunks_++;
+
+    pimpl_->compressor_->Submit(*file.chunks_.back());
+
+    // Bound the memory that is used by the chunks waiting to be written
+    WriteParallelFiles(4 * compressionThreads_);
+  }
+
+
+  void ZipWriter::CloseParallelFile()
+  {
+    if (!pimpl_->parallelFiles_.empty() &&
+        !pimpl_->parallelFiles_.back()->isClosed_)
+    {
+      SubmitParallelChunk(true);
+      pimpl_->parallelFiles_.back()->isClosed_ = true;
+    }
+  }
+
+
+  void ZipWriter::WriteParallelFiles(size_t maxPendingChunks)
+  {
+    // Write the compressed chunks in the order of the archive. If
+    // more than "maxPendingChunks" are not written yet, wait for the
+    // compression of the oldest chunks.
+    assert(pimpl_->compressor_.get() != NULL);
+
+    while (!pimpl_->parallelFiles_.empty())
+    {
+      PImpl::ParallelFile& file = *pimpl_->parallelFiles_.front();
+
+      if (!file.isOpenInZip_)
+      {
+        if (zipOpenNewFileInZip2_64(pimpl_->file_, file.path_.c_str(), &file.zfi_,
+                                    NULL,   0,
+                                    NULL,   0,
+                                    "",  // Comment
+                                    (file.level_ == 0 ? 0 : Z_DEFLATED),
+                                    file.level_,
+                                    1 /* raw */,
+                                    isZip64_ ? 1 : 0) != 0)
+        {
+          throw OrthancException(ErrorCode_CannotWriteFile,
+                                 "Cannot add new file inside ZIP archive: " + file.path_);
+        }
+
+        file.isOpenInZip_ = true;
+      }
+
+      while (!file.chunks_.empty())
+      {
+        ParallelCompressor::Chunk* chunk = file.chunks_.front();
+
+        if (!pimpl_->compressor_->IsDone(*chunk))
+        {
+          if (pimpl_->pendingChunks_ > maxPendingChunks)
+          {
+            pimpl_->compressor_->WaitDone(*chunk);
+          }
+          else
+          {
+            return;
+          }
+        }
+
+        if (!chunk->IsSuccess())
+        {
+          throw OrthancException(ErrorCode_InternalError,
+                                 "Cannot compress file inside ZIP archive: " + file.path_);
+        }
+
+        // The compressed chunks are smaller than "PARALLEL_CHUNK_SIZE",
+        // up to the overhead of deflate
+        if (!chunk->GetData().empty() &&
+            zipWriteInFileInZip(pimpl_->file_, chunk->GetData().c_str(),
+                                static_cast<unsigned int>(chunk->GetData().size())))
+        {
+          throw OrthancException(ErrorCode_CannotWriteFile,
+                                 "Cannot write data to ZIP archive: " + path_);
+        }
+
+        file.crc32_ = crc32_combine(file.crc32_, chunk->GetCrc32(),
+                                    static_cast<z_off_t>(chunk->GetUncompressedSize()));
+        file.uncompressedSize_ += chunk->GetUncompressedSize();
+
+        file.chunks_.pop_front();
+        delete chunk;
+
+        assert(pimpl_->pendingChunks_ > 0);
+        pimpl_->pendingChunks_--;
+      }
+
+      if (file.isClosed_)
+      {
+        if (zipCloseFileInZipRaw64(pimpl_->file_, file.uncompressedSize_, file.crc32_) != 0)
+        {
+          throw OrthancException(ErrorCode_CannotWriteFile,
+                                 "Cannot close file inside ZIP archive: " + file.path_);
+        }
+
+        delete pimpl_->parallelFiles_.front();
+        pimpl_->parallelFiles_.pop_front();
+      }
+      else
+      {
+        return;  // This file is still being written by the caller
+      }
+    }
+  }
+
+
   void ZipWriter::SetAppendToExisting(bool append)
   {
     Close();
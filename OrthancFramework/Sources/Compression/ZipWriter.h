@@ -122,6 +122,7 @@ namespace Orthanc
     
   private:
     class StreamBuffer;
+    class ParallelCompressor;
     
     struct PImpl;
     boost::shared_ptr<PImpl> pimpl_;
@@ -131,9 +132,16 @@ namespace Orthanc
     bool append_;
     uint8_t compressionLevel_;
     std::string path_;
+    unsigned int compressionThreads_;
 
     std::unique_ptr<IOutputStream> outputStream_;
 
+    void SubmitParallelChunk(bool isLast);
+
+    void CloseParallelFile();
+
+    void WriteParallelFiles(size_t maxPendingChunks);
+
   public:
     ZipWriter();
 
@@ -147,6 +155,16 @@ namespace Orthanc
 
     uint8_t GetCompressionLevel() const;
 
+    /**
+     * New in Orthanc 1.9.6: If "threads > 0", the files are deflated
+     * by a pool of threads (large files being split into chunks),
+     * whereas the ZIP container is written in order by the calling
+     * thread. Must be called before the first "OpenFile()".
+     **/
+    void SetCompressionThreads(unsigned int threads);
+
+    unsigned int GetCompressionThreads() const;
+
     void SetAppendToExisting(bool append);
     
     bool IsAppendToExisting() const;
@@ -163,6 +181,12 @@ namespace Orthanc
 
     void OpenFile(const char* path);
 
+    // A compression level of "0" stores the file without compression,
+    // which is notably useful for compressed transfer syntaxes (new
+    // in Orthanc 1.9.6)
+    void OpenFile(const char* path,
+                  uint8_t compressionLevel);
+
     void Write(const void* data, size_t length);
 
     void Write(const std::string& data);
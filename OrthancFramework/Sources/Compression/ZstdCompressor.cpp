@@ -0,0 +1,139 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "ZstdCompressor.h"
+
+#include "../OrthancException.h"
+
+#include <boost/lexical_cast.hpp>
+#include <zstd.h>
+
+namespace Orthanc
+{
+  ZstdCompressor::ZstdCompressor() :
+    compressionLevel_(3)  // Default level of zstd
+  {
+  }
+
+
+  void ZstdCompressor::SetCompressionLevel(int level)
+  {
+    if (level < 1 ||
+        level > GetMaximumCompressionLevel())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The zstd compression level must be between 1 and " +
+                             boost::lexical_cast<std::string>(GetMaximumCompressionLevel()));
+    }
+    else
+    {
+      compressionLevel_ = level;
+    }
+  }
+
+
+  int ZstdCompressor::GetMaximumCompressionLevel()
+  {
+    return ZSTD_maxCLevel();
+  }
+
+
+  void ZstdCompressor::Compress(std::string& compressed,
+                                const void* uncompressed,
+                                size_t uncompressedSize)
+  {
+    if (uncompressedSize == 0)
+    {
+      compressed.clear();
+      return;
+    }
+
+    try
+    {
+      compressed.resize(ZSTD_compressBound(uncompressedSize));
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    const size_t size = ZSTD_compress(&compressed[0], compressed.size(),
+                                      uncompressed, uncompressedSize, compressionLevel_);
+
+    if (ZSTD_isError(size))
+    {
+      compressed.clear();
+      throw OrthancException(ErrorCode_InternalError,
+                             "Error in zstd compression: " + std::string(ZSTD_getErrorName(size)));
+    }
+    else
+    {
+      compressed.resize(size);
+    }
+  }
+
+
+  void ZstdCompressor::Uncompress(std::string& uncompressed,
+                                  const void* compressed,
+                                  size_t compressedSize)
+  {
+    if (compressedSize == 0)
+    {
+      uncompressed.clear();
+      return;
+    }
+
+    const unsigned long long uncompressedSize = ZSTD_getFrameContentSize(compressed, compressedSize);
+
+    if (uncompressedSize == ZSTD_CONTENTSIZE_ERROR ||
+        uncompressedSize == ZSTD_CONTENTSIZE_UNKNOWN ||
+        static_cast<unsigned long long>(static_cast<size_t>(uncompressedSize)) != uncompressedSize)
+    {
+      throw OrthancException(ErrorCode_CorruptedFile, "Bad header in a zstd-encoded buffer");
+    }
+
+    try
+    {
+      uncompressed.resize(static_cast<size_t>(uncompressedSize));
+    }
+    catch (...)
+    {
+      throw OrthancException(ErrorCode_NotEnoughMemory);
+    }
+
+    if (uncompressedSize == 0)
+    {
+      return;
+    }
+
+    const size_t size = ZSTD_decompress(&uncompressed[0], uncompressed.size(), compressed, compressedSize);
+
+    if (ZSTD_isError(size) ||
+        size != uncompressed.size())
+    {
+      uncompressed.clear();
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+  }
+}
@@ -0,0 +1,74 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IBufferCompressor.h"
+#include "../Compatibility.h"  // For ORTHANC_OVERRIDE
+
+#if !defined(ORTHANC_ENABLE_ZSTD)
+#  error The macro ORTHANC_ENABLE_ZSTD must be defined
+#endif
+
+#if ORTHANC_ENABLE_ZSTD != 1
+#  error zstd support must be enabled to include this file
+#endif
+
+
+#include <stdint.h>
+
+namespace Orthanc
+{
+  /**
+   * Compression using zstd (new in Orthanc 1.9.6), cf.
+   * "CompressionType_Zstd". The compressed buffer is a standard zstd
+   * frame, whose header contains the uncompressed size. An empty
+   * buffer is compressed as an empty buffer, as in "ZlibCompressor".
+   **/
+  class ORTHANC_PUBLIC ZstdCompressor : public IBufferCompressor
+  {
+  private:
+    int  compressionLevel_;
+
+  public:
+    ZstdCompressor();
+
+    // Between 1 (fastest) and "GetMaximumCompressionLevel()"
+    void SetCompressionLevel(int level);
+
+    int GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    static int GetMaximumCompressionLevel();
+
+    virtual void Compress(std::string& compressed,
+                          const void* uncompressed,
+                          size_t uncompressedSize) ORTHANC_OVERRIDE;
+
+    virtual void Uncompress(std::string& uncompressed,
+                            const void* compressed,
+                            size_t compressedSize) ORTHANC_OVERRIDE;
+  };
+}
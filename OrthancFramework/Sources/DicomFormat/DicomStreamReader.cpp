@@ -578,13 +578,15 @@ namespace Orthanc
   class DicomStreamReader::PixelDataVisitor : public DicomStreamReader::IVisitor
   {
   private:
-    bool      hasPixelData_;
-    uint64_t  pixelDataOffset_;
+    bool                 hasPixelData_;
+    uint64_t             pixelDataOffset_;
+    DicomTransferSyntax  transferSyntax_;
     
   public:
     PixelDataVisitor() :
       hasPixelData_(false),
-      pixelDataOffset_(0)
+      pixelDataOffset_(0),
+      transferSyntax_(DicomTransferSyntax_LittleEndianImplicit)
     {
     }
     
@@ -596,6 +598,7 @@ namespace Orthanc
 
     virtual void VisitTransferSyntax(DicomTransferSyntax transferSyntax) ORTHANC_OVERRIDE
     {
+      transferSyntax_ = transferSyntax;
     }
     
     virtual bool VisitDatasetTag(const DicomTag& tag,
@@ -604,7 +607,12 @@ namespace Orthanc
                                  bool isLittleEndian,
                                  uint64_t fileOffset) ORTHANC_OVERRIDE
     {
-      if (tag == DICOM_TAG_PIXEL_DATA)
+      if (transferSyntax_ == DicomTransferSyntax_DeflatedLittleEndianExplicit)
+      {
+        // The dataset is compressed, so the offsets in the file are meaningless
+        return false;
+      }
+      else if (tag == DICOM_TAG_PIXEL_DATA)
       {
         hasPixelData_ = true;
         pixelDataOffset_ = fileOffset;
@@ -624,7 +632,13 @@ namespace Orthanc
       return pixelDataOffset_;
     }
 
+    DicomTransferSyntax GetTransferSyntax() const
+    {
+      return transferSyntax_;
+    }
+
     static bool LookupPixelDataOffset(uint64_t& offset,
+                                      DicomTransferSyntax& transferSyntax,
                                       std::istream& stream)
     {
       PixelDataVisitor visitor;
@@ -645,7 +659,11 @@ namespace Orthanc
         }
       }
 
-      if (visitor.HasPixelData())
+      if (visitor.GetTransferSyntax() == DicomTransferSyntax_DeflatedLittleEndianExplicit)
+      {
+        return false;
+      }
+      else if (visitor.HasPixelData())
       {
         // Sanity check if we face an unsupported DICOM file: Make
         // sure that we can read DICOM_TAG_PIXEL_DATA at the reported
@@ -671,6 +689,7 @@ namespace Orthanc
             s[3] == char(0x00))
         {
           offset = visitor.GetPixelDataOffset();
+          transferSyntax = visitor.GetTransferSyntax();
           return true;
         }
         else
@@ -690,17 +709,28 @@ namespace Orthanc
                                                 const std::string& dicom)
   {
     std::stringstream stream(dicom);
-    return PixelDataVisitor::LookupPixelDataOffset(offset, stream);
+    DicomTransferSyntax transferSyntax;
+    return PixelDataVisitor::LookupPixelDataOffset(offset, transferSyntax, stream);
   }
   
 
   bool DicomStreamReader::LookupPixelDataOffset(uint64_t& offset,
                                                 const void* buffer,
                                                 size_t size)
+  {
+    DicomTransferSyntax transferSyntax;
+    return LookupPixelDataOffset(offset, transferSyntax, buffer, size);
+  }
+
+
+  bool DicomStreamReader::LookupPixelDataOffset(uint64_t& offset,
+                                                DicomTransferSyntax& transferSyntax,
+                                                const void* buffer,
+                                                size_t size)
   {
     boost::iostreams::array_source source(reinterpret_cast<const char*>(buffer), size);
     boost::iostreams::stream<boost::iostreams::array_source> stream(source);
-    return PixelDataVisitor::LookupPixelDataOffset(offset, stream);
+    return PixelDataVisitor::LookupPixelDataOffset(offset, transferSyntax, stream);
   }
 }
 
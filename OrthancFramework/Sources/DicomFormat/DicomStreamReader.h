@@ -133,5 +133,15 @@ namespace Orthanc
     static bool LookupPixelDataOffset(uint64_t& offset,
                                       const void* buffer,
                                       size_t size);
+
+    /**
+     * Also returns the transfer syntax of the file (new in Orthanc
+     * 1.9.6). Returns "false" for deflated transfer syntaxes, as the
+     * offsets are meaningless in the compressed dataset.
+     **/
+    static bool LookupPixelDataOffset(uint64_t& offset,
+                                      DicomTransferSyntax& transferSyntax,
+                                      const void* buffer,
+                                      size_t size);
   };
 }
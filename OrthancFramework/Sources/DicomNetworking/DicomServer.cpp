@@ -24,7 +24,8 @@
 #include "DicomServer.h"
 
 #include "../Logging.h"
-#include "../MultiThreading/RunnableWorkersPool.h"
+#include "../MetricsRegistry.h"
+#include "../MultiThreading/FairRunnablesPool.h"
 #include "../OrthancException.h"
 #include "../SystemToolbox.h"
 #include "../Toolbox.h"
@@ -46,9 +47,30 @@ namespace Orthanc
 {
   struct DicomServer::PImpl
   {
+    // Publishes the metrics each time an association is started or
+    // completed by the pool of workers
+    class MetricsListener : public FairRunnablesPool::IListener
+    {
+    private:
+      DicomServer&  server_;
+
+    public:
+      explicit MetricsListener(DicomServer& server) :
+        server_(server)
+      {
+      }
+
+      virtual void SignalCountsChanged(size_t activeCount,
+                                       size_t queuedCount) ORTHANC_OVERRIDE
+      {
+        server_.PublishMetrics(activeCount, queuedCount);
+      }
+    };
+
     boost::thread  thread_;
     T_ASC_Network *network_;
-    std::unique_ptr<RunnableWorkersPool>  workers_;
+    std::unique_ptr<MetricsListener>    listener_;  // Must be declared before "workers_"
+    std::unique_ptr<FairRunnablesPool>  workers_;
 
 #if ORTHANC_ENABLE_SSL == 1
     std::unique_ptr<DcmTLSTransportLayer> tls_;
@@ -73,8 +95,20 @@ namespace Orthanc
       {
         if (dispatcher.get() != NULL)
         {
-          server->pimpl_->workers_->Add(dispatcher.release());
+          // The pending associations are served in a round-robin
+          // fashion over the AET of the remote modalities. The limit
+          // on the pending associations was checked before
+          // acknowledging the association, and only this thread adds
+          // associations to the pool, so this should not fail.
+          const std::string remoteAet = dispatcher->GetRemoteAet();
+          if (!server->pimpl_->workers_->Add(dispatcher.release(), remoteAet))
+          {
+            CLOG(WARNING, DICOM) << "Too many pending DICOM associations, dropping the already "
+                                 << "acknowledged association from AET " << remoteAet;
+          }
         }
+
+        server->PublishMetrics();
       }
       catch (OrthancException& e)
       {
@@ -103,7 +137,10 @@ namespace Orthanc
     applicationEntityFilter_(NULL),
     useDicomTls_(false),
     maximumPduLength_(ASC_DEFAULTMAXPDU),
-    remoteCertificateRequired_(true)
+    remoteCertificateRequired_(true),
+    threadsCount_(16),
+    maximumPendingAssociations_(0),
+    metrics_(NULL)
   {
   }
 
@@ -424,7 +461,9 @@ namespace Orthanc
 #endif
 
     continue_ = true;
-    pimpl_->workers_.reset(new RunnableWorkersPool(4));   // Use 4 workers - TODO as a parameter?
+    pimpl_->listener_.reset(new PImpl::MetricsListener(*this));
+    pimpl_->workers_.reset(new FairRunnablesPool(threadsCount_, maximumPendingAssociations_));
+    pimpl_->workers_->SetListener(pimpl_->listener_.get());
     pimpl_->thread_ = boost::thread(ServerThread, this, maximumPduLength_, useDicomTls_);
   }
 
@@ -441,6 +480,7 @@ namespace Orthanc
       }
 
       pimpl_->workers_.reset(NULL);
+      PublishMetrics();
 
 #if ORTHANC_ENABLE_SSL == 1
       pimpl_->tls_.reset(NULL);  // Transport layer must be destroyed before the association itself
@@ -588,4 +628,85 @@ namespace Orthanc
   {
     return remoteCertificateRequired_;
   }
+
+
+  void DicomServer::SetThreadsCount(unsigned int threadsCount)
+  {
+    if (threadsCount == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    Stop();
+    threadsCount_ = threadsCount;
+  }
+
+  unsigned int DicomServer::GetThreadsCount() const
+  {
+    return threadsCount_;
+  }
+
+  void DicomServer::SetMaximumPendingAssociations(unsigned int count)
+  {
+    Stop();
+    maximumPendingAssociations_ = count;
+  }
+
+  unsigned int DicomServer::GetMaximumPendingAssociations() const
+  {
+    return maximumPendingAssociations_;
+  }
+
+  void DicomServer::SetMetricsRegistry(MetricsRegistry& metrics)
+  {
+    Stop();
+    metrics_ = &metrics;
+  }
+
+  size_t DicomServer::GetActiveAssociationsCount() const
+  {
+    if (pimpl_->workers_.get() == NULL)
+    {
+      return 0;
+    }
+    else
+    {
+      return pimpl_->workers_->GetActiveCount();
+    }
+  }
+
+  size_t DicomServer::GetPendingAssociationsCount() const
+  {
+    if (pimpl_->workers_.get() == NULL)
+    {
+      return 0;
+    }
+    else
+    {
+      return pimpl_->workers_->GetQueuedCount();
+    }
+  }
+
+  bool DicomServer::IsPendingAssociationsLimitReached() const
+  {
+    return (maximumPendingAssociations_ != 0 &&
+            GetPendingAssociationsCount() >= maximumPendingAssociations_);
+  }
+
+  void DicomServer::PublishMetrics(size_t activeAssociations,
+                                   size_t pendingAssociations)
+  {
+    if (metrics_ != NULL)
+    {
+      metrics_->SetValue("orthanc_dicom_active_associations",
+                         static_cast<float>(activeAssociations), MetricsType_MaxOver10Seconds);
+      metrics_->SetValue("orthanc_dicom_pending_associations",
+                         static_cast<float>(pendingAssociations), MetricsType_MaxOver10Seconds);
+    }
+  }
+
+  void DicomServer::PublishMetrics()
+  {
+    PublishMetrics(GetActiveAssociationsCount(), GetPendingAssociationsCount());
+  }
 }
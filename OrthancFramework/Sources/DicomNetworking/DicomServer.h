@@ -45,6 +45,8 @@
 
 namespace Orthanc
 {
+  class MetricsRegistry;
+
   class DicomServer : public boost::noncopyable
   {
   public:
@@ -89,6 +91,16 @@ namespace Orthanc
     unsigned int maximumPduLength_;
     bool         remoteCertificateRequired_;  // New in 1.9.3
 
+    // New in Orthanc 1.9.6
+    unsigned int      threadsCount_;
+    unsigned int      maximumPendingAssociations_;
+    MetricsRegistry*  metrics_;
+
+    void PublishMetrics(size_t activeAssociations,
+                        size_t pendingAssociations);
+
+    void PublishMetrics();
+
     static void ServerThread(DicomServer* server,
                              unsigned int maximumPduLength,
                              bool useDicomTls);
@@ -163,5 +175,24 @@ namespace Orthanc
 
     void SetRemoteCertificateRequired(bool required);
     bool IsRemoteCertificateRequired() const;
+
+    // Number of associations that are served simultaneously
+    void SetThreadsCount(unsigned int threadsCount);
+    unsigned int GetThreadsCount() const;
+
+    // Number of associations that can wait for a thread before new
+    // associations are rejected ("0" means no limit)
+    void SetMaximumPendingAssociations(unsigned int count);
+    unsigned int GetMaximumPendingAssociations() const;
+
+    // Publishes the number of active and pending associations
+    void SetMetricsRegistry(MetricsRegistry& metrics);
+
+    size_t GetActiveAssociationsCount() const;
+    size_t GetPendingAssociationsCount() const;
+
+    // Whether a new association must be rejected, because too many
+    // associations are waiting for a thread
+    bool IsPendingAssociationsLimitReached() const;
   };
 }
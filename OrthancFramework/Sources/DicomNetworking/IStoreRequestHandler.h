@@ -23,6 +23,7 @@
 #pragma once
 
 #include "../DicomFormat/DicomMap.h"
+#include "../OrthancException.h"
 
 #include <vector>
 #include <string>
@@ -32,6 +33,8 @@ class DcmDataset;
 
 namespace Orthanc
 {
+  class TemporaryFile;
+
   class IStoreRequestHandler : public boost::noncopyable
   {
   public:
@@ -43,5 +46,25 @@ namespace Orthanc
                         const std::string& remoteIp,
                         const std::string& remoteAet,
                         const std::string& calledAet) = 0;
+
+    /**
+     * If this method returns a temporary file (new in Orthanc 1.9.6),
+     * the C-STORE SCP writes the incoming DICOM stream directly into
+     * this file, together with a meta-header, without building a DCMTK
+     * dataset. "HandleFile()" is then called instead of "Handle()".
+     * The default implementation disables this streaming mode.
+     **/
+    virtual TemporaryFile* CreateStreamingFile()
+    {
+      return NULL;
+    }
+
+    virtual void HandleFile(TemporaryFile& /*dicom*/,
+                            const std::string& /*remoteIp*/,
+                            const std::string& /*remoteAet*/,
+                            const std::string& /*calledAet*/)
+    {
+      throw OrthancException(ErrorCode_NotImplemented);
+    }
   };
 }
@@ -646,6 +646,22 @@ namespace Orthanc
         return NULL;
       }
 
+      /* check the pending associations before acknowledging this one (new in Orthanc 1.9.6) */
+      if (server.IsPendingAssociationsLimitReached())
+      {
+        CLOG(WARNING, DICOM) << "Too many pending DICOM associations, rejecting the association from AET "
+                             << remoteAet << " on IP " << remoteIp;
+        T_ASC_RejectParameters rej =
+          {
+            ASC_RESULT_REJECTEDTRANSIENT,
+            ASC_SOURCE_SERVICEPROVIDER_PRESENTATION_RELATED,
+            ASC_REASON_SP_PRES_LOCALLIMITEXCEEDED
+          };
+        ASC_rejectAssociation(assoc, &rej);
+        AssociationCleanup(assoc);
+        return NULL;
+      }
+
       {
         cond = ASC_acknowledgeAssociation(assoc);
         if (cond.bad())
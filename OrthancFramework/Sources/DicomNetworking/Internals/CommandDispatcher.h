@@ -63,6 +63,11 @@ namespace Orthanc
       virtual ~CommandDispatcher();
 
       virtual bool Step();
+
+      const std::string& GetRemoteAet() const
+      {
+        return remoteAet_;
+      }
     };
 
     CommandDispatcher* AcceptAssociation(const DicomServer& server, 
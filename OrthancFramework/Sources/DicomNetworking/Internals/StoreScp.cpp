@@ -76,10 +76,13 @@
 #  error The macro DCMTK_VERSION_NUMBER must be defined
 #endif
 
+#include "../../DicomFormat/DicomStreamReader.h"
 #include "../../DicomParsing/FromDcmtkBridge.h"
 #include "../../DicomParsing/ToDcmtkBridge.h"
 #include "../../OrthancException.h"
 #include "../../Logging.h"
+#include "../../TemporaryFile.h"
+#include "../../Toolbox.h"
 
 #include <dcmtk/dcmdata/dcfilefo.h>
 #include <dcmtk/dcmdata/dcmetinf.h>
@@ -87,6 +90,8 @@
 #include <dcmtk/dcmdata/dcdeftag.h>
 #include <dcmtk/dcmnet/diutil.h>
 
+#include <boost/filesystem/fstream.hpp>
+
 
 namespace Orthanc
 {
@@ -101,8 +106,204 @@ namespace Orthanc
       const char* modality;
       const char* affectedSOPInstanceUID;
       uint32_t messageID;
+      TemporaryFile* streamingFile;  // New in Orthanc 1.9.6
     };
 
+
+    static const DicomTag SOURCE_APPLICATION_ENTITY_TITLE(0x0002, 0x0016);
+
+
+    // Reads the main tags of the DICOM file written by the streaming
+    // mode, without parsing the tags after "lastTag" (new in Orthanc 1.9.6)
+    class StreamingFileVisitor : public DicomStreamReader::IVisitor
+    {
+    private:
+      DicomTag     lastTag_;
+      bool         deflated_;
+      bool         hasSourceAet_;
+      DicomMap     tags_;
+
+      static bool IsMainTag(const DicomTag& tag)
+      {
+        return (tag == DICOM_TAG_SOP_CLASS_UID ||
+                tag == DICOM_TAG_SOP_INSTANCE_UID ||
+                tag == DICOM_TAG_PATIENT_ID ||
+                tag == DICOM_TAG_STUDY_INSTANCE_UID ||
+                tag == DICOM_TAG_SERIES_INSTANCE_UID);
+      }
+
+      void ReadWithDcmtk(const std::string& path)
+      {
+        // The "DicomStreamReader" class cannot parse deflated
+        // datasets: Fallback to DCMTK, which is slower
+        DcmFileFormat dicom;
+        if (!dicom.loadFile(path.c_str()).good() ||
+            dicom.getDataset() == NULL)
+        {
+          throw OrthancException(ErrorCode_BadFileFormat);
+        }
+
+        const DicomTag tags[] = {
+          DICOM_TAG_SOP_CLASS_UID,
+          DICOM_TAG_SOP_INSTANCE_UID,
+          DICOM_TAG_PATIENT_ID,
+          DICOM_TAG_STUDY_INSTANCE_UID,
+          DICOM_TAG_SERIES_INSTANCE_UID
+        };
+
+        for (size_t i = 0; i < sizeof(tags) / sizeof(DicomTag); i++)
+        {
+          const char* value = NULL;
+          if (dicom.getDataset()->findAndGetString(ToDcmtkBridge::Convert(tags[i]), value).good() &&
+              value != NULL)
+          {
+            tags_.SetValue(tags[i], Toolbox::StripSpaces(value), false);
+          }
+        }
+
+        const char* aet = NULL;
+        hasSourceAet_ = (dicom.getMetaInfo() != NULL &&
+                         dicom.getMetaInfo()->findAndGetString(DCM_SourceApplicationEntityTitle, aet).good() &&
+                         aet != NULL);
+      }
+
+    public:
+      explicit StreamingFileVisitor(const DicomTag& lastTag) :
+        lastTag_(lastTag),
+        deflated_(false),
+        hasSourceAet_(false)
+      {
+      }
+
+      virtual void VisitMetaHeaderTag(const DicomTag& tag,
+                                      const ValueRepresentation& /*vr*/,
+                                      const std::string& /*value*/) ORTHANC_OVERRIDE
+      {
+        if (tag == SOURCE_APPLICATION_ENTITY_TITLE)
+        {
+          hasSourceAet_ = true;
+        }
+      }
+
+      virtual void VisitTransferSyntax(DicomTransferSyntax transferSyntax) ORTHANC_OVERRIDE
+      {
+        deflated_ = (transferSyntax == DicomTransferSyntax_DeflatedLittleEndianExplicit);
+      }
+
+      virtual bool VisitDatasetTag(const DicomTag& tag,
+                                   const ValueRepresentation& /*vr*/,
+                                   const std::string& value,
+                                   bool /*isLittleEndian*/,
+                                   uint64_t /*fileOffset*/) ORTHANC_OVERRIDE
+      {
+        if (deflated_)
+        {
+          return false;  // The dataset will be read by DCMTK
+        }
+
+        if (IsMainTag(tag))
+        {
+          tags_.SetValue(tag, Toolbox::StripSpaces(value.c_str()), false);  // Remove the padding
+        }
+
+        return (tag < lastTag_);
+      }
+
+      // Returns "false" if the file cannot be parsed
+      bool Read(const std::string& path)
+      {
+        try
+        {
+          boost::filesystem::ifstream stream(path, std::ios::in | std::ios::binary);
+          DicomStreamReader reader(stream);
+          reader.Consume(*this, DICOM_TAG_PIXEL_DATA);
+        }
+        catch (OrthancException&)
+        {
+          if (!deflated_)
+          {
+            return false;
+          }
+        }
+
+        if (deflated_)
+        {
+          try
+          {
+            tags_.Clear();
+            ReadWithDcmtk(path);
+          }
+          catch (OrthancException&)
+          {
+            return false;
+          }
+        }
+
+        return true;
+      }
+
+      bool HasSourceApplicationEntityTitle() const
+      {
+        return hasSourceAet_;
+      }
+
+      std::string GetValue(const DicomTag& tag) const
+      {
+        std::string value;
+        if (tags_.LookupStringValue(value, tag, false))
+        {
+          return value;
+        }
+        else
+        {
+          return "";
+        }
+      }
+    };
+
+
+    static void LogMissingTagsForStreamingFile(const std::string& path)
+    {
+      StreamingFileVisitor visitor(DICOM_TAG_PIXEL_DATA);
+      visitor.Read(path);
+      DicomMap::LogMissingTagsForStore(visitor.GetValue(DICOM_TAG_PATIENT_ID),
+                                       visitor.GetValue(DICOM_TAG_STUDY_INSTANCE_UID),
+                                       visitor.GetValue(DICOM_TAG_SERIES_INSTANCE_UID),
+                                       visitor.GetValue(DICOM_TAG_SOP_INSTANCE_UID));
+    }
+
+
+    static void HandleStreamingFile(StoreCallbackData& cbdata,
+                                    const T_DIMSE_C_StoreRQ& req,
+                                    T_DIMSE_C_StoreRSP& rsp)
+    {
+      const std::string& path = cbdata.streamingFile->GetPath();
+
+      rsp.DimseStatus = Internals::CheckStreamingStoreFile(path, req.AffectedSOPClassUID, req.AffectedSOPInstanceUID);
+
+      if (rsp.DimseStatus == STATUS_Success)
+      {
+        try
+        {
+          Internals::EnsureSourceApplicationEntityTitle(path, cbdata.remoteAET);
+          cbdata.handler->HandleFile(*cbdata.streamingFile, *cbdata.remoteIp, cbdata.remoteAET, cbdata.calledAET);
+        }
+        catch (OrthancException& e)
+        {
+          rsp.DimseStatus = STATUS_STORE_Refused_OutOfResources;
+
+          if (e.GetErrorCode() == ErrorCode_InexistentTag)
+          {
+            LogMissingTagsForStreamingFile(path);
+          }
+          else
+          {
+            CLOG(ERROR, DICOM) << "Exception while storing DICOM: " << e.What();
+          }
+        }
+      }
+    }
+
     
     static void
     storeScpCallback(
@@ -150,9 +351,19 @@ namespace Orthanc
         // then the status will reflect this.  The callback function is still called to allow cleanup.
         //rsp->DimseStatus = STATUS_Success;
 
+        if (cbdata->streamingFile != NULL)
+        {
+          // The dataset was directly written to the temporary file
+          // while being received (new in Orthanc 1.9.6)
+          if (rsp->DimseStatus == STATUS_Success)
+          {
+            HandleStreamingFile(*cbdata, *req, *rsp);
+          }
+        }
+
         // we want to write the received information to a file only if this information
         // is present and the options opt_bitPreserving and opt_ignore are not set.
-        if ((imageDataSet != NULL) && (*imageDataSet != NULL))
+        else if ((imageDataSet != NULL) && (*imageDataSet != NULL))
         {
           // check the image to make sure it is consistent, i.e. that its sopClass and sopInstance correspond
           // to those mentioned in the request. If not, set the status in the response message variable.
@@ -204,6 +415,68 @@ namespace Orthanc
     }
   }
 
+  DIC_US Internals::CheckStreamingStoreFile(const std::string& path,
+                                            const char* affectedSopClassUid,
+                                            const char* affectedSopInstanceUid)
+  {
+    StreamingFileVisitor visitor(DICOM_TAG_SOP_INSTANCE_UID);
+
+    if (!visitor.Read(path))
+    {
+      return STATUS_STORE_Error_CannotUnderstand;
+    }
+
+    const std::string sopClassUid = visitor.GetValue(DICOM_TAG_SOP_CLASS_UID);
+    const std::string sopInstanceUid = visitor.GetValue(DICOM_TAG_SOP_INSTANCE_UID);
+
+    if (sopClassUid.empty() ||
+        sopInstanceUid.empty())
+    {
+      return STATUS_STORE_Error_CannotUnderstand;
+    }
+    else if (affectedSopClassUid == NULL ||
+             affectedSopInstanceUid == NULL ||
+             sopClassUid != affectedSopClassUid ||
+             sopInstanceUid != affectedSopInstanceUid)
+    {
+      return STATUS_STORE_Error_DataSetDoesNotMatchSOPClass;
+    }
+    else
+    {
+      return STATUS_Success;
+    }
+  }
+
+
+  void Internals::EnsureSourceApplicationEntityTitle(const std::string& path,
+                                                     const char* aet)
+  {
+    if (aet == NULL ||
+        strlen(aet) == 0)
+    {
+      return;
+    }
+
+    StreamingFileVisitor visitor(DICOM_TAG_SOP_CLASS_UID);
+    if (!visitor.Read(path) ||
+        visitor.HasSourceApplicationEntityTitle())
+    {
+      return;  // This is the usual case, as DCMTK writes this tag in the meta header
+    }
+
+    // The meta header has to be rewritten, which is only possible by
+    // re-encoding the file (the dataset itself is left untouched)
+    DcmFileFormat dicom;
+    if (!dicom.loadFile(path.c_str()).good() ||
+        !dicom.getMetaInfo()->putAndInsertString(DCM_SourceApplicationEntityTitle, aet).good() ||
+        !dicom.saveFile(path.c_str(), EXS_Unknown).good())
+    {
+      throw OrthancException(ErrorCode_CannotWriteFile,
+                             "Cannot store the source AET in the meta header of: " + path);
+    }
+  }
+
+
 /*
  * This function processes a DIMSE C-STORE-RQ commmand that was
  * received over the network connection.
@@ -237,6 +510,7 @@ namespace Orthanc
 
     data.affectedSOPInstanceUID = req->AffectedSOPInstanceUID;
     data.messageID = req->MessageID;
+    data.streamingFile = NULL;
     if (assoc && assoc->params)
     {
       data.remoteAET = assoc->params->DULparams.callingAPTitle;
@@ -248,6 +522,35 @@ namespace Orthanc
       data.calledAET = "";
     }
 
+    std::unique_ptr<TemporaryFile> streamingFile(handler.CreateStreamingFile());
+
+    if (streamingFile.get() != NULL)
+    {
+      /**
+       * Streaming mode (new in Orthanc 1.9.6): DCMTK writes the meta
+       * header and the incoming PDVs into the temporary file as they
+       * are received, which avoids to hold the full DCMTK dataset in
+       * memory and to re-encode it ("bit preserving" mode of DCMTK).
+       * As in the non-streaming mode below, the calling AET is stored
+       * as the SourceApplicationEntityTitle of the meta header: This
+       * is done by "DIMSE_createFilestream()" in DCMTK, and checked by
+       * "EnsureSourceApplicationEntityTitle()".
+       **/
+      data.streamingFile = streamingFile.get();
+
+      cond = DIMSE_storeProvider(assoc, presID, req, streamingFile->GetPath().c_str(),
+                                 /*opt_useMetaheader*/ OFTrue, NULL, storeScpCallback, &data,
+                                 /*opt_blockMode*/ (timeout ? DIMSE_NONBLOCKING : DIMSE_BLOCKING),
+                                 /*opt_dimse_timeout*/ timeout);
+
+      if (cond.bad())
+      {
+        CLOG(ERROR, DICOM) << "Store SCP Failed: " << cond.text();
+      }
+
+      return cond;
+    }
+
     DcmFileFormat dcmff;
 
     // store SourceApplicationEntityTitle in metaheader
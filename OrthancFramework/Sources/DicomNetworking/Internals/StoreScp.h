@@ -22,6 +22,7 @@
 
 #pragma once
 
+#include "../../OrthancFramework.h"
 #include "../IStoreRequestHandler.h"
 
 #include <dcmtk/dcmnet/dimse.h>
@@ -36,5 +37,19 @@ namespace Orthanc
                          IStoreRequestHandler& handler,
                          const std::string& remoteIp,
                          int timeout);
+
+    /**
+     * Checks the SOP class and instance UIDs of a DICOM file received
+     * in streaming mode against the C-STORE request, and returns the
+     * DIMSE status of the C-STORE response (new in Orthanc 1.9.6)
+     **/
+    ORTHANC_PUBLIC DIC_US CheckStreamingStoreFile(const std::string& path,
+                                                  const char* affectedSopClassUid,
+                                                  const char* affectedSopInstanceUid);
+
+    // Adds the SourceApplicationEntityTitle to the meta header of a
+    // DICOM file received in streaming mode, if missing (new in Orthanc 1.9.6)
+    ORTHANC_PUBLIC void EnsureSourceApplicationEntityTitle(const std::string& path,
+                                                           const char* aet);
   }
 }
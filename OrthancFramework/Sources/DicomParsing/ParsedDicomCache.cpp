@@ -23,21 +23,35 @@
 #include "../PrecompiledHeaders.h"
 #include "ParsedDicomCache.h"
 
+#include "../Compatibility.h"
 #include "../OrthancException.h"
 
 namespace Orthanc
 {
-  class ParsedDicomCache::Item : public ICacheable
+  class ParsedDicomCache::Item : public boost::noncopyable
   {
   private:
-    std::unique_ptr<ParsedDicomFile>  dicom_;
-    size_t                            fileSize_;
+    std::unique_ptr<ParsedDicomFile>      dicom_;
+    size_t                                fileSize_;
+    boost::shared_ptr<const std::string>  buffer_;      // Can be NULL
+    Shard*                                shard_;       // NULL for the large item
+    unsigned int                          references_;  // Number of accessors
+    bool                                  detached_;    // Removed from the cache while in use
 
   public:
+#if !defined(__EMSCRIPTEN__)
+    boost::mutex  mutex_;  // Serializes the accessors to this item
+#endif
+
     Item(ParsedDicomFile* dicom,
-         size_t fileSize) :
+         size_t fileSize,
+         const boost::shared_ptr<const std::string>& buffer) :
       dicom_(dicom),
-      fileSize_(fileSize)
+      fileSize_(fileSize),
+      buffer_(buffer),
+      shard_(NULL),
+      references_(0),
+      detached_(false)
     {
       if (dicom == NULL)
       {
@@ -45,150 +59,573 @@ namespace Orthanc
       }
     }
 
-    virtual size_t GetMemoryUsage() const ORTHANC_OVERRIDE
+    size_t GetFileSize() const
     {
       return fileSize_;
     }
 
+    // Size of the item, as counted in the size of the cache: The
+    // parsed dataset (estimated by the size of the file), plus the
+    // raw buffer if it is kept
+    size_t GetMemorySize() const
+    {
+      return fileSize_ + (buffer_.get() == NULL ? 0 : buffer_->size());
+    }
+
+    const boost::shared_ptr<const std::string>& GetBuffer() const
+    {
+      return buffer_;
+    }
+
     ParsedDicomFile& GetDicom() const
     {
       assert(dicom_.get() != NULL);
       return *dicom_;
     }
+
+    Shard* GetShard() const
+    {
+      return shard_;
+    }
+
+    void SetShard(Shard& shard)
+    {
+      shard_ = &shard;
+    }
+
+    // The methods below must be called with the mutex of the owner
+    // (shard or large item) locked
+
+    void AddReference()
+    {
+      references_++;
+    }
+
+    // Returns "true" iff the item must be deleted by the caller
+    bool RemoveReference()
+    {
+      assert(references_ > 0);
+      references_--;
+      return (references_ == 0 && detached_);
+    }
+
+    bool IsInUse() const
+    {
+      return references_ > 0;
+    }
+
+    // Returns "true" iff the item must be deleted by the caller
+    bool Detach()
+    {
+      if (references_ == 0)
+      {
+        return true;
+      }
+      else
+      {
+        detached_ = true;
+        return false;
+      }
+    }
   };
 
 
-  ParsedDicomCache::ParsedDicomCache(size_t size) :
-    cacheSize_(size),
-    largeSize_(0)
+  class ParsedDicomCache::Shard : public boost::noncopyable
+  {
+  public:
+#if !defined(__EMSCRIPTEN__)
+    boost::mutex                                 mutex_;
+#endif
+
+    LeastRecentlyUsedIndex<std::string, Item*>   content_;
+  };
+
+
+  void ParsedDicomCache::Setup(unsigned int shardsCount)
   {
-    if (size == 0)
+    if (cacheSize_ == 0 ||
+        shardsCount == 0)
     {
       throw OrthancException(ErrorCode_ParameterOutOfRange);
     }
+
+#if defined(__EMSCRIPTEN__)
+    shardsCount = 1;  // No multithreading in WebAssembly
+#endif
+
+    shards_.resize(shardsCount);
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i] = new Shard;
+    }
   }
 
-  
-  size_t ParsedDicomCache::GetNumberOfItems()
+
+  size_t ParsedDicomCache::GetShardIndex(const std::string& id) const
   {
+    // Orthanc identifiers are SHA-1 hashes, a simple hash is sufficient
+    size_t hash = 0;
+
+    for (size_t i = 0; i < id.size(); i++)
+    {
+      hash = hash * 31 + static_cast<uint8_t>(id[i]);
+    }
+
+    return hash % shards_.size();
+  }
+
+
+  void ParsedDicomCache::DropLargeItem()
+  {
+    // WARNING: "largeMutex_" must be locked
+    if (largeItem_ != NULL)
+    {
+      if (largeItem_->Detach())
+      {
+        delete largeItem_;
+      }
+
+      largeItem_ = NULL;
+      largeId_.clear();
+    }
+  }
+
+
+  void ParsedDicomCache::Recycle(size_t modifiedShard)
+  {
+    /**
+     * Evict the least recently used items until the total size fits
+     * the cache. The shard that has just received a new item is
+     * visited last, so that this new item is not the first to be
+     * evicted. The shards are locked one at a time to avoid
+     * deadlocks. The items in use are skipped (they are marked as the
+     * most recent, which they are).
+     **/
+    
+    for (size_t i = 1; i <= shards_.size(); i++)
+    {
+      Shard& shard = *shards_[(modifiedShard + i) % shards_.size()];
+
 #if !defined(__EMSCRIPTEN__)
-    boost::mutex::scoped_lock lock(mutex_);
+      boost::mutex::scoped_lock shardLock(shard.mutex_);
 #endif
 
-    if (cache_.get() == NULL)
+      size_t skipped = 0;
+
+      while (skipped < shard.content_.GetSize())
+      {
+        {
+#if !defined(__EMSCRIPTEN__)
+          boost::mutex::scoped_lock sizeLock(sizeMutex_);
+#endif
+          if (currentSize_ <= cacheSize_)
+          {
+            return;  // Done
+          }
+        }
+
+        Item* item = shard.content_.GetOldestPayload();
+        assert(item != NULL);
+
+        if (item->IsInUse())
+        {
+          shard.content_.MakeMostRecent(shard.content_.GetOldest());
+          skipped++;
+        }
+        else
+        {
+          shard.content_.RemoveOldest();
+
+          {
+#if !defined(__EMSCRIPTEN__)
+            boost::mutex::scoped_lock sizeLock(sizeMutex_);
+#endif
+            assert(currentSize_ >= item->GetMemorySize());
+            currentSize_ -= item->GetMemorySize();
+          }
+          
+          delete item;
+        }
+      }
+    }
+  }
+
+
+  void ParsedDicomCache::Clear()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
     {
-      return (largeDicom_.get() == NULL ? 0 : 1);
+      Shard& shard = *shards_[i];
+
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock shardLock(shard.mutex_);
+#endif
+
+      while (!shard.content_.IsEmpty())
+      {
+        Item* item = NULL;
+        shard.content_.RemoveOldest(item);
+        assert(item != NULL);
+
+        {
+#if !defined(__EMSCRIPTEN__)
+          boost::mutex::scoped_lock sizeLock(sizeMutex_);
+#endif
+          assert(currentSize_ >= item->GetMemorySize());
+          currentSize_ -= item->GetMemorySize();
+        }
+
+        if (item->Detach())
+        {
+          delete item;
+        }
+      }
+    }
+  }
+
+
+  void ParsedDicomCache::Release(Item* item)
+  {
+    assert(item != NULL);
+
+    bool isDelete;
+
+    if (item->GetShard() == NULL)
+    {
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(largeMutex_);
+#endif
+      isDelete = item->RemoveReference();
     }
     else
     {
-      assert(largeDicom_.get() == NULL);
-      assert(largeSize_ == 0);
-      return cache_->GetNumberOfItems();
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(item->GetShard()->mutex_);
+#endif
+      isDelete = item->RemoveReference();
+    }
+
+    if (isDelete)
+    {
+      // The item was detached from the cache, no one else can see it
+      delete item;
     }
   }
 
 
-  size_t ParsedDicomCache::GetCurrentSize()
+  ParsedDicomCache::ParsedDicomCache(size_t size) :
+    cacheSize_(size),
+    currentSize_(0),
+    largeItem_(NULL)
+  {
+    Setup(1);
+  }
+
+
+  ParsedDicomCache::ParsedDicomCache(size_t size,
+                                     unsigned int shardsCount) :
+    cacheSize_(size),
+    currentSize_(0),
+    largeItem_(NULL)
+  {
+    Setup(shardsCount);
+  }
+
+
+  ParsedDicomCache::~ParsedDicomCache()
   {
+    // No accessor can be alive at this point
+    Clear();
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      assert(shards_[i] != NULL);
+      delete shards_[i];
+    }
+
+    if (largeItem_ != NULL)
+    {
+      delete largeItem_;
+    }
+  }
+
+  
+  size_t ParsedDicomCache::GetNumberOfItems()
+  {
+    size_t count = 0;
+
+    {
 #if !defined(__EMSCRIPTEN__)
-    boost::mutex::scoped_lock lock(mutex_);
+      boost::mutex::scoped_lock lock(largeMutex_);
 #endif
+      if (largeItem_ != NULL)
+      {
+        count = 1;
+      }
+    }
 
-    if (cache_.get() == NULL)
+    for (size_t i = 0; i < shards_.size(); i++)
     {
-      return largeSize_;
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(shards_[i]->mutex_);
+#endif
+      count += shards_[i]->content_.GetSize();
     }
-    else
+
+    return count;
+  }
+
+
+  size_t ParsedDicomCache::GetCurrentSize()
+  {
+    size_t size = 0;
+
     {
-      assert(largeDicom_.get() == NULL);
-      assert(largeSize_ == 0);
-      return cache_->GetCurrentSize();
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(largeMutex_);
+#endif
+      if (largeItem_ != NULL)
+      {
+        size = largeItem_->GetMemorySize();
+      }
+    }
+
+    {
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(sizeMutex_);
+#endif
+      size += currentSize_;
     }
+
+    return size;
   }
 
   
   void ParsedDicomCache::Invalidate(const std::string& id)
   {
+    {
 #if !defined(__EMSCRIPTEN__)
-    boost::mutex::scoped_lock lock(mutex_);
+      boost::mutex::scoped_lock lock(largeMutex_);
 #endif
-      
-    if (cache_.get() != NULL)
-    {
-      cache_->Invalidate(id);
+
+      if (largeItem_ != NULL &&
+          largeId_ == id)
+      {
+        DropLargeItem();
+      }
     }
 
-    if (largeId_ == id)
+    Shard& shard = *shards_[GetShardIndex(id)];
+
+#if !defined(__EMSCRIPTEN__)
+    boost::mutex::scoped_lock shardLock(shard.mutex_);
+#endif
+
+    Item* item = NULL;
+    if (shard.content_.Contains(id, item))
     {
-      largeDicom_.reset(NULL);
-      largeSize_ = 0;
+      assert(item != NULL);
+      shard.content_.Invalidate(id);
+
+      {
+#if !defined(__EMSCRIPTEN__)
+        boost::mutex::scoped_lock sizeLock(sizeMutex_);
+#endif
+        assert(currentSize_ >= item->GetMemorySize());
+        currentSize_ -= item->GetMemorySize();
+      }
+
+      if (item->Detach())
+      {
+        delete item;
+      }
     }
   }
 
   
+  void ParsedDicomCache::AcquireInternal(const std::string& id,
+                                         Item* newItem)
+  {
+    std::unique_ptr<Item> item(newItem);
+    const size_t memorySize = item->GetMemorySize();
+
+    if (memorySize >= cacheSize_)
+    {
+      // This file is larger than the cache: It replaces all the content
+      {
+#if !defined(__EMSCRIPTEN__)
+        boost::mutex::scoped_lock lock(largeMutex_);
+#endif
+        DropLargeItem();
+        largeItem_ = item.release();
+        largeId_ = id;
+      }
+
+      Clear();
+    }
+    else
+    {
+      {
+#if !defined(__EMSCRIPTEN__)
+        boost::mutex::scoped_lock lock(largeMutex_);
+#endif
+        DropLargeItem();
+      }
+
+      const size_t index = GetShardIndex(id);
+      Shard& shard = *shards_[index];
+
+      {
+#if !defined(__EMSCRIPTEN__)
+        boost::mutex::scoped_lock shardLock(shard.mutex_);
+#endif
+
+        if (shard.content_.Contains(id))
+        {
+          // Value already stored, don't overwrite the old value
+          shard.content_.MakeMostRecent(id);
+          return;
+        }
+        else
+        {
+          item->SetShard(shard);
+          shard.content_.Add(id, item.release());
+
+#if !defined(__EMSCRIPTEN__)
+          boost::mutex::scoped_lock sizeLock(sizeMutex_);
+#endif
+          currentSize_ += memorySize;
+        }
+      }
+
+      Recycle(index);
+    }
+  }
+
+
   void ParsedDicomCache::Acquire(const std::string& id,
                                  ParsedDicomFile* dicom,  // Takes ownership
                                  size_t fileSize)
   {
-#if !defined(__EMSCRIPTEN__)
-    boost::mutex::scoped_lock lock(mutex_);
-#endif
-      
-    if (fileSize >= cacheSize_)
+    AcquireInternal(id, new Item(dicom, fileSize, boost::shared_ptr<const std::string>()));
+  }
+
+
+  void ParsedDicomCache::Acquire(const std::string& id,
+                                 ParsedDicomFile* dicom,  // Takes ownership
+                                 const boost::shared_ptr<const std::string>& buffer)
+  {
+    std::unique_ptr<ParsedDicomFile> protection(dicom);
+
+    if (buffer.get() == NULL)
     {
-      cache_.reset(NULL);
-      largeDicom_.reset(dicom);
-      largeId_ = id;
-      largeSize_ = fileSize;
+      throw OrthancException(ErrorCode_NullPointer);
     }
     else
     {
-      largeDicom_.reset(NULL);
-      largeSize_ = 0;
+      AcquireInternal(id, new Item(protection.release(), buffer->size(), buffer));
+    }
+  }
+
 
-      if (cache_.get() == NULL)
+  bool ParsedDicomCache::LookupBuffer(boost::shared_ptr<const std::string>& buffer,
+                                      const std::string& id)
+  {
+    {
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(largeMutex_);
+#endif
+      if (largeItem_ != NULL &&
+          largeId_ == id)
       {
-        cache_.reset(new MemoryObjectCache);
-        cache_->SetMaximumSize(cacheSize_);
+        buffer = largeItem_->GetBuffer();
+        return (buffer.get() != NULL);
       }
+    }
+
+    Shard& shard = *shards_[GetShardIndex(id)];
+
+#if !defined(__EMSCRIPTEN__)
+    boost::mutex::scoped_lock lock(shard.mutex_);
+#endif
 
-      cache_->Acquire(id, new Item(dicom, fileSize));
+    Item* item = NULL;
+    if (shard.content_.Contains(id, item))
+    {
+      assert(item != NULL);
+      shard.content_.MakeMostRecent(id);
+      buffer = item->GetBuffer();
+      return (buffer.get() != NULL);
+    }
+    else
+    {
+      return false;
     }
   }
 
 
   ParsedDicomCache::Accessor::Accessor(ParsedDicomCache& that,
                                        const std::string& id) :
-#if !defined(__EMSCRIPTEN__)
-    lock_(that.mutex_),
-#endif
-    id_(id),
-    file_(NULL),
-    fileSize_(0)
+    cache_(that),
+    item_(NULL)
   {
-    if (that.largeDicom_.get() != NULL &&
-        that.largeId_ == id)
     {
-      file_ = that.largeDicom_.get();
-      fileSize_ = that.largeSize_;
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(that.largeMutex_);
+#endif
+      if (that.largeItem_ != NULL &&
+          that.largeId_ == id)
+      {
+        item_ = that.largeItem_;
+        item_->AddReference();
+      }
     }
-    else if (that.cache_.get() != NULL)
+
+    if (item_ == NULL)
     {
-      accessor_.reset(new MemoryObjectCache::Accessor(
-                        *that.cache_, id, true /* unique */));
-      if (accessor_->IsValid())
-      {            
-        const Item& item = dynamic_cast<const Item&>(accessor_->GetValue());
-        file_ = &item.GetDicom();
-        fileSize_ = item.GetMemoryUsage();
+      Shard& shard = *that.shards_[that.GetShardIndex(id)];
+
+#if !defined(__EMSCRIPTEN__)
+      boost::mutex::scoped_lock lock(shard.mutex_);
+#endif
+
+      Item* item = NULL;
+      if (shard.content_.Contains(id, item))
+      {
+        assert(item != NULL);
+        shard.content_.MakeMostRecent(id);
+        item->AddReference();
+        item_ = item;
       }
     }
+
+#if !defined(__EMSCRIPTEN__)
+    if (item_ != NULL)
+    {
+      // Must be done *after* the lock on the cache is released, as
+      // another accessor might be working on the same item
+      lock_ = boost::mutex::scoped_lock(item_->mutex_);
+    }
+#endif
+  }
+
+
+  ParsedDicomCache::Accessor::~Accessor()
+  {
+    if (item_ != NULL)
+    {
+#if !defined(__EMSCRIPTEN__)
+      lock_.unlock();
+#endif
+      cache_.Release(item_);
+    }
   }
 
 
   bool ParsedDicomCache::Accessor::IsValid() const
   {
-    return file_ != NULL;
+    return item_ != NULL;
   }
 
 
@@ -196,8 +633,7 @@ namespace Orthanc
   {
     if (IsValid())
     {
-      assert(file_ != NULL);
-      return *file_;
+      return item_->GetDicom();
     }
     else
     {
@@ -210,7 +646,33 @@ namespace Orthanc
   {
     if (IsValid())
     {
-      return fileSize_;
+      return item_->GetFileSize();
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
+  bool ParsedDicomCache::Accessor::HasBuffer() const
+  {
+    if (IsValid())
+    {
+      return (item_->GetBuffer().get() != NULL);
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
+  const boost::shared_ptr<const std::string>& ParsedDicomCache::Accessor::GetBuffer() const
+  {
+    if (HasBuffer())
+    {
+      return item_->GetBuffer();
     }
     else
     {
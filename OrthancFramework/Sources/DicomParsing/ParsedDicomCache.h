@@ -22,61 +22,128 @@
 
 #pragma once
 
-#include "../Cache/MemoryObjectCache.h"
+#include "../Cache/LeastRecentlyUsedIndex.h"
 #include "ParsedDicomFile.h"
 
+#if !defined(__EMSCRIPTEN__)
+// Multithreading is not supported in WebAssembly
+#  include <boost/thread/mutex.hpp>
+#endif
+
+#include <boost/shared_ptr.hpp>
+#include <vector>
+
 namespace Orthanc
 {
+  /**
+   * Cache of parsed DICOM files. Since Orthanc 1.9.6, the accessors
+   * only lock the cache while looking up the item, and keep a
+   * reference to this item during their lifetime. Accessors to
+   * different DICOM files can thus run concurrently, whereas the
+   * accessors to the same DICOM file are serialized (as
+   * "ParsedDicomFile" is not thread-safe). The cache can be split
+   * into shards, each with its own mutex and LRU index, to reduce
+   * contention. An item that is in use is never destroyed by the
+   * recycling: It is skipped, or destroyed as soon as its last
+   * accessor is released if it was invalidated in the meantime.
+   *
+   * Since Orthanc 1.9.6, the cache can also keep the raw DICOM file
+   * from which each item was parsed. This buffer is immutable and is
+   * shared by reference counting, so that it can be used without
+   * holding the lock on the item, and without copying it.
+   **/
   class ORTHANC_PUBLIC ParsedDicomCache : public boost::noncopyable
   {
   private:
     class Item;
+    class Shard;
+
+    size_t               cacheSize_;
+    std::vector<Shard*>  shards_;
 
 #if !defined(__EMSCRIPTEN__)
-    boost::mutex                        mutex_;
+    boost::mutex         sizeMutex_;   // Protects "currentSize_"
+    boost::mutex         largeMutex_;  // Protects "largeItem_" and "largeId_"
 #endif
-    
-    size_t                              cacheSize_;
-    std::unique_ptr<MemoryObjectCache>  cache_;
-    std::unique_ptr<ParsedDicomFile>    largeDicom_;
-    std::string                         largeId_;
-    size_t                              largeSize_;
+
+    size_t               currentSize_;  // Total size of the items in the shards
+    Item*                largeItem_;
+    std::string          largeId_;
+
+    void Setup(unsigned int shardsCount);
+
+    size_t GetShardIndex(const std::string& id) const;
+
+    void DropLargeItem();  // "largeMutex_" must be locked
+
+    void Recycle(size_t modifiedShard);
+
+    void Clear();
+
+    void Release(Item* item);
+
+    void AcquireInternal(const std::string& id,
+                         Item* newItem);  // Takes ownership
 
   public:
     explicit ParsedDicomCache(size_t size);
 
+    ParsedDicomCache(size_t size,
+                     unsigned int shardsCount);
+
+    ~ParsedDicomCache();
+
     size_t GetNumberOfItems();  // For unit tests only
 
     size_t GetCurrentSize();  // For unit tests only
 
+    size_t GetShardsCount() const
+    {
+      return shards_.size();
+    }
+
     void Invalidate(const std::string& id);
 
     void Acquire(const std::string& id,
                  ParsedDicomFile* dicom,  // Takes ownership
                  size_t fileSize);
 
+    // The item holds both the parsed dataset, whose size is estimated
+    // by the size of the buffer, and the buffer itself: It is charged
+    // twice the size of the buffer in the size of the cache
+    void Acquire(const std::string& id,
+                 ParsedDicomFile* dicom,  // Takes ownership
+                 const boost::shared_ptr<const std::string>& buffer);
+
+    // Only locks the cache (not the item), as the buffer is immutable
+    bool LookupBuffer(boost::shared_ptr<const std::string>& buffer,
+                      const std::string& id);
+
     class ORTHANC_PUBLIC Accessor : public boost::noncopyable
     {
     private:
+      ParsedDicomCache&          cache_;
+      Item*                      item_;
+
 #if !defined(__EMSCRIPTEN__)
-      boost::mutex::scoped_lock  lock_;
+      boost::mutex::scoped_lock  lock_;  // Exclusive access to the item
 #endif
       
-      std::string                id_;
-      ParsedDicomFile*           file_;
-      size_t                     fileSize_;
-
-      std::unique_ptr<MemoryObjectCache::Accessor>  accessor_;
-      
     public:
       Accessor(ParsedDicomCache& that,
                const std::string& id);
 
+      ~Accessor();
+
       bool IsValid() const;
 
       ParsedDicomFile& GetDicom() const;
 
       size_t GetFileSize() const;
+
+      bool HasBuffer() const;
+
+      const boost::shared_ptr<const std::string>& GetBuffer() const;
     };
   };
 }
@@ -723,7 +723,23 @@ namespace Orthanc
      * buffer is non-empty, the buffer is compatible with the
      * "deflate" HTTP compression.
      **/
-    CompressionType_ZlibWithSize = 2
+    CompressionType_ZlibWithSize = 2,
+
+    /**
+     * Buffer that is cut into chunks of fixed size that are
+     * independently compressed using zlib, followed by an index of
+     * the chunks, which allows random access to the uncompressed
+     * content. This format is internal to Orthanc, cf. class
+     * "ChunkedZlibCompressor" (new in Orthanc 1.9.6).
+     **/
+    CompressionType_ZlibChunked = 3,
+
+    /**
+     * Standard zstd frame, whose header contains the uncompressed
+     * size, cf. class "ZstdCompressor". Only available if Orthanc is
+     * built with "ORTHANC_ENABLE_ZSTD" (new in Orthanc 1.9.6).
+     **/
+    CompressionType_Zstd = 4
   };
 
   enum FileContentType
@@ -27,6 +27,7 @@
 // http://stackoverflow.com/questions/446358/storing-a-large-number-of-images
 
 #include "../Logging.h"
+#include "../MappedFileMemoryBuffer.h"
 #include "../OrthancException.h"
 #include "../StringMemoryBuffer.h"
 #include "../SystemToolbox.h"
@@ -78,14 +79,16 @@ namespace Orthanc
   }
 
   FilesystemStorage::FilesystemStorage(const std::string &root) :
-    fsyncOnWrite_(false)
+    fsyncOnWrite_(false),
+    memoryMapThreshold_(0)
   {
     Setup(root);
   }
 
   FilesystemStorage::FilesystemStorage(const std::string &root,
                                        bool fsyncOnWrite) :
-    fsyncOnWrite_(fsyncOnWrite)
+    fsyncOnWrite_(fsyncOnWrite),
+    memoryMapThreshold_(0)
   {
     Setup(root);
   }
@@ -160,10 +163,20 @@ namespace Orthanc
     LOG(INFO) << "Reading attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
               << "\" content type";
 
-    std::string content;
-    SystemToolbox::ReadFile(content, GetPath(uuid).string());
+    const std::string path = GetPath(uuid).string();
 
-    return StringMemoryBuffer::CreateFromSwap(content);
+    if (memoryMapThreshold_ != 0 &&
+        SystemToolbox::GetFileSize(path) >= memoryMapThreshold_)
+    {
+      return new MappedFileMemoryBuffer(path);
+    }
+    else
+    {
+      std::string content;
+      SystemToolbox::ReadFile(content, path);
+
+      return StringMemoryBuffer::CreateFromSwap(content);
+    }
   }
 
 
@@ -175,11 +188,21 @@ namespace Orthanc
     LOG(INFO) << "Reading attachment \"" << uuid << "\" of \"" << GetDescriptionInternal(type) 
               << "\" content type (range from " << start << " to " << end << ")";
 
-    std::string content;
-    SystemToolbox::ReadFileRange(
-      content, GetPath(uuid).string(), start, end, true /* throw if overflow */);
+    const std::string path = GetPath(uuid).string();
+
+    if (memoryMapThreshold_ != 0 &&
+        start <= end &&
+        end - start >= memoryMapThreshold_)
+    {
+      return new MappedFileMemoryBuffer(path, start, end);
+    }
+    else
+    {
+      std::string content;
+      SystemToolbox::ReadFileRange(content, path, start, end, true /* throw if overflow */);
 
-    return StringMemoryBuffer::CreateFromSwap(content);
+      return StringMemoryBuffer::CreateFromSwap(content);
+    }
   }
 
 
@@ -189,6 +212,22 @@ namespace Orthanc
   }
 
 
+  void FilesystemStorage::SetMemoryMapThreshold(uint64_t threshold)
+  {
+    if (threshold != 0 &&
+        !MappedFileMemoryBuffer::IsSupported())
+    {
+      LOG(WARNING) << "Memory-mapped files are not supported on this platform, "
+                   << "the attachments will be read into memory";
+      memoryMapThreshold_ = 0;
+    }
+    else
+    {
+      memoryMapThreshold_ = threshold;
+    }
+  }
+
+
   uintmax_t FilesystemStorage::GetSize(const std::string& uuid) const
   {
     boost::filesystem::path path = GetPath(uuid);
@@ -304,7 +343,8 @@ namespace Orthanc
 
 #if ORTHANC_BUILDING_FRAMEWORK_LIBRARY == 1
   FilesystemStorage::FilesystemStorage(std::string root) :
-    fsyncOnWrite_(false)
+    fsyncOnWrite_(false),
+    memoryMapThreshold_(0)
   {
     Setup(root);
   }
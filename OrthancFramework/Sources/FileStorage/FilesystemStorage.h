@@ -50,6 +50,7 @@ namespace Orthanc
   private:
     boost::filesystem::path root_;
     bool                    fsyncOnWrite_;
+    uint64_t                memoryMapThreshold_;  // New in Orthanc 1.9.6
 
     boost::filesystem::path GetPath(const std::string& uuid) const;
 
@@ -88,6 +89,19 @@ namespace Orthanc
 
     virtual bool HasReadRange() const ORTHANC_OVERRIDE;
 
+    /**
+     * The files or ranges whose size is at least "threshold" bytes
+     * are mapped in memory by "Read()" and "ReadRange()", instead of
+     * being copied into the heap. A value of "0" disables the memory
+     * mapping, which is the default (new in Orthanc 1.9.6).
+     **/
+    void SetMemoryMapThreshold(uint64_t threshold);
+
+    uint64_t GetMemoryMapThreshold() const
+    {
+      return memoryMapThreshold_;
+    }
+
     virtual void Remove(const std::string& uuid,
                         FileContentType type) ORTHANC_OVERRIDE;
 
@@ -24,18 +24,28 @@
 #include "StorageAccessor.h"
 
 #include "../Compatibility.h"
+#include "../Compression/ChunkedZlibCompressor.h"
 #include "../Compression/ZlibCompressor.h"
 #include "../MetricsRegistry.h"
 #include "../OrthancException.h"
 #include "../Toolbox.h"
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
+#  include "../HttpServer/BufferHttpSender.h"
 #  include "../HttpServer/HttpStreamTranscoder.h"
 #endif
 
+#if ORTHANC_ENABLE_ZSTD == 1
+#  include "../Compression/ZstdCompressor.h"
+#endif
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+
 
 static const std::string METRICS_CREATE = "orthanc_storage_create_duration_ms";
 static const std::string METRICS_READ = "orthanc_storage_read_duration_ms";
+static const std::string METRICS_READ_RANGE = "orthanc_storage_read_range_duration_ms";
 static const std::string METRICS_REMOVE = "orthanc_storage_remove_duration_ms";
 
 
@@ -58,16 +68,205 @@ namespace Orthanc
   };
 
 
+  class StorageAccessor::RangeReader : public ChunkedZlibCompressor::IRangeReader
+  {
+  private:
+    StorageAccessor&  that_;
+    const FileInfo&   info_;
+
+  public:
+    RangeReader(StorageAccessor& that,
+                const FileInfo& info) :
+      that_(that),
+      info_(info)
+    {
+    }
+
+    virtual void ReadRange(std::string& target,
+                           uint64_t start,
+                           uint64_t end) ORTHANC_OVERRIDE
+    {
+      MetricsTimer timer(that_, METRICS_READ_RANGE);
+
+      std::unique_ptr<IMemoryBuffer> buffer(
+        that_.area_.ReadRange(info_.GetUuid(), info_.GetContentType(), start, end));
+      buffer->MoveToString(target);
+    }
+  };
+
+
+  namespace
+  {
+    // Used if the storage area does not support range reads
+    class MemoryRangeReader : public ChunkedZlibCompressor::IRangeReader
+    {
+    private:
+      const IMemoryBuffer&  buffer_;
+
+    public:
+      explicit MemoryRangeReader(const IMemoryBuffer& buffer) :
+        buffer_(buffer)
+      {
+      }
+
+      virtual void ReadRange(std::string& target,
+                             uint64_t start,
+                             uint64_t end) ORTHANC_OVERRIDE
+      {
+        if (start > end ||
+            end > buffer_.GetSize())
+        {
+          throw OrthancException(ErrorCode_CorruptedFile);
+        }
+
+        target.assign(reinterpret_cast<const char*>(buffer_.GetData()) + start,
+                      static_cast<size_t>(end - start));
+      }
+    };
+
+
+#if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
+    // Uncompresses one chunk at a time while sending the answer
+    class ChunkedZlibHttpSender : public HttpFileSender
+    {
+    private:
+      std::unique_ptr<IMemoryBuffer>  compressed_;
+      ChunkedZlibCompressor::Index    index_;
+      size_t                          next_;
+      std::string                     chunk_;
+
+    public:
+      // Takes the ownership of the buffer
+      explicit ChunkedZlibHttpSender(IMemoryBuffer* compressed) :
+        compressed_(compressed),
+        index_(compressed->GetData(), compressed->GetSize()),
+        next_(0)
+      {
+      }
+
+      virtual uint64_t GetContentLength() ORTHANC_OVERRIDE
+      {
+        return index_.GetUncompressedSize();
+      }
+
+      virtual bool ReadNextChunk() ORTHANC_OVERRIDE
+      {
+        if (next_ == index_.GetChunksCount())
+        {
+          return false;
+        }
+
+        uint64_t start, end;
+        index_.GetCompressedRange(start, end, next_);
+
+        ChunkedZlibCompressor::UncompressChunk(
+          chunk_, index_, next_, reinterpret_cast<const uint8_t*>(compressed_->GetData()) + start,
+          static_cast<size_t>(end - start));
+
+        next_++;
+        return true;
+      }
+
+      virtual const char* GetChunkContent() ORTHANC_OVERRIDE
+      {
+        return chunk_.c_str();
+      }
+
+      virtual size_t GetChunkSize() ORTHANC_OVERRIDE
+      {
+        return chunk_.size();
+      }
+    };
+#endif
+  }
+
+
   StorageAccessor::StorageAccessor(IStorageArea &area) :
     area_(area),
-    metrics_(NULL)
+    metrics_(NULL),
+    chunkSize_(1024 * 1024),
+    compressionThreads_(1),
+    compressionLevel_(6)
   {
   }
 
   StorageAccessor::StorageAccessor(IStorageArea &area, MetricsRegistry &metrics) :
     area_(area),
-    metrics_(&metrics)
+    metrics_(&metrics),
+    chunkSize_(1024 * 1024),
+    compressionThreads_(1),
+    compressionLevel_(6)
+  {
+  }
+
+
+  uint8_t StorageAccessor::GetMaximumCompressionLevel(CompressionType compression)
+  {
+    switch (compression)
+    {
+      case CompressionType_ZlibWithSize:
+      case CompressionType_ZlibChunked:
+        return 9;
+
+      case CompressionType_Zstd:
+#if ORTHANC_ENABLE_ZSTD == 1
+        return static_cast<uint8_t>(std::min(ZstdCompressor::GetMaximumCompressionLevel(), 255));
+#else
+        throw OrthancException(ErrorCode_NotImplemented, "Orthanc was built without support for zstd");
+#endif
+
+      default:
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void StorageAccessor::SetCompressionLevel(uint8_t level)
+  {
+#if ORTHANC_ENABLE_ZSTD == 1
+    const uint8_t maximum = GetMaximumCompressionLevel(CompressionType_Zstd);
+#else
+    const uint8_t maximum = GetMaximumCompressionLevel(CompressionType_ZlibWithSize);
+#endif
+
+    if (level < 1 ||
+        level > maximum)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The compression level must be between 1 (fastest) and " +
+                             boost::lexical_cast<std::string>(static_cast<int>(maximum)) +
+                             " (highest compression)");
+    }
+    else
+    {
+      compressionLevel_ = level;
+    }
+  }
+
+
+  void StorageAccessor::SetCompressionChunkSize(size_t size)
+  {
+    if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      chunkSize_ = size;
+    }
+  }
+
+
+  void StorageAccessor::SetCompressionThreadsCount(unsigned int count)
   {
+    if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      compressionThreads_ = count;
+    }
   }
 
 
@@ -97,11 +296,45 @@ namespace Orthanc
       }
 
       case CompressionType_ZlibWithSize:
+      case CompressionType_ZlibChunked:
+      case CompressionType_Zstd:
       {
-        ZlibCompressor zlib;
+        if (compressionLevel_ > GetMaximumCompressionLevel(compression))
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange, "The compression level " +
+                                 boost::lexical_cast<std::string>(static_cast<int>(compressionLevel_)) +
+                                 " is not supported by " +
+                                 std::string(compression == CompressionType_Zstd ? "zstd" : "zlib") +
+                                 " (maximum is " + boost::lexical_cast<std::string>(
+                                   static_cast<int>(GetMaximumCompressionLevel(compression))) + ")");
+        }
 
         std::string compressed;
-        zlib.Compress(compressed, data, size);
+
+        if (compression == CompressionType_ZlibWithSize)
+        {
+          ZlibCompressor zlib;
+          zlib.SetCompressionLevel(compressionLevel_);
+          zlib.Compress(compressed, data, size);
+        }
+        else if (compression == CompressionType_ZlibChunked)
+        {
+          ChunkedZlibCompressor chunked;
+          chunked.SetCompressionLevel(compressionLevel_);
+          chunked.SetChunkSize(chunkSize_);
+          chunked.SetThreadsCount(compressionThreads_);
+          chunked.Compress(compressed, data, size);
+        }
+        else
+        {
+#if ORTHANC_ENABLE_ZSTD == 1
+          ZstdCompressor zstd;
+          zstd.SetCompressionLevel(compressionLevel_);
+          zstd.Compress(compressed, data, size);
+#else
+          throw OrthancException(ErrorCode_NotImplemented, "Orthanc was built without support for zstd");
+#endif
+        }
 
         std::string compressedMD5;
       
@@ -124,7 +357,7 @@ namespace Orthanc
         }
 
         return FileInfo(uuid, type, size, md5,
-                        CompressionType_ZlibWithSize, compressed.size(), compressedMD5);
+                        compression, compressed.size(), compressedMD5);
       }
 
       default:
@@ -171,6 +404,38 @@ namespace Orthanc
         break;
       }
 
+      case CompressionType_ZlibChunked:
+      {
+        ChunkedZlibCompressor chunked;
+
+        std::unique_ptr<IMemoryBuffer> compressed;
+
+        {
+          MetricsTimer timer(*this, METRICS_READ);
+          compressed.reset(area_.Read(info.GetUuid(), info.GetContentType()));
+        }
+
+        chunked.Uncompress(content, compressed->GetData(), compressed->GetSize());
+        break;
+      }
+
+#if ORTHANC_ENABLE_ZSTD == 1
+      case CompressionType_Zstd:
+      {
+        ZstdCompressor zstd;
+
+        std::unique_ptr<IMemoryBuffer> compressed;
+
+        {
+          MetricsTimer timer(*this, METRICS_READ);
+          compressed.reset(area_.Read(info.GetUuid(), info.GetContentType()));
+        }
+
+        zstd.Uncompress(content, compressed->GetData(), compressed->GetSize());
+        break;
+      }
+#endif
+
       default:
       {
         throw OrthancException(ErrorCode_NotImplemented);
@@ -191,6 +456,75 @@ namespace Orthanc
   }
 
 
+  void StorageAccessor::ReadRange(std::string& target,
+                                  const FileInfo& info,
+                                  uint64_t start,
+                                  uint64_t end)
+  {
+    if (start > end ||
+        end > info.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    switch (info.GetCompressionType())
+    {
+      case CompressionType_None:
+        if (area_.HasReadRange())
+        {
+          RangeReader reader(*this, info);
+          reader.ReadRange(target, start, end);
+
+          if (target.size() != end - start)
+          {
+            throw OrthancException(ErrorCode_CorruptedFile);
+          }
+
+          return;
+        }
+        else
+        {
+          break;
+        }
+
+      case CompressionType_ZlibChunked:
+        if (area_.HasReadRange())
+        {
+          RangeReader reader(*this, info);
+          ChunkedZlibCompressor::ReadRange(target, reader, info.GetCompressedSize(), start, end);
+        }
+        else
+        {
+          std::unique_ptr<IMemoryBuffer> compressed;
+
+          {
+            MetricsTimer timer(*this, METRICS_READ);
+            compressed.reset(area_.Read(info.GetUuid(), info.GetContentType()));
+          }
+
+          MemoryRangeReader reader(*compressed);
+          ChunkedZlibCompressor::ReadRange(target, reader, compressed->GetSize(), start, end);
+        }
+
+        return;
+
+      default:
+        break;
+    }
+
+    // The attachment cannot be partially read: Read all of it
+    std::string content;
+    Read(content, info);
+
+    if (content.size() != info.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_CorruptedFile);
+    }
+
+    target = content.substr(static_cast<size_t>(start), static_cast<size_t>(end - start));
+  }
+
+
   void StorageAccessor::Remove(const std::string& fileUuid,
                                FileContentType type)
   {
@@ -204,16 +538,10 @@ namespace Orthanc
   }
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
-  void StorageAccessor::SetupSender(BufferHttpSender& sender,
+  void StorageAccessor::SetupSender(HttpFileSender& sender,
                                     const FileInfo& info,
                                     const std::string& mime)
   {
-    {
-      MetricsTimer timer(*this, METRICS_READ);
-      std::unique_ptr<IMemoryBuffer> buffer(area_.Read(info.GetUuid(), info.GetContentType()));
-      buffer->MoveToString(sender.GetBuffer());
-    }
-
     sender.SetContentType(mime);
 
     const char* extension;
@@ -253,11 +581,40 @@ namespace Orthanc
                                    const FileInfo& info,
                                    const std::string& mime)
   {
-    BufferHttpSender sender;
-    SetupSender(sender, info, mime);
+    std::unique_ptr<IMemoryBuffer> buffer;
+
+    {
+      MetricsTimer timer(*this, METRICS_READ);
+      buffer.reset(area_.Read(info.GetUuid(), info.GetContentType()));
+    }
+
+    if (info.GetCompressionType() == CompressionType_ZlibChunked)
+    {
+      ChunkedZlibHttpSender sender(buffer.release());
+      SetupSender(sender, info, mime);
+      output.Answer(sender);
+    }
+#if ORTHANC_ENABLE_ZSTD == 1
+    else if (info.GetCompressionType() == CompressionType_Zstd)
+    {
+      // A zstd frame cannot be transcoded on the fly by "HttpStreamTranscoder"
+      BufferHttpSender sender;
+      ZstdCompressor zstd;
+      zstd.Uncompress(sender.GetBuffer(), buffer->GetData(), buffer->GetSize());
+      SetupSender(sender, info, mime);
+      output.Answer(sender);
+    }
+#endif
+    else
+    {
+      // The buffer is directly sent, which avoids a copy if the storage
+      // area has mapped the file in memory (new in Orthanc 1.9.6)
+      MemoryBufferHttpSender sender(buffer.release());
+      SetupSender(sender, info, mime);
   
-    HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
-    output.Answer(transcoder);
+      HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
+      output.Answer(transcoder);
+    }
   }
 #endif
 
@@ -277,11 +634,40 @@ namespace Orthanc
                                    const FileInfo& info,
                                    const std::string& mime)
   {
-    BufferHttpSender sender;
-    SetupSender(sender, info, mime);
+    std::unique_ptr<IMemoryBuffer> buffer;
+
+    {
+      MetricsTimer timer(*this, METRICS_READ);
+      buffer.reset(area_.Read(info.GetUuid(), info.GetContentType()));
+    }
+
+    if (info.GetCompressionType() == CompressionType_ZlibChunked)
+    {
+      ChunkedZlibHttpSender sender(buffer.release());
+      SetupSender(sender, info, mime);
+      output.AnswerStream(sender);
+    }
+#if ORTHANC_ENABLE_ZSTD == 1
+    else if (info.GetCompressionType() == CompressionType_Zstd)
+    {
+      // A zstd frame cannot be transcoded on the fly by "HttpStreamTranscoder"
+      BufferHttpSender sender;
+      ZstdCompressor zstd;
+      zstd.Uncompress(sender.GetBuffer(), buffer->GetData(), buffer->GetSize());
+      SetupSender(sender, info, mime);
+      output.AnswerStream(sender);
+    }
+#endif
+    else
+    {
+      // The buffer is directly sent, which avoids a copy if the storage
+      // area has mapped the file in memory (new in Orthanc 1.9.6)
+      MemoryBufferHttpSender sender(buffer.release());
+      SetupSender(sender, info, mime);
   
-    HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
-    output.AnswerStream(transcoder);
+      HttpStreamTranscoder transcoder(sender, info.GetCompressionType());
+      output.AnswerStream(transcoder);
+    }
   }
 #endif
 }
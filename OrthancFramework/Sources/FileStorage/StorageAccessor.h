@@ -42,7 +42,7 @@
 #include "FileInfo.h"
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
-#  include "../HttpServer/BufferHttpSender.h"
+#  include "../HttpServer/MemoryBufferHttpSender.h"
 #  include "../RestApi/RestApiOutput.h"
 #endif
 
@@ -64,12 +64,16 @@ namespace Orthanc
   {
   private:
     class MetricsTimer;
+    class RangeReader;
 
     IStorageArea&     area_;
     MetricsRegistry*  metrics_;
+    size_t            chunkSize_;
+    unsigned int      compressionThreads_;
+    uint8_t           compressionLevel_;
 
 #if ORTHANC_ENABLE_CIVETWEB == 1 || ORTHANC_ENABLE_MONGOOSE == 1
-    void SetupSender(BufferHttpSender& sender,
+    void SetupSender(HttpFileSender& sender,
                      const FileInfo& info,
                      const std::string& mime);
 #endif
@@ -80,6 +84,38 @@ namespace Orthanc
     StorageAccessor(IStorageArea& area,
                     MetricsRegistry& metrics);
 
+    // Highest compression level of the given codec: 9 for zlib, and
+    // "ZSTD_maxCLevel()" for zstd. The negative levels of zstd are
+    // not supported.
+    static uint8_t GetMaximumCompressionLevel(CompressionType compression);
+
+    // Compression level, starting at 1 (fastest), that is used to
+    // write compressed attachments. Levels above 9 are only accepted
+    // if zstd is available, and "Write()" rejects them for zlib.
+    void SetCompressionLevel(uint8_t level);
+
+    uint8_t GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
+    // Size of the chunks for "CompressionType_ZlibChunked"
+    void SetCompressionChunkSize(size_t size);
+
+    size_t GetCompressionChunkSize() const
+    {
+      return chunkSize_;
+    }
+
+    // Number of threads that compress the chunks in parallel for
+    // "CompressionType_ZlibChunked"
+    void SetCompressionThreadsCount(unsigned int count);
+
+    unsigned int GetCompressionThreadsCount() const
+    {
+      return compressionThreads_;
+    }
+
     FileInfo Write(const void* data,
                    size_t size,
                    FileContentType type,
@@ -97,6 +133,14 @@ namespace Orthanc
     void ReadRaw(std::string& content,
                  const FileInfo& info);
 
+    // Reads the bytes [start, end) of the uncompressed content. Only
+    // the required chunks are read if the attachment is stored with
+    // "CompressionType_ZlibChunked" (new in Orthanc 1.9.6).
+    void ReadRange(std::string& target,
+                   const FileInfo& info,
+                   uint64_t start,
+                   uint64_t end);
+
     void Remove(const std::string& fileUuid,
                 FileContentType type);
 
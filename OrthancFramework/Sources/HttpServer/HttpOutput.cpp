@@ -30,6 +30,7 @@
 #include "../OrthancException.h"
 #include "../Toolbox.h"
 
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <stdio.h>
@@ -201,13 +202,30 @@ namespace Orthanc
         s += *it;
       }
 
-      if (status_ != HttpStatus_200_Ok)
+      if (status_ != HttpStatus_200_Ok &&
+          status_ != HttpStatus_206_PartialContent)  // The byte ranges are sent by blocks (new in Orthanc 1.9.6)
       {
         hasContentLength_ = false;
       }
 
-      uint64_t contentLength = (hasContentLength_ ? contentLength_ : length);
-      s += "Content-Length: " + boost::lexical_cast<std::string>(contentLength) + "\r\n\r\n";
+      if (status_ == HttpStatus_304_NotModified)
+      {
+        // A "304 Not Modified" answer has no body, and a
+        // "Content-Length" would describe the representation that was
+        // not sent (RFC 7230, section 3.3.2)
+        if (length != 0)
+        {
+          LOG(WARNING) << "Discarding the body of a 304 HTTP answer";
+          length = 0;
+        }
+
+        s += "\r\n";
+      }
+      else
+      {
+        uint64_t contentLength = (hasContentLength_ ? contentLength_ : length);
+        s += "Content-Length: " + boost::lexical_cast<std::string>(contentLength) + "\r\n\r\n";
+      }
 
       stream_.Send(true, s.c_str(), s.size());
       state_ = State_WritingBody;
@@ -929,4 +947,100 @@ namespace Orthanc
 
     stateMachine_.CloseStream();
   }
+
+
+  static std::string FormatContentRange(const HttpToolbox::ByteRange& range,
+                                        uint64_t contentLength)
+  {
+    return ("bytes " + boost::lexical_cast<std::string>(range.first) + "-" +
+            boost::lexical_cast<std::string>(range.second) + "/" +
+            boost::lexical_cast<std::string>(contentLength));
+  }
+
+
+  void HttpOutput::SendByteRange(IByteRangesReader& reader,
+                                 const HttpToolbox::ByteRange& range)
+  {
+    // Read the range by blocks, in order to bound the memory usage
+    static const uint64_t BLOCK_SIZE = 4 * 1024 * 1024;
+
+    std::string block;
+
+    for (uint64_t start = range.first; start <= range.second; start += BLOCK_SIZE)
+    {
+      const uint64_t end = std::min(start + BLOCK_SIZE, range.second + 1);
+
+      reader.ReadRange(block, start, end);
+      if (block.size() != end - start)
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      stateMachine_.SendBody(block.c_str(), block.size());
+    }
+  }
+
+
+  void HttpOutput::AnswerByteRanges(const std::string& contentType,
+                                    uint64_t contentLength,
+                                    const std::vector<HttpToolbox::ByteRange>& ranges,
+                                    IByteRangesReader& reader)
+  {
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+      if (ranges[i].first > ranges[i].second ||
+          ranges[i].second >= contentLength)
+      {
+        throw OrthancException(ErrorCode_BadRange);
+      }
+    }
+
+    if (ranges.empty())
+    {
+      stateMachine_.AddHeader("Content-Range", "bytes */" + boost::lexical_cast<std::string>(contentLength));
+      SendStatus(HttpStatus_416_RequestedRangeNotSatisfiable);
+    }
+    else if (ranges.size() == 1)
+    {
+      stateMachine_.SetHttpStatus(HttpStatus_206_PartialContent);
+      stateMachine_.SetContentType(contentType.c_str());
+      stateMachine_.AddHeader("Content-Range", FormatContentRange(ranges[0], contentLength));
+      stateMachine_.SetContentLength(ranges[0].second - ranges[0].first + 1);
+      SendByteRange(reader, ranges[0]);
+      stateMachine_.CloseBody();
+    }
+    else
+    {
+      // Boundaries must be no longer than 70 characters (RFC 1521)
+      const std::string boundary = (Toolbox::GenerateUuid() + "-" + Toolbox::GenerateUuid()).substr(0, 70);
+      const std::string trailer = "--" + boundary + "--\r\n";
+
+      // The headers of the parts are generated first, in order to
+      // announce the size of the body through "Content-Length"
+      std::vector<std::string> headers(ranges.size());
+      uint64_t bodySize = trailer.size();
+
+      for (size_t i = 0; i < ranges.size(); i++)
+      {
+        headers[i] = ("--" + boundary + "\r\n" +
+                      "Content-Type: " + contentType + "\r\n" +
+                      "Content-Range: " + FormatContentRange(ranges[i], contentLength) + "\r\n\r\n");
+        bodySize += headers[i].size() + (ranges[i].second - ranges[i].first + 1) + 2;
+      }
+
+      stateMachine_.SetHttpStatus(HttpStatus_206_PartialContent);
+      stateMachine_.SetContentType(("multipart/byteranges; boundary=" + boundary).c_str());
+      stateMachine_.SetContentLength(bodySize);
+
+      for (size_t i = 0; i < ranges.size(); i++)
+      {
+        stateMachine_.SendBody(headers[i].c_str(), headers[i].size());
+        SendByteRange(reader, ranges[i]);
+        stateMachine_.SendBody("\r\n", 2);
+      }
+
+      stateMachine_.SendBody(trailer.c_str(), trailer.size());
+      stateMachine_.CloseBody();
+    }
+  }
 }
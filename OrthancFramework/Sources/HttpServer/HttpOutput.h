@@ -23,6 +23,7 @@
 #pragma once
 
 #include "../Enumerations.h"
+#include "HttpToolbox.h"
 #include "IHttpOutputStream.h"
 #include "IHttpStreamAnswer.h"
 
@@ -36,6 +37,21 @@ namespace Orthanc
 {
   class ORTHANC_PUBLIC HttpOutput : public boost::noncopyable
   {
+  public:
+    // Source of the bytes of a "Range" HTTP request (new in Orthanc 1.9.6)
+    class IByteRangesReader : public boost::noncopyable
+    {
+    public:
+      virtual ~IByteRangesReader()
+      {
+      }
+
+      // "start" is inclusive, "end" is exclusive
+      virtual void ReadRange(std::string& target,
+                             uint64_t start,
+                             uint64_t end) = 0;
+    };
+
   private:
     typedef std::list< std::pair<std::string, std::string> >  Header;
 
@@ -123,6 +139,9 @@ namespace Orthanc
 
     HttpCompression GetPreferredCompression(size_t bodySize) const;
 
+    void SendByteRange(IByteRangesReader& reader,
+                       const HttpToolbox::ByteRange& range);
+
   public:
     HttpOutput(IHttpOutputStream& stream,
                bool isKeepAlive);
@@ -202,5 +221,20 @@ namespace Orthanc
      * used to handle compression using "Content-Encoding".
      **/
     void AnswerWithoutBuffering(IHttpStreamAnswer& stream);
+
+    /**
+     * Answer a "Range" HTTP request (new in Orthanc 1.9.6), for the
+     * "ranges" returned by "HttpToolbox::ParseRange()". One single
+     * range is answered as such, several ranges as a
+     * "multipart/byteranges" body, and an empty set of ranges with
+     * HTTP status 416. The bytes are read from "reader" by blocks and
+     * streamed to the client, so that the parts are never loaded
+     * together into memory. The body is never compressed using
+     * "Content-Encoding".
+     **/
+    void AnswerByteRanges(const std::string& contentType,
+                          uint64_t contentLength,
+                          const std::vector<HttpToolbox::ByteRange>& ranges,
+                          IByteRangesReader& reader);
   };
 }
@@ -23,6 +23,8 @@
 #include "../PrecompiledHeaders.h"
 #include "HttpToolbox.h"
 
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
 #include <string.h>
 
 #if (ORTHANC_ENABLE_MONGOOSE == 1 || ORTHANC_ENABLE_CIVETWEB == 1)
@@ -183,6 +185,242 @@ namespace Orthanc
   }
 
 
+  static bool ParseRangeBound(uint64_t& target,
+                              const std::string& value)
+  {
+    if (value.empty() ||
+        value.size() > 19 /* avoid overflows */)
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < value.size(); i++)
+    {
+      if (value[i] < '0' ||
+          value[i] > '9')
+      {
+        return false;
+      }
+    }
+
+    try
+    {
+      target = boost::lexical_cast<uint64_t>(value);
+      return true;
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+  }
+
+
+  bool HttpToolbox::ParseRange(std::vector<ByteRange>& ranges,
+                               const std::string& header,
+                               uint64_t contentLength)
+  {
+    // Protection against denial of service with many small ranges
+    static const size_t MAX_RANGES = 32;
+
+    ranges.clear();
+
+    std::string value = Toolbox::StripSpaces(header);
+
+    size_t equal = value.find('=');
+    if (equal == std::string::npos)
+    {
+      return false;
+    }
+
+    std::string unit;
+    Toolbox::ToLowerCase(unit, Toolbox::StripSpaces(value.substr(0, equal)));
+    if (unit != "bytes")
+    {
+      return false;  // Unsupported unit, the header is ignored
+    }
+
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, value.substr(equal + 1), ',');
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      const std::string token = Toolbox::StripSpaces(tokens[i]);
+      if (token.empty())
+      {
+        continue;
+      }
+
+      count++;
+      if (count > MAX_RANGES)
+      {
+        ranges.clear();
+        return false;
+      }
+
+      size_t dash = token.find('-');
+      if (dash == std::string::npos)
+      {
+        ranges.clear();
+        return false;
+      }
+
+      const std::string first = Toolbox::StripSpaces(token.substr(0, dash));
+      const std::string last = Toolbox::StripSpaces(token.substr(dash + 1));
+
+      if (first.empty())
+      {
+        // Suffix range: "-n" designates the last "n" bytes
+        uint64_t suffix;
+        if (!ParseRangeBound(suffix, last))
+        {
+          ranges.clear();
+          return false;
+        }
+
+        if (suffix > 0 &&
+            contentLength > 0)
+        {
+          ranges.push_back(std::make_pair(suffix >= contentLength ? 0 : contentLength - suffix,
+                                          contentLength - 1));
+        }
+      }
+      else
+      {
+        uint64_t start, end;
+        if (!ParseRangeBound(start, first))
+        {
+          ranges.clear();
+          return false;
+        }
+
+        if (last.empty())
+        {
+          end = (contentLength == 0 ? 0 : contentLength - 1);
+        }
+        else if (!ParseRangeBound(end, last) ||
+                 end < start)
+        {
+          ranges.clear();
+          return false;
+        }
+
+        if (start < contentLength)
+        {
+          ranges.push_back(std::make_pair(start, std::min(end, contentLength - 1)));
+        }
+      }
+    }
+
+    if (count == 0)
+    {
+      return false;
+    }
+
+    /**
+     * Protection against denial of service with overlapping ranges,
+     * such as "bytes=0-,0-,0-,...": If the ranges request more bytes
+     * than the content itself, the header is ignored and the full
+     * content is sent (RFC 7233, section 6.1). Otherwise, the
+     * overlapping or adjacent ranges are coalesced, which guarantees
+     * that the body of the answer is not larger than the content.
+     **/
+    uint64_t total = 0;
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+      total += ranges[i].second - ranges[i].first + 1;  // Cannot overflow, as "ranges.size() <= MAX_RANGES"
+    }
+
+    if (total > contentLength)
+    {
+      ranges.clear();
+      return false;
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); i++)
+    {
+      if (ranges[i].first <= ranges[merged].second + 1)
+      {
+        ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+      }
+      else
+      {
+        merged++;
+        ranges[merged] = ranges[i];
+      }
+    }
+
+    if (!ranges.empty())
+    {
+      ranges.resize(merged + 1);
+    }
+
+    return true;
+  }
+
+
+  bool HttpToolbox::LookupRange(std::vector<ByteRange>& ranges,
+                                const Arguments& httpHeaders,
+                                uint64_t contentLength)
+  {
+    Arguments::const_iterator found = httpHeaders.find("range");
+
+    if (found == httpHeaders.end())
+    {
+      ranges.clear();
+      return false;
+    }
+    else
+    {
+      return ParseRange(ranges, found->second, contentLength);
+    }
+  }
+
+
+  bool HttpToolbox::IsNoneMatch(const Arguments& httpHeaders,
+                                const std::string& etag)
+  {
+    Arguments::const_iterator found = httpHeaders.find("if-none-match");
+
+    if (found == httpHeaders.end())
+    {
+      return false;
+    }
+
+    std::vector<std::string> tokens;
+    Toolbox::TokenizeString(tokens, found->second, ',');
+
+    for (size_t i = 0; i < tokens.size(); i++)
+    {
+      std::string token = Toolbox::StripSpaces(tokens[i]);
+
+      if (token == "*")
+      {
+        return true;
+      }
+
+      // "If-None-Match" uses the weak comparison (RFC 7232)
+      if (token.size() > 2 &&
+          token[0] == 'W' &&
+          token[1] == '/')
+      {
+        token = token.substr(2);
+      }
+
+      if (token == etag)
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
 
 #if (ORTHANC_ENABLE_MONGOOSE == 1 || ORTHANC_ENABLE_CIVETWEB == 1)
   bool HttpToolbox::SimpleGet(std::string& result,
@@ -40,6 +40,10 @@ namespace Orthanc
     typedef std::map<std::string, std::string>                  Arguments;
     typedef std::vector< std::pair<std::string, std::string> >  GetArguments;
 
+    // First and last bytes of a range, both inclusive, as in the
+    // "Range" HTTP header (new in Orthanc 1.9.6)
+    typedef std::pair<uint64_t, uint64_t>                       ByteRange;
+
     static void ParseGetArguments(GetArguments& result, 
                                   const char* query);
 
@@ -61,6 +65,30 @@ namespace Orthanc
     static void CompileGetArguments(Arguments& compiled,
                                     const GetArguments& source);
 
+    /**
+     * Parse the "Range" HTTP header (RFC 7233), for a content of the
+     * given length (new in Orthanc 1.9.6). Returns "false" if the
+     * header is absent or must be ignored (unsupported unit, syntax
+     * error, too many ranges, or ranges requesting more bytes than
+     * the content), in which case the full content must be sent.
+     * Returns "true" with an empty "ranges" if none of the ranges can
+     * be satisfied, in which case HTTP status 416 must be answered.
+     * The returned ranges are sorted, and the overlapping or adjacent
+     * ranges are merged.
+     **/
+    static bool ParseRange(std::vector<ByteRange>& ranges,
+                           const std::string& header,
+                           uint64_t contentLength);
+
+    static bool LookupRange(std::vector<ByteRange>& ranges,
+                            const Arguments& httpHeaders,
+                            uint64_t contentLength);
+
+    // Check whether the "If-None-Match" HTTP header matches the
+    // given entity tag, which must be quoted (new in Orthanc 1.9.6)
+    static bool IsNoneMatch(const Arguments& httpHeaders,
+                            const std::string& etag);
+
 #if (ORTHANC_ENABLE_MONGOOSE == 1 || ORTHANC_ENABLE_CIVETWEB == 1)
     ORTHANC_DEPRECATED(static bool SimpleGet(std::string& result,
                                              IHttpHandler& handler,
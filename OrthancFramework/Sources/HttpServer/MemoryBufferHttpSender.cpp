@@ -0,0 +1,93 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "../PrecompiledHeaders.h"
+#include "MemoryBufferHttpSender.h"
+
+#include "../OrthancException.h"
+
+#include <cassert>
+
+namespace Orthanc
+{
+  MemoryBufferHttpSender::MemoryBufferHttpSender(IMemoryBuffer* buffer) :
+    buffer_(buffer),
+    position_(0),
+    chunkSize_(0),
+    currentChunkSize_(0)
+  {
+    if (buffer == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+  }
+
+  void MemoryBufferHttpSender::SetChunkSize(size_t chunkSize)
+  {
+    chunkSize_ = chunkSize;
+  }
+
+  uint64_t MemoryBufferHttpSender::GetContentLength()
+  {
+    return buffer_->GetSize();
+  }
+
+
+  bool MemoryBufferHttpSender::ReadNextChunk()
+  {
+    const size_t size = buffer_->GetSize();
+
+    assert(position_ + currentChunkSize_ <= size);
+
+    position_ += currentChunkSize_;
+
+    if (position_ == size)
+    {
+      return false;
+    }
+    else
+    {
+      currentChunkSize_ = size - position_;
+
+      if (chunkSize_ != 0 &&
+          currentChunkSize_ > chunkSize_)
+      {
+        currentChunkSize_ = chunkSize_;
+      }
+
+      return true;
+    }
+  }
+
+
+  const char* MemoryBufferHttpSender::GetChunkContent()
+  {
+    return reinterpret_cast<const char*>(buffer_->GetData()) + position_;
+  }
+
+
+  size_t MemoryBufferHttpSender::GetChunkSize()
+  {
+    return currentChunkSize_;
+  }
+}
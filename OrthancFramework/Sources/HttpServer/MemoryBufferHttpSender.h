@@ -0,0 +1,67 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "HttpFileSender.h"
+#include "../IMemoryBuffer.h"
+
+#include <memory>
+
+namespace Orthanc
+{
+  /**
+   * Sends the content of a memory buffer without copying it, which
+   * notably avoids to load into the heap the attachments that are
+   * mapped in memory (new in Orthanc 1.9.6).
+   **/
+  class ORTHANC_PUBLIC MemoryBufferHttpSender : public HttpFileSender
+  {
+  private:
+    std::unique_ptr<IMemoryBuffer>  buffer_;
+    size_t                          position_;
+    size_t                          chunkSize_;
+    size_t                          currentChunkSize_;
+
+  public:
+    // Takes the ownership of the buffer
+    explicit MemoryBufferHttpSender(IMemoryBuffer* buffer);
+
+    // If "chunkSize" is set to "0" (the default), the entire buffer
+    // is consumed at once
+    void SetChunkSize(size_t chunkSize);
+
+
+    /**
+     * Implementation of the IHttpStreamAnswer interface.
+     **/
+
+    virtual uint64_t GetContentLength() ORTHANC_OVERRIDE;
+
+    virtual bool ReadNextChunk() ORTHANC_OVERRIDE;
+
+    virtual const char* GetChunkContent() ORTHANC_OVERRIDE;
+
+    virtual size_t GetChunkSize() ORTHANC_OVERRIDE;
+  };
+}
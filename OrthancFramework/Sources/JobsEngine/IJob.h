@@ -60,5 +60,23 @@ namespace Orthanc
     virtual bool GetOutput(std::string& output,
                            MimeType& mime,
                            const std::string& key) = 0;
+
+    /**
+     * Read one range of an output, without loading the full output
+     * (new in Orthanc 1.9.6). "start" is inclusive, "end" is
+     * exclusive, and "totalSize" receives the size of the full
+     * output. Returns "false" if the output is not available, or if
+     * the job cannot read ranges. This function can only be called if
+     * the job has reached its "success" state.
+     **/
+    virtual bool GetOutputRange(std::string& output,
+                                MimeType& mime,
+                                uint64_t& totalSize,
+                                const std::string& key,
+                                uint64_t start,
+                                uint64_t end)
+    {
+      return false;
+    }
   };
 }
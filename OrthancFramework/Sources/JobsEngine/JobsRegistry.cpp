@@ -58,6 +58,7 @@ namespace Orthanc
     bool                              pauseScheduled_;
     bool                              cancelScheduled_;
     JobStatus                         lastStatus_;
+    bool                              isDirty_;  // Changed since the last call to "SerializeChanges()"
 
     void Touch()
     {
@@ -76,6 +77,7 @@ namespace Orthanc
       state_ = state;
       pauseScheduled_ = false;
       cancelScheduled_ = false;
+      isDirty_ = true;
       Touch();
     }
 
@@ -91,7 +93,8 @@ namespace Orthanc
       runtime_(boost::posix_time::milliseconds(0)),
       retryTime_(creationTime_),
       pauseScheduled_(false),
-      cancelScheduled_(false)
+      cancelScheduled_(false),
+      isDirty_(true)
     {
       if (job == NULL)
       {
@@ -118,6 +121,7 @@ namespace Orthanc
     void SetPriority(int priority)
     {
       priority_ = priority;
+      isDirty_ = true;
     }
 
     int GetPriority() const
@@ -234,12 +238,24 @@ namespace Orthanc
     void SetLastStatus(const JobStatus& status)
     {
       lastStatus_ = status;
+      isDirty_ = true;
       Touch();
     }
 
     void SetLastErrorCode(ErrorCode code)
     {
       lastStatus_.SetErrorCode(code);
+      isDirty_ = true;
+    }
+
+    bool IsDirty() const
+    {
+      return isDirty_;
+    }
+
+    void ClearDirty()
+    {
+      isDirty_ = false;
     }
 
     bool Serialize(Json::Value& target) const
@@ -297,7 +313,8 @@ namespace Orthanc
                const std::string& id) :
       id_(id),
       pauseScheduled_(false),
-      cancelScheduled_(false)
+      cancelScheduled_(false),
+      isDirty_(false)
     {
       state_ = StringToJobState(SerializationToolbox::ReadString(serialized, STATE));
       priority_ = SerializationToolbox::ReadInteger(serialized, PRIORITY);
@@ -454,6 +471,12 @@ namespace Orthanc
       assert(jobsIndex_.find(id) != jobsIndex_.end());
 
       jobsIndex_.erase(id);
+
+      if (trackRemovedJobs_)
+      {
+        removedJobs_.insert(id);
+      }
+
       delete(completedJobs_.front());
       completedJobs_.pop_front();
     }
@@ -673,6 +696,39 @@ namespace Orthanc
   }
 
 
+  bool JobsRegistry::GetJobOutputRange(std::string& output,
+                                       MimeType& mime,
+                                       uint64_t& totalSize,
+                                       const std::string& job,
+                                       const std::string& key,
+                                       uint64_t start,
+                                       uint64_t end)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    CheckInvariants();
+
+    JobsIndex::const_iterator found = jobsIndex_.find(job);
+
+    if (found == jobsIndex_.end())
+    {
+      return false;
+    }
+    else
+    {
+      const JobHandler& handler = *found->second;
+
+      if (handler.GetState() == JobState_Success)
+      {
+        return handler.GetJob().GetOutputRange(output, mime, totalSize, key, start, end);
+      }
+      else
+      {
+        return false;
+      }
+    }
+  }
+
+
   void JobsRegistry::SubmitInternal(std::string& id,
                                     JobHandler* handler)
   {
@@ -736,6 +792,7 @@ namespace Orthanc
 
   JobsRegistry::JobsRegistry(size_t maxCompletedJobs) :
     maxCompletedJobs_(maxCompletedJobs),
+    trackRemovedJobs_(false),
     observer_(NULL)
   {
   }
@@ -1397,10 +1454,53 @@ namespace Orthanc
   }
 
 
+  void JobsRegistry::SerializeChanges(Json::Value& target,
+                                      bool full)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    CheckInvariants();
+
+    target = Json::objectValue;
+
+    for (std::set<std::string>::const_iterator it = removedJobs_.begin();
+         it != removedJobs_.end(); ++it)
+    {
+      target[*it] = Json::nullValue;
+    }
+
+    removedJobs_.clear();
+    trackRemovedJobs_ = true;
+
+    for (JobsIndex::const_iterator it = jobsIndex_.begin();
+         it != jobsIndex_.end(); ++it)
+    {
+      JobHandler& job = *it->second;
+
+      if (full ||
+          job.IsDirty())
+      {
+        Json::Value v;
+        if (job.Serialize(v))
+        {
+          target[it->first] = v;
+        }
+        else
+        {
+          // Make sure that a previous version of this job is discarded
+          target[it->first] = Json::nullValue;
+        }
+
+        job.ClearDirty();
+      }
+    }
+  }
+
+
   JobsRegistry::JobsRegistry(IJobUnserializer& unserializer,
                              const Json::Value& s,
                              size_t maxCompletedJobs) :
     maxCompletedJobs_(maxCompletedJobs),
+    trackRemovedJobs_(true),  // The removed jobs must be discarded from the saved registry
     observer_(NULL)
   {
     if (SerializationToolbox::ReadString(s, TYPE) != JOBS_REGISTRY ||
@@ -1429,6 +1529,7 @@ namespace Orthanc
       }
 
       const boost::posix_time::ptime lastChangeTime = job->GetLastStateChangeTime();
+      const JobState state = job->GetState();
 
       std::string id;
       SubmitInternal(id, job.release());
@@ -1442,6 +1543,12 @@ namespace Orthanc
         // last change to the time that was serialized
         assert(found->second != NULL);
         found->second->SetLastStateChangeTime(lastChangeTime);
+
+        if (found->second->GetState() == state)
+        {
+          // The job is unchanged wrt. its serialized version
+          found->second->ClearDirty();
+        }
       }
     }
   }
@@ -87,10 +87,12 @@ namespace Orthanc
     PendingJobs                pendingJobs_;
     CompletedJobs              completedJobs_;
     RetryJobs                  retryJobs_;
+    std::set<std::string>      removedJobs_;  // Forgotten since the last call to "SerializeChanges()"
 
     boost::condition_variable  pendingJobAvailable_;
     boost::condition_variable  someJobComplete_;
     size_t                     maxCompletedJobs_;
+    bool                       trackRemovedJobs_;
 
     IObserver*                 observer_;
 
@@ -151,8 +153,29 @@ namespace Orthanc
                       const std::string& job,
                       const std::string& key);
 
+    // New in Orthanc 1.9.6
+    bool GetJobOutputRange(std::string& output,
+                           MimeType& mime,
+                           uint64_t& totalSize,
+                           const std::string& job,
+                           const std::string& key,
+                           uint64_t start,
+                           uint64_t end);
+
     void Serialize(Json::Value& target);
 
+    /**
+     * Incremental serialization (new in Orthanc 1.9.6). The "target"
+     * object maps the ID of each job that has changed since the
+     * previous call, to its serialized version. Jobs that have been
+     * removed from the registry, or that cannot be serialized, are
+     * mapped to "null". If "full" is "true", all the jobs are
+     * reported. The jobs removed before the first call are only
+     * reported if the registry was unserialized.
+     **/
+    void SerializeChanges(Json::Value& target,
+                          bool full);
+
     void Submit(std::string& id,
                 IJob* job,        // Takes ownership
                 int priority);
@@ -27,15 +27,81 @@
 #include "../OrthancException.h"
 #include "../SerializationToolbox.h"
 
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 #include <cassert>
 #include <memory>
 
 namespace Orthanc
 {
+  namespace
+  {
+    // Executes one command, keeping track of its exception (if any)
+    // so that it can be run by a separate thread
+    class CommandRunner : public boost::noncopyable
+    {
+    private:
+      SetOfCommandsJob::ICommand&        command_;
+      const std::string&                 jobId_;
+      bool                               success_;
+      std::unique_ptr<OrthancException>  error_;
+
+    public:
+      CommandRunner(SetOfCommandsJob::ICommand& command,
+                    const std::string& jobId) :
+        command_(command),
+        jobId_(jobId),
+        success_(false)
+      {
+      }
+
+      void Run()
+      {
+        try
+        {
+          success_ = command_.Execute(jobId_);
+        }
+        catch (OrthancException& e)
+        {
+          error_.reset(new OrthancException(e));
+        }
+        catch (std::bad_alloc&)
+        {
+          error_.reset(new OrthancException(ErrorCode_NotEnoughMemory));
+        }
+        catch (std::exception& e)
+        {
+          error_.reset(new OrthancException(ErrorCode_InternalError, e.what()));
+        }
+        catch (...)
+        {
+          error_.reset(new OrthancException(ErrorCode_InternalError));
+        }
+      }
+
+      static void Worker(CommandRunner* runner)
+      {
+        runner->Run();
+      }
+
+      bool IsSuccess() const
+      {
+        return success_;
+      }
+
+      const OrthancException* GetError() const
+      {
+        return error_.get();
+      }
+    };
+  }
+
+
   SetOfCommandsJob::SetOfCommandsJob() :
     started_(false),
     permissive_(false),
-    position_(0)
+    position_(0),
+    parallelism_(1)
   {
   }
 
@@ -117,6 +183,29 @@ namespace Orthanc
   }
 
 
+  unsigned int SetOfCommandsJob::GetParallelism() const
+  {
+    return parallelism_;
+  }
+
+
+  void SetOfCommandsJob::SetParallelism(unsigned int threads)
+  {
+    if (started_)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (threads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      parallelism_ = threads;
+    }
+  }
+
+
   void SetOfCommandsJob::Reset()
   {
     if (started_)
@@ -189,6 +278,12 @@ namespace Orthanc
       throw OrthancException(ErrorCode_BadSequenceOfCalls);
     }
 
+    if (parallelism_ > 1 &&
+        commands_[position_]->IsParallelizable())
+    {
+      return StepParallel(jobId);
+    }
+
     try
     {
       // Not at the trailing step: Handle the current command
@@ -228,11 +323,88 @@ namespace Orthanc
 
 
 
+  JobStepResult SetOfCommandsJob::StepParallel(const std::string& jobId)
+  {
+    assert(position_ < commands_.size() &&
+           commands_[position_]->IsParallelizable());
+
+    // Group the next parallelizable commands
+    size_t end = position_ + 1;
+    while (end < commands_.size() &&
+           end - position_ < parallelism_ &&
+           commands_[end]->IsParallelizable())
+    {
+      end++;
+    }
+
+    std::vector< boost::shared_ptr<CommandRunner> > runners(end - position_);
+    for (size_t i = 0; i < runners.size(); i++)
+    {
+      runners[i].reset(new CommandRunner(*commands_[position_ + i], jobId));
+    }
+
+    {
+      // The first command is executed by the calling thread
+      std::vector< boost::shared_ptr<boost::thread> > threads;
+      threads.reserve(runners.size() - 1);
+
+      for (size_t i = 1; i < runners.size(); i++)
+      {
+        threads.push_back(boost::shared_ptr<boost::thread>(
+                            new boost::thread(CommandRunner::Worker, runners[i].get())));
+      }
+
+      runners[0]->Run();
+
+      for (size_t i = 0; i < threads.size(); i++)
+      {
+        threads[i]->join();
+      }
+    }
+
+    // Report the errors in the order of the commands, as in the sequential mode
+    for (size_t i = 0; i < runners.size(); i++)
+    {
+      const OrthancException* error = runners[i]->GetError();
+
+      if (error != NULL)
+      {
+        if (permissive_)
+        {
+          LOG(WARNING) << "Ignoring an error in a permissive job: " << error->What();
+        }
+        else
+        {
+          return JobStepResult::Failure(*error);
+        }
+      }
+      else if (!runners[i]->IsSuccess() &&
+               !permissive_)
+      {
+        return JobStepResult::Failure(ErrorCode_InternalError, NULL);
+      }
+    }
+
+    position_ = end;
+
+    if (position_ == commands_.size())
+    {
+      // We're done
+      return JobStepResult::Success();
+    }
+    else
+    {
+      return JobStepResult::Continue();
+    }
+  }
+
+
   static const char* KEY_DESCRIPTION = "Description";
   static const char* KEY_PERMISSIVE = "Permissive";
   static const char* KEY_POSITION = "Position";
   static const char* KEY_TYPE = "Type";
   static const char* KEY_COMMANDS = "Commands";
+  static const char* KEY_PARALLELISM = "Parallelism";
 
   
   void SetOfCommandsJob::GetPublicContent(Json::Value& value)
@@ -252,6 +424,7 @@ namespace Orthanc
     target[KEY_PERMISSIVE] = permissive_;
     target[KEY_POSITION] = static_cast<unsigned int>(position_);
     target[KEY_DESCRIPTION] = description_;
+    target[KEY_PARALLELISM] = parallelism_;
 
     target[KEY_COMMANDS] = Json::arrayValue;
     Json::Value& tmp = target[KEY_COMMANDS];
@@ -278,13 +451,19 @@ namespace Orthanc
 
   SetOfCommandsJob::SetOfCommandsJob(ICommandUnserializer* unserializer,
                                      const Json::Value& source) :
-    started_(false)
+    started_(false),
+    parallelism_(1)
   {
     std::unique_ptr<ICommandUnserializer> raii(unserializer);
 
     permissive_ = SerializationToolbox::ReadBoolean(source, KEY_PERMISSIVE);
     position_ = SerializationToolbox::ReadUnsignedInteger(source, KEY_POSITION);
     description_ = SerializationToolbox::ReadString(source, KEY_DESCRIPTION);
+
+    if (source.isMember(KEY_PARALLELISM))
+    {
+      SetParallelism(SerializationToolbox::ReadUnsignedInteger(source, KEY_PARALLELISM));
+    }
     
     if (!source.isMember(KEY_COMMANDS) ||
         source[KEY_COMMANDS].type() != Json::arrayValue)
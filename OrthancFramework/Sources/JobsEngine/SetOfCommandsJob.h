@@ -43,6 +43,14 @@ namespace Orthanc
       virtual bool Execute(const std::string& jobId) = 0;
 
       virtual void Serialize(Json::Value& target) const = 0;
+
+      // Whether this command can be executed concurrently with the
+      // neighboring commands that are also parallelizable, from
+      // another thread (new in Orthanc 1.9.6)
+      virtual bool IsParallelizable() const
+      {
+        return false;
+      }
     };
 
     class ICommandUnserializer : public boost::noncopyable
@@ -61,6 +69,9 @@ namespace Orthanc
     bool                    permissive_;
     size_t                  position_;
     std::string             description_;
+    unsigned int            parallelism_;
+
+    JobStepResult StepParallel(const std::string& jobId);
 
   public:
     SetOfCommandsJob();
@@ -86,6 +97,12 @@ namespace Orthanc
 
     void SetPermissive(bool permissive);
 
+    // Maximum number of parallelizable commands that are executed
+    // simultaneously by one step of the job (new in Orthanc 1.9.6)
+    unsigned int GetParallelism() const;
+
+    void SetParallelism(unsigned int threads);
+
     virtual void Reset() ORTHANC_OVERRIDE;
     
     virtual void Start() ORTHANC_OVERRIDE;
@@ -53,6 +53,8 @@ namespace Orthanc
     {
       if (!that_.HandleInstance(instance_))
       {
+        // Several instances are handled concurrently in parallel mode
+        boost::mutex::scoped_lock lock(that_.failedInstancesMutex_);
         that_.failedInstances_.insert(instance_);
         return false;
       }
@@ -62,6 +64,11 @@ namespace Orthanc
       }
     }
 
+    virtual bool IsParallelizable() const ORTHANC_OVERRIDE
+    {
+      return that_.IsHandleInstanceThreadSafe();
+    }
+
     virtual void Serialize(Json::Value& target) const ORTHANC_OVERRIDE
     {
       target = instance_;
@@ -25,6 +25,7 @@
 #include "IJob.h"
 #include "SetOfCommandsJob.h"
 
+#include <boost/thread/mutex.hpp>
 #include <set>
 
 namespace Orthanc
@@ -37,12 +38,22 @@ namespace Orthanc
     class InstanceUnserializer;
     
     bool                   hasTrailingStep_;
+    boost::mutex           failedInstancesMutex_;
     std::set<std::string>  failedInstances_;
     std::set<std::string>  parentResources_;
 
   protected:
     virtual bool HandleInstance(const std::string& instance) = 0;
 
+    // Must return "true" iff "HandleInstance()" can be invoked
+    // concurrently by several threads. This enables the execution of
+    // the instances in parallel if "SetParallelism()" is called (new
+    // in Orthanc 1.9.6).
+    virtual bool IsHandleInstanceThreadSafe() const
+    {
+      return false;
+    }
+
     virtual bool HandleTrailingStep() = 0;
 
     // Hiding this method, use AddInstance() instead
@@ -504,6 +504,7 @@ namespace
 #include "SystemToolbox.h"
 
 #include <fstream>
+#include <vector>
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
@@ -690,6 +691,299 @@ namespace Orthanc
     }
     
 
+    // "loggingStreamsMutex_" must be locked, and the context must exist
+    static std::ostream* GetStream(LogLevel level)
+    {
+      assert(loggingStreamsContext_.get() != NULL);
+
+      switch (level)
+      {
+        case LogLevel_ERROR:
+          return loggingStreamsContext_->error_;
+
+        case LogLevel_WARNING:
+          return loggingStreamsContext_->warning_;
+
+        case LogLevel_INFO:
+        case LogLevel_TRACE:
+          return loggingStreamsContext_->info_;
+
+        default:  // Should not occur
+          return loggingStreamsContext_->error_;
+      }
+    }
+
+
+    namespace
+    {
+      /**
+       * Background writer of the asynchronous mode. The log lines are
+       * appended to a bounded queue, that is swapped out as a whole
+       * and written by batches, with one single flush per batch.
+       **/
+      class AsyncWriter : public boost::noncopyable
+      {
+      private:
+        struct Message
+        {
+          LogLevel     level_;
+          std::string  line_;
+        };
+
+        boost::mutex               mutex_;
+        boost::condition_variable  pendingCondition_;
+        boost::condition_variable  spaceCondition_;
+        boost::condition_variable  writtenCondition_;
+        std::vector<Message>       queue_;
+        size_t                     maxPending_;
+        AsyncOverflowPolicy        policy_;
+        bool                       done_;
+        uint64_t                   enqueued_;  // Number of messages that have been enqueued
+        uint64_t                   written_;   // Number of messages that have been written
+        unsigned int               dropped_;
+        boost::thread              thread_;
+
+        static void WriteBatch(const std::vector<Message>& batch,
+                               unsigned int dropped)
+        {
+          boost::mutex::scoped_lock lock(loggingStreamsMutex_);
+
+          if (loggingStreamsContext_.get() == NULL)
+          {
+            fprintf(stderr, "ERROR: Trying to log a message after the finalization of the logging engine\n");
+            return;
+          }
+
+          try
+          {
+            if (dropped > 0)
+            {
+              std::string prefix;
+              GetLinePrefix(prefix, LogLevel_WARNING, __FILE__, __LINE__, LogCategory_GENERIC);
+              (*loggingStreamsContext_->warning_) << prefix << dropped << " log messages have been dropped, "
+                                                  << "as the queue of the asynchronous logging was full\n";
+            }
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+              (*GetStream(batch[i].level_)) << batch[i].line_ << "\n";
+            }
+
+            loggingStreamsContext_->error_->flush();
+
+            if (loggingStreamsContext_->warning_ != loggingStreamsContext_->error_)
+            {
+              loggingStreamsContext_->warning_->flush();
+            }
+
+            if (loggingStreamsContext_->info_ != loggingStreamsContext_->error_ &&
+                loggingStreamsContext_->info_ != loggingStreamsContext_->warning_)
+            {
+              loggingStreamsContext_->info_->flush();
+            }
+          }
+          catch (...)
+          {
+            fprintf(stderr, "ERROR: Cannot write the log messages\n");
+          }
+        }
+
+        static void Worker(AsyncWriter* that)
+        {
+          std::vector<Message> batch;
+
+          for (;;)
+          {
+            unsigned int dropped;
+
+            {
+              boost::mutex::scoped_lock lock(that->mutex_);
+
+              while (that->queue_.empty() &&
+                     that->dropped_ == 0 &&
+                     !that->done_)
+              {
+                that->pendingCondition_.wait(lock);
+              }
+
+              if (that->queue_.empty() &&
+                  that->dropped_ == 0)
+              {
+                return;  // Stopping, and the queue has been drained
+              }
+
+              batch.clear();
+              batch.swap(that->queue_);
+              dropped = that->dropped_;
+              that->dropped_ = 0;
+            }
+
+            that->spaceCondition_.notify_all();
+
+            WriteBatch(batch, dropped);
+
+            {
+              boost::mutex::scoped_lock lock(that->mutex_);
+              that->written_ += batch.size();
+            }
+
+            that->writtenCondition_.notify_all();
+          }
+        }
+
+        void WaitWritten(uint64_t count)
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          while (written_ < count)
+          {
+            writtenCondition_.wait(lock);
+          }
+        }
+
+      public:
+        AsyncWriter(size_t maxPending,
+                    AsyncOverflowPolicy policy) :
+          maxPending_(maxPending),
+          policy_(policy),
+          done_(false),
+          enqueued_(0),
+          written_(0),
+          dropped_(0)
+        {
+          assert(maxPending_ > 0);
+          thread_ = boost::thread(Worker, this);
+        }
+
+        ~AsyncWriter()
+        {
+          Stop();
+        }
+
+        // Writes all the pending messages before returning
+        void Stop()
+        {
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            done_ = true;
+          }
+
+          pendingCondition_.notify_all();
+
+          if (thread_.joinable())
+          {
+            thread_.join();
+          }
+        }
+
+        // The content of "line" is swapped into the queue
+        void Enqueue(LogLevel level,
+                     std::string& line)
+        {
+          uint64_t count;
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+
+            while (queue_.size() >= maxPending_ &&
+                   !done_)
+            {
+              if (policy_ == AsyncOverflowPolicy_DropInfo &&
+                  (level == LogLevel_INFO ||
+                   level == LogLevel_TRACE))
+              {
+                dropped_++;
+                return;
+              }
+
+              spaceCondition_.wait(lock);
+            }
+
+            queue_.push_back(Message());
+            queue_.back().level_ = level;
+            queue_.back().line_.swap(line);
+
+            enqueued_++;
+            count = enqueued_;
+          }
+
+          pendingCondition_.notify_one();
+
+          if (level == LogLevel_ERROR)
+          {
+            // Make sure that the errors are written, notably before a crash
+            WaitWritten(count);
+          }
+        }
+
+        void Flush()
+        {
+          uint64_t count;
+
+          {
+            boost::mutex::scoped_lock lock(mutex_);
+            count = enqueued_;
+          }
+
+          WaitWritten(count);
+        }
+      };
+    }
+
+
+    // The writer is protected by a shared lock while messages are
+    // enqueued, and by an exclusive lock while enabling/disabling it
+    static std::unique_ptr<AsyncWriter>  asyncWriter_;
+    static boost::shared_mutex           asyncWriterMutex_;
+
+
+    void EnableAsynchronousMode(size_t maxPendingMessages,
+                                AsyncOverflowPolicy policy)
+    {
+      if (maxPendingMessages == 0)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+
+      if (pluginContext_ == NULL)
+      {
+        boost::unique_lock<boost::shared_mutex> lock(asyncWriterMutex_);
+
+        if (asyncWriter_.get() != NULL)
+        {
+          throw OrthancException(ErrorCode_BadSequenceOfCalls);
+        }
+
+        asyncWriter_.reset(new AsyncWriter(maxPendingMessages, policy));
+      }
+    }
+
+
+    void DisableAsynchronousMode()
+    {
+      // The exclusive lock makes the concurrent loggers wait until
+      // the pending messages are written, which preserves their order
+      boost::unique_lock<boost::shared_mutex> lock(asyncWriterMutex_);
+
+      if (asyncWriter_.get() != NULL)
+      {
+        asyncWriter_->Stop();
+        asyncWriter_.reset(NULL);
+      }
+    }
+
+
+    static void FlushAsynchronousMode()
+    {
+      boost::shared_lock<boost::shared_mutex> lock(asyncWriterMutex_);
+
+      if (asyncWriter_.get() != NULL)
+      {
+        asyncWriter_->Flush();
+      }
+    }
+    
+
     void InitializePluginContext(void* pluginContext)
     {
       assert(sizeof(_OrthancPluginService) == sizeof(int32_t));
@@ -712,12 +1006,17 @@ namespace Orthanc
 
     void Finalize()
     {
+      DisableAsynchronousMode();
+
       boost::mutex::scoped_lock lock(loggingStreamsMutex_);
       loggingStreamsContext_.reset(NULL);
     }
 
     void Reset()
     {
+      // Write the pending messages to the previous targets
+      FlushAsynchronousMode();
+
       {
         boost::mutex::scoped_lock lock(loggingStreamsMutex_);
         loggingStreamsContext_.reset(new LoggingStreamsContext);
@@ -807,6 +1106,20 @@ namespace Orthanc
         std::string prefix;
         GetLinePrefix(prefix, level_, file, line, category);
 
+        {
+          boost::shared_lock<boost::shared_mutex> asyncLock(asyncWriterMutex_);
+
+          if (asyncWriter_.get() != NULL)
+          {
+            // Asynchronous mode: The line is built without any lock,
+            // and is enqueued by the destructor
+            asyncStream_.reset(new std::stringstream);
+            stream_ = asyncStream_.get();
+            (*stream_) << prefix;
+            return;
+          }
+        }
+
         {
           // We lock the global mutex. The mutex is locked until the
           // destructor is called: No change in the output can be done.
@@ -819,25 +1132,7 @@ namespace Orthanc
             return;
           }
 
-          switch (level_)
-          {
-            case LogLevel_ERROR:
-              stream_ = loggingStreamsContext_->error_;
-              break;
-              
-            case LogLevel_WARNING:
-              stream_ = loggingStreamsContext_->warning_;
-              break;
-              
-            case LogLevel_INFO:
-            case LogLevel_TRACE:
-              stream_ = loggingStreamsContext_->info_;
-              break;
-              
-            default:  // Should not occur
-              stream_ = loggingStreamsContext_->error_;
-              break;              
-          }
+          stream_ = GetStream(level_);
 
           if (stream_ == &nullStream_)
           {
@@ -916,6 +1211,36 @@ namespace Orthanc
           }
         }
       }
+      else if (asyncStream_.get() != NULL)
+      {
+        try
+        {
+          std::string line = asyncStream_->str();
+
+          boost::shared_lock<boost::shared_mutex> asyncLock(asyncWriterMutex_);
+
+          if (asyncWriter_.get() != NULL)
+          {
+            asyncWriter_->Enqueue(level_, line);
+          }
+          else
+          {
+            // The asynchronous mode was disabled in the meantime
+            boost::mutex::scoped_lock lock(loggingStreamsMutex_);
+
+            if (loggingStreamsContext_.get() != NULL)
+            {
+              std::ostream* stream = GetStream(level_);
+              *stream << line << "\n";
+              stream->flush();
+            }
+          }
+        }
+        catch (...)
+        {
+          fprintf(stderr, "ERROR: Cannot enqueue a log message\n");
+        }
+      }
       else if (stream_ != &nullStream_)
       {
         *stream_ << "\n";
@@ -926,6 +1251,8 @@ namespace Orthanc
 
     void Flush()
     {
+      FlushAsynchronousMode();
+
       if (pluginContext_ != NULL)
       {
         boost::mutex::scoped_lock lock(loggingStreamsMutex_);
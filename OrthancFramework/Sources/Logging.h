@@ -240,6 +240,7 @@ namespace Orthanc
       boost::mutex::scoped_lock           lock_;
       LogLevel                            level_;
       std::unique_ptr<std::stringstream>  pluginStream_;
+      std::unique_ptr<std::stringstream>  asyncStream_;  // New in Orthanc 1.9.6
       std::ostream*                       stream_;
 
       void Setup(LogCategory category,
@@ -283,6 +284,30 @@ namespace Orthanc
     ORTHANC_PUBLIC void SetErrorWarnInfoLoggingStreams(std::ostream& errorStream,
                                                        std::ostream& warningStream, 
                                                        std::ostream& infoStream);
+
+    /**
+     * Behavior of the asynchronous mode if its queue is full (new in
+     * Orthanc 1.9.6). The errors and the warnings are never dropped.
+     **/
+    enum AsyncOverflowPolicy
+    {
+      AsyncOverflowPolicy_Block,     // Wait for the background writer
+      AsyncOverflowPolicy_DropInfo   // Discard the info and trace messages
+    };
+
+    /**
+     * In the asynchronous mode (new in Orthanc 1.9.6), the threads
+     * only append their log lines to a queue of at most
+     * "maxPendingMessages" lines, that is written by batches from a
+     * background thread. The logging of an error waits until the error
+     * has been written, and "Flush()" waits for the queue to be
+     * empty. The mode is disabled by "Finalize()". This function is
+     * ignored if InitializePluginContext() was called.
+     **/
+    ORTHANC_PUBLIC void EnableAsynchronousMode(size_t maxPendingMessages,
+                                               AsyncOverflowPolicy policy);
+
+    ORTHANC_PUBLIC void DisableAsynchronousMode();
   }
 }
 
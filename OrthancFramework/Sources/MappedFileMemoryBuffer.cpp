@@ -0,0 +1,206 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrecompiledHeaders.h"
+#include "MappedFileMemoryBuffer.h"
+
+#include "OrthancException.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+
+namespace Orthanc
+{
+  void MappedFileMemoryBuffer::Setup(const std::string& path,
+                                     bool wholeFile,
+                                     uint64_t start,
+                                     uint64_t end)
+  {
+    mapping_ = NULL;
+    mappingSize_ = 0;
+    offset_ = 0;
+    size_ = 0;
+
+#if defined(_WIN32)
+    /**
+     * Windows forbids the removal of a file while it is mapped, which
+     * would make the removal of the attachments fail silently.
+     **/
+    throw OrthancException(ErrorCode_NotImplemented,
+                           "Memory-mapped files are not supported on this platform");
+#else
+    if (start > end)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw OrthancException(ErrorCode_InexistentFile,
+                             "File not found: " + path);
+    }
+
+    try
+    {
+      struct stat info;
+      if (fstat(fd, &info) != 0 ||
+          !S_ISREG(info.st_mode))
+      {
+        throw OrthancException(ErrorCode_RegularFileExpected,
+                               "The path does not point to a regular file: " + path);
+      }
+
+      const uint64_t fileSize = static_cast<uint64_t>(info.st_size);
+
+      if (wholeFile)
+      {
+        start = 0;
+        end = fileSize;
+      }
+      else if (end > fileSize)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange,
+                               "Reading beyond the end of a file");
+      }
+
+      // The offset given to mmap() must be a multiple of the page size
+      const uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+      const uint64_t alignedStart = start - (start % pageSize);
+
+      if (static_cast<uint64_t>(static_cast<size_t>(end - alignedStart)) != end - alignedStart)
+      {
+        throw OrthancException(ErrorCode_InternalError,
+                               "Mapping a file that is too large for a 32bit architecture");
+      }
+
+      if (start < end)
+      {
+        mappingSize_ = static_cast<size_t>(end - alignedStart);
+        mapping_ = mmap(NULL, mappingSize_, PROT_READ, MAP_PRIVATE, fd, static_cast<off_t>(alignedStart));
+
+        if (mapping_ == MAP_FAILED)
+        {
+          mapping_ = NULL;
+          mappingSize_ = 0;
+          throw OrthancException(ErrorCode_NotEnoughMemory,
+                                 "Cannot map file in memory: " + path);
+        }
+
+        // Hint for the read-ahead, as attachments are mostly read sequentially
+        madvise(mapping_, mappingSize_, MADV_SEQUENTIAL);
+
+        offset_ = static_cast<size_t>(start - alignedStart);
+        size_ = static_cast<size_t>(end - start);
+      }
+    }
+    catch (OrthancException&)
+    {
+      close(fd);
+      throw;
+    }
+
+    // The mapping remains valid after the file descriptor is closed
+    close(fd);
+#endif
+  }
+
+
+  void MappedFileMemoryBuffer::Clear()
+  {
+#if !defined(_WIN32)
+    if (mapping_ != NULL)
+    {
+      munmap(mapping_, mappingSize_);
+    }
+#endif
+
+    mapping_ = NULL;
+    mappingSize_ = 0;
+    offset_ = 0;
+    size_ = 0;
+  }
+
+
+  MappedFileMemoryBuffer::MappedFileMemoryBuffer(const std::string& path)
+  {
+    Setup(path, true, 0, 0);
+  }
+
+
+  MappedFileMemoryBuffer::MappedFileMemoryBuffer(const std::string& path,
+                                                 uint64_t start,
+                                                 uint64_t end)
+  {
+    Setup(path, false, start, end);
+  }
+
+
+  MappedFileMemoryBuffer::~MappedFileMemoryBuffer()
+  {
+    Clear();
+  }
+
+
+  void MappedFileMemoryBuffer::MoveToString(std::string& target)
+  {
+    target.resize(size_);
+
+    if (size_ != 0)
+    {
+      memcpy(&target[0], GetData(), size_);
+    }
+
+    Clear();
+  }
+
+
+  const void* MappedFileMemoryBuffer::GetData() const
+  {
+    if (mapping_ == NULL)
+    {
+      return NULL;
+    }
+    else
+    {
+      return reinterpret_cast<const uint8_t*>(mapping_) + offset_;
+    }
+  }
+
+
+  bool MappedFileMemoryBuffer::IsSupported()
+  {
+#if defined(_WIN32)
+    return false;
+#else
+    return true;
+#endif
+  }
+}
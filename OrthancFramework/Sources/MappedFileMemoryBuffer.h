@@ -0,0 +1,77 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IMemoryBuffer.h"
+#include "Compatibility.h"
+#include "OrthancFramework.h"
+
+#include <stdint.h>
+
+
+namespace Orthanc
+{
+  /**
+   * Memory buffer that maps a range of a file in the address space
+   * of the process (new in Orthanc 1.9.6). The content is not copied
+   * into the heap, but is paged in by the operating system on
+   * demand. The file must not be modified as long as the buffer
+   * exists, which is the case of the files of the storage area.
+   **/
+  class ORTHANC_PUBLIC MappedFileMemoryBuffer : public IMemoryBuffer
+  {
+  private:
+    void*   mapping_;
+    size_t  mappingSize_;
+    size_t  offset_;  // Offset of the range in the mapping (alignment on pages)
+    size_t  size_;
+
+    void Setup(const std::string& path,
+               bool wholeFile,
+               uint64_t start,
+               uint64_t end);
+
+    void Clear();
+
+  public:
+    explicit MappedFileMemoryBuffer(const std::string& path);
+
+    MappedFileMemoryBuffer(const std::string& path,
+                           uint64_t start /* inclusive */,
+                           uint64_t end /* exclusive */);
+
+    virtual ~MappedFileMemoryBuffer();
+
+    virtual void MoveToString(std::string& target) ORTHANC_OVERRIDE;
+
+    virtual const void* GetData() const ORTHANC_OVERRIDE;
+
+    virtual size_t GetSize() const ORTHANC_OVERRIDE
+    {
+      return size_;
+    }
+
+    static bool IsSupported();
+  };
+}
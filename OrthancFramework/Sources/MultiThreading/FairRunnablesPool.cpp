@@ -0,0 +1,319 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "../PrecompiledHeaders.h"
+#include "FairRunnablesPool.h"
+
+#include "../Compatibility.h"
+#include "../Logging.h"
+#include "../OrthancException.h"
+
+#include <boost/thread.hpp>
+#include <cassert>
+#include <deque>
+#include <map>
+#include <vector>
+
+
+namespace Orthanc
+{
+  struct FairRunnablesPool::PImpl
+  {
+    typedef std::deque<IRunnableBySteps*>          Runnables;
+    typedef std::map<std::string, Runnables>       Queues;
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    queueNotEmpty_;
+    bool                         continue_;
+    size_t                       maxQueued_;
+    Queues                       queues_;    // Queued runnables, indexed by key
+    std::deque<std::string>      keys_;      // Round-robin over the keys having queued runnables
+    size_t                       queued_;
+    size_t                       active_;
+    std::vector<boost::thread*>  threads_;
+    IListener*                   listener_;
+
+    PImpl() :
+      continue_(true),
+      maxQueued_(0),
+      queued_(0),
+      active_(0),
+      listener_(NULL)
+    {
+    }
+
+    ~PImpl()
+    {
+      for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+      {
+        for (Runnables::iterator runnable = it->second.begin();
+             runnable != it->second.end(); ++runnable)
+        {
+          delete *runnable;
+        }
+      }
+    }
+
+    IRunnableBySteps* Dequeue()
+    {
+      // WARNING: "mutex_" must be locked
+      assert(!keys_.empty());
+
+      std::string key = keys_.front();
+      keys_.pop_front();
+
+      Queues::iterator found = queues_.find(key);
+      assert(found != queues_.end() &&
+             !found->second.empty());
+
+      IRunnableBySteps* runnable = found->second.front();
+      found->second.pop_front();
+
+      if (found->second.empty())
+      {
+        queues_.erase(found);
+      }
+      else
+      {
+        // This key has other runnables, put it at the end of the round-robin
+        keys_.push_back(key);
+      }
+
+      assert(queued_ > 0);
+      queued_--;
+
+      return runnable;
+    }
+
+    static void NotifyListener(IListener* listener,
+                               size_t activeCount,
+                               size_t queuedCount)
+    {
+      // The listener is called without holding "mutex_", so that it
+      // can call back "GetActiveCount()" and "GetQueuedCount()"
+      if (listener != NULL)
+      {
+        try
+        {
+          listener->SignalCountsChanged(activeCount, queuedCount);
+        }
+        catch (OrthancException& e)
+        {
+          LOG(ERROR) << "Exception in the listener of a pool of runnables: " << e.What();
+        }
+      }
+    }
+
+    static void Worker(PImpl* that)
+    {
+      for (;;)
+      {
+        std::unique_ptr<IRunnableBySteps> runnable;
+        IListener* listener;
+        size_t activeCount, queuedCount;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (that->continue_ &&
+                 that->keys_.empty())
+          {
+            that->queueNotEmpty_.wait(lock);
+          }
+
+          if (!that->continue_)
+          {
+            return;
+          }
+
+          runnable.reset(that->Dequeue());
+          that->active_++;
+
+          listener = that->listener_;
+          activeCount = that->active_;
+          queuedCount = that->queued_;
+        }
+
+        NotifyListener(listener, activeCount, queuedCount);
+
+        try
+        {
+          while (that->continue_ &&
+                 runnable->Step())
+          {
+          }
+        }
+        catch (OrthancException& e)
+        {
+          LOG(ERROR) << "Exception while handling some runnable object: " << e.What();
+        }
+        catch (std::bad_alloc&)
+        {
+          LOG(ERROR) << "Not enough memory to handle some runnable object";
+        }
+        catch (std::exception& e)
+        {
+          LOG(ERROR) << "std::exception while handling some runnable object: " << e.what();
+        }
+        catch (...)
+        {
+          LOG(ERROR) << "Native exception while handling some runnable object";
+        }
+
+        runnable.reset(NULL);
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          assert(that->active_ > 0);
+          that->active_--;
+
+          listener = that->listener_;
+          activeCount = that->active_;
+          queuedCount = that->queued_;
+        }
+
+        NotifyListener(listener, activeCount, queuedCount);
+      }
+    }
+  };
+
+
+  FairRunnablesPool::FairRunnablesPool(size_t countThreads,
+                                       size_t maxQueued) :
+    pimpl_(new PImpl)
+  {
+    if (countThreads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    pimpl_->maxQueued_ = maxQueued;
+    pimpl_->threads_.resize(countThreads);
+
+    for (size_t i = 0; i < countThreads; i++)
+    {
+      pimpl_->threads_[i] = new boost::thread(PImpl::Worker, pimpl_.get());
+    }
+  }
+
+
+  void FairRunnablesPool::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(pimpl_->mutex_);
+
+      if (!pimpl_->continue_)
+      {
+        return;
+      }
+
+      pimpl_->continue_ = false;
+    }
+
+    pimpl_->queueNotEmpty_.notify_all();
+
+    for (size_t i = 0; i < pimpl_->threads_.size(); i++)
+    {
+      if (pimpl_->threads_[i] != NULL)
+      {
+        if (pimpl_->threads_[i]->joinable())
+        {
+          pimpl_->threads_[i]->join();
+        }
+
+        delete pimpl_->threads_[i];
+      }
+    }
+
+    pimpl_->threads_.clear();
+  }
+
+
+  FairRunnablesPool::~FairRunnablesPool()
+  {
+    Stop();
+  }
+
+
+  bool FairRunnablesPool::Add(IRunnableBySteps* runnable,
+                              const std::string& key)
+  {
+    std::unique_ptr<IRunnableBySteps> protection(runnable);
+
+    if (runnable == NULL)
+    {
+      throw OrthancException(ErrorCode_NullPointer);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(pimpl_->mutex_);
+
+      if (!pimpl_->continue_)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      if (pimpl_->maxQueued_ != 0 &&
+          pimpl_->queued_ >= pimpl_->maxQueued_)
+      {
+        return false;  // The runnable is deleted by "protection"
+      }
+
+      PImpl::Queues::iterator found = pimpl_->queues_.find(key);
+      if (found == pimpl_->queues_.end())
+      {
+        pimpl_->keys_.push_back(key);
+        pimpl_->queues_[key].push_back(protection.release());
+      }
+      else
+      {
+        found->second.push_back(protection.release());
+      }
+
+      pimpl_->queued_++;
+    }
+
+    pimpl_->queueNotEmpty_.notify_one();
+    return true;
+  }
+
+
+  size_t FairRunnablesPool::GetActiveCount() const
+  {
+    boost::mutex::scoped_lock lock(pimpl_->mutex_);
+    return pimpl_->active_;
+  }
+
+
+  size_t FairRunnablesPool::GetQueuedCount() const
+  {
+    boost::mutex::scoped_lock lock(pimpl_->mutex_);
+    return pimpl_->queued_;
+  }
+
+
+  void FairRunnablesPool::SetListener(IListener* listener)
+  {
+    boost::mutex::scoped_lock lock(pimpl_->mutex_);
+    pimpl_->listener_ = listener;
+  }
+}
@@ -0,0 +1,82 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program. If not, see
+ * <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "IRunnableBySteps.h"
+
+#include <boost/shared_ptr.hpp>
+#include <string>
+
+namespace Orthanc
+{
+  /**
+   * Pool of threads, each of which runs one runnable object until its
+   * completion (new in Orthanc 1.9.6). Contrarily to
+   * "RunnableWorkersPool", a runnable that takes a long time to
+   * complete one step does not delay the other runnables. If all the
+   * threads are busy, the runnables are queued, and they are started
+   * in a round-robin fashion over their "key" (e.g. the AET of the
+   * remote modality), so that one client cannot starve the others.
+   **/
+  class ORTHANC_PUBLIC FairRunnablesPool : public boost::noncopyable
+  {
+  public:
+    // Notified by the threads of the pool each time a runnable is
+    // started or completed, e.g. to publish metrics
+    class IListener : public boost::noncopyable
+    {
+    public:
+      virtual ~IListener()
+      {
+      }
+
+      virtual void SignalCountsChanged(size_t activeCount,
+                                       size_t queuedCount) = 0;
+    };
+
+  private:
+    struct PImpl;
+    boost::shared_ptr<PImpl> pimpl_;
+
+    void Stop();
+
+  public:
+    // "maxQueued == 0" means no limit on the size of the queue
+    FairRunnablesPool(size_t countThreads,
+                      size_t maxQueued);
+
+    ~FairRunnablesPool();
+
+    // Takes the ownership. Returns "false" (and deletes the runnable)
+    // if the queue is full.
+    bool Add(IRunnableBySteps* runnable,
+             const std::string& key);
+
+    size_t GetActiveCount() const;
+
+    size_t GetQueuedCount() const;
+
+    // The listener can be "NULL", otherwise it must outlive the pool
+    void SetListener(IListener* listener);
+  };
+}
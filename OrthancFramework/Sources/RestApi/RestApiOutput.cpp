@@ -148,6 +148,23 @@ namespace Orthanc
     }
   }
 
+  void RestApiOutput::AnswerByteRanges(const std::string& contentType,
+                                       uint64_t contentLength,
+                                       const std::vector<HttpToolbox::ByteRange>& ranges,
+                                       HttpOutput::IByteRangesReader& reader)
+  {
+    CheckStatus();
+    output_.AnswerByteRanges(contentType, contentLength, ranges, reader);
+    alreadySent_ = true;
+  }
+
+  void RestApiOutput::AnswerNotModified()
+  {
+    CheckStatus();
+    output_.SendStatus(HttpStatus_304_NotModified);
+    alreadySent_ = true;
+  }
+
   void RestApiOutput::Redirect(const std::string& path)
   {
     CheckStatus();
@@ -77,6 +77,15 @@ namespace Orthanc
                       size_t length,
                       MimeType contentType);
 
+    // New in Orthanc 1.9.6
+    void AnswerByteRanges(const std::string& contentType,
+                          uint64_t contentLength,
+                          const std::vector<HttpToolbox::ByteRange>& ranges,
+                          HttpOutput::IByteRangesReader& reader);
+
+    // New in Orthanc 1.9.6
+    void AnswerNotModified();
+
     void SignalError(HttpStatus status);
 
     void SignalError(HttpStatus status,
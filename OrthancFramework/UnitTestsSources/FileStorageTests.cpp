@@ -27,15 +27,26 @@
 
 #include <gtest/gtest.h>
 
+#include "../Sources/Compression/ChunkedZlibCompressor.h"
 #include "../Sources/FileStorage/FilesystemStorage.h"
 #include "../Sources/FileStorage/StorageAccessor.h"
 #include "../Sources/HttpServer/BufferHttpSender.h"
 #include "../Sources/HttpServer/FilesystemHttpSender.h"
+#include "../Sources/HttpServer/MemoryBufferHttpSender.h"
+#include "../Sources/Compression/ZlibCompressor.h"
 #include "../Sources/Logging.h"
+#include "../Sources/MappedFileMemoryBuffer.h"
 #include "../Sources/OrthancException.h"
+#include "../Sources/SystemToolbox.h"
 #include "../Sources/Toolbox.h"
 
+#if ORTHANC_ENABLE_ZSTD == 1
+#  include "../Sources/Compression/ZstdCompressor.h"
+#endif
+
+#include <boost/filesystem.hpp>
 #include <ctype.h>
+#include <stdlib.h>
 
 
 using namespace Orthanc;
@@ -85,6 +96,80 @@ TEST(FilesystemStorage, Basic2)
   ASSERT_EQ(s.GetSize(uid), data.size());
 }
 
+TEST(FilesystemStorage, MemoryMapping)
+{
+  if (!MappedFileMemoryBuffer::IsSupported())
+  {
+    return;
+  }
+
+  FilesystemStorage s("UnitTestsStorage");
+
+  std::string data;
+  data.resize(100000);
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    data[i] = static_cast<char>(i % 251);
+  }
+
+  std::string uid = Toolbox::GenerateUuid();
+  s.Create(uid.c_str(), &data[0], data.size(), FileContentType_Unknown);
+
+  s.SetMemoryMapThreshold(data.size());
+  ASSERT_EQ(data.size(), s.GetMemoryMapThreshold());
+
+  {
+    std::unique_ptr<IMemoryBuffer> buffer(s.Read(uid, FileContentType_Unknown));
+    ASSERT_TRUE(dynamic_cast<MappedFileMemoryBuffer*>(buffer.get()) != NULL);
+    ASSERT_EQ(data.size(), buffer->GetSize());
+    ASSERT_FALSE(memcmp(buffer->GetData(), &data[0], data.size()));
+  }
+
+  // Ranges that are not aligned on the pages
+  s.SetMemoryMapThreshold(10);
+
+  {
+    std::unique_ptr<IMemoryBuffer> buffer(s.ReadRange(uid, FileContentType_Unknown, 4097, 90001));
+    ASSERT_TRUE(dynamic_cast<MappedFileMemoryBuffer*>(buffer.get()) != NULL);
+    ASSERT_EQ(90001u - 4097u, buffer->GetSize());
+    ASSERT_FALSE(memcmp(buffer->GetData(), &data[4097], buffer->GetSize()));
+
+    std::string d;
+    buffer->MoveToString(d);
+    ASSERT_EQ(data.substr(4097, 90001 - 4097), d);
+    ASSERT_EQ(0u, buffer->GetSize());
+  }
+
+  {
+    // Below the threshold
+    std::unique_ptr<IMemoryBuffer> buffer(s.ReadRange(uid, FileContentType_Unknown, 5, 10));
+    ASSERT_TRUE(dynamic_cast<MappedFileMemoryBuffer*>(buffer.get()) == NULL);
+    ASSERT_EQ(5u, buffer->GetSize());
+  }
+
+  ASSERT_THROW(s.ReadRange(uid, FileContentType_Unknown, 0, data.size() + 1), OrthancException);
+
+  {
+    // Sending by chunks, directly from the mapping
+    MemoryBufferHttpSender sender(s.Read(uid, FileContentType_Unknown));
+    sender.SetChunkSize(30000);
+    ASSERT_EQ(data.size(), sender.GetContentLength());
+
+    std::string d;
+    unsigned int count = 0;
+    while (sender.ReadNextChunk())
+    {
+      d.append(sender.GetChunkContent(), sender.GetChunkSize());
+      count++;
+    }
+
+    ASSERT_EQ(4u, count);
+    ASSERT_EQ(data, d);
+  }
+
+  s.Remove(uid, FileContentType_Unknown);
+}
+
 TEST(FilesystemStorage, EndToEnd)
 {
   FilesystemStorage s("UnitTestsStorage");
@@ -162,6 +247,282 @@ TEST(StorageAccessor, Compression)
 }
 
 
+TEST(StorageAccessor, ChunkedCompression)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  StorageAccessor accessor(s);
+  accessor.SetCompressionChunkSize(1000);
+  accessor.SetCompressionThreadsCount(4);
+
+  std::string data;
+  data.resize(10500);
+  for (size_t i = 0; i < data.size(); i++)
+  {
+    data[i] = static_cast<char>((i * 7) % 13 + (i / 1000));
+  }
+
+  FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibChunked, true);
+  ASSERT_EQ(CompressionType_ZlibChunked, info.GetCompressionType());
+  ASSERT_EQ(10500u, info.GetUncompressedSize());
+  ASSERT_GT(info.GetUncompressedSize(), info.GetCompressedSize());
+
+  std::string r;
+  accessor.Read(r, info);
+  ASSERT_EQ(data, r);
+
+  accessor.ReadRange(r, info, 0, 10500);  ASSERT_EQ(data, r);
+  accessor.ReadRange(r, info, 0, 0);      ASSERT_TRUE(r.empty());
+  accessor.ReadRange(r, info, 10, 20);    ASSERT_EQ(data.substr(10, 10), r);
+  accessor.ReadRange(r, info, 999, 3001); ASSERT_EQ(data.substr(999, 2002), r);
+  accessor.ReadRange(r, info, 10000, 10500);  ASSERT_EQ(data.substr(10000), r);
+  ASSERT_THROW(accessor.ReadRange(r, info, 10, 10501), OrthancException);
+  ASSERT_THROW(accessor.ReadRange(r, info, 20, 10), OrthancException);
+
+  // The parallel compression must produce the same buffer
+  accessor.SetCompressionThreadsCount(1);
+  FileInfo info2 = accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibChunked, true);
+  ASSERT_EQ(info.GetCompressedMD5(), info2.GetCompressedMD5());
+
+  // Empty buffer
+  info = accessor.Write("", FileContentType_Dicom, CompressionType_ZlibChunked, true);
+  accessor.Read(r, info);
+  ASSERT_TRUE(r.empty());
+
+  // Corrupted buffer
+  std::string raw;
+  accessor.ReadRaw(raw, info2);
+  raw[raw.size() - 1] = 'X';
+  ChunkedZlibCompressor compressor;
+  ASSERT_THROW(compressor.Uncompress(r, raw.c_str(), raw.size()), OrthancException);
+}
+
+
+TEST(StorageAccessor, CompressionLevel)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  StorageAccessor accessor(s);
+
+  ASSERT_EQ(6u, accessor.GetCompressionLevel());
+  ASSERT_EQ(9u, StorageAccessor::GetMaximumCompressionLevel(CompressionType_ZlibWithSize));
+  ASSERT_EQ(9u, StorageAccessor::GetMaximumCompressionLevel(CompressionType_ZlibChunked));
+  ASSERT_THROW(StorageAccessor::GetMaximumCompressionLevel(CompressionType_None), OrthancException);
+  ASSERT_THROW(accessor.SetCompressionLevel(0), OrthancException);
+
+#if ORTHANC_ENABLE_ZSTD == 1
+  ASSERT_THROW(accessor.SetCompressionLevel(StorageAccessor::GetMaximumCompressionLevel(CompressionType_Zstd) + 1),
+               OrthancException);
+#else
+  ASSERT_THROW(accessor.SetCompressionLevel(10), OrthancException);
+#endif
+
+  std::string data;
+  for (unsigned int i = 0; i < 10000; i++)
+  {
+    data += boost::lexical_cast<std::string>(i % 97) + "\\" + boost::lexical_cast<std::string>(i * i);
+  }
+
+  std::string r;
+
+  accessor.SetCompressionLevel(1);
+  FileInfo fast = accessor.Write(data, FileContentType_DicomAsJson, CompressionType_ZlibWithSize, false);
+  FileInfo fastChunked = accessor.Write(data, FileContentType_DicomAsJson, CompressionType_ZlibChunked, false);
+
+  accessor.SetCompressionLevel(9);
+  FileInfo best = accessor.Write(data, FileContentType_DicomAsJson, CompressionType_ZlibWithSize, false);
+  FileInfo bestChunked = accessor.Write(data, FileContentType_DicomAsJson, CompressionType_ZlibChunked, false);
+
+  ASSERT_GT(fast.GetCompressedSize(), best.GetCompressedSize());
+  ASSERT_GT(fastChunked.GetCompressedSize(), bestChunked.GetCompressedSize());
+
+  accessor.Read(r, fast);  ASSERT_EQ(data, r);
+  accessor.Read(r, fastChunked);  ASSERT_EQ(data, r);
+  accessor.Read(r, best);  ASSERT_EQ(data, r);
+  accessor.Read(r, bestChunked);  ASSERT_EQ(data, r);
+}
+
+
+#if ORTHANC_ENABLE_ZSTD == 1
+TEST(StorageAccessor, Zstd)
+{
+  FilesystemStorage s("UnitTestsStorage");
+  StorageAccessor accessor(s);
+
+  std::string data;
+  for (unsigned int i = 0; i < 10000; i++)
+  {
+    data += boost::lexical_cast<std::string>(i % 97) + "\\" + boost::lexical_cast<std::string>(i * i);
+  }
+
+  FileInfo info = accessor.Write(data, FileContentType_Dicom, CompressionType_Zstd, true);
+  ASSERT_EQ(CompressionType_Zstd, info.GetCompressionType());
+  ASSERT_EQ(data.size(), info.GetUncompressedSize());
+  ASSERT_GT(info.GetUncompressedSize(), info.GetCompressedSize());
+  ASSERT_NE(info.GetUncompressedMD5(), info.GetCompressedMD5());
+
+  std::string r;
+  accessor.Read(r, info);
+  ASSERT_EQ(data, r);
+
+  accessor.ReadRange(r, info, 10, 20);
+  ASSERT_EQ(data.substr(10, 10), r);
+
+  // Empty buffer
+  info = accessor.Write("", FileContentType_Dicom, CompressionType_Zstd, true);
+  ASSERT_EQ(0u, info.GetCompressedSize());
+  accessor.Read(r, info);
+  ASSERT_TRUE(r.empty());
+
+  // Corrupted buffers
+  ZstdCompressor zstd;
+  std::string compressed;
+  IBufferCompressor::Compress(compressed, zstd, data);
+  ASSERT_THROW(zstd.Uncompress(r, compressed.c_str(), compressed.size() - 1), OrthancException);
+  ASSERT_THROW(zstd.Uncompress(r, "nope", 4), OrthancException);
+
+  ASSERT_THROW(zstd.SetCompressionLevel(0), OrthancException);
+  ASSERT_THROW(zstd.SetCompressionLevel(ZstdCompressor::GetMaximumCompressionLevel() + 1), OrthancException);
+
+  // The levels above 9 are specific to zstd
+  const uint8_t maximum = StorageAccessor::GetMaximumCompressionLevel(CompressionType_Zstd);
+  ASSERT_EQ(ZstdCompressor::GetMaximumCompressionLevel(), static_cast<int>(maximum));
+  ASSERT_LT(9u, maximum);
+
+  accessor.SetCompressionLevel(maximum);
+  info = accessor.Write(data, FileContentType_Dicom, CompressionType_Zstd, false);
+  accessor.Read(r, info);
+  ASSERT_EQ(data, r);
+
+  ASSERT_THROW(accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibWithSize, false), OrthancException);
+  ASSERT_THROW(accessor.Write(data, FileContentType_Dicom, CompressionType_ZlibChunked, false), OrthancException);
+}
+#endif
+
+
+TEST(StorageAccessor, DISABLED_CompressionBenchmark)
+{
+  /**
+   * Compression ratio and throughput of the formats and levels of
+   * compression of the storage area. The environment variable
+   * "ORTHANC_COMPRESSION_BENCHMARK" must point to a folder whose
+   * subfolders contain the DICOM files of one modality each (e.g.
+   * "CT", "MR" and "US").
+   **/
+  const char* path = getenv("ORTHANC_COMPRESSION_BENCHMARK");
+  if (path == NULL)
+  {
+    LOG(WARNING) << "Set the environment variable ORTHANC_COMPRESSION_BENCHMARK to run this benchmark";
+    return;
+  }
+
+  struct Codec
+  {
+    CompressionType  type_;
+    uint8_t          level_;
+    unsigned int     threads_;
+  };
+
+  static const Codec CODECS[] = {
+    { CompressionType_ZlibWithSize, 1, 1 },
+    { CompressionType_ZlibWithSize, 6, 1 },
+    { CompressionType_ZlibWithSize, 9, 1 },
+    { CompressionType_ZlibChunked, 1, 1 },
+    { CompressionType_ZlibChunked, 6, 1 },
+    { CompressionType_ZlibChunked, 1, 4 },
+    { CompressionType_ZlibChunked, 6, 4 },
+#if ORTHANC_ENABLE_ZSTD == 1
+    { CompressionType_Zstd, 1, 1 },
+    { CompressionType_Zstd, 3, 1 },
+    { CompressionType_Zstd, 6, 1 },
+    { CompressionType_Zstd, 9, 1 }
+#endif
+  };
+
+  for (boost::filesystem::directory_iterator dataset(path), end; dataset != end; ++dataset)
+  {
+    if (!boost::filesystem::is_directory(dataset->status()))
+    {
+      continue;
+    }
+
+    std::vector<std::string> files;
+
+    for (boost::filesystem::recursive_directory_iterator current(dataset->path()), end2;
+         current != end2; ++current)
+    {
+      if (SystemToolbox::IsRegularFile(current->path().string()))
+      {
+        std::string content;
+        SystemToolbox::ReadFile(content, current->path().string());
+        files.push_back(content);
+      }
+    }
+
+    for (size_t i = 0; i < sizeof(CODECS) / sizeof(Codec); i++)
+    {
+      uint64_t uncompressedSize = 0;
+      uint64_t compressedSize = 0;
+      int64_t compressionTime = 0;
+      int64_t uncompressionTime = 0;
+
+      for (size_t j = 0; j < files.size(); j++)
+      {
+        std::unique_ptr<IBufferCompressor> compressor;
+
+        if (CODECS[i].type_ == CompressionType_ZlibWithSize)
+        {
+          std::unique_ptr<ZlibCompressor> zlib(new ZlibCompressor);
+          zlib->SetCompressionLevel(CODECS[i].level_);
+          compressor.reset(zlib.release());
+        }
+#if ORTHANC_ENABLE_ZSTD == 1
+        else if (CODECS[i].type_ == CompressionType_Zstd)
+        {
+          std::unique_ptr<ZstdCompressor> zstd(new ZstdCompressor);
+          zstd->SetCompressionLevel(CODECS[i].level_);
+          compressor.reset(zstd.release());
+        }
+#endif
+        else
+        {
+          std::unique_ptr<ChunkedZlibCompressor> chunked(new ChunkedZlibCompressor);
+          chunked->SetCompressionLevel(CODECS[i].level_);
+          chunked->SetThreadsCount(CODECS[i].threads_);
+          compressor.reset(chunked.release());
+        }
+
+        std::string compressed, uncompressed;
+
+        const boost::posix_time::ptime t1 = boost::posix_time::microsec_clock::universal_time();
+        IBufferCompressor::Compress(compressed, *compressor, files[j]);
+        const boost::posix_time::ptime t2 = boost::posix_time::microsec_clock::universal_time();
+        IBufferCompressor::Uncompress(uncompressed, *compressor, compressed);
+        const boost::posix_time::ptime t3 = boost::posix_time::microsec_clock::universal_time();
+
+        ASSERT_EQ(files[j].size(), uncompressed.size());
+
+        uncompressedSize += files[j].size();
+        compressedSize += compressed.size();
+        compressionTime += (t2 - t1).total_microseconds();
+        uncompressionTime += (t3 - t2).total_microseconds();
+      }
+
+      if (uncompressedSize > 0)
+      {
+        LOG(WARNING) << dataset->path().filename().string() << " - "
+                     << (CODECS[i].type_ == CompressionType_ZlibWithSize ? "zlib" :
+                         CODECS[i].type_ == CompressionType_Zstd ? "zstd" : "chunked zlib")
+                     << " level " << static_cast<int>(CODECS[i].level_)
+                     << " with " << CODECS[i].threads_ << " thread(s): ratio "
+                     << (static_cast<float>(uncompressedSize) / static_cast<float>(compressedSize))
+                     << ", compression " << (uncompressedSize / std::max(static_cast<int64_t>(1), compressionTime))
+                     << " MB/s, uncompression " << (uncompressedSize / std::max(static_cast<int64_t>(1), uncompressionTime))
+                     << " MB/s";
+      }
+    }
+  }
+}
+
+
 TEST(StorageAccessor, Mix)
 {
   FilesystemStorage s("UnitTestsStorage");
@@ -66,7 +66,9 @@
 #include <dcmtk/dcmdata/dcvrfl.h>
 
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 #if ORTHANC_ENABLE_PUGIXML == 1
 #  include <pugixml.hpp>
@@ -2261,6 +2263,200 @@ TEST(ParsedDicomCache, Basic)
 }
 
 
+TEST(ParsedDicomCache, Buffer)
+{
+  ParsedDicomCache cache(20);
+
+  boost::shared_ptr<const std::string> buffer(new std::string("hello"));
+  ASSERT_THROW(cache.Acquire("a", new ParsedDicomFile(true), boost::shared_ptr<const std::string>()), OrthancException);
+
+  cache.Acquire("a", new ParsedDicomFile(true), buffer);
+  cache.Acquire("b", new ParsedDicomFile(true), 5);
+  ASSERT_EQ(15u, cache.GetCurrentSize());  // Both the parsed dataset and the buffer of "a" are counted
+  ASSERT_EQ(2u, cache.GetNumberOfItems());
+
+  {
+    ParsedDicomCache::Accessor accessor(cache, "a");
+    ASSERT_TRUE(accessor.IsValid());
+    ASSERT_EQ(5u, accessor.GetFileSize());
+    ASSERT_TRUE(accessor.HasBuffer());
+    ASSERT_EQ(buffer.get(), accessor.GetBuffer().get());  // No copy
+  }
+
+  {
+    ParsedDicomCache::Accessor accessor(cache, "b");
+    ASSERT_TRUE(accessor.IsValid());
+    ASSERT_FALSE(accessor.HasBuffer());
+    ASSERT_THROW(accessor.GetBuffer(), OrthancException);
+  }
+
+  boost::shared_ptr<const std::string> s;
+  ASSERT_TRUE(cache.LookupBuffer(s, "a"));
+  ASSERT_EQ("hello", *s);
+  ASSERT_FALSE(cache.LookupBuffer(s, "b"));
+  ASSERT_FALSE(cache.LookupBuffer(s, "c"));
+
+  // The buffer survives the invalidation of the item
+  s = buffer;
+  buffer.reset();
+  cache.Invalidate("a");
+  ASSERT_EQ(5u, cache.GetCurrentSize());
+  ASSERT_FALSE(cache.LookupBuffer(buffer, "a"));
+  ASSERT_EQ("hello", *s);
+}
+
+
+static void AccessParsedDicomCache(ParsedDicomCache* cache,
+                                   std::string id,
+                                   bool* success)
+{
+  ParsedDicomCache::Accessor accessor(*cache, id);
+  std::string s;
+  *success = (accessor.IsValid() &&
+              accessor.GetDicom().GetTagValue(s, DICOM_TAG_SOP_INSTANCE_UID));
+}
+
+
+TEST(ParsedDicomCache, Concurrency)
+{
+  ParsedDicomCache cache(10, 4);
+  ASSERT_EQ(4u, cache.GetShardsCount());
+
+  cache.Acquire("a", new ParsedDicomFile(true), 4);
+  cache.Acquire("b", new ParsedDicomFile(true), 4);
+  ASSERT_EQ(8u, cache.GetCurrentSize());
+  ASSERT_EQ(2u, cache.GetNumberOfItems());
+
+  {
+    ParsedDicomCache::Accessor a(cache, "a");
+    ASSERT_TRUE(a.IsValid());
+
+    // Accessing another item does not block (it did before Orthanc 1.9.6)
+    bool success = false;
+    boost::thread t(AccessParsedDicomCache, &cache, "b", &success);
+    t.join();
+    ASSERT_TRUE(success);
+
+    // Invalidating an item in use does not block, and the item
+    // remains available to its accessor
+    cache.Invalidate("a");
+    ASSERT_EQ(4u, cache.GetCurrentSize());
+    ASSERT_EQ(1u, cache.GetNumberOfItems());
+    ASSERT_FALSE(ParsedDicomCache::Accessor(cache, "a").IsValid());
+
+    std::string s;
+    ASSERT_TRUE(a.GetDicom().GetTagValue(s, DICOM_TAG_SOP_INSTANCE_UID));
+  }
+
+  {
+    // An item in use cannot be recycled
+    ParsedDicomCache::Accessor b(cache, "b");
+    ASSERT_TRUE(b.IsValid());
+
+    cache.Acquire("c", new ParsedDicomFile(true), 4);
+    cache.Acquire("d", new ParsedDicomFile(true), 4);
+    ASSERT_EQ(8u, cache.GetCurrentSize());
+    ASSERT_EQ(2u, cache.GetNumberOfItems());
+
+    std::string s;
+    ASSERT_TRUE(b.GetDicom().GetTagValue(s, DICOM_TAG_SOP_INSTANCE_UID));
+  }
+
+  ASSERT_TRUE(ParsedDicomCache::Accessor(cache, "b").IsValid());
+  ASSERT_FALSE(ParsedDicomCache::Accessor(cache, "c").IsValid());
+  ASSERT_TRUE(ParsedDicomCache::Accessor(cache, "d").IsValid());
+
+  // Large item in use, replaced by a small item
+  cache.Acquire("e", new ParsedDicomFile(true), 20);
+  ASSERT_EQ(20u, cache.GetCurrentSize());
+  ASSERT_EQ(1u, cache.GetNumberOfItems());
+
+  {
+    ParsedDicomCache::Accessor e(cache, "e");
+    ASSERT_TRUE(e.IsValid());
+    cache.Acquire("f", new ParsedDicomFile(true), 4);
+    ASSERT_EQ(4u, cache.GetCurrentSize());
+    ASSERT_EQ(20u, e.GetFileSize());
+  }
+
+  ASSERT_FALSE(ParsedDicomCache::Accessor(cache, "e").IsValid());
+  ASSERT_TRUE(ParsedDicomCache::Accessor(cache, "f").IsValid());
+}
+
+
+static void ServeParsedDicomFrames(ParsedDicomCache* cache,
+                                   unsigned int thread,
+                                   unsigned int countInstances,
+                                   unsigned int countFrames)
+{
+  for (unsigned int i = 0; i < countFrames; i++)
+  {
+    const unsigned int instance = (thread + i * 7) % countInstances;
+    ParsedDicomCache::Accessor accessor(*cache, "instance-" + boost::lexical_cast<std::string>(instance));
+    
+    if (accessor.IsValid())
+    {
+      std::unique_ptr<ImageAccessor> frame(accessor.GetDicom().DecodeFrame(0));
+      if (frame->GetWidth() != 256)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+    }
+  }
+}
+
+
+TEST(ParsedDicomCache, Benchmark)
+{
+  /**
+   * Frame-serving throughput as the number of threads grows. This
+   * was constant before Orthanc 1.9.6, as all the accessors to the
+   * cache were serialized.
+   **/
+  static const unsigned int COUNT_INSTANCES = 64;
+  static const unsigned int COUNT_FRAMES = 1000;
+
+  ParsedDicomCache cache(128 * 1024 * 1024, 16);
+
+  {
+    Image image(PixelFormat_Grayscale8, 256, 256, false);
+    ImageProcessing::Set(image, 128);
+
+    for (unsigned int i = 0; i < COUNT_INSTANCES; i++)
+    {
+      std::unique_ptr<ParsedDicomFile> dicom(new ParsedDicomFile(true));
+      dicom->EmbedImage(image);
+      cache.Acquire("instance-" + boost::lexical_cast<std::string>(i), dicom.release(), 256 * 256);
+    }
+  }
+
+  ASSERT_EQ(COUNT_INSTANCES, cache.GetNumberOfItems());
+
+  for (unsigned int threads = 1; threads <= 8; threads *= 2)
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    std::vector<boost::thread*> workers(threads);
+    for (unsigned int i = 0; i < threads; i++)
+    {
+      workers[i] = new boost::thread(ServeParsedDicomFrames, &cache, i, COUNT_INSTANCES, COUNT_FRAMES);
+    }
+
+    for (unsigned int i = 0; i < threads; i++)
+    {
+      workers[i]->join();
+      delete workers[i];
+    }
+
+    const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+    const int64_t ms = std::max(static_cast<int64_t>(1), static_cast<int64_t>((end - start).total_milliseconds()));
+
+    LOG(WARNING) << "ParsedDicomCache with " << threads << " thread(s): "
+                 << (1000 * static_cast<int64_t>(threads * COUNT_FRAMES) / ms) << " frames/second";
+  }
+}
+
+
 static bool MyIsMatch(const DicomPath& a,
                       const DicomPath& b)
 {
@@ -2995,6 +3191,108 @@ TEST(FromDcmtkBridge, VisitorRemoveTag)
 
 
 
+#if ORTHANC_ENABLE_DCMTK_NETWORKING == 1
+
+#include "../Sources/DicomNetworking/Internals/StoreScp.h"
+#include "../Sources/TemporaryFile.h"
+
+static void WriteStreamingStoreFile(TemporaryFile& target,
+                                    ParsedDicomFile& dicom,
+                                    DicomTransferSyntax syntax)
+{
+  ASSERT_TRUE(FromDcmtkBridge::Transcode(dicom.GetDcmtkObject(), syntax, NULL));
+
+  std::string s;
+  dicom.SaveToMemoryBuffer(s);
+  target.Write(s);
+}
+
+
+TEST(StoreScp, CheckStreamingStoreFile)
+{
+  Image image(PixelFormat_Grayscale8, 16, 16, false);
+  ImageProcessing::Set(image, 128);
+
+  ParsedDicomFile dicom(true);
+  dicom.EmbedImage(image);
+
+  std::string sopClassUid, sopInstanceUid;
+  ASSERT_TRUE(dicom.GetTagValue(sopClassUid, DICOM_TAG_SOP_CLASS_UID));
+  ASSERT_TRUE(dicom.GetTagValue(sopInstanceUid, DICOM_TAG_SOP_INSTANCE_UID));
+
+  const DicomTransferSyntax syntaxes[] = {
+    DicomTransferSyntax_LittleEndianImplicit,
+    DicomTransferSyntax_LittleEndianExplicit,
+    DicomTransferSyntax_BigEndianExplicit,
+    DicomTransferSyntax_DeflatedLittleEndianExplicit
+  };
+
+  for (size_t i = 0; i < sizeof(syntaxes) / sizeof(DicomTransferSyntax); i++)
+  {
+    TemporaryFile f;
+    WriteStreamingStoreFile(f, dicom, syntaxes[i]);
+
+    ASSERT_EQ(STATUS_Success, Internals::CheckStreamingStoreFile(
+                f.GetPath(), sopClassUid.c_str(), sopInstanceUid.c_str()));
+    ASSERT_EQ(STATUS_STORE_Error_DataSetDoesNotMatchSOPClass, Internals::CheckStreamingStoreFile(
+                f.GetPath(), "1.2.840.10008.5.1.4.1.1.2", sopInstanceUid.c_str()));
+    ASSERT_EQ(STATUS_STORE_Error_DataSetDoesNotMatchSOPClass, Internals::CheckStreamingStoreFile(
+                f.GetPath(), sopClassUid.c_str(), "1.2.3.4"));
+  }
+
+  {
+    // Missing SOP instance UID
+    ParsedDicomFile other(true);
+    other.Remove(DICOM_TAG_SOP_INSTANCE_UID);
+
+    TemporaryFile f;
+    WriteStreamingStoreFile(f, other, DicomTransferSyntax_LittleEndianExplicit);
+    ASSERT_EQ(STATUS_STORE_Error_CannotUnderstand, Internals::CheckStreamingStoreFile(
+                f.GetPath(), sopClassUid.c_str(), sopInstanceUid.c_str()));
+  }
+
+  {
+    // Not a DICOM file
+    TemporaryFile f;
+    f.Write("Hello, world");
+    ASSERT_EQ(STATUS_STORE_Error_CannotUnderstand, Internals::CheckStreamingStoreFile(
+                f.GetPath(), sopClassUid.c_str(), sopInstanceUid.c_str()));
+  }
+}
+
+
+TEST(StoreScp, EnsureSourceApplicationEntityTitle)
+{
+  ParsedDicomFile dicom(true);
+  dicom.GetDcmtkObject().getMetaInfo()->findAndDeleteElement(DCM_SourceApplicationEntityTitle);
+
+  TemporaryFile f;
+  WriteStreamingStoreFile(f, dicom, DicomTransferSyntax_LittleEndianExplicit);
+
+  Internals::EnsureSourceApplicationEntityTitle(f.GetPath(), "MYAET");
+
+  std::string s;
+  f.Read(s);
+
+  {
+    ParsedDicomFile stored(s);
+    OFString aet;
+    ASSERT_TRUE(stored.GetDcmtkObject().getMetaInfo()->findAndGetOFString(DCM_SourceApplicationEntityTitle, aet).good());
+    ASSERT_EQ("MYAET", std::string(aet.c_str()));
+  }
+
+  // The file is left untouched if the source AET is already present
+  Internals::EnsureSourceApplicationEntityTitle(f.GetPath(), "OTHER");
+
+  std::string t;
+  f.Read(t);
+  ASSERT_EQ(s, t);
+}
+
+#endif
+
+
+
 #if ORTHANC_ENABLE_DCMTK_TRANSCODING == 1
 
 #include "../Sources/DicomNetworking/DicomStoreUserConnection.h"
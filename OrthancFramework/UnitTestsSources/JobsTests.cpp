@@ -26,6 +26,7 @@
 #endif
 
 #include <gtest/gtest.h>
+#include <boost/thread.hpp>
 
 #include "../../OrthancFramework/Sources/Compatibility.h"
 #include "../../OrthancFramework/Sources/DicomNetworking/DicomAssociationParameters.h"
@@ -41,6 +42,7 @@
 #include "../../OrthancFramework/Sources/JobsEngine/Operations/StringOperationValue.h"
 #include "../../OrthancFramework/Sources/JobsEngine/SetOfInstancesJob.h"
 #include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MultiThreading/FairRunnablesPool.h"
 #include "../../OrthancFramework/Sources/MultiThreading/SharedMessageQueue.h"
 #include "../../OrthancFramework/Sources/OrthancException.h"
 #include "../../OrthancFramework/Sources/SerializationToolbox.h"
@@ -198,6 +200,16 @@ namespace
   };
 
 
+  class ParallelInstancesJob : public DummyInstancesJob
+  {
+  protected:
+    virtual bool IsHandleInstanceThreadSafe() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+  };
+
+
   class DummyUnserializer : public GenericJobUnserializer
   {
   public:
@@ -279,6 +291,141 @@ TEST(MultiThreading, SharedMessageQueueClean)
 }
 
 
+namespace
+{
+  class BlockingRunnable : public IRunnableBySteps
+  {
+  private:
+    boost::mutex&         mutex_;
+    std::vector<int>&     order_;
+    int                   value_;
+    const bool&           blocked_;
+
+  public:
+    BlockingRunnable(boost::mutex& mutex,
+                     std::vector<int>& order,
+                     int value,
+                     const bool& blocked) :
+      mutex_(mutex),
+      order_(order),
+      value_(value),
+      blocked_(blocked)
+    {
+    }
+
+    virtual bool Step() ORTHANC_OVERRIDE
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        if (blocked_)
+        {
+          return true;
+        }
+
+        order_.push_back(value_);
+      }
+
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      return false;
+    }
+  };
+
+
+  class CountingListener : public FairRunnablesPool::IListener
+  {
+  private:
+    boost::mutex  mutex_;
+    unsigned int  signals_;
+    size_t        lastActive_;
+    size_t        lastQueued_;
+
+  public:
+    CountingListener() :
+      signals_(0),
+      lastActive_(0),
+      lastQueued_(0)
+    {
+    }
+
+    virtual void SignalCountsChanged(size_t activeCount,
+                                     size_t queuedCount) ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      signals_++;
+      lastActive_ = activeCount;
+      lastQueued_ = queuedCount;
+    }
+
+    void Get(unsigned int& signals,
+             size_t& lastActive,
+             size_t& lastQueued)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      signals = signals_;
+      lastActive = lastActive_;
+      lastQueued = lastQueued_;
+    }
+  };
+}
+
+
+TEST(MultiThreading, FairRunnablesPool)
+{
+  boost::mutex mutex;
+  std::vector<int> order;
+  bool blocked = true;
+  CountingListener listener;
+
+  {
+    FairRunnablesPool pool(1, 4);
+    pool.SetListener(&listener);
+
+    ASSERT_TRUE(pool.Add(new BlockingRunnable(mutex, order, 0, blocked), "first"));
+
+    while (pool.GetActiveCount() == 0)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+
+    // The single thread is busy: Queue 3 runnables for "a", then 1 for "b"
+    ASSERT_TRUE(pool.Add(new BlockingRunnable(mutex, order, 1, blocked), "a"));
+    ASSERT_TRUE(pool.Add(new BlockingRunnable(mutex, order, 2, blocked), "a"));
+    ASSERT_TRUE(pool.Add(new BlockingRunnable(mutex, order, 3, blocked), "a"));
+    ASSERT_TRUE(pool.Add(new BlockingRunnable(mutex, order, 4, blocked), "b"));
+    ASSERT_FALSE(pool.Add(new BlockingRunnable(mutex, order, 5, blocked), "c"));  // Queue is full
+    ASSERT_EQ(1u, pool.GetActiveCount());
+    ASSERT_EQ(4u, pool.GetQueuedCount());
+
+    {
+      boost::mutex::scoped_lock lock(mutex);
+      blocked = false;
+    }
+
+    while (pool.GetActiveCount() != 0 ||
+           pool.GetQueuedCount() != 0)
+    {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+    }
+  }
+
+  // "b" is not delayed by the runnables of "a"
+  ASSERT_EQ(5u, order.size());
+  ASSERT_EQ(0, order[0]);
+  ASSERT_EQ(1, order[1]);
+  ASSERT_EQ(4, order[2]);
+  ASSERT_EQ(2, order[3]);
+  ASSERT_EQ(3, order[4]);
+
+  // The listener is notified when each runnable starts and completes
+  unsigned int signals;
+  size_t lastActive, lastQueued;
+  listener.Get(signals, lastActive, lastQueued);
+  ASSERT_EQ(10u, signals);
+  ASSERT_EQ(0u, lastActive);
+  ASSERT_EQ(0u, lastQueued);
+}
+
+
 
 
 static bool CheckState(JobsRegistry& registry,
@@ -1139,6 +1286,114 @@ TEST(JobsSerialization, Registry)
 }
 
 
+TEST(JobsSerialization, RegistryChanges)
+{
+  Json::Value s, changes;
+  std::string i1, i2;
+
+  JobsRegistry registry(1);
+  registry.Submit(i1, new DummyJob(), 10);
+  registry.Submit(i2, new DummyJob(), 20);
+
+  registry.SerializeChanges(changes, false);
+  ASSERT_EQ(2u, changes.size());
+  ASSERT_EQ(Json::objectValue, changes[i1].type());
+  ASSERT_EQ(Json::objectValue, changes[i2].type());
+
+  registry.SerializeChanges(changes, false);
+  ASSERT_EQ(0u, changes.size());
+
+  ASSERT_TRUE(registry.SetPriority(i1, 5));
+  registry.SerializeChanges(changes, false);
+  ASSERT_EQ(1u, changes.size());
+  ASSERT_EQ(5, changes[i1]["Priority"].asInt());
+
+  {
+    DummyUnserializer unserializer;
+    registry.Serialize(s);
+    JobsRegistry registry2(unserializer, s, 1);
+
+    // The unserialized jobs are identical to their saved version
+    registry2.SerializeChanges(changes, false);
+    ASSERT_EQ(0u, changes.size());
+
+    registry2.SerializeChanges(changes, true);
+    ASSERT_EQ(2u, changes.size());
+  }
+
+  // "i1" is removed from the history, as its size is 1
+  ASSERT_TRUE(registry.Cancel(i1));
+  ASSERT_TRUE(registry.Cancel(i2));
+  registry.SerializeChanges(changes, false);
+  ASSERT_EQ(2u, changes.size());
+  ASSERT_TRUE(changes[i1].isNull());
+  ASSERT_EQ("Failure", changes[i2]["State"].asString());
+}
+
+
+TEST(JobsSerialization, Parallelism)
+{
+  {
+    ParallelInstancesJob job;
+    job.AddInstance("a");
+    job.AddInstance("b");
+    job.AddInstance("nope");
+    job.AddInstance("c");
+    job.AddInstance("d");
+    job.AddTrailingStep();
+    job.SetPermissive(true);
+    ASSERT_THROW(job.SetParallelism(0), OrthancException);
+    job.SetParallelism(3);
+
+    job.Start();
+    ASSERT_THROW(job.SetParallelism(2), OrthancException);
+
+    ASSERT_EQ(JobStepCode_Continue, job.Step("jobId").GetCode());
+    ASSERT_EQ(3u, job.GetPosition());
+    ASSERT_EQ(1u, job.GetFailedInstances().size());
+    ASSERT_TRUE(job.IsFailedInstance("nope"));
+
+    {
+      DummyUnserializer unserializer;
+      ASSERT_TRUE(CheckIdempotentSetOfInstances(unserializer, job));
+    }
+
+    // The trailing step is never executed in parallel
+    ASSERT_EQ(JobStepCode_Continue, job.Step("jobId").GetCode());
+    ASSERT_EQ(5u, job.GetPosition());
+    ASSERT_FALSE(job.IsTrailingStepDone());
+
+    ASSERT_EQ(JobStepCode_Success, job.Step("jobId").GetCode());
+    ASSERT_EQ(6u, job.GetPosition());
+    ASSERT_TRUE(job.IsTrailingStepDone());
+  }
+
+  {
+    ParallelInstancesJob job;
+    job.AddInstance("a");
+    job.AddInstance("nope");
+    job.SetParallelism(4);
+    job.Start();
+
+    ASSERT_EQ(JobStepCode_Failure, job.Step("jobId").GetCode());
+    ASSERT_EQ(0u, job.GetPosition());
+    ASSERT_TRUE(job.IsFailedInstance("nope"));
+  }
+
+  {
+    // Jobs whose instances are not thread-safe ignore the parallelism
+    DummyInstancesJob job;
+    job.AddInstance("a");
+    job.AddInstance("b");
+    job.SetParallelism(4);
+    job.Start();
+
+    ASSERT_EQ(JobStepCode_Continue, job.Step("jobId").GetCode());
+    ASSERT_EQ(1u, job.GetPosition());
+  }
+}
+
+
 TEST(JobsSerialization, TrailingStep)
 {
   {
@@ -203,6 +203,68 @@ TEST(FuncStreamBuf, BasicTest)
 #endif
 
 
+#if ORTHANC_ENABLE_LOGGING_STDIO == 0
+TEST(Logging, Asynchronous)
+{
+  LoggingMementoScope loggingConfiguration;
+
+  std::stringstream errorStream, warningStream, infoStream;
+  Orthanc::Logging::SetErrorWarnInfoLoggingStreams(errorStream, warningStream, infoStream);
+
+  Orthanc::Logging::EnableAsynchronousMode(2, Orthanc::Logging::AsyncOverflowPolicy_Block);
+  ASSERT_THROW(Orthanc::Logging::EnableAsynchronousMode(2, Orthanc::Logging::AsyncOverflowPolicy_Block),
+               Orthanc::OrthancException);
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    LOG(WARNING) << "Warning " << i;
+  }
+
+  // The errors are written before the logging returns
+  LOG(ERROR) << "Hello";
+  ASSERT_NE(std::string::npos, errorStream.str().find("] Hello\n"));
+
+  Orthanc::Logging::Flush();
+
+  std::string s = warningStream.str();
+  size_t previous = 0;
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    // The order of the messages is preserved
+    size_t pos = s.find("] Warning " + boost::lexical_cast<std::string>(i) + "\n");
+    ASSERT_NE(std::string::npos, pos);
+    ASSERT_LE(previous, pos);
+    previous = pos;
+  }
+
+  Orthanc::Logging::DisableAsynchronousMode();
+
+  // Back to the synchronous mode
+  LOG(WARNING) << "World";
+  ASSERT_NE(std::string::npos, warningStream.str().find("] World\n"));
+
+  const bool infoEnabled = Orthanc::Logging::IsInfoLevelEnabled();
+
+  Orthanc::Logging::EnableAsynchronousMode(1, Orthanc::Logging::AsyncOverflowPolicy_DropInfo);
+  Orthanc::Logging::EnableInfoLevel(true);
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    LOG(INFO) << "Info " << i;
+  }
+
+  LOG(WARNING) << "Last";
+
+  // Disabling the asynchronous mode writes the pending messages
+  Orthanc::Logging::DisableAsynchronousMode();
+  Orthanc::Logging::EnableInfoLevel(infoEnabled);  // Back to normal
+
+  ASSERT_NE(std::string::npos, warningStream.str().find("] Last\n"));
+  ASSERT_NE(std::string::npos, infoStream.str().find("] Info 0\n"));
+}
+#endif
+
+
 
 TEST(Logging, Categories)
 {
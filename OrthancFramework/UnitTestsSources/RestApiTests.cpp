@@ -30,11 +30,13 @@
 #include "../Sources/ChunkedBuffer.h"
 #include "../Sources/Compression/ZlibCompressor.h"
 #include "../Sources/HttpServer/HttpContentNegociation.h"
+#include "../Sources/HttpServer/HttpOutput.h"
 #include "../Sources/HttpServer/MultipartStreamReader.h"
 #include "../Sources/HttpServer/StringMatcher.h"
 #include "../Sources/Logging.h"
 #include "../Sources/OrthancException.h"
 #include "../Sources/RestApi/RestApiHierarchy.h"
+#include "../Sources/RestApi/RestApiOutput.h"
 #include "../Sources/WebServiceParameters.h"
 
 #include <ctype.h>
@@ -213,6 +215,290 @@ TEST(RestApi, ParseCookies)
 }
 
 
+TEST(RestApi, ParseRange)
+{
+  std::vector<HttpToolbox::ByteRange> r;
+
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "items=0-10", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=10", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=20-10", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=a-10", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=-", 100));
+
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=0-9", 100));
+  ASSERT_EQ(1u, r.size());
+  ASSERT_EQ(0u, r[0].first);
+  ASSERT_EQ(9u, r[0].second);
+
+  // The ranges are sorted, and the overlapping or adjacent ranges are merged
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, " Bytes = 90- , -5,10-19, 50-59 ,20-29", 100));
+  ASSERT_EQ(3u, r.size());
+  ASSERT_EQ(10u, r[0].first);
+  ASSERT_EQ(29u, r[0].second);
+  ASSERT_EQ(50u, r[1].first);
+  ASSERT_EQ(59u, r[1].second);
+  ASSERT_EQ(90u, r[2].first);
+  ASSERT_EQ(99u, r[2].second);
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=90-,-5,10-1000", 100));  // Here, the 90 bytes are counted thrice
+
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=-1000", 100));
+  ASSERT_EQ(1u, r.size());
+  ASSERT_EQ(0u, r[0].first);
+  ASSERT_EQ(99u, r[0].second);
+
+  // Not satisfiable (HTTP status 416)
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=100-200", 100));
+  ASSERT_TRUE(r.empty());
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=-0", 100));
+  ASSERT_TRUE(r.empty());
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=0-10", 0));
+  ASSERT_TRUE(r.empty());
+
+  std::string many = "bytes=0-0";
+  for (int i = 1; i < 100; i++)
+  {
+    many += "," + boost::lexical_cast<std::string>(i) + "-" + boost::lexical_cast<std::string>(i);
+  }
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, many, 100));
+
+  // Protection against denial of service: The ranges cannot request
+  // more bytes than the content itself
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=0-,0-", 100));
+  ASSERT_FALSE(HttpToolbox::ParseRange(r, "bytes=0-59,40-99", 100));
+  ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=0-49,50-", 100));
+  ASSERT_EQ(1u, r.size());
+  ASSERT_EQ(0u, r[0].first);
+  ASSERT_EQ(99u, r[0].second);
+
+  HttpToolbox::Arguments headers;
+  ASSERT_FALSE(HttpToolbox::LookupRange(r, headers, 100));
+  headers["range"] = "bytes=5-";
+  ASSERT_TRUE(HttpToolbox::LookupRange(r, headers, 100));
+  ASSERT_EQ(1u, r.size());
+  ASSERT_EQ(5u, r[0].first);
+  ASSERT_EQ(99u, r[0].second);
+}
+
+
+namespace
+{
+  class RecordingHttpStream : public IHttpOutputStream
+  {
+  private:
+    HttpStatus   status_;
+    std::string  header_;
+    std::string  body_;
+    unsigned int bodyChunks_;
+
+  public:
+    RecordingHttpStream() :
+      status_(HttpStatus_404_NotFound),
+      bodyChunks_(0)
+    {
+    }
+
+    virtual void OnHttpStatusReceived(HttpStatus status) ORTHANC_OVERRIDE
+    {
+      status_ = status;
+    }
+
+    virtual void Send(bool isHeader, const void* buffer, size_t length) ORTHANC_OVERRIDE
+    {
+      if (isHeader)
+      {
+        header_.append(reinterpret_cast<const char*>(buffer), length);
+      }
+      else
+      {
+        body_.append(reinterpret_cast<const char*>(buffer), length);
+        bodyChunks_++;
+      }
+    }
+
+    virtual void DisableKeepAlive() ORTHANC_OVERRIDE
+    {
+    }
+
+    HttpStatus GetStatus() const
+    {
+      return status_;
+    }
+
+    bool HasHeader(const std::string& line) const
+    {
+      return header_.find("\r\n" + line + "\r\n") != std::string::npos;
+    }
+
+    const std::string& GetHeader() const
+    {
+      return header_;
+    }
+
+    const std::string& GetBody() const
+    {
+      return body_;
+    }
+
+    unsigned int GetBodyChunks() const
+    {
+      return bodyChunks_;
+    }
+  };
+
+
+  class StringRangesReader : public HttpOutput::IByteRangesReader
+  {
+  private:
+    const std::string&  content_;
+    unsigned int        count_;
+
+  public:
+    explicit StringRangesReader(const std::string& content) :
+      content_(content),
+      count_(0)
+    {
+    }
+
+    virtual void ReadRange(std::string& target,
+                           uint64_t start,
+                           uint64_t end) ORTHANC_OVERRIDE
+    {
+      target = content_.substr(start, end - start);
+      count_++;
+    }
+
+    unsigned int GetCount() const
+    {
+      return count_;
+    }
+  };
+}
+
+
+TEST(RestApi, AnswerByteRanges)
+{
+  std::string content;
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    content.push_back('a' + (i % 26));
+  }
+
+  std::vector<HttpToolbox::ByteRange> r;
+
+  {
+    ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=10-19", content.size()));
+
+    RecordingHttpStream s;
+    HttpOutput output(s, false);
+    StringRangesReader reader(content);
+    output.AnswerByteRanges("text/plain", content.size(), r, reader);
+
+    ASSERT_EQ(HttpStatus_206_PartialContent, s.GetStatus());
+    ASSERT_EQ(content.substr(10, 10), s.GetBody());
+    ASSERT_EQ(1u, reader.GetCount());
+    ASSERT_TRUE(s.HasHeader("Content-Range: bytes 10-19/100"));
+    ASSERT_TRUE(s.HasHeader("Content-Length: 10"));
+  }
+
+  {
+    ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=90-,0-4", content.size()));
+
+    RecordingHttpStream s;
+    HttpOutput output(s, false);
+    StringRangesReader reader(content);
+    output.AnswerByteRanges("text/plain", content.size(), r, reader);
+
+    ASSERT_EQ(HttpStatus_206_PartialContent, s.GetStatus());
+    ASSERT_TRUE(s.HasHeader("Content-Length: " + boost::lexical_cast<std::string>(s.GetBody().size())));
+
+    // The parts are read one by one, and streamed in several chunks
+    ASSERT_EQ(2u, reader.GetCount());
+    ASSERT_LT(1u, s.GetBodyChunks());
+
+    const std::string& body = s.GetBody();
+    ASSERT_EQ(0u, body.find("--"));
+    const std::string boundary = body.substr(2, body.find("\r\n") - 2);
+    ASSERT_TRUE(s.HasHeader("Content-Type: multipart/byteranges; boundary=" + boundary));
+
+    ASSERT_EQ("--" + boundary + "\r\n" +
+              "Content-Type: text/plain\r\n" +
+              "Content-Range: bytes 0-4/100\r\n\r\n" +
+              content.substr(0, 5) + "\r\n" +
+              "--" + boundary + "\r\n" +
+              "Content-Type: text/plain\r\n" +
+              "Content-Range: bytes 90-99/100\r\n\r\n" +
+              content.substr(90) + "\r\n" +
+              "--" + boundary + "--\r\n", body);
+  }
+
+  {
+    ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=200-", content.size()));
+    ASSERT_TRUE(r.empty());
+
+    RecordingHttpStream s;
+    HttpOutput output(s, false);
+    StringRangesReader reader(content);
+    output.AnswerByteRanges("text/plain", content.size(), r, reader);
+    ASSERT_EQ(HttpStatus_416_RequestedRangeNotSatisfiable, s.GetStatus());
+    ASSERT_TRUE(s.HasHeader("Content-Range: bytes */100"));
+    ASSERT_EQ(0u, reader.GetCount());
+  }
+
+  {
+    // Large ranges are read by blocks of 4MB
+    const std::string large(9 * 1024 * 1024, 'x');
+    ASSERT_TRUE(HttpToolbox::ParseRange(r, "bytes=1-", large.size()));
+
+    RecordingHttpStream s;
+    HttpOutput output(s, false);
+    StringRangesReader reader(large);
+    output.AnswerByteRanges("text/plain", large.size(), r, reader);
+    ASSERT_EQ(HttpStatus_206_PartialContent, s.GetStatus());
+    ASSERT_EQ(large.size() - 1, s.GetBody().size());
+    ASSERT_EQ(3u, reader.GetCount());
+  }
+}
+
+
+TEST(RestApi, IsNoneMatch)
+{
+  HttpToolbox::Arguments headers;
+  ASSERT_FALSE(HttpToolbox::IsNoneMatch(headers, "\"a\""));
+
+  headers["if-none-match"] = "\"a\"";
+  ASSERT_TRUE(HttpToolbox::IsNoneMatch(headers, "\"a\""));
+  ASSERT_FALSE(HttpToolbox::IsNoneMatch(headers, "\"b\""));
+
+  headers["if-none-match"] = "\"b\", W/\"a\"";
+  ASSERT_TRUE(HttpToolbox::IsNoneMatch(headers, "\"a\""));
+  ASSERT_TRUE(HttpToolbox::IsNoneMatch(headers, "\"b\""));
+  ASSERT_FALSE(HttpToolbox::IsNoneMatch(headers, "\"c\""));
+
+  headers["if-none-match"] = "*";
+  ASSERT_TRUE(HttpToolbox::IsNoneMatch(headers, "\"c\""));
+}
+
+
+TEST(RestApi, AnswerNotModified)
+{
+  RecordingHttpStream s;
+
+  {
+    HttpOutput output(s, false);
+    RestApiOutput answer(output, HttpMethod_Get);
+    output.AddHeader("ETag", "\"a\"");
+    answer.AnswerNotModified();
+  }
+
+  ASSERT_EQ(HttpStatus_304_NotModified, s.GetStatus());
+  ASSERT_TRUE(s.HasHeader("ETag: \"a\""));
+  ASSERT_EQ(std::string::npos, s.GetHeader().find("Content-Length"));
+  ASSERT_TRUE(s.GetBody().empty());
+}
+
+
 TEST(RestApi, RestApiPath)
 {
   HttpToolbox::Arguments args;
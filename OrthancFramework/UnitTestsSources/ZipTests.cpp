@@ -177,8 +177,8 @@ TEST(HierarchicalZipWriter, Basic)
 
      # unzip -v hello2.zip 
 
-     => There must be 6 files. The first 3 files must have a negative
-     compression ratio.
+     => There must be 6 files. The first 3 files must be stored
+     without compression (method "Stored").
 
   **/
 }
@@ -318,6 +318,129 @@ TEST(ZipWriter, Stream)
 }
 
 
+TEST(ZipWriter, ParallelCompression)
+{
+  // Larger than the chunks that are compressed in parallel, and compressible
+  std::string large;
+  large.resize(3 * 1024 * 1024 + 17);
+  for (size_t i = 0; i < large.size(); i++)
+  {
+    large[i] = (rand() % 4 == 0 ? rand() % 256 : 'a' + (i % 7));
+  }
+
+  for (unsigned int threads = 1; threads <= 4; threads *= 2)
+  {
+    for (int zip64 = 0; zip64 < 2; zip64++)
+    {
+      std::string memory;
+
+      {
+        ZipWriter w;
+        w.SetMemoryOutput(memory, (zip64 == 1));
+        w.SetCompressionThreads(threads);
+        ASSERT_EQ(threads, w.GetCompressionThreads());
+        w.Open();
+
+        w.OpenFile("large");
+        w.Write(large.c_str(), 1000);  // Several calls to "Write()"
+        w.Write(large.c_str() + 1000, large.size() - 1000);
+        w.OpenFile("empty");
+        w.OpenFile("hello");
+        w.Write("Hello world");
+        w.OpenFile("stored", 0 /* no compression */);
+        w.Write(large);
+        ASSERT_THROW(w.SetCompressionThreads(0), OrthancException);
+        w.Close();
+
+        ASSERT_EQ(w.GetArchiveSize(), memory.size());
+      }
+
+      // The CRC-32 of each file is checked by the reader
+      std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(memory));
+      ASSERT_EQ(4u, reader->GetFilesCount());
+
+      std::string filename, content;
+      ASSERT_TRUE(reader->ReadNextFile(filename, content));
+      ASSERT_EQ("large", filename);
+      ASSERT_TRUE(content == large);
+      ASSERT_TRUE(reader->ReadNextFile(filename, content));
+      ASSERT_EQ("empty", filename);
+      ASSERT_TRUE(content.empty());
+      ASSERT_TRUE(reader->ReadNextFile(filename, content));
+      ASSERT_EQ("hello", filename);
+      ASSERT_EQ("Hello world", content);
+      ASSERT_TRUE(reader->ReadNextFile(filename, content));
+      ASSERT_EQ("stored", filename);
+      ASSERT_TRUE(content == large);
+      ASSERT_FALSE(reader->ReadNextFile(filename, content));
+
+      // "large" is compressed, whereas "stored" is not
+      ASSERT_LT(memory.size(), 2 * large.size());
+      ASSERT_GT(memory.size(), large.size());
+    }
+  }
+}
+
+
+TEST(ZipWriter, ParallelCompressionCanceled)
+{
+  std::string large;
+  large.resize(3 * 1024 * 1024 + 17);
+  for (size_t i = 0; i < large.size(); i++)
+  {
+    large[i] = rand() % 256;
+  }
+
+  std::string memory;
+
+  {
+    ZipWriter w;
+    w.SetMemoryOutput(memory, false);
+    w.SetCompressionThreads(2);
+    w.Open();
+
+    w.OpenFile("large");
+    w.Write(large);
+    w.CancelStream();
+
+    // The archive is incomplete, which must not be reported as a success
+    ASSERT_THROW(w.Close(), OrthancException);
+    ASSERT_FALSE(w.IsOpen());
+    w.Close();  // Closing again is a no-op
+  }
+
+  ASSERT_THROW(ZipReader::CreateFromMemory(memory), OrthancException);
+}
+
+
+TEST(HierarchicalZipWriter, ParallelCompression)
+{
+  std::string memory;
+
+  {
+    std::unique_ptr<HierarchicalZipWriter> w(HierarchicalZipWriter::CreateToMemory(memory, false));
+    w->SetCompressionThreads(2);
+    w->OpenDirectory("a");
+    w->OpenFile("hello");
+    w->Write("Hello");
+    w->OpenFile("hello", 0);
+    w->Write("World");
+    w->CloseDirectory();
+    w->Close();
+  }
+
+  std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(memory));
+
+  std::string filename, content;
+  ASSERT_TRUE(reader->ReadNextFile(filename, content));
+  ASSERT_EQ("a/hello", filename);
+  ASSERT_EQ("Hello", content);
+  ASSERT_TRUE(reader->ReadNextFile(filename, content));
+  ASSERT_EQ("a/hello-2", filename);
+  ASSERT_EQ("World", content);
+  ASSERT_FALSE(reader->ReadNextFile(filename, content));
+}
+
 namespace Orthanc
 {
   // The namespace is necessary because of FRIEND_TEST
@@ -1429,6 +1429,40 @@ namespace Orthanc
         CheckSuccess(that_.extensions_.tagMostRecentPatient(that_.payload_, patient));
       }
     }
+
+
+    virtual bool LookupResourceStatistics(uint64_t& /*countStudies*/,
+                                          uint64_t& /*countSeries*/,
+                                          uint64_t& /*countInstances*/,
+                                          uint64_t& /*diskSize*/,
+                                          uint64_t& /*uncompressedSize*/,
+                                          uint64_t& /*dicomDiskSize*/,
+                                          uint64_t& /*dicomUncompressedSize*/,
+                                          int64_t /*id*/) ORTHANC_OVERRIDE
+    {
+      // Not available in the SDK of database plugins, the statistics
+      // are computed by walking the tree of resources
+      return false;
+    }
+
+
+    virtual void EnqueueStorageDeletion(const std::string& /*uuid*/,
+                                        FileContentType /*type*/) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Cf. "HasStorageDeletionQueue()"
+    }
+
+
+    virtual void GetStorageDeletions(std::map<std::string, FileContentType>& /*target*/) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Cf. "HasStorageDeletionQueue()"
+    }
+
+
+    virtual void RemoveStorageDeletions(const std::list<std::string>& /*uuids*/) ORTHANC_OVERRIDE
+    {
+      throw OrthancException(ErrorCode_NotImplemented);  // Cf. "HasStorageDeletionQueue()"
+    }
   };
 
 
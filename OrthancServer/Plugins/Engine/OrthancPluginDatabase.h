@@ -124,6 +124,11 @@ namespace Orthanc
       return false;  // No support for revisions in old API
     }
 
+    virtual bool HasStorageDeletionQueue() const ORTHANC_OVERRIDE
+    {
+      return false;  // The attachments are synchronously removed
+    }
+
     void AnswerReceived(const _OrthancPluginDatabaseAnswer& answer);
   };
 }
@@ -93,6 +93,11 @@ namespace Orthanc
                          IStorageArea& storageArea) ORTHANC_OVERRIDE;    
 
     virtual bool HasRevisionsSupport() const ORTHANC_OVERRIDE;
+
+    virtual bool HasStorageDeletionQueue() const ORTHANC_OVERRIDE
+    {
+      return false;  // The attachments are synchronously removed
+    }
   };
 }
 
@@ -61,6 +61,7 @@
 #include "../../../OrthancFramework/Sources/Lua/LuaFunctionCall.h"
 #include "../../../OrthancFramework/Sources/MallocMemoryBuffer.h"
 #include "../../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "../../../OrthancFramework/Sources/MultiThreading/Semaphore.h"
 #include "../../../OrthancFramework/Sources/OrthancException.h"
 #include "../../../OrthancFramework/Sources/SerializationToolbox.h"
 #include "../../../OrthancFramework/Sources/StringMemoryBuffer.h"
@@ -76,7 +77,9 @@
 #include "PluginsEnumerations.h"
 #include "PluginsJob.h"
 
+#include <boost/lexical_cast.hpp>
 #include <boost/regex.hpp>
+#include <ctype.h>
 #include <dcmtk/dcmdata/dcdict.h>
 #include <dcmtk/dcmdata/dcdicent.h>
 
@@ -949,27 +952,56 @@ namespace Orthanc
     class RestCallback : public boost::noncopyable
     {
     private:
-      boost::regex              regex_;
-      OrthancPluginRestCallback callback_;
-      bool                      mutualExclusion_;
-
-      OrthancPluginErrorCode InvokeInternal(PluginHttpOutput& output,
+      boost::regex                regex_;
+      OrthancPluginRestCallback   callback_;
+      bool                        mutualExclusion_;
+      std::string                 pluginName_;
+      std::unique_ptr<Semaphore>  concurrency_;  // New in Orthanc 1.9.6
+      std::string                 waitMetricsName_;
+      std::string                 durationMetricsName_;
+
+      OrthancPluginErrorCode InvokeInternal(MetricsRegistry* metrics,
+                                            const boost::posix_time::ptime& start,
+                                            PluginHttpOutput& output,
                                             const std::string& flatUri,
                                             const OrthancPluginHttpRequest& request)
       {
-        return callback_(reinterpret_cast<OrthancPluginRestOutput*>(&output), 
-                         flatUri.c_str(), 
-                         &request);
+        const boost::posix_time::ptime acquired = boost::posix_time::microsec_clock::universal_time();
+
+        OrthancPluginErrorCode error = callback_(reinterpret_cast<OrthancPluginRestOutput*>(&output), 
+                                                 flatUri.c_str(), 
+                                                 &request);
+
+        if (metrics != NULL)
+        {
+          const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+          metrics->SetValue(waitMetricsName_, static_cast<float>((acquired - start).total_milliseconds()),
+                            MetricsType_MaxOver10Seconds);
+          metrics->SetValue(durationMetricsName_, static_cast<float>((end - acquired).total_milliseconds()),
+                            MetricsType_MaxOver10Seconds);
+        }
+
+        return error;
       }
 
     public:
       RestCallback(const char* regex,
                    OrthancPluginRestCallback callback,
-                   bool mutualExclusion) :
+                   bool mutualExclusion,
+                   const std::string& pluginName,
+                   unsigned int maxConcurrency,
+                   const std::string& metricsSuffix) :
         regex_(regex),
         callback_(callback),
-        mutualExclusion_(mutualExclusion)
+        mutualExclusion_(mutualExclusion),
+        pluginName_(pluginName),
+        waitMetricsName_("orthanc_plugins_rest_wait_ms_" + metricsSuffix),
+        durationMetricsName_("orthanc_plugins_rest_duration_ms_" + metricsSuffix)
       {
+        if (maxConcurrency != 0)
+        {
+          concurrency_.reset(new Semaphore(maxConcurrency));
+        }
       }
 
       const boost::regex& GetRegularExpression() const
@@ -977,19 +1009,34 @@ namespace Orthanc
         return regex_;
       }
 
+      const std::string& GetPluginName() const
+      {
+        return pluginName_;
+      }
+
       OrthancPluginErrorCode Invoke(boost::recursive_mutex& invokationMutex,
+                                    MetricsRegistry* metrics,
                                     PluginHttpOutput& output,
                                     const std::string& flatUri,
                                     const OrthancPluginHttpRequest& request)
       {
-        if (mutualExclusion_)
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        if (concurrency_.get() != NULL)
+        {
+          // The concurrency of the plugin is explicitly configured,
+          // which replaces the global mutual exclusion
+          Semaphore::Locker locker(*concurrency_);
+          return InvokeInternal(metrics, start, output, flatUri, request);
+        }
+        else if (mutualExclusion_)
         {
           boost::recursive_mutex::scoped_lock lock(invokationMutex);
-          return InvokeInternal(output, flatUri, request);
+          return InvokeInternal(metrics, start, output, flatUri, request);
         }
         else
         {
-          return InvokeInternal(output, flatUri, request);
+          return InvokeInternal(metrics, start, output, flatUri, request);
         }
       }
     };
@@ -1157,11 +1204,26 @@ namespace Orthanc
     }
 
 
+    MetricsRegistry* LookupMetricsRegistry()
+    {
+      boost::mutex::scoped_lock lock(contextMutex_);
+
+      if (context_ == NULL)
+      {
+        return NULL;
+      }
+      else
+      {
+        return &context_->GetMetricsRegistry();
+      }
+    }
+
+
     typedef std::pair<std::string, _OrthancPluginProperty>  Property;
     typedef std::list<RestCallback*>  RestCallbacks;
     typedef std::list<ChunkedRestCallback*>  ChunkedRestCallbacks;
     typedef std::list<OrthancPluginOnStoredInstanceCallback>  OnStoredCallbacks;
-    typedef std::list<OrthancPluginOnChangeCallback>  OnChangeCallbacks;
+    typedef std::list<OnChangeListener*>  OnChangeCallbacks;
     typedef std::list<OrthancPluginIncomingHttpRequestFilter>  IncomingHttpRequestFilters;
     typedef std::list<OrthancPluginIncomingHttpRequestFilter2>  IncomingHttpRequestFilters2;
     typedef std::list<OrthancPluginIncomingDicomInstanceFilter>  IncomingDicomInstanceFilters;
@@ -1229,6 +1291,75 @@ namespace Orthanc
 
 
   
+  class OrthancPlugins::OnChangeListener : public IServerListener
+  {
+  private:
+    OrthancPlugins&                that_;
+    OrthancPluginOnChangeCallback  callback_;
+    std::string                    pluginName_;
+    std::string                    description_;
+    boost::mutex                   mutex_;  // A callback is never invoked concurrently with itself
+
+  public:
+    OnChangeListener(OrthancPlugins& that,
+                     OrthancPluginOnChangeCallback callback,
+                     const std::string& pluginName,
+                     const std::string& description) :
+      that_(that),
+      callback_(callback),
+      pluginName_(pluginName),
+      description_(description)
+    {
+    }
+
+    const std::string& GetPluginName() const
+    {
+      return pluginName_;
+    }
+
+    const std::string& GetDescription() const
+    {
+      return description_;
+    }
+
+    void Invoke(OrthancPluginChangeType changeType,
+                OrthancPluginResourceType resourceType,
+                const char* resource)
+    {
+      OrthancPluginErrorCode error;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        error = callback_(changeType, resourceType, resource);
+      }
+
+      if (error != OrthancPluginErrorCode_Success)
+      {
+        that_.GetErrorDictionary().LogError(error, true);
+        throw OrthancException(static_cast<ErrorCode>(error));
+      }
+    }
+
+    virtual void SignalStoredInstance(const std::string& publicId,
+                                      const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
+    {
+      // Only the changes are delivered to this listener
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE
+    {
+      Invoke(Plugins::Convert(change.GetChangeType()),
+             Plugins::Convert(change.GetResourceType()),
+             change.GetPublicId().c_str());
+    }
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+  };
+
+
   class OrthancPlugins::WorklistHandler : public IWorklistRequestHandler
   {
   private:
@@ -1772,6 +1903,12 @@ namespace Orthanc
     {
       delete *it;
     } 
+
+    for (PImpl::OnChangeCallbacks::iterator it = pimpl_->onChangeCallbacks_.begin(); 
+         it != pimpl_->onChangeCallbacks_.end(); ++it)
+    {
+      delete *it;
+    } 
   }
 
 
@@ -2107,7 +2244,8 @@ namespace Orthanc
 
     assert(callback != NULL);
     OrthancPluginErrorCode error = callback->Invoke
-      (pimpl_->restCallbackInvokationMutex_, pluginOutput, matcher.GetFlatUri(), converter.GetRequest());
+      (pimpl_->restCallbackInvokationMutex_, pimpl_->LookupMetricsRegistry(),
+       pluginOutput, matcher.GetFlatUri(), converter.GetRequest());
 
     pluginOutput.Close(error, GetErrorDictionary());
     return true;
@@ -2210,8 +2348,7 @@ namespace Orthanc
 
 
   void OrthancPlugins::SignalStoredInstance(const std::string& instanceId,
-                                            const DicomInstanceToStore& instance,
-                                            const Json::Value& simplifiedTags)
+                                            const DicomInstanceToStore& instance)
   {
     DicomInstanceFromCallback wrapped(instance);
     
@@ -2234,8 +2371,7 @@ namespace Orthanc
   }
 
 
-  bool OrthancPlugins::FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                              const Json::Value& simplified)
+  bool OrthancPlugins::FilterIncomingInstance(const DicomInstanceToStore& instance)
   {
     DicomInstanceFromCallback wrapped(instance);
     
@@ -2268,17 +2404,28 @@ namespace Orthanc
   {
     boost::recursive_mutex::scoped_lock lock(pimpl_->changeCallbackMutex_);
 
-    for (std::list<OrthancPluginOnChangeCallback>::const_iterator 
+    for (PImpl::OnChangeCallbacks::const_iterator 
            callback = pimpl_->onChangeCallbacks_.begin(); 
          callback != pimpl_->onChangeCallbacks_.end(); ++callback)
     {
-      OrthancPluginErrorCode error = (*callback) (changeType, resourceType, resource);
+      assert(*callback != NULL);
+      (*callback)->Invoke(changeType, resourceType, resource);
+    }
+  }
 
-      if (error != OrthancPluginErrorCode_Success)
-      {
-        GetErrorDictionary().LogError(error, true);
-        throw OrthancException(static_cast<ErrorCode>(error));
-      }
+
+  void OrthancPlugins::GetOnChangeListeners(OnChangeListeners& target) const
+  {
+    boost::recursive_mutex::scoped_lock lock(pimpl_->changeCallbackMutex_);
+
+    target.clear();
+
+    for (PImpl::OnChangeCallbacks::const_iterator 
+           callback = pimpl_->onChangeCallbacks_.begin(); 
+         callback != pimpl_->onChangeCallbacks_.end(); ++callback)
+    {
+      assert(*callback != NULL);
+      target.push_back(std::make_pair(*callback, (*callback)->GetDescription()));
     }
   }
 
@@ -2293,20 +2440,93 @@ namespace Orthanc
 
 
 
-  void OrthancPlugins::RegisterRestCallback(const void* parameters,
+  static unsigned int GetRestCallbacksConcurrency(const std::string& pluginName)
+  {
+    static const char* const CONCURRENCY = "PluginsRestConcurrency";
+
+    OrthancConfiguration::ReaderLock lock;
+
+    const Json::Value& configuration = lock.GetJson();
+    if (configuration.isMember(CONCURRENCY))
+    {
+      const Json::Value& concurrency = configuration[CONCURRENCY];
+
+      if (concurrency.type() != Json::objectValue)
+      {
+        throw OrthancException(ErrorCode_BadFileFormat, "The configuration option \"" +
+                               std::string(CONCURRENCY) + "\" must be an object");
+      }
+
+      if (concurrency.isMember(pluginName))
+      {
+        if (concurrency[pluginName].isInt() &&
+            concurrency[pluginName].asInt() >= 0)
+        {
+          return concurrency[pluginName].asUInt();
+        }
+        else
+        {
+          throw OrthancException(ErrorCode_BadFileFormat, "The configuration option \"" +
+                                 std::string(CONCURRENCY) + "\" must map the plugin \"" +
+                                 pluginName + "\" to a non-negative integer (0 = serialized)");
+        }
+      }
+    }
+
+    return 0;  // Not configured
+  }
+
+
+  void OrthancPlugins::RegisterRestCallback(SharedLibrary& plugin,
+                                            const void* parameters,
                                             bool mutualExclusion)
   {
     const _OrthancPluginRestCallback& p = 
       *reinterpret_cast<const _OrthancPluginRestCallback*>(parameters);
 
-    CLOG(INFO, PLUGINS) << "Plugin has registered a REST callback "
-                        << (mutualExclusion ? "with" : "without")
-                        << " mutual exclusion on: " 
-                        << p.pathRegularExpression;
+    const std::string pluginName = PluginsManager::GetPluginName(plugin);
+    const unsigned int maxConcurrency = GetRestCallbacksConcurrency(pluginName);
 
     {
       boost::unique_lock<boost::shared_mutex> lock(pimpl_->restCallbackRegistrationMutex_);
-      pimpl_->restCallbacks_.push_back(new PImpl::RestCallback(p.pathRegularExpression, p.callback, mutualExclusion));
+
+      // The metrics are named after the plugin and the index of the
+      // callback, as the regular expressions are not valid metrics names
+      unsigned int index = 0;
+      for (PImpl::RestCallbacks::const_iterator it = pimpl_->restCallbacks_.begin();
+           it != pimpl_->restCallbacks_.end(); ++it)
+      {
+        if ((*it)->GetPluginName() == pluginName)
+        {
+          index++;
+        }
+      }
+
+      std::string suffix;
+      for (size_t i = 0; i < pluginName.size(); i++)
+      {
+        const unsigned char c = static_cast<unsigned char>(pluginName[i]);
+        suffix.push_back(isalnum(c) ? static_cast<char>(tolower(c)) : '_');
+      }
+
+      suffix += "_" + boost::lexical_cast<std::string>(index);
+
+      if (maxConcurrency != 0)
+      {
+        CLOG(INFO, PLUGINS) << "Plugin " << pluginName << " has registered a REST callback with at most "
+                            << maxConcurrency << " concurrent invocation(s) on: "
+                            << p.pathRegularExpression << " (metrics suffix: " << suffix << ")";
+      }
+      else
+      {
+        CLOG(INFO, PLUGINS) << "Plugin " << pluginName << " has registered a REST callback "
+                            << (mutualExclusion ? "with" : "without")
+                            << " mutual exclusion on: " 
+                            << p.pathRegularExpression << " (metrics suffix: " << suffix << ")";
+      }
+
+      pimpl_->restCallbacks_.push_back(new PImpl::RestCallback(p.pathRegularExpression, p.callback, mutualExclusion,
+                                                               pluginName, maxConcurrency, suffix));
     }
   }
 
@@ -2336,13 +2556,37 @@ namespace Orthanc
   }
 
 
-  void OrthancPlugins::RegisterOnChangeCallback(const void* parameters)
+  void OrthancPlugins::RegisterOnChangeCallback(SharedLibrary& plugin,
+                                                const void* parameters)
   {
     const _OrthancPluginOnChangeCallback& p = 
       *reinterpret_cast<const _OrthancPluginOnChangeCallback*>(parameters);
 
-    CLOG(INFO, PLUGINS) << "Plugin has registered an OnChange callback";
-    pimpl_->onChangeCallbacks_.push_back(p.callback);
+    const std::string pluginName = PluginsManager::GetPluginName(plugin);
+
+    CLOG(INFO, PLUGINS) << "Plugin " << pluginName << " has registered an OnChange callback";
+
+    boost::recursive_mutex::scoped_lock lock(pimpl_->changeCallbackMutex_);
+
+    // The description must be unique, as it is part of the name of the metrics
+    size_t count = 0;
+    for (PImpl::OnChangeCallbacks::const_iterator 
+           it = pimpl_->onChangeCallbacks_.begin(); it != pimpl_->onChangeCallbacks_.end(); ++it)
+    {
+      assert(*it != NULL);
+      if ((*it)->GetPluginName() == pluginName)
+      {
+        count++;
+      }
+    }
+
+    std::string description = "plugin " + pluginName;
+    if (count > 0)
+    {
+      description += " " + boost::lexical_cast<std::string>(count + 1);
+    }
+
+    pimpl_->onChangeCallbacks_.push_back(new OnChangeListener(*this, p.callback, pluginName, description));
   }
 
 
@@ -4910,11 +5154,11 @@ namespace Orthanc
     switch (service)
     {
       case _OrthancPluginService_RegisterRestCallback:
-        RegisterRestCallback(parameters, true);
+        RegisterRestCallback(plugin, parameters, true);
         return true;
 
       case _OrthancPluginService_RegisterRestCallbackNoLock:
-        RegisterRestCallback(parameters, false);
+        RegisterRestCallback(plugin, parameters, false);
         return true;
 
       case _OrthancPluginService_RegisterChunkedRestCallback:
@@ -4926,7 +5170,7 @@ namespace Orthanc
         return true;
 
       case _OrthancPluginService_RegisterOnChangeCallback:
-        RegisterOnChangeCallback(parameters);
+        RegisterOnChangeCallback(plugin, parameters);
         return true;
 
       case _OrthancPluginService_RegisterWorklistCallback:
@@ -99,8 +99,10 @@ namespace Orthanc
     class DicomInstanceFromCallback;
     class DicomInstanceFromBuffer;
     class DicomInstanceFromTranscoded;
+    class OnChangeListener;
     
-    void RegisterRestCallback(const void* parameters,
+    void RegisterRestCallback(SharedLibrary& plugin,
+                              const void* parameters,
                               bool lock);
 
     void RegisterChunkedRestCallback(const void* parameters);
@@ -113,7 +115,8 @@ namespace Orthanc
 
     void RegisterOnStoredInstanceCallback(const void* parameters);
 
-    void RegisterOnChangeCallback(const void* parameters);
+    void RegisterOnChangeCallback(SharedLibrary& plugin,
+                                  const void* parameters);
 
     void RegisterWorklistCallback(const void* parameters);
 
@@ -273,11 +276,9 @@ namespace Orthanc
     virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE;
     
     virtual void SignalStoredInstance(const std::string& instanceId,
-                                      const DicomInstanceToStore& instance,
-                                      const Json::Value& simplifiedTags) ORTHANC_OVERRIDE;
+                                      const DicomInstanceToStore& instance) ORTHANC_OVERRIDE;
 
-    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                        const Json::Value& simplified) ORTHANC_OVERRIDE;
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance) ORTHANC_OVERRIDE;
 
     bool HasStorageArea() const;
 
@@ -302,6 +303,16 @@ namespace Orthanc
 
     PluginsErrorDictionary& GetErrorDictionary();
 
+    /**
+     * Each OnChange callback is a distinct listener of the changes,
+     * which gives it its own queue and thread in the dispatcher of the
+     * changes, so that a slow plugin does not delay the others (new in
+     * Orthanc 1.9.6). The listeners are owned by this object.
+     **/
+    typedef std::list< std::pair<IServerListener*, std::string> >  OnChangeListeners;
+
+    void GetOnChangeListeners(OnChangeListeners& target /* out: listener and description */) const;
+
     void SignalOrthancStarted()
     {
       SignalChangeInternal(OrthancPluginChangeType_OrthancStarted, OrthancPluginResourceType_None, NULL);
@@ -0,0 +1,473 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "ChangesDispatcher.h"
+
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "../../OrthancFramework/Sources/Toolbox.h"
+#include "IServerListener.h"
+
+#include <boost/thread.hpp>
+#include <ctype.h>
+#include <deque>
+
+
+namespace Orthanc
+{
+  // Maximum number of changes that are dequeued at once by a listener
+  static const size_t BATCH_SIZE = 64;
+
+  /**
+   * With the "Block" policy, the producer waits at most this delay
+   * for some room in a full queue, after which the change is
+   * dropped. The changes are enqueued once the database transaction
+   * has released its lock, so a callback that accesses the database
+   * can always drain its queue: This delay is only a safety net.
+   **/
+  static const unsigned int BLOCK_TIMEOUT_SECONDS = 10;
+
+
+  class ChangesDispatcher::ListenerQueue : public boost::noncopyable
+  {
+  private:
+    IServerListener&                 listener_;
+    std::string                      description_;
+    MetricsRegistry&                 metrics_;
+    MetricsRegistry::SharedMetrics&  droppedMetrics_;
+    std::string                      sizeMetricsName_;
+    std::string                      durationMetricsName_;
+    size_t                           maxSize_;
+    ChangesOverflowPolicy            policy_;
+
+    boost::mutex                     mutex_;
+    boost::condition_variable        notEmpty_;
+    boost::condition_variable        notFull_;  // Also signals the end of a batch
+    std::deque<ServerIndexChange*>   queue_;
+    bool                             isBusy_;   // A batch is being delivered
+    bool                             done_;
+    uint64_t                         droppedCount_;
+    boost::thread                    worker_;
+
+    void PublishMetrics()
+    {
+      // WARNING: "mutex_" must be locked
+      metrics_.SetValue(sizeMetricsName_, static_cast<float>(queue_.size()), MetricsType_MaxOver10Seconds);
+    }
+
+    void SignalDropped()
+    {
+      // WARNING: "mutex_" must be locked
+      droppedCount_++;
+      droppedMetrics_.Add(1);
+
+      if (droppedCount_ == 1 ||
+          droppedCount_ % 1000 == 0)
+      {
+        LOG(WARNING) << "The queue of changes for the " << description_ << " callbacks is full, "
+                     << droppedCount_ << " change(s) have been dropped so far";
+      }
+    }
+
+    void Deliver(const ServerIndexChange& change)
+    {
+      try
+      {
+        try
+        {
+          MetricsRegistry::Timer timer(metrics_, durationMetricsName_);
+          listener_.SignalChange(change);
+        }
+        catch (std::bad_alloc&)
+        {
+          LOG(ERROR) << "Not enough memory while signaling a change";
+        }
+        catch (...)
+        {
+          throw OrthancException(ErrorCode_InternalError);
+        }
+      }
+      catch (OrthancException& e)
+      {
+        LOG(ERROR) << "Error in the " << description_
+                   << " callback while signaling a change: " << e.What()
+                   << " (code " << e.GetErrorCode() << ")";
+      }
+    }
+
+    bool IsDone()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return done_;
+    }
+
+    static void Worker(ListenerQueue* that)
+    {
+      for (;;)
+      {
+        std::vector<ServerIndexChange*> batch;
+        batch.reserve(BATCH_SIZE);
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (that->queue_.empty() &&
+                 !that->done_)
+          {
+            that->notEmpty_.wait(lock);
+          }
+
+          if (that->done_)
+          {
+            return;
+          }
+
+          while (!that->queue_.empty() &&
+                 batch.size() < BATCH_SIZE)
+          {
+            batch.push_back(that->queue_.front());
+            that->queue_.pop_front();
+          }
+
+          that->isBusy_ = true;
+          that->PublishMetrics();
+        }
+
+        that->notFull_.notify_all();
+
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+          assert(batch[i] != NULL);
+
+          if (!that->IsDone())
+          {
+            that->Deliver(*batch[i]);
+          }
+
+          delete batch[i];
+        }
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          that->isBusy_ = false;
+        }
+
+        that->notFull_.notify_all();
+      }
+    }
+
+  public:
+    ListenerQueue(IServerListener& listener,
+                  const std::string& description,
+                  MetricsRegistry& metrics,
+                  MetricsRegistry::SharedMetrics& droppedMetrics,
+                  size_t maxSize,
+                  ChangesOverflowPolicy policy) :
+      listener_(listener),
+      description_(description),
+      metrics_(metrics),
+      droppedMetrics_(droppedMetrics),
+      maxSize_(maxSize),
+      policy_(policy),
+      isBusy_(false),
+      done_(false),
+      droppedCount_(0)
+    {
+      std::string suffix;
+      Toolbox::ToLowerCase(suffix, description);
+
+      // The description might contain the name of a plugin
+      for (size_t i = 0; i < suffix.size(); i++)
+      {
+        if (!isalnum(suffix[i]))
+        {
+          suffix[i] = '_';
+        }
+      }
+
+      sizeMetricsName_ = "orthanc_changes_queue_size_" + suffix;
+      durationMetricsName_ = "orthanc_changes_callback_duration_ms_" + suffix;
+
+      worker_ = boost::thread(Worker, this);
+    }
+
+    ~ListenerQueue()
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = true;
+      }
+
+      notEmpty_.notify_all();
+      notFull_.notify_all();
+
+      if (worker_.joinable())
+      {
+        worker_.join();
+      }
+
+      if (!queue_.empty())
+      {
+        LOG(INFO) << "Discarding " << queue_.size() << " change(s) that were not signaled to the "
+                  << description_ << " callbacks";
+      }
+
+      for (std::deque<ServerIndexChange*>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+      {
+        assert(*it != NULL);
+        delete *it;
+      }
+    }
+
+    IServerListener& GetListener() const
+    {
+      return listener_;
+    }
+
+    void Enqueue(const ServerIndexChange& change)
+    {
+      std::unique_ptr<ServerIndexChange> item(change.Clone());
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (maxSize_ != 0 &&
+            queue_.size() >= maxSize_)
+        {
+          switch (policy_)
+          {
+            case ChangesOverflowPolicy_Block:
+            {
+              if (boost::this_thread::get_id() == worker_.get_id())
+              {
+                // The callback of this listener has triggered a new
+                // change: Waiting for its own worker would deadlock
+                break;
+              }
+
+              const boost::system_time timeout = (boost::get_system_time() +
+                                                  boost::posix_time::seconds(BLOCK_TIMEOUT_SECONDS));
+
+              while (queue_.size() >= maxSize_ &&
+                     !done_)
+              {
+                if (!notFull_.timed_wait(lock, timeout))
+                {
+                  break;
+                }
+              }
+
+              if (queue_.size() >= maxSize_)
+              {
+                SignalDropped();
+                return;
+              }
+
+              break;
+            }
+
+            case ChangesOverflowPolicy_DropOldest:
+              assert(!queue_.empty());
+              delete queue_.front();
+              queue_.pop_front();
+              SignalDropped();
+              break;
+
+            case ChangesOverflowPolicy_DropNewest:
+              SignalDropped();
+              return;
+
+            default:
+              throw OrthancException(ErrorCode_ParameterOutOfRange);
+          }
+        }
+
+        queue_.push_back(item.release());
+        PublishMetrics();
+      }
+
+      notEmpty_.notify_one();
+    }
+
+    size_t GetSize()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return queue_.size();
+    }
+
+    void WaitEmpty()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while ((!queue_.empty() || isBusy_) &&
+             !done_)
+      {
+        notFull_.wait(lock);
+      }
+    }
+  };
+
+
+  ChangesDispatcher::ChangesDispatcher(MetricsRegistry& metrics) :
+    metrics_(metrics),
+    droppedMetrics_(metrics, "orthanc_changes_dropped_count", MetricsType_Default),
+    maxQueueSize_(0),
+    overflowPolicy_(ChangesOverflowPolicy_Block)
+  {
+  }
+
+
+  ChangesDispatcher::~ChangesDispatcher()
+  {
+    RemoveAllListeners();
+  }
+
+
+  void ChangesDispatcher::SetMaxQueueSize(size_t size)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    if (!queues_.empty())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    maxQueueSize_ = size;
+  }
+
+
+  void ChangesDispatcher::SetOverflowPolicy(ChangesOverflowPolicy policy)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    if (!queues_.empty())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    overflowPolicy_ = policy;
+  }
+
+
+  void ChangesDispatcher::AddListener(IServerListener& listener,
+                                      const std::string& description)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Queues::const_iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      if (&(*it)->GetListener() == &listener)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls, "This listener is already registered");
+      }
+    }
+
+    queues_.push_back(new ListenerQueue(listener, description, metrics_, droppedMetrics_,
+                                        maxQueueSize_, overflowPolicy_));
+  }
+
+
+  void ChangesDispatcher::RemoveListener(IServerListener& listener)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      if (&(*it)->GetListener() == &listener)
+      {
+        delete *it;
+        queues_.erase(it);
+        return;
+      }
+    }
+  }
+
+
+  void ChangesDispatcher::RemoveAllListeners()
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+
+    queues_.clear();
+  }
+
+
+  void ChangesDispatcher::Enqueue(const ServerIndexChange& change)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      (*it)->Enqueue(change);
+    }
+  }
+
+
+  size_t ChangesDispatcher::GetPendingCount()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    size_t count = 0;
+
+    for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      count += (*it)->GetSize();
+    }
+
+    return count;
+  }
+
+
+  void ChangesDispatcher::WaitEmpty()
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Queues::iterator it = queues_.begin(); it != queues_.end(); ++it)
+    {
+      assert(*it != NULL);
+      (*it)->WaitEmpty();
+    }
+  }
+}
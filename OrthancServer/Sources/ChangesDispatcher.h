@@ -0,0 +1,109 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "ServerEnumerations.h"
+
+#include <boost/thread/shared_mutex.hpp>
+#include <list>
+
+namespace Orthanc
+{
+  class IServerListener;
+  class ServerIndexChange;
+
+  /**
+   * Delivery of the changes to the listeners (Lua and plugins) of the
+   * server context (new in Orthanc 1.9.6). Each listener has its own
+   * queue and its own thread, so that a slow listener does not delay
+   * the others. The changes are dequeued by batches. If the size of
+   * the queues is bounded, the overflow policy decides whether the
+   * producer of the changes is slowed down, or whether changes are
+   * dropped.
+   **/
+  class ChangesDispatcher : public boost::noncopyable
+  {
+  private:
+    class ListenerQueue;
+
+    typedef std::list<ListenerQueue*>  Queues;
+
+    MetricsRegistry&                metrics_;
+    MetricsRegistry::SharedMetrics  droppedMetrics_;
+    size_t                          maxQueueSize_;
+    ChangesOverflowPolicy           overflowPolicy_;
+    boost::shared_mutex             mutex_;
+    Queues                          queues_;
+
+  public:
+    explicit ChangesDispatcher(MetricsRegistry& metrics);
+
+    ~ChangesDispatcher();
+
+    // Can only be invoked before adding the listeners, "0" means no limit
+    void SetMaxQueueSize(size_t size);
+
+    size_t GetMaxQueueSize() const
+    {
+      return maxQueueSize_;
+    }
+
+    // Can only be invoked before adding the listeners
+    void SetOverflowPolicy(ChangesOverflowPolicy policy);
+
+    ChangesOverflowPolicy GetOverflowPolicy() const
+    {
+      return overflowPolicy_;
+    }
+
+    void AddListener(IServerListener& listener,
+                     const std::string& description);
+
+    // The changes that are pending for this listener are discarded
+    void RemoveListener(IServerListener& listener);
+
+    void RemoveAllListeners();
+
+    void Enqueue(const ServerIndexChange& change);
+
+    // Total number of changes waiting for delivery, over all the listeners
+    size_t GetPendingCount();
+
+    // Wait until all the changes have been delivered (for unit tests)
+    void WaitEmpty();
+  };
+}
@@ -246,6 +246,38 @@ namespace Orthanc
                                            ResourceType& type,
                                            std::string& parentPublicId,
                                            const std::string& publicId) = 0;
+
+
+      /**
+       * Primitives introduced in Orthanc 1.9.6
+       **/
+
+      // Returns "false" if the database does not maintain aggregated
+      // statistics about the resources, in which case they must be
+      // computed by walking the tree of resources. The counters only
+      // cover the descendants of the resource, whereas the sizes also
+      // include the attachments of the resource itself.
+      virtual bool LookupResourceStatistics(uint64_t& countStudies,
+                                            uint64_t& countSeries,
+                                            uint64_t& countInstances,
+                                            uint64_t& diskSize,
+                                            uint64_t& uncompressedSize,
+                                            uint64_t& dicomDiskSize,
+                                            uint64_t& dicomUncompressedSize,
+                                            int64_t id) = 0;
+
+      // The 3 primitives below are only invoked if
+      // "HasStorageDeletionQueue()" returns "true". They give access
+      // to the attachments that must still be removed from the
+      // storage area, which are saved in the same transaction that
+      // deletes them from the database.
+      virtual void EnqueueStorageDeletion(const std::string& uuid,
+                                          FileContentType type) = 0;
+
+      virtual void GetStorageDeletions(std::map<std::string, FileContentType>& target) = 0;
+
+      // Removes a batch of attachments whose file is gone
+      virtual void RemoveStorageDeletions(const std::list<std::string>& uuids) = 0;
     };
 
 
@@ -270,5 +302,8 @@ namespace Orthanc
                          IStorageArea& storageArea) = 0;
 
     virtual bool HasRevisionsSupport() const = 0;
+
+    // New in Orthanc 1.9.6
+    virtual bool HasStorageDeletionQueue() const = 0;
   };
 }
@@ -0,0 +1,187 @@
+-- Orthanc - A Lightweight, RESTful DICOM Store
+-- Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+-- Department, University Hospital of Liege, Belgium
+-- Copyright (C) 2017-2021 Osimis S.A., Belgium
+--
+-- This program is free software: you can redistribute it and/or
+-- modify it under the terms of the GNU General Public License as
+-- published by the Free Software Foundation, either version 3 of the
+-- License, or (at your option) any later version.
+--
+-- In addition, as a special exception, the copyright holders of this
+-- program give permission to link the code of its release with the
+-- OpenSSL project's "OpenSSL" library (or with modified versions of it
+-- that use the same license as the "OpenSSL" library), and distribute
+-- the linked executables. You must obey the GNU General Public License
+-- in all respects for all of the code used other than "OpenSSL". If you
+-- modify file(s) with this exception, you may extend this exception to
+-- your version of the file(s), but you are not obligated to do so. If
+-- you do not wish to do so, delete this exception statement from your
+-- version. If you delete this exception statement from all source files
+-- in the program, then also delete it here.
+-- 
+-- This program is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+-- General Public License for more details.
+--
+-- You should have received a copy of the GNU General Public License
+-- along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+
+
+-- Aggregated statistics about the descendants of each resource (new
+-- in Orthanc 1.9.6). The sizes also include the attachments of the
+-- resource itself. The resource types are hard-coded: "2"
+-- corresponds to "ResourceType_Study", "3" to "ResourceType_Series",
+-- and "4" to "ResourceType_Instance" in C++, and the file type "1"
+-- corresponds to "FileContentType_Dicom".
+CREATE TABLE ResourceStatistics(
+       id INTEGER PRIMARY KEY REFERENCES Resources(internalId) ON DELETE CASCADE,
+       countStudies INTEGER,
+       countSeries INTEGER,
+       countInstances INTEGER,
+       compressedSize INTEGER,
+       uncompressedSize INTEGER,
+       dicomCompressedSize INTEGER,
+       dicomUncompressedSize INTEGER
+       );
+
+INSERT INTO GlobalProperties VALUES (8, 1);  -- GlobalProperty_ResourceStatisticsAreFast
+
+-- Migration of the existing resources: Each resource is paired with
+-- itself and with each of its (at most 3) ancestors
+INSERT INTO ResourceStatistics
+  SELECT a.ancestor,
+         SUM(a.descendant <> a.ancestor AND a.resourceType = 2),
+         SUM(a.descendant <> a.ancestor AND a.resourceType = 3),
+         SUM(a.descendant <> a.ancestor AND a.resourceType = 4),
+         IFNULL(SUM(f.compressedSize), 0),
+         IFNULL(SUM(f.uncompressedSize), 0),
+         IFNULL(SUM(f.dicomCompressedSize), 0),
+         IFNULL(SUM(f.dicomUncompressedSize), 0)
+  FROM (SELECT r.internalId AS descendant, r.internalId AS ancestor, r.resourceType AS resourceType
+        FROM Resources AS r
+        UNION ALL
+        SELECT r.internalId, r.parentId, r.resourceType
+        FROM Resources AS r WHERE r.parentId IS NOT NULL
+        UNION ALL
+        SELECT r.internalId, p1.parentId, r.resourceType
+        FROM Resources AS r
+        INNER JOIN Resources AS p1 ON p1.internalId = r.parentId
+        WHERE p1.parentId IS NOT NULL
+        UNION ALL
+        SELECT r.internalId, p2.parentId, r.resourceType
+        FROM Resources AS r
+        INNER JOIN Resources AS p1 ON p1.internalId = r.parentId
+        INNER JOIN Resources AS p2 ON p2.internalId = p1.parentId
+        WHERE p2.parentId IS NOT NULL) AS a
+  LEFT JOIN (SELECT id,
+                    SUM(compressedSize) AS compressedSize,
+                    SUM(uncompressedSize) AS uncompressedSize,
+                    SUM(CASE WHEN fileType = 1 THEN compressedSize ELSE 0 END) AS dicomCompressedSize,
+                    SUM(CASE WHEN fileType = 1 THEN uncompressedSize ELSE 0 END) AS dicomUncompressedSize
+             FROM AttachedFiles GROUP BY id) AS f
+  ON f.id = a.descendant
+  GROUP BY a.ancestor;
+
+CREATE TRIGGER ResourceStatisticsCreated
+AFTER INSERT ON Resources
+BEGIN
+  INSERT INTO ResourceStatistics VALUES (new.internalId, 0, 0, 0, 0, 0, 0, 0);
+END;
+
+-- The resources are created without a parent, and are attached to
+-- their parent afterward (cf. "AttachChild()")
+CREATE TRIGGER ResourceStatisticsAttachChild
+AFTER UPDATE OF parentId ON Resources
+FOR EACH ROW WHEN old.parentId IS NULL AND new.parentId IS NOT NULL
+BEGIN
+  UPDATE ResourceStatistics SET
+    countStudies = countStudies + (new.resourceType = 2) +
+      (SELECT c.countStudies FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    countSeries = countSeries + (new.resourceType = 3) +
+      (SELECT c.countSeries FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    countInstances = countInstances + (new.resourceType = 4) +
+      (SELECT c.countInstances FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    compressedSize = compressedSize +
+      (SELECT c.compressedSize FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    uncompressedSize = uncompressedSize +
+      (SELECT c.uncompressedSize FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    dicomCompressedSize = dicomCompressedSize +
+      (SELECT c.dicomCompressedSize FROM ResourceStatistics AS c WHERE c.id = new.internalId),
+    dicomUncompressedSize = dicomUncompressedSize +
+      (SELECT c.dicomUncompressedSize FROM ResourceStatistics AS c WHERE c.id = new.internalId)
+  WHERE id IN (new.parentId,
+               (SELECT parentId FROM Resources WHERE internalId = new.parentId),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId = new.parentId)));
+END;
+
+-- If the parent is deleted at the same time (i.e. "ON DELETE
+-- CASCADE"), it is not in the "Resources" table anymore, which
+-- prevents from updating the ancestors twice
+CREATE TRIGGER ResourceStatisticsDetachChild
+BEFORE DELETE ON Resources
+FOR EACH ROW WHEN old.parentId IS NOT NULL
+BEGIN
+  UPDATE ResourceStatistics SET
+    countStudies = countStudies - (old.resourceType = 2) -
+      (SELECT c.countStudies FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    countSeries = countSeries - (old.resourceType = 3) -
+      (SELECT c.countSeries FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    countInstances = countInstances - (old.resourceType = 4) -
+      (SELECT c.countInstances FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    compressedSize = compressedSize -
+      (SELECT c.compressedSize FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    uncompressedSize = uncompressedSize -
+      (SELECT c.uncompressedSize FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    dicomCompressedSize = dicomCompressedSize -
+      (SELECT c.dicomCompressedSize FROM ResourceStatistics AS c WHERE c.id = old.internalId),
+    dicomUncompressedSize = dicomUncompressedSize -
+      (SELECT c.dicomUncompressedSize FROM ResourceStatistics AS c WHERE c.id = old.internalId)
+  WHERE id IN (old.parentId,
+               (SELECT parentId FROM Resources WHERE internalId = old.parentId),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId = old.parentId)));
+END;
+
+CREATE TRIGGER AttachedFileIncrementStatistics
+AFTER INSERT ON AttachedFiles
+BEGIN
+  UPDATE ResourceStatistics SET
+    compressedSize = compressedSize + new.compressedSize,
+    uncompressedSize = uncompressedSize + new.uncompressedSize,
+    dicomCompressedSize = dicomCompressedSize +
+      (CASE WHEN new.fileType = 1 THEN new.compressedSize ELSE 0 END),
+    dicomUncompressedSize = dicomUncompressedSize +
+      (CASE WHEN new.fileType = 1 THEN new.uncompressedSize ELSE 0 END)
+  WHERE id IN (new.id,
+               (SELECT parentId FROM Resources WHERE internalId = new.id),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId = new.id)),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId =
+                 (SELECT parentId FROM Resources WHERE internalId = new.id))));
+END;
+
+-- If the resource is being deleted (i.e. "ON DELETE CASCADE"), its
+-- ancestors have already been updated by "ResourceStatisticsDetachChild"
+CREATE TRIGGER AttachedFileDecrementStatistics
+AFTER DELETE ON AttachedFiles
+BEGIN
+  UPDATE ResourceStatistics SET
+    compressedSize = compressedSize - old.compressedSize,
+    uncompressedSize = uncompressedSize - old.uncompressedSize,
+    dicomCompressedSize = dicomCompressedSize -
+      (CASE WHEN old.fileType = 1 THEN old.compressedSize ELSE 0 END),
+    dicomUncompressedSize = dicomUncompressedSize -
+      (CASE WHEN old.fileType = 1 THEN old.uncompressedSize ELSE 0 END)
+  WHERE id IN (old.id,
+               (SELECT parentId FROM Resources WHERE internalId = old.id),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId = old.id)),
+               (SELECT parentId FROM Resources WHERE internalId =
+                (SELECT parentId FROM Resources WHERE internalId =
+                 (SELECT parentId FROM Resources WHERE internalId = old.id))));
+END;
@@ -157,79 +157,6 @@ namespace Orthanc
     public Compatibility::ISetResourcesContent
   {
   private:
-    void AnswerLookup(std::list<std::string>& resourcesId,
-                      std::list<std::string>& instancesId,
-                      ResourceType level)
-    {
-      resourcesId.clear();
-      instancesId.clear();
-    
-      std::unique_ptr<SQLite::Statement> statement;
-    
-      switch (level)
-      {
-        case ResourceType_Patient:
-        {
-          statement.reset(
-            new SQLite::Statement(
-              db_, SQLITE_FROM_HERE,
-              "SELECT patients.publicId, instances.publicID FROM Lookup AS patients "
-              "INNER JOIN Resources studies ON patients.internalId=studies.parentId "
-              "INNER JOIN Resources series ON studies.internalId=series.parentId "
-              "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY patients.publicId"));
-      
-          break;
-        }
-
-        case ResourceType_Study:
-        {
-          statement.reset(
-            new SQLite::Statement(
-              db_, SQLITE_FROM_HERE,
-              "SELECT studies.publicId, instances.publicID FROM Lookup AS studies "
-              "INNER JOIN Resources series ON studies.internalId=series.parentId "
-              "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY studies.publicId"));
-      
-          break;
-        }
-
-        case ResourceType_Series:
-        {
-          statement.reset(
-            new SQLite::Statement(
-              db_, SQLITE_FROM_HERE,
-              "SELECT series.publicId, instances.publicID FROM Lookup AS series "
-              "INNER JOIN Resources instances ON series.internalId=instances.parentId "
-              "GROUP BY series.publicId"));
-      
-          break;
-        }
-
-        case ResourceType_Instance:
-        {
-          statement.reset(
-            new SQLite::Statement(
-              db_, SQLITE_FROM_HERE, "SELECT publicId, publicId FROM Lookup"));
-        
-          break;
-        }
-      
-        default:
-          throw OrthancException(ErrorCode_InternalError);
-      }
-
-      assert(statement.get() != NULL);
-      
-      while (statement->Step())
-      {
-        resourcesId.push_back(statement->ColumnString(0));
-        instancesId.push_back(statement->ColumnString(1));
-      }
-    }
-
-
     void ClearTable(const std::string& tableName)
     {
       db_.Execute("DELETE FROM " + tableName);    
@@ -349,37 +276,42 @@ namespace Orthanc
                                       ResourceType queryLevel,
                                       size_t limit) ORTHANC_OVERRIDE
     {
+      /**
+       * Since Orthanc 1.9.6, the results are streamed from one single
+       * statement, instead of going through a "Lookup" temporary
+       * table. Writing to the temporary storage was done for each
+       * lookup, while holding the lock on the database.
+       **/
+      
       LookupFormatter formatter;
 
       std::string sql;
-      LookupFormatter::Apply(sql, formatter, lookup, queryLevel, limit);
-
-      sql = "CREATE TEMPORARY TABLE Lookup AS " + sql;
-    
+      if (instancesId == NULL)
       {
-        SQLite::Statement s(db_, SQLITE_FROM_HERE, "DROP TABLE IF EXISTS Lookup");
-        s.Run();
+        LookupFormatter::Apply(sql, formatter, lookup, queryLevel, limit);
       }
-
+      else
       {
-        SQLite::Statement statement(db_, sql);
-        formatter.Bind(statement);
-        statement.Run();
+        LookupFormatter::ApplyWithSampleInstance(sql, formatter, lookup, queryLevel, limit);
+        instancesId->clear();
       }
 
-      if (instancesId != NULL)
-      {
-        AnswerLookup(resourcesId, *instancesId, queryLevel);
-      }
-      else
+      resourcesId.clear();
+
+      // Don't use "SQLITE_FROM_HERE", as the SQL depends on the lookup
+      SQLite::Statement statement(db_, sql);
+      formatter.Bind(statement);
+
+      while (statement.Step())
       {
-        resourcesId.clear();
-    
-        SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT publicId FROM Lookup");
-        
-        while (s.Step())
+        if (instancesId == NULL)
+        {
+          resourcesId.push_back(statement.ColumnString(0));
+        }
+        else if (!statement.ColumnIsNull(1))
         {
-          resourcesId.push_back(s.ColumnString(0));
+          resourcesId.push_back(statement.ColumnString(0));
+          instancesId->push_back(statement.ColumnString(1));
         }
       }
     }
@@ -909,6 +841,75 @@ namespace Orthanc
     }
 
 
+    virtual bool LookupResourceStatistics(uint64_t& countStudies,
+                                          uint64_t& countSeries,
+                                          uint64_t& countInstances,
+                                          uint64_t& diskSize,
+                                          uint64_t& uncompressedSize,
+                                          uint64_t& dicomDiskSize,
+                                          uint64_t& dicomUncompressedSize,
+                                          int64_t id) ORTHANC_OVERRIDE
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, 
+                          "SELECT countStudies, countSeries, countInstances, compressedSize, uncompressedSize, "
+                          "dicomCompressedSize, dicomUncompressedSize FROM ResourceStatistics WHERE id=?");
+      s.BindInt64(0, id);
+
+      if (!s.Step())
+      {
+        // Should only occur if the resource has been concurrently deleted
+        throw OrthancException(ErrorCode_UnknownResource);
+      }
+      else
+      {
+        countStudies = static_cast<uint64_t>(s.ColumnInt64(0));
+        countSeries = static_cast<uint64_t>(s.ColumnInt64(1));
+        countInstances = static_cast<uint64_t>(s.ColumnInt64(2));
+        diskSize = static_cast<uint64_t>(s.ColumnInt64(3));
+        uncompressedSize = static_cast<uint64_t>(s.ColumnInt64(4));
+        dicomDiskSize = static_cast<uint64_t>(s.ColumnInt64(5));
+        dicomUncompressedSize = static_cast<uint64_t>(s.ColumnInt64(6));
+        return true;
+      }
+    }
+
+
+    virtual void EnqueueStorageDeletion(const std::string& uuid,
+                                        FileContentType type) ORTHANC_OVERRIDE
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "INSERT OR REPLACE INTO StorageDeletionQueue VALUES(?, ?)");
+      s.BindString(0, uuid);
+      s.BindInt(1, type);
+      s.Run();
+    }
+
+
+    virtual void GetStorageDeletions(std::map<std::string, FileContentType>& target) ORTHANC_OVERRIDE
+    {
+      target.clear();
+
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT uuid, fileType FROM StorageDeletionQueue");
+
+      while (s.Step())
+      {
+        target[s.ColumnString(0)] = static_cast<FileContentType>(s.ColumnInt(1));
+      }
+    }
+
+
+    virtual void RemoveStorageDeletions(const std::list<std::string>& uuids) ORTHANC_OVERRIDE
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM StorageDeletionQueue WHERE uuid=?");
+
+      for (std::list<std::string>::const_iterator it = uuids.begin(); it != uuids.end(); ++it)
+      {
+        s.Reset();
+        s.BindString(0, *it);
+        s.Run();
+      }
+    }
+
+
     virtual bool LookupResource(int64_t& id,
                                 ResourceType& type,
                                 const std::string& publicId) ORTHANC_OVERRIDE
@@ -1263,12 +1264,130 @@ namespace Orthanc
       }
     }
   };
+
+
+  class SQLiteDatabaseWrapper::ReaderConnection : public boost::noncopyable
+  {
+  private:
+    boost::mutex        mutex_;   // Never contended, as the reader is leased by one transaction at once
+    SQLite::Connection  db_;
+
+  public:
+    explicit ReaderConnection(const std::string& path)
+    {
+      db_.Open(path);
+      db_.Execute("PRAGMA case_sensitive_like = true;");
+      db_.Execute("PRAGMA busy_timeout = 5000;");
+    }
+
+    boost::mutex& GetMutex()
+    {
+      return mutex_;
+    }
+
+    SQLite::Connection& GetDatabase()
+    {
+      return db_;
+    }
+  };
+
+
+  class SQLiteDatabaseWrapper::ReaderAccessor : public boost::noncopyable
+  {
+  private:
+    SQLiteDatabaseWrapper&  that_;
+    ReaderConnection*       reader_;
+
+  public:
+    explicit ReaderAccessor(SQLiteDatabaseWrapper& that) :
+      that_(that),
+      reader_(NULL)
+    {
+      boost::mutex::scoped_lock lock(that_.readersMutex_);
+
+      while (that_.availableReaders_.empty())
+      {
+        that_.readerAvailable_.wait(lock);
+      }
+
+      reader_ = that_.availableReaders_.front();
+      that_.availableReaders_.pop_front();
+    }
+
+    ~ReaderAccessor()
+    {
+      assert(reader_ != NULL);
+      
+      {
+        boost::mutex::scoped_lock lock(that_.readersMutex_);
+        that_.availableReaders_.push_back(reader_);
+      }
+
+      that_.readerAvailable_.notify_one();
+    }
+
+    ReaderConnection& GetReader() const
+    {
+      assert(reader_ != NULL);
+      return *reader_;
+    }
+  };
+
+
+  /**
+   * Read-only transaction running over one connection of the pool of
+   * readers. A SQLite transaction is explicitly opened, so that all
+   * the statements share the same snapshot of the WAL database,
+   * independently of the concurrent writer.
+   **/
+  class SQLiteDatabaseWrapper::PooledReadOnlyTransaction : public SQLiteDatabaseWrapper::TransactionBase
+  {
+  private:
+    std::unique_ptr<ReaderAccessor>       accessor_;
+    std::unique_ptr<SQLite::Transaction>  transaction_;
+
+  public:
+    PooledReadOnlyTransaction(SQLiteDatabaseWrapper& that,
+                              ReaderAccessor* accessor /* takes ownership */,
+                              IDatabaseListener& listener) :
+      TransactionBase(accessor->GetReader().GetMutex(), accessor->GetReader().GetDatabase(),
+                      listener, *that.signalRemainingAncestor_),
+      accessor_(accessor),
+      transaction_(new SQLite::Transaction(accessor->GetReader().GetDatabase()))
+    {
+      transaction_->Begin();
+    }
+
+    virtual ~PooledReadOnlyTransaction()
+    {
+      // Close the SQLite transaction before giving back the connection
+      // to the pool (this rolls back the transaction if still open)
+      transaction_.reset(NULL);
+    }
+
+    virtual void Rollback() ORTHANC_OVERRIDE
+    {
+      transaction_->Rollback();
+    }
+
+    virtual void Commit(int64_t fileSizeDelta /* only used in debug */) ORTHANC_OVERRIDE
+    {
+      if (fileSizeDelta != 0)
+      {
+        throw OrthancException(ErrorCode_InternalError);
+      }
+
+      transaction_->Commit();
+    }
+  };
   
 
   SQLiteDatabaseWrapper::SQLiteDatabaseWrapper(const std::string& path) : 
     activeTransaction_(NULL), 
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    path_(path),
+    readersCount_(0)
   {
     db_.Open(path);
   }
@@ -1277,7 +1396,8 @@ namespace Orthanc
   SQLiteDatabaseWrapper::SQLiteDatabaseWrapper() : 
     activeTransaction_(NULL), 
     signalRemainingAncestor_(NULL),
-    version_(0)
+    version_(0),
+    readersCount_(0)
   {
     db_.OpenInMemory();
   }
@@ -1288,6 +1408,70 @@ namespace Orthanc
     {
       LOG(ERROR) << "A SQLite transaction is still active in the SQLiteDatabaseWrapper destructor: Expect a crash";
     }
+
+    CloseReaders();
+  }
+
+
+  void SQLiteDatabaseWrapper::SetReadersCount(unsigned int count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (signalRemainingAncestor_ != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls, "The SQLite database is already opened");
+    }
+    else if (count != 0 &&
+             path_.empty())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "A pool of SQLite readers cannot be used with an in-memory database");
+    }
+    else
+    {
+      readersCount_ = count;
+    }
+  }
+
+
+  void SQLiteDatabaseWrapper::OpenReaders()
+  {
+    boost::mutex::scoped_lock lock(readersMutex_);
+
+    assert(readers_.empty());
+    
+    for (unsigned int i = 0; i < readersCount_; i++)
+    {
+      std::unique_ptr<ReaderConnection> reader(new ReaderConnection(path_));
+      readers_.push_back(reader.release());
+      availableReaders_.push_back(readers_.back());
+    }
+
+    if (readersCount_ != 0)
+    {
+      LOG(WARNING) << "Read-only transactions to the SQLite index run over "
+                   << readersCount_ << " parallel connections";
+    }
+  }
+
+
+  void SQLiteDatabaseWrapper::CloseReaders()
+  {
+    boost::mutex::scoped_lock lock(readersMutex_);
+
+    if (availableReaders_.size() != readers_.size())
+    {
+      LOG(ERROR) << "Closing the SQLite database while some read-only transaction is still active";
+    }
+
+    for (size_t i = 0; i < readers_.size(); i++)
+    {
+      assert(readers_[i] != NULL);
+      delete readers_[i];
+    }
+
+    readers_.clear();
+    availableReaders_.clear();
   }
 
 
@@ -1311,7 +1495,19 @@ namespace Orthanc
       // http://www.sqlite.org/pragma.html
       db_.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
       db_.Execute("PRAGMA JOURNAL_MODE=WAL;");
-      db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+
+      if (readersCount_ == 0)
+      {
+        db_.Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+      }
+      else
+      {
+        // The exclusive locking mode would prevent the readers from
+        // accessing the WAL database
+        db_.Execute("PRAGMA LOCKING_MODE=NORMAL;");
+        db_.Execute("PRAGMA busy_timeout = 5000;");
+      }
+      
       db_.Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
       //db_.Execute("PRAGMA TEMP_STORE=memory");
 
@@ -1367,15 +1563,37 @@ namespace Orthanc
           ServerResources::GetFileResource(query, ServerResources::INSTALL_TRACK_ATTACHMENTS_SIZE);
           db_.Execute(query);
         }
+
+        // New in Orthanc 1.9.6
+        if (!transaction->LookupGlobalProperty(tmp, GlobalProperty_ResourceStatisticsAreFast, true /* unused in SQLite */) ||
+            tmp != "1")
+        {
+          LOG(INFO) << "Installing the SQLite triggers to maintain the statistics of the resources";
+          std::string query;
+          ServerResources::GetFileResource(query, ServerResources::INSTALL_RESOURCE_STATISTICS);
+          db_.Execute(query);
+        }
+
+        // New in Orthanc 1.9.6
+        if (!db_.DoesTableExist("StorageDeletionQueue"))
+        {
+          LOG(INFO) << "Creating the table of the attachments to be removed from the storage area";
+          db_.Execute("CREATE TABLE StorageDeletionQueue(uuid TEXT PRIMARY KEY, fileType INTEGER);");
+        }
       }
 
       transaction->Commit(0);
     }
+
+    // The readers are only opened once the database is created
+    OpenReaders();
   }
 
 
   void SQLiteDatabaseWrapper::Close()
   {
+    CloseReaders();
+    
     boost::mutex::scoped_lock lock(mutex_);
     db_.Close();
   }
@@ -1457,7 +1675,24 @@ namespace Orthanc
     switch (type)
     {
       case TransactionType_ReadOnly:
-        return new ReadOnlyTransaction(*this, listener);  // This is a no-op transaction in SQLite (thanks to mutex)
+      {
+        bool hasReaders;
+
+        {
+          boost::mutex::scoped_lock lock(readersMutex_);
+          hasReaders = !readers_.empty();
+        }
+
+        if (hasReaders)
+        {
+          std::unique_ptr<ReaderAccessor> accessor(new ReaderAccessor(*this));
+          return new PooledReadOnlyTransaction(*this, accessor.release(), listener);
+        }
+        else
+        {
+          return new ReadOnlyTransaction(*this, listener);  // This is a no-op transaction in SQLite (thanks to mutex)
+        }
+      }
 
       case TransactionType_ReadWrite:
       {
@@ -1527,6 +1762,29 @@ namespace Orthanc
   }
 
 
+  void SQLiteDatabaseWrapper::UnitTestsTransaction::RemoveResourceStatistics()
+  {
+    db_.Execute("DROP TRIGGER ResourceStatisticsCreated;"
+                "DROP TRIGGER ResourceStatisticsAttachChild;"
+                "DROP TRIGGER ResourceStatisticsDetachChild;"
+                "DROP TRIGGER AttachedFileIncrementStatistics;"
+                "DROP TRIGGER AttachedFileDecrementStatistics;"
+                "DROP TABLE ResourceStatistics;");
+
+    SQLite::Statement s(db_, SQLITE_FROM_HERE, "DELETE FROM GlobalProperties WHERE property=?");
+    s.BindInt(0, GlobalProperty_ResourceStatisticsAreFast);
+    s.Run();
+  }
+
+
+  void SQLiteDatabaseWrapper::UnitTestsTransaction::InstallResourceStatistics()
+  {
+    std::string query;
+    ServerResources::GetFileResource(query, ServerResources::INSTALL_RESOURCE_STATISTICS);
+    db_.Execute(query);
+  }
+
+
   int64_t SQLiteDatabaseWrapper::UnitTestsTransaction::GetTableRecordCount(const std::string& table)
   {
     /**
@@ -1593,4 +1851,121 @@ namespace Orthanc
       childrenPublicIds.push_back(s.ColumnString(0));
     }
   }
+
+
+  static void AnswerLookupFromTemporaryTable(SQLite::Connection& db,
+                                             std::list<std::string>& resourcesId,
+                                             std::list<std::string>& instancesId,
+                                             ResourceType level)
+  {
+    resourcesId.clear();
+    instancesId.clear();
+  
+    std::unique_ptr<SQLite::Statement> statement;
+  
+    switch (level)
+    {
+      case ResourceType_Patient:
+      {
+        statement.reset(
+          new SQLite::Statement(
+            db, SQLITE_FROM_HERE,
+            "SELECT patients.publicId, instances.publicID FROM Lookup AS patients "
+            "INNER JOIN Resources studies ON patients.internalId=studies.parentId "
+            "INNER JOIN Resources series ON studies.internalId=series.parentId "
+            "INNER JOIN Resources instances ON series.internalId=instances.parentId "
+            "GROUP BY patients.publicId"));
+    
+        break;
+      }
+
+      case ResourceType_Study:
+      {
+        statement.reset(
+          new SQLite::Statement(
+            db, SQLITE_FROM_HERE,
+            "SELECT studies.publicId, instances.publicID FROM Lookup AS studies "
+            "INNER JOIN Resources series ON studies.internalId=series.parentId "
+            "INNER JOIN Resources instances ON series.internalId=instances.parentId "
+            "GROUP BY studies.publicId"));
+    
+        break;
+      }
+
+      case ResourceType_Series:
+      {
+        statement.reset(
+          new SQLite::Statement(
+            db, SQLITE_FROM_HERE,
+            "SELECT series.publicId, instances.publicID FROM Lookup AS series "
+            "INNER JOIN Resources instances ON series.internalId=instances.parentId "
+            "GROUP BY series.publicId"));
+    
+        break;
+      }
+
+      case ResourceType_Instance:
+      {
+        statement.reset(
+          new SQLite::Statement(
+            db, SQLITE_FROM_HERE, "SELECT publicId, publicId FROM Lookup"));
+      
+        break;
+      }
+    
+      default:
+        throw OrthancException(ErrorCode_InternalError);
+    }
+
+    assert(statement.get() != NULL);
+    
+    while (statement->Step())
+    {
+      resourcesId.push_back(statement->ColumnString(0));
+      instancesId.push_back(statement->ColumnString(1));
+    }
+  }
+
+
+  void SQLiteDatabaseWrapper::UnitTestsTransaction::ApplyLookupResourcesWithTemporaryTable(
+    std::list<std::string>& resourcesId,
+    std::list<std::string>* instancesId,
+    const std::vector<DatabaseConstraint>& lookup,
+    ResourceType queryLevel,
+    size_t limit)
+  {
+    LookupFormatter formatter;
+
+    std::string sql;
+    LookupFormatter::Apply(sql, formatter, lookup, queryLevel, limit);
+
+    sql = "CREATE TEMPORARY TABLE Lookup AS " + sql;
+    
+    {
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "DROP TABLE IF EXISTS Lookup");
+      s.Run();
+    }
+
+    {
+      SQLite::Statement statement(db_, sql);
+      formatter.Bind(statement);
+      statement.Run();
+    }
+
+    if (instancesId != NULL)
+    {
+      AnswerLookupFromTemporaryTable(db_, resourcesId, *instancesId, queryLevel);
+    }
+    else
+    {
+      resourcesId.clear();
+    
+      SQLite::Statement s(db_, SQLITE_FROM_HERE, "SELECT publicId FROM Lookup");
+        
+      while (s.Step())
+      {
+        resourcesId.push_back(s.ColumnString(0));
+      }
+    }
+  }
 }
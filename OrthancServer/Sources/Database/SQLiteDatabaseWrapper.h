@@ -37,6 +37,7 @@
 
 #include "../../../OrthancFramework/Sources/SQLite/Connection.h"
 
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 
 namespace Orthanc
@@ -45,6 +46,13 @@ namespace Orthanc
    * This class manages an instance of the Orthanc SQLite database. It
    * translates low-level requests into SQL statements. Mutual
    * exclusion MUST be implemented at a higher level.
+   *
+   * By default, all the transactions are serialized over one single
+   * connection that is opened in exclusive locking mode. If a pool
+   * of readers is configured (cf. "SetReadersCount()"), the
+   * read-only transactions run in parallel over distinct connections
+   * to the same WAL database, while the read-write transactions are
+   * still serialized over the main connection.
    **/
   class SQLiteDatabaseWrapper : public IDatabaseWrapper
   {
@@ -56,6 +64,9 @@ namespace Orthanc
     class ReadOnlyTransaction;
     class ReadWriteTransaction;
     class LookupFormatter;
+    class ReaderConnection;
+    class ReaderAccessor;
+    class PooledReadOnlyTransaction;
 
     boost::mutex              mutex_;
     SQLite::Connection        db_;
@@ -63,6 +74,18 @@ namespace Orthanc
     SignalRemainingAncestor*  signalRemainingAncestor_;
     unsigned int              version_;
 
+    // Pool of read-only connections (new in Orthanc 1.9.6)
+    std::string                     path_;
+    unsigned int                    readersCount_;
+    boost::mutex                    readersMutex_;
+    boost::condition_variable       readerAvailable_;
+    std::vector<ReaderConnection*>  readers_;
+    std::list<ReaderConnection*>    availableReaders_;
+
+    void OpenReaders();
+
+    void CloseReaders();
+
     void GetChangesInternal(std::list<ServerIndexChange>& target,
                             bool& done,
                             SQLite::Statement& s,
@@ -80,6 +103,17 @@ namespace Orthanc
 
     virtual ~SQLiteDatabaseWrapper();
 
+    // Must be called before "Open()". "0" means that the read-only
+    // transactions are serialized with the read-write transactions
+    // over the main connection (this is the default). This option is
+    // not available for in-memory databases.
+    void SetReadersCount(unsigned int count);
+
+    unsigned int GetReadersCount() const
+    {
+      return readersCount_;
+    }
+
     virtual void Open() ORTHANC_OVERRIDE;
 
     virtual void Close() ORTHANC_OVERRIDE;
@@ -108,6 +142,11 @@ namespace Orthanc
       return false;  // TODO - REVISIONS
     }
 
+    virtual bool HasStorageDeletionQueue() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
 
     /**
      * The "StartTransaction()" method is guaranteed to return a class
@@ -130,6 +169,12 @@ namespace Orthanc
                        int64_t id);
 
       int64_t GetTableRecordCount(const std::string& table);
+
+      // Simulates a database created by Orthanc <= 1.9.5, then runs
+      // the migration script of the statistics (new in Orthanc 1.9.6)
+      void RemoveResourceStatistics();
+
+      void InstallResourceStatistics();
     
       bool GetParentPublicId(std::string& target,
                              int64_t id);
@@ -147,6 +192,14 @@ namespace Orthanc
       void SetMainDicomTag(int64_t id,
                            const DicomTag& tag,
                            const std::string& value);
+
+      // Implementation of "ApplyLookupResources()" in Orthanc <=
+      // 1.9.5, kept as a reference for the unit tests
+      void ApplyLookupResourcesWithTemporaryTable(std::list<std::string>& resourcesId,
+                                                  std::list<std::string>* instancesId,
+                                                  const std::vector<DatabaseConstraint>& lookup,
+                                                  ResourceType queryLevel,
+                                                  size_t limit);
     };
   };
 }
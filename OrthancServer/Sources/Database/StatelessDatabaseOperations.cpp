@@ -545,6 +545,8 @@ namespace Orthanc
     {
       if (!isCommitted_)
       {
+        assert(transaction_.get() != NULL);
+
         try
         {
           transaction_->Rollback();
@@ -570,11 +572,21 @@ namespace Orthanc
       }
       else
       {
+        context_->PrepareCommit(*transaction_);
+
         int64_t delta = context_->GetCompressedSizeDelta();
 
         transaction_->Commit(delta);
-        context_->Commit();
         isCommitted_ = true;
+
+        /**
+         * Release the database transaction (hence the lock of the
+         * SQLite database) before notifying the context, as the
+         * listeners of the changes might have to wait for their
+         * queues to be drained by callbacks that access the database.
+         **/
+        transaction_.reset();
+        context_->Commit();
       }
     }
 
@@ -666,6 +678,7 @@ namespace Orthanc
     db_(db),
     mainDicomTagsRegistry_(new MainDicomTagsRegistry),
     hasFlushToDisk_(db.HasFlushToDisk()),
+    hasStorageDeletionQueue_(db.HasStorageDeletionQueue()),
     maxRetries_(0)
   {
   }
@@ -722,274 +735,358 @@ namespace Orthanc
   }
   
 
-  bool StatelessDatabaseOperations::ExpandResource(Json::Value& target,
-                                                   const std::string& publicId,
-                                                   ResourceType level,
-                                                   DicomToJsonFormat format)
-  {    
-    class Operations : public ReadOnlyOperationsT5<
-      bool&, Json::Value&, const std::string&, ResourceType, DicomToJsonFormat>
+  static void MainDicomTagsToJson(StatelessDatabaseOperations::ReadOnlyTransaction& transaction,
+                                  Json::Value& target,
+                                  int64_t resourceId,
+                                  ResourceType resourceType,
+                                  DicomToJsonFormat format)
+  {
+    static const char* const MAIN_DICOM_TAGS = "MainDicomTags";
+    static const char* const PATIENT_MAIN_DICOM_TAGS = "PatientMainDicomTags";
+    
+    DicomMap tags;
+    transaction.GetMainDicomTags(tags, resourceId);
+
+    if (resourceType == ResourceType_Study)
     {
-    private:
-      static void MainDicomTagsToJson(ReadOnlyTransaction& transaction,
-                                      Json::Value& target,
-                                      int64_t resourceId,
-                                      ResourceType resourceType,
-                                      DicomToJsonFormat format)
-      {
-        static const char* const MAIN_DICOM_TAGS = "MainDicomTags";
-        static const char* const PATIENT_MAIN_DICOM_TAGS = "PatientMainDicomTags";
-        
-        DicomMap tags;
-        transaction.GetMainDicomTags(tags, resourceId);
+      DicomMap t1, t2;
+      tags.ExtractStudyInformation(t1);
+      tags.ExtractPatientInformation(t2);
 
-        if (resourceType == ResourceType_Study)
-        {
-          DicomMap t1, t2;
-          tags.ExtractStudyInformation(t1);
-          tags.ExtractPatientInformation(t2);
+      target[MAIN_DICOM_TAGS] = Json::objectValue;
+      FromDcmtkBridge::ToJson(target[MAIN_DICOM_TAGS], t1, format);
 
-          target[MAIN_DICOM_TAGS] = Json::objectValue;
-          FromDcmtkBridge::ToJson(target[MAIN_DICOM_TAGS], t1, format);
+      target[PATIENT_MAIN_DICOM_TAGS] = Json::objectValue;
+      FromDcmtkBridge::ToJson(target[PATIENT_MAIN_DICOM_TAGS], t2, format);
+    }
+    else
+    {
+      target[MAIN_DICOM_TAGS] = Json::objectValue;
+      FromDcmtkBridge::ToJson(target[MAIN_DICOM_TAGS], tags, format);
+    }
+  }
 
-          target[PATIENT_MAIN_DICOM_TAGS] = Json::objectValue;
-          FromDcmtkBridge::ToJson(target[PATIENT_MAIN_DICOM_TAGS], t2, format);
-        }
-        else
+
+  static bool LookupStringMetadata(std::string& result,
+                                   const std::map<MetadataType, std::string>& metadata,
+                                   MetadataType type)
+  {
+    std::map<MetadataType, std::string>::const_iterator found = metadata.find(type);
+
+    if (found == metadata.end())
+    {
+      return false;
+    }
+    else
+    {
+      result = found->second;
+      return true;
+    }
+  }
+
+
+  static bool LookupIntegerMetadata(int64_t& result,
+                                    const std::map<MetadataType, std::string>& metadata,
+                                    MetadataType type)
+  {
+    std::string s;
+    if (!LookupStringMetadata(s, metadata, type))
+    {
+      return false;
+    }
+
+    try
+    {
+      result = boost::lexical_cast<int64_t>(s);
+      return true;
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+  }
+
+
+  static bool ExpandResourceInternal(StatelessDatabaseOperations::ReadOnlyTransaction& transaction,
+                                     Json::Value& target,
+                                     const std::string& publicId,
+                                     bool checkLevel,
+                                     ResourceType level,
+                                     DicomToJsonFormat format)
+  {
+    // Lookup for the requested resource
+    int64_t internalId;  // unused
+    ResourceType type;
+    std::string parent;
+    if (!transaction.LookupResourceAndParent(internalId, type, parent, publicId) ||
+        (checkLevel && type != level))
+    {
+      return false;
+    }
+    else
+    {
+      target = Json::objectValue;
+    
+      // Set information about the parent resource (if it exists)
+      if (type == ResourceType_Patient)
+      {
+        if (!parent.empty())
         {
-          target[MAIN_DICOM_TAGS] = Json::objectValue;
-          FromDcmtkBridge::ToJson(target[MAIN_DICOM_TAGS], tags, format);
+          throw OrthancException(ErrorCode_DatabasePlugin);
         }
       }
-
-  
-      static bool LookupStringMetadata(std::string& result,
-                                       const std::map<MetadataType, std::string>& metadata,
-                                       MetadataType type)
+      else
       {
-        std::map<MetadataType, std::string>::const_iterator found = metadata.find(type);
-
-        if (found == metadata.end())
+        if (parent.empty())
         {
-          return false;
+          throw OrthancException(ErrorCode_DatabasePlugin);
         }
-        else
+
+        switch (type)
         {
-          result = found->second;
-          return true;
+          case ResourceType_Study:
+            target["ParentPatient"] = parent;
+            break;
+
+          case ResourceType_Series:
+            target["ParentStudy"] = parent;
+            break;
+
+          case ResourceType_Instance:
+            target["ParentSeries"] = parent;
+            break;
+
+          default:
+            throw OrthancException(ErrorCode_InternalError);
         }
       }
 
+      // List the children resources
+      std::list<std::string> children;
+      transaction.GetChildrenPublicId(children, internalId);
 
-      static bool LookupIntegerMetadata(int64_t& result,
-                                        const std::map<MetadataType, std::string>& metadata,
-                                        MetadataType type)
+      if (type != ResourceType_Instance)
       {
-        std::string s;
-        if (!LookupStringMetadata(s, metadata, type))
-        {
-          return false;
-        }
+        Json::Value c = Json::arrayValue;
 
-        try
+        for (std::list<std::string>::const_iterator
+               it = children.begin(); it != children.end(); ++it)
         {
-          result = boost::lexical_cast<int64_t>(s);
-          return true;
+          c.append(*it);
         }
-        catch (boost::bad_lexical_cast&)
+
+        switch (type)
         {
-          return false;
+          case ResourceType_Patient:
+            target["Studies"] = c;
+            break;
+
+          case ResourceType_Study:
+            target["Series"] = c;
+            break;
+
+          case ResourceType_Series:
+            target["Instances"] = c;
+            break;
+
+          default:
+            throw OrthancException(ErrorCode_InternalError);
         }
       }
 
+      // Extract the metadata
+      std::map<MetadataType, std::string> metadata;
+      transaction.GetAllMetadata(metadata, internalId);
 
-    public:
-      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
-                              const Tuple& tuple) ORTHANC_OVERRIDE
+      // Set the resource type
+      switch (type)
       {
-        // Lookup for the requested resource
-        int64_t internalId;  // unused
-        ResourceType type;
-        std::string parent;
-        if (!transaction.LookupResourceAndParent(internalId, type, parent, tuple.get<2>()) ||
-            type != tuple.get<3>())
-        {
-          tuple.get<0>() = false;
-        }
-        else
+        case ResourceType_Patient:
+          target["Type"] = "Patient";
+          break;
+
+        case ResourceType_Study:
+          target["Type"] = "Study";
+          break;
+
+        case ResourceType_Series:
         {
-          Json::Value& target = tuple.get<1>();
-          target = Json::objectValue;
-        
-          // Set information about the parent resource (if it exists)
-          if (type == ResourceType_Patient)
+          target["Type"] = "Series";
+
+          int64_t i;
+          if (LookupIntegerMetadata(i, metadata, MetadataType_Series_ExpectedNumberOfInstances))
           {
-            if (!parent.empty())
-            {
-              throw OrthancException(ErrorCode_DatabasePlugin);
-            }
+            target["ExpectedNumberOfInstances"] = static_cast<int>(i);
+            target["Status"] = EnumerationToString(transaction.GetSeriesStatus(internalId, i));
           }
           else
           {
-            if (parent.empty())
-            {
-              throw OrthancException(ErrorCode_DatabasePlugin);
-            }
-
-            switch (type)
-            {
-              case ResourceType_Study:
-                target["ParentPatient"] = parent;
-                break;
+            target["ExpectedNumberOfInstances"] = Json::nullValue;
+            target["Status"] = EnumerationToString(SeriesStatus_Unknown);
+          }
 
-              case ResourceType_Series:
-                target["ParentStudy"] = parent;
-                break;
+          break;
+        }
 
-              case ResourceType_Instance:
-                target["ParentSeries"] = parent;
-                break;
+        case ResourceType_Instance:
+        {
+          target["Type"] = "Instance";
 
-              default:
-                throw OrthancException(ErrorCode_InternalError);
-            }
+          FileInfo attachment;
+          int64_t revision;  // ignored
+          if (!transaction.LookupAttachment(attachment, revision, internalId, FileContentType_Dicom))
+          {
+            throw OrthancException(ErrorCode_InternalError);
           }
 
-          // List the children resources
-          std::list<std::string> children;
-          transaction.GetChildrenPublicId(children, internalId);
+          target["FileSize"] = static_cast<unsigned int>(attachment.GetUncompressedSize());
+          target["FileUuid"] = attachment.GetUuid();
 
-          if (type != ResourceType_Instance)
+          int64_t i;
+          if (LookupIntegerMetadata(i, metadata, MetadataType_Instance_IndexInSeries))
           {
-            Json::Value c = Json::arrayValue;
-
-            for (std::list<std::string>::const_iterator
-                   it = children.begin(); it != children.end(); ++it)
-            {
-              c.append(*it);
-            }
+            target["IndexInSeries"] = static_cast<int>(i);
+          }
+          else
+          {
+            target["IndexInSeries"] = Json::nullValue;
+          }
 
-            switch (type)
-            {
-              case ResourceType_Patient:
-                target["Studies"] = c;
-                break;
+          break;
+        }
 
-              case ResourceType_Study:
-                target["Series"] = c;
-                break;
+        default:
+          throw OrthancException(ErrorCode_InternalError);
+      }
 
-              case ResourceType_Series:
-                target["Instances"] = c;
-                break;
+      // Record the remaining information
+      target["ID"] = publicId;
+      MainDicomTagsToJson(transaction, target, internalId, type, format);
 
-              default:
-                throw OrthancException(ErrorCode_InternalError);
-            }
-          }
+      std::string tmp;
 
-          // Extract the metadata
-          std::map<MetadataType, std::string> metadata;
-          transaction.GetAllMetadata(metadata, internalId);
+      if (LookupStringMetadata(tmp, metadata, MetadataType_AnonymizedFrom))
+      {
+        target["AnonymizedFrom"] = tmp;
+      }
 
-          // Set the resource type
-          switch (type)
-          {
-            case ResourceType_Patient:
-              target["Type"] = "Patient";
-              break;
+      if (LookupStringMetadata(tmp, metadata, MetadataType_ModifiedFrom))
+      {
+        target["ModifiedFrom"] = tmp;
+      }
 
-            case ResourceType_Study:
-              target["Type"] = "Study";
-              break;
+      if (type == ResourceType_Patient ||
+          type == ResourceType_Study ||
+          type == ResourceType_Series)
+      {
+        target["IsStable"] = !transaction.GetTransactionContext().IsUnstableResource(internalId);
 
-            case ResourceType_Series:
-            {
-              target["Type"] = "Series";
+        if (LookupStringMetadata(tmp, metadata, MetadataType_LastUpdate))
+        {
+          target["LastUpdate"] = tmp;
+        }
+      }
 
-              int64_t i;
-              if (LookupIntegerMetadata(i, metadata, MetadataType_Series_ExpectedNumberOfInstances))
-              {
-                target["ExpectedNumberOfInstances"] = static_cast<int>(i);
-                target["Status"] = EnumerationToString(transaction.GetSeriesStatus(internalId, i));
-              }
-              else
-              {
-                target["ExpectedNumberOfInstances"] = Json::nullValue;
-                target["Status"] = EnumerationToString(SeriesStatus_Unknown);
-              }
+      return true;
+    }
+  }
 
-              break;
-            }
 
-            case ResourceType_Instance:
-            {
-              target["Type"] = "Instance";
+  bool StatelessDatabaseOperations::ExpandResource(Json::Value& target,
+                                                   const std::string& publicId,
+                                                   ResourceType level,
+                                                   DicomToJsonFormat format)
+  {    
+    class Operations : public ReadOnlyOperationsT5<
+      bool&, Json::Value&, const std::string&, ResourceType, DicomToJsonFormat>
+    {
+    public:
+      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
+                              const Tuple& tuple) ORTHANC_OVERRIDE
+      {
+        tuple.get<0>() = ExpandResourceInternal(transaction, tuple.get<1>(), tuple.get<2>(),
+                                                true /* check level */, tuple.get<3>(), tuple.get<4>());
+      }
+    };
 
-              FileInfo attachment;
-              int64_t revision;  // ignored
-              if (!transaction.LookupAttachment(attachment, revision, internalId, FileContentType_Dicom))
-              {
-                throw OrthancException(ErrorCode_InternalError);
-              }
+    bool found;
+    Operations operations;
+    operations.Apply(*this, found, target, publicId, level, format);
+    return found;
+  }
 
-              target["FileSize"] = static_cast<unsigned int>(attachment.GetUncompressedSize());
-              target["FileUuid"] = attachment.GetUuid();
 
-              int64_t i;
-              if (LookupIntegerMetadata(i, metadata, MetadataType_Instance_IndexInSeries))
-              {
-                target["IndexInSeries"] = static_cast<int>(i);
-              }
-              else
-              {
-                target["IndexInSeries"] = Json::nullValue;
-              }
+  void StatelessDatabaseOperations::ExpandResourcesInternal(Json::Value& target,
+                                                            const std::list<std::string>& publicIds,
+                                                            bool checkLevel,
+                                                            ResourceType level,
+                                                            DicomToJsonFormat format)
+  {
+    class Operations : public ReadOnlyOperationsT5<
+      Json::Value&, const std::list<std::string>&, bool, ResourceType, DicomToJsonFormat>
+    {
+    public:
+      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
+                              const Tuple& tuple) ORTHANC_OVERRIDE
+      {
+        Json::Value& target = tuple.get<0>();
 
-              break;
-            }
+        // If the transaction is retried (cf. "maxRetries_"), discard
+        // the items that were appended by the failed attempt
+        target = Json::arrayValue;
 
-            default:
-              throw OrthancException(ErrorCode_InternalError);
+        for (std::list<std::string>::const_iterator
+               it = tuple.get<1>().begin(); it != tuple.get<1>().end(); ++it)
+        {
+          Json::Value item;
+          if (ExpandResourceInternal(transaction, item, *it, tuple.get<2>(), tuple.get<3>(), tuple.get<4>()))
+          {
+            target.append(item);
           }
+        }
+      }
+    };
 
-          // Record the remaining information
-          target["ID"] = tuple.get<2>();
-          MainDicomTagsToJson(transaction, target, internalId, type, tuple.get<4>());
+    if (target.type() != Json::arrayValue)
+    {
+      throw OrthancException(ErrorCode_BadParameterType);
+    }
 
-          std::string tmp;
+    if (!publicIds.empty())
+    {
+      /**
+       * The items are only appended to "target" once the transaction
+       * has succeeded, as "Operations" resets "expanded" at the
+       * beginning of each attempt
+       **/
+      Json::Value expanded;
 
-          if (LookupStringMetadata(tmp, metadata, MetadataType_AnonymizedFrom))
-          {
-            target["AnonymizedFrom"] = tmp;
-          }
+      Operations operations;
+      operations.Apply(*this, expanded, publicIds, checkLevel, level, format);
 
-          if (LookupStringMetadata(tmp, metadata, MetadataType_ModifiedFrom))
-          {
-            target["ModifiedFrom"] = tmp;
-          }
+      for (Json::Value::ArrayIndex i = 0; i < expanded.size(); i++)
+      {
+        target.append(expanded[i]);
+      }
+    }
+  }
 
-          if (type == ResourceType_Patient ||
-              type == ResourceType_Study ||
-              type == ResourceType_Series)
-          {
-            target["IsStable"] = !transaction.GetTransactionContext().IsUnstableResource(internalId);
 
-            if (LookupStringMetadata(tmp, metadata, MetadataType_LastUpdate))
-            {
-              target["LastUpdate"] = tmp;
-            }
-          }
+  void StatelessDatabaseOperations::ExpandResources(Json::Value& target,
+                                                    const std::list<std::string>& publicIds,
+                                                    ResourceType level,
+                                                    DicomToJsonFormat format)
+  {
+    ExpandResourcesInternal(target, publicIds, true /* check level */, level, format);
+  }
 
-          tuple.get<0>() = true;
-        }
-      }
-    };
 
-    bool found;
-    Operations operations;
-    operations.Apply(*this, found, target, publicId, level, format);
-    return found;
+  void StatelessDatabaseOperations::ExpandResources(Json::Value& target,
+                                                    const std::list<std::string>& publicIds,
+                                                    DicomToJsonFormat format)
+  {
+    ExpandResourcesInternal(target, publicIds, false /* don't check level */,
+                            ResourceType_Instance /* unused */, format);
   }
 
 
@@ -1539,7 +1636,21 @@ namespace Orthanc
           dicomUncompressedSize_ = 0;
 
           std::stack<int64_t> toExplore;
-          toExplore.push(top);
+
+          uint64_t studies, series, instances;
+          if (transaction.LookupResourceStatistics(studies, series, instances, diskSize_, uncompressedSize_,
+                                                   dicomDiskSize_, dicomUncompressedSize_, top))
+          {
+            // New in Orthanc 1.9.6: The database maintains aggregated
+            // statistics, which only cover the descendants of "top"
+            countStudies_ = static_cast<unsigned int>(studies) + (type_ == ResourceType_Study ? 1 : 0);
+            countSeries_ = static_cast<unsigned int>(series) + (type_ == ResourceType_Series ? 1 : 0);
+            countInstances_ = static_cast<unsigned int>(instances) + (type_ == ResourceType_Instance ? 1 : 0);
+          }
+          else
+          {
+            toExplore.push(top);
+          }
 
           while (!toExplore.empty())
           {
@@ -2506,6 +2617,50 @@ namespace Orthanc
   }
 
 
+  void StatelessDatabaseOperations::GetStorageDeletions(std::map<std::string, FileContentType>& target)
+  {
+    class Operations : public ReadOnlyOperationsT1<std::map<std::string, FileContentType>&>
+    {
+    public:
+      virtual void ApplyTuple(ReadOnlyTransaction& transaction,
+                              const Tuple& tuple) ORTHANC_OVERRIDE
+      {
+        transaction.GetStorageDeletions(tuple.get<0>());
+      }
+    };
+
+    Operations operations;
+    operations.Apply(*this, target);
+  }
+
+
+  void StatelessDatabaseOperations::RemoveStorageDeletions(const std::list<std::string>& uuids)
+  {
+    class Operations : public IReadWriteOperations
+    {
+    private:
+      const std::list<std::string>&  uuids_;
+      
+    public:
+      explicit Operations(const std::list<std::string>& uuids) :
+        uuids_(uuids)
+      {
+      }
+        
+      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        transaction.RemoveStorageDeletions(uuids_);
+      }
+    };
+
+    if (!uuids.empty())
+    {
+      Operations operations(uuids);
+      Apply(operations);
+    }
+  }
+
+
   bool StatelessDatabaseOperations::DeleteAttachment(const std::string& publicId,
                                                      FileContentType type,
                                                      bool hasRevision,
@@ -2858,429 +3013,458 @@ namespace Orthanc
   }
 
 
-  StoreStatus StatelessDatabaseOperations::Store(std::map<MetadataType, std::string>& instanceMetadata,
-                                                 const DicomMap& dicomSummary,
-                                                 const Attachments& attachments,
-                                                 const MetadataMap& metadata,
-                                                 const DicomInstanceOrigin& origin,
-                                                 bool overwrite,
-                                                 bool hasTransferSyntax,
-                                                 DicomTransferSyntax transferSyntax,
-                                                 bool hasPixelDataOffset,
-                                                 uint64_t pixelDataOffset,
-                                                 uint64_t maximumStorageSize,
-                                                 unsigned int maximumPatients)
+  static void SetInstanceMetadata(ResourcesContent& content,
+                                  std::map<MetadataType, std::string>& instanceMetadata,
+                                  int64_t instance,
+                                  MetadataType metadata,
+                                  const std::string& value)
   {
-    class Operations : public IReadWriteOperations
+    content.AddMetadata(instance, metadata, value);
+    instanceMetadata[metadata] = value;
+  }
+
+
+  static bool ComputeExpectedNumberOfInstances(int64_t& target,
+                                               const DicomMap& dicomSummary)
+  {
+    try
     {
-    private:
-      StoreStatus                          storeStatus_;
-      std::map<MetadataType, std::string>& instanceMetadata_;
-      const DicomMap&                      dicomSummary_;
-      const Attachments&                   attachments_;
-      const MetadataMap&                   metadata_;
-      const DicomInstanceOrigin&           origin_;
-      bool                                 overwrite_;
-      bool                                 hasTransferSyntax_;
-      DicomTransferSyntax                  transferSyntax_;
-      bool                                 hasPixelDataOffset_;
-      uint64_t                             pixelDataOffset_;
-      uint64_t                             maximumStorageSize_;
-      unsigned int                         maximumPatientCount_;
-
-      // Auto-computed fields
-      bool          hasExpectedInstances_;
-      int64_t       expectedInstances_;
-      std::string   hashPatient_;
-      std::string   hashStudy_;
-      std::string   hashSeries_;
-      std::string   hashInstance_;
+      const DicomValue* value;
+      const DicomValue* value2;
 
-      
-      static void SetInstanceMetadata(ResourcesContent& content,
-                                      std::map<MetadataType, std::string>& instanceMetadata,
-                                      int64_t instance,
-                                      MetadataType metadata,
-                                      const std::string& value)
+      if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_IMAGES_IN_ACQUISITION)) != NULL &&
+          !value->IsNull() &&
+          !value->IsBinary() &&
+          (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TEMPORAL_POSITIONS)) != NULL &&
+          !value2->IsNull() &&
+          !value2->IsBinary())
       {
-        content.AddMetadata(instance, metadata, value);
-        instanceMetadata[metadata] = value;
+        // Patch for series with temporal positions thanks to Will Ryder
+        int64_t imagesInAcquisition = boost::lexical_cast<int64_t>(value->GetContent());
+        int64_t countTemporalPositions = boost::lexical_cast<int64_t>(value2->GetContent());
+        target = imagesInAcquisition * countTemporalPositions;
+        return (target > 0);
       }
 
-      
-      static bool ComputeExpectedNumberOfInstances(int64_t& target,
-                                                   const DicomMap& dicomSummary)
+      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_SLICES)) != NULL &&
+               !value->IsNull() &&
+               !value->IsBinary() &&
+               (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TIME_SLICES)) != NULL &&
+               !value2->IsBinary() &&
+               !value2->IsNull())
       {
-        try
-        {
-          const DicomValue* value;
-          const DicomValue* value2;
-          
-          if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_IMAGES_IN_ACQUISITION)) != NULL &&
-              !value->IsNull() &&
-              !value->IsBinary() &&
-              (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TEMPORAL_POSITIONS)) != NULL &&
-              !value2->IsNull() &&
-              !value2->IsBinary())
-          {
-            // Patch for series with temporal positions thanks to Will Ryder
-            int64_t imagesInAcquisition = boost::lexical_cast<int64_t>(value->GetContent());
-            int64_t countTemporalPositions = boost::lexical_cast<int64_t>(value2->GetContent());
-            target = imagesInAcquisition * countTemporalPositions;
-            return (target > 0);
-          }
+        // Support of Cardio-PET images
+        int64_t numberOfSlices = boost::lexical_cast<int64_t>(value->GetContent());
+        int64_t numberOfTimeSlices = boost::lexical_cast<int64_t>(value2->GetContent());
+        target = numberOfSlices * numberOfTimeSlices;
+        return (target > 0);
+      }
 
-          else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_SLICES)) != NULL &&
-                   !value->IsNull() &&
-                   !value->IsBinary() &&
-                   (value2 = dicomSummary.TestAndGetValue(DICOM_TAG_NUMBER_OF_TIME_SLICES)) != NULL &&
-                   !value2->IsBinary() &&
-                   !value2->IsNull())
-          {
-            // Support of Cardio-PET images
-            int64_t numberOfSlices = boost::lexical_cast<int64_t>(value->GetContent());
-            int64_t numberOfTimeSlices = boost::lexical_cast<int64_t>(value2->GetContent());
-            target = numberOfSlices * numberOfTimeSlices;
-            return (target > 0);
-          }
+      else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_CARDIAC_NUMBER_OF_IMAGES)) != NULL &&
+               !value->IsNull() &&
+               !value->IsBinary())
+      {
+        target = boost::lexical_cast<int64_t>(value->GetContent());
+        return (target > 0);
+      }
+    }
+    catch (OrthancException&)
+    {
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+    }
+
+    return false;
+  }
+
+
+  StatelessDatabaseOperations::StoreOperations::StoreOperations(
+    std::map<MetadataType, std::string>& instanceMetadata,
+    const DicomMap& dicomSummary,
+    const Attachments& attachments,
+    const MetadataMap& metadata,
+    const DicomInstanceOrigin& origin,
+    bool overwrite,
+    bool hasTransferSyntax,
+    DicomTransferSyntax transferSyntax,
+    bool hasPixelDataOffset,
+    uint64_t pixelDataOffset,
+    uint64_t maximumStorageSize,
+    unsigned int maximumPatientCount) :
+    storeStatus_(StoreStatus_Failure),
+    instanceMetadata_(instanceMetadata),
+    dicomSummary_(dicomSummary),
+    attachments_(attachments),
+    metadata_(metadata),
+    origin_(origin),
+    overwrite_(overwrite),
+    hasTransferSyntax_(hasTransferSyntax),
+    transferSyntax_(transferSyntax),
+    hasPixelDataOffset_(hasPixelDataOffset),
+    pixelDataOffset_(pixelDataOffset),
+    maximumStorageSize_(maximumStorageSize),
+    maximumPatientCount_(maximumPatientCount)
+  {
+    hasExpectedInstances_ = ComputeExpectedNumberOfInstances(expectedInstances_, dicomSummary);
+    
+    instanceMetadata_.clear();
+
+    DicomInstanceHasher hasher(dicomSummary);
+    hashPatient_ = hasher.HashPatient();
+    hashStudy_ = hasher.HashStudy();
+    hashSeries_ = hasher.HashSeries();
+    hashInstance_ = hasher.HashInstance();
+  }
+
+
+  void StatelessDatabaseOperations::StoreOperations::Apply(ReadWriteTransaction& transaction)
+  {
+    // The operations might be applied several times, in the case of
+    // a retry or of the rollback of a group commit
+    instanceMetadata_.clear();
+    
+    try
+    {
+      IDatabaseWrapper::CreateInstanceResult status;
+      int64_t instanceId;
+
+      // Check whether this instance is already stored
+      if (!transaction.CreateInstance(status, instanceId, hashPatient_,
+                                      hashStudy_, hashSeries_, hashInstance_))
+      {
+        // The instance already exists
+
+        if (overwrite_)
+        {
+          // Overwrite the old instance
+          LOG(INFO) << "Overwriting instance: " << hashInstance_;
+          transaction.DeleteResource(instanceId);
 
-          else if ((value = dicomSummary.TestAndGetValue(DICOM_TAG_CARDIAC_NUMBER_OF_IMAGES)) != NULL &&
-                   !value->IsNull() &&
-                   !value->IsBinary())
+          // Re-create the instance, now that the old one is removed
+          if (!transaction.CreateInstance(status, instanceId, hashPatient_,
+                                          hashStudy_, hashSeries_, hashInstance_))
           {
-            target = boost::lexical_cast<int64_t>(value->GetContent());
-            return (target > 0);
+            throw OrthancException(ErrorCode_InternalError);
           }
         }
-        catch (OrthancException&)
-        {
-        }
-        catch (boost::bad_lexical_cast&)
+        else
         {
+          // Do nothing if the instance already exists and overwriting is disabled
+          transaction.GetAllMetadata(instanceMetadata_, instanceId);
+          storeStatus_ = StoreStatus_AlreadyStored;
+          return;
         }
+      }
+
 
-        return false;
+      // Warn about the creation of new resources. The order must be
+      // from instance to patient.
+
+      // NB: In theory, could be sped up by grouping the underlying
+      // calls to "transaction.LogChange()". However, this would only have an
+      // impact when new patient/study/series get created, which
+      // occurs far less often that creating new instances. The
+      // positive impact looks marginal in practice.
+      transaction.LogChange(instanceId, ChangeType_NewInstance, ResourceType_Instance, hashInstance_);
+
+      if (status.isNewSeries_)
+      {
+        transaction.LogChange(status.seriesId_, ChangeType_NewSeries, ResourceType_Series, hashSeries_);
       }
 
-    public:
-      Operations(std::map<MetadataType, std::string>& instanceMetadata,
-                 const DicomMap& dicomSummary,
-                 const Attachments& attachments,
-                 const MetadataMap& metadata,
-                 const DicomInstanceOrigin& origin,
-                 bool overwrite,
-                 bool hasTransferSyntax,
-                 DicomTransferSyntax transferSyntax,
-                 bool hasPixelDataOffset,
-                 uint64_t pixelDataOffset,
-                 uint64_t maximumStorageSize,
-                 unsigned int maximumPatientCount) :
-        storeStatus_(StoreStatus_Failure),
-        instanceMetadata_(instanceMetadata),
-        dicomSummary_(dicomSummary),
-        attachments_(attachments),
-        metadata_(metadata),
-        origin_(origin),
-        overwrite_(overwrite),
-        hasTransferSyntax_(hasTransferSyntax),
-        transferSyntax_(transferSyntax),
-        hasPixelDataOffset_(hasPixelDataOffset),
-        pixelDataOffset_(pixelDataOffset),
-        maximumStorageSize_(maximumStorageSize),
-        maximumPatientCount_(maximumPatientCount)
+      if (status.isNewStudy_)
       {
-        hasExpectedInstances_ = ComputeExpectedNumberOfInstances(expectedInstances_, dicomSummary);
-    
-        instanceMetadata_.clear();
+        transaction.LogChange(status.studyId_, ChangeType_NewStudy, ResourceType_Study, hashStudy_);
+      }
 
-        DicomInstanceHasher hasher(dicomSummary);
-        hashPatient_ = hasher.HashPatient();
-        hashStudy_ = hasher.HashStudy();
-        hashSeries_ = hasher.HashSeries();
-        hashInstance_ = hasher.HashInstance();
+      if (status.isNewPatient_)
+      {
+        transaction.LogChange(status.patientId_, ChangeType_NewPatient, ResourceType_Patient, hashPatient_);
       }
 
-      StoreStatus GetStoreStatus() const
+
+      // Ensure there is enough room in the storage for the new instance
+      uint64_t instanceSize = 0;
+      for (Attachments::const_iterator it = attachments_.begin();
+           it != attachments_.end(); ++it)
       {
-        return storeStatus_;
+        instanceSize += it->GetCompressedSize();
       }
-        
-      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+
+      transaction.Recycle(maximumStorageSize_, maximumPatientCount_,
+                          instanceSize, hashPatient_ /* don't consider the current patient for recycling */);
+
+
+      // Attach the files to the newly created instance
+      for (Attachments::const_iterator it = attachments_.begin();
+           it != attachments_.end(); ++it)
       {
-        try
-        {
-          IDatabaseWrapper::CreateInstanceResult status;
-          int64_t instanceId;
+        transaction.AddAttachment(instanceId, *it, 0 /* this is the first revision */);
+      }
 
-          // Check whether this instance is already stored
-          if (!transaction.CreateInstance(status, instanceId, hashPatient_,
-                                          hashStudy_, hashSeries_, hashInstance_))
-          {
-            // The instance already exists
-        
-            if (overwrite_)
-            {
-              // Overwrite the old instance
-              LOG(INFO) << "Overwriting instance: " << hashInstance_;
-              transaction.DeleteResource(instanceId);
 
-              // Re-create the instance, now that the old one is removed
-              if (!transaction.CreateInstance(status, instanceId, hashPatient_,
-                                              hashStudy_, hashSeries_, hashInstance_))
-              {
-                throw OrthancException(ErrorCode_InternalError);
-              }
-            }
-            else
-            {
-              // Do nothing if the instance already exists and overwriting is disabled
-              transaction.GetAllMetadata(instanceMetadata_, instanceId);
-              storeStatus_ = StoreStatus_AlreadyStored;
-              return;
-            }
-          }
+      {
+        ResourcesContent content(true /* new resource, metadata can be set */);
 
+        // Populate the tags of the newly-created resources
 
-          // Warn about the creation of new resources. The order must be
-          // from instance to patient.
+        content.AddResource(instanceId, ResourceType_Instance, dicomSummary_);
 
-          // NB: In theory, could be sped up by grouping the underlying
-          // calls to "transaction.LogChange()". However, this would only have an
-          // impact when new patient/study/series get created, which
-          // occurs far less often that creating new instances. The
-          // positive impact looks marginal in practice.
-          transaction.LogChange(instanceId, ChangeType_NewInstance, ResourceType_Instance, hashInstance_);
+        if (status.isNewSeries_)
+        {
+          content.AddResource(status.seriesId_, ResourceType_Series, dicomSummary_);
+        }
 
-          if (status.isNewSeries_)
-          {
-            transaction.LogChange(status.seriesId_, ChangeType_NewSeries, ResourceType_Series, hashSeries_);
-          }
-      
-          if (status.isNewStudy_)
-          {
-            transaction.LogChange(status.studyId_, ChangeType_NewStudy, ResourceType_Study, hashStudy_);
-          }
-      
-          if (status.isNewPatient_)
-          {
-            transaction.LogChange(status.patientId_, ChangeType_NewPatient, ResourceType_Patient, hashPatient_);
-          }
-      
-      
-          // Ensure there is enough room in the storage for the new instance
-          uint64_t instanceSize = 0;
-          for (Attachments::const_iterator it = attachments_.begin();
-               it != attachments_.end(); ++it)
-          {
-            instanceSize += it->GetCompressedSize();
-          }
+        if (status.isNewStudy_)
+        {
+          content.AddResource(status.studyId_, ResourceType_Study, dicomSummary_);
+        }
 
-          transaction.Recycle(maximumStorageSize_, maximumPatientCount_,
-                              instanceSize, hashPatient_ /* don't consider the current patient for recycling */);
-      
-     
-          // Attach the files to the newly created instance
-          for (Attachments::const_iterator it = attachments_.begin();
-               it != attachments_.end(); ++it)
+        if (status.isNewPatient_)
+        {
+          content.AddResource(status.patientId_, ResourceType_Patient, dicomSummary_);
+        }
+
+
+        // Attach the user-specified metadata
+
+        for (MetadataMap::const_iterator 
+               it = metadata_.begin(); it != metadata_.end(); ++it)
+        {
+          switch (it->first.first)
           {
-            transaction.AddAttachment(instanceId, *it, 0 /* this is the first revision */);
+            case ResourceType_Patient:
+              content.AddMetadata(status.patientId_, it->first.second, it->second);
+              break;
+
+            case ResourceType_Study:
+              content.AddMetadata(status.studyId_, it->first.second, it->second);
+              break;
+
+            case ResourceType_Series:
+              content.AddMetadata(status.seriesId_, it->first.second, it->second);
+              break;
+
+            case ResourceType_Instance:
+              SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                                  it->first.second, it->second);
+              break;
+
+            default:
+              throw OrthancException(ErrorCode_ParameterOutOfRange);
           }
+        }
 
-      
-          {
-            ResourcesContent content(true /* new resource, metadata can be set */);
-      
-            // Populate the tags of the newly-created resources
 
-            content.AddResource(instanceId, ResourceType_Instance, dicomSummary_);
+        // Attach the auto-computed metadata for the patient/study/series levels
+        std::string now = SystemToolbox::GetNowIsoString(true /* use UTC time (not local time) */);
+        content.AddMetadata(status.seriesId_, MetadataType_LastUpdate, now);
+        content.AddMetadata(status.studyId_, MetadataType_LastUpdate, now);
+        content.AddMetadata(status.patientId_, MetadataType_LastUpdate, now);
 
-            if (status.isNewSeries_)
-            {
-              content.AddResource(status.seriesId_, ResourceType_Series, dicomSummary_);
-            }
+        if (status.isNewSeries_)
+        {
+          if (hasExpectedInstances_)
+          {
+            content.AddMetadata(status.seriesId_, MetadataType_Series_ExpectedNumberOfInstances,
+                                boost::lexical_cast<std::string>(expectedInstances_));
+          }
 
-            if (status.isNewStudy_)
-            {
-              content.AddResource(status.studyId_, ResourceType_Study, dicomSummary_);
-            }
+          // New in Orthanc 1.9.0
+          content.AddMetadata(status.seriesId_, MetadataType_RemoteAet,
+                              origin_.GetRemoteAetC());
+        }
 
-            if (status.isNewPatient_)
-            {
-              content.AddResource(status.patientId_, ResourceType_Patient, dicomSummary_);
-            }
 
+        // Attach the auto-computed metadata for the instance level,
+        // reflecting these additions into the input metadata map
+        SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                            MetadataType_Instance_ReceptionDate, now);
+        SetInstanceMetadata(content, instanceMetadata_, instanceId, MetadataType_RemoteAet,
+                            origin_.GetRemoteAetC());
+        SetInstanceMetadata(content, instanceMetadata_, instanceId, MetadataType_Instance_Origin, 
+                            EnumerationToString(origin_.GetRequestOrigin()));
 
-            // Attach the user-specified metadata
 
-            for (MetadataMap::const_iterator 
-                   it = metadata_.begin(); it != metadata_.end(); ++it)
-            {
-              switch (it->first.first)
-              {
-                case ResourceType_Patient:
-                  content.AddMetadata(status.patientId_, it->first.second, it->second);
-                  break;
+        if (hasTransferSyntax_)
+        {
+          // New in Orthanc 1.2.0
+          SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                              MetadataType_Instance_TransferSyntax,
+                              GetTransferSyntaxUid(transferSyntax_));
+        }
 
-                case ResourceType_Study:
-                  content.AddMetadata(status.studyId_, it->first.second, it->second);
-                  break;
+        {
+          std::string s;
 
-                case ResourceType_Series:
-                  content.AddMetadata(status.seriesId_, it->first.second, it->second);
-                  break;
+          if (origin_.LookupRemoteIp(s))
+          {
+            // New in Orthanc 1.4.0
+            SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                                MetadataType_Instance_RemoteIp, s);
+          }
 
-                case ResourceType_Instance:
-                  SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                      it->first.second, it->second);
-                  break;
+          if (origin_.LookupCalledAet(s))
+          {
+            // New in Orthanc 1.4.0
+            SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                                MetadataType_Instance_CalledAet, s);
+          }
 
-                default:
-                  throw OrthancException(ErrorCode_ParameterOutOfRange);
-              }
-            }
+          if (origin_.LookupHttpUsername(s))
+          {
+            // New in Orthanc 1.4.0
+            SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                                MetadataType_Instance_HttpUsername, s);
+          }
+        }
 
-        
-            // Attach the auto-computed metadata for the patient/study/series levels
-            std::string now = SystemToolbox::GetNowIsoString(true /* use UTC time (not local time) */);
-            content.AddMetadata(status.seriesId_, MetadataType_LastUpdate, now);
-            content.AddMetadata(status.studyId_, MetadataType_LastUpdate, now);
-            content.AddMetadata(status.patientId_, MetadataType_LastUpdate, now);
+        if (hasPixelDataOffset_)
+        {
+          // New in Orthanc 1.9.1
+          SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                              MetadataType_Instance_PixelDataOffset,
+                              boost::lexical_cast<std::string>(pixelDataOffset_));
+        }
 
-            if (status.isNewSeries_)
-            {
-              if (hasExpectedInstances_)
-              {
-                content.AddMetadata(status.seriesId_, MetadataType_Series_ExpectedNumberOfInstances,
-                                    boost::lexical_cast<std::string>(expectedInstances_));
-              }
+        const DicomValue* value;
+        if ((value = dicomSummary_.TestAndGetValue(DICOM_TAG_SOP_CLASS_UID)) != NULL &&
+            !value->IsNull() &&
+            !value->IsBinary())
+        {
+          SetInstanceMetadata(content, instanceMetadata_, instanceId,
+                              MetadataType_Instance_SopClassUid, value->GetContent());
+        }
 
-              // New in Orthanc 1.9.0
-              content.AddMetadata(status.seriesId_, MetadataType_RemoteAet,
-                                  origin_.GetRemoteAetC());
-            }
 
-        
-            // Attach the auto-computed metadata for the instance level,
-            // reflecting these additions into the input metadata map
+        if ((value = dicomSummary_.TestAndGetValue(DICOM_TAG_INSTANCE_NUMBER)) != NULL ||
+            (value = dicomSummary_.TestAndGetValue(DICOM_TAG_IMAGE_INDEX)) != NULL)
+        {
+          if (!value->IsNull() && 
+              !value->IsBinary())
+          {
             SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                MetadataType_Instance_ReceptionDate, now);
-            SetInstanceMetadata(content, instanceMetadata_, instanceId, MetadataType_RemoteAet,
-                                origin_.GetRemoteAetC());
-            SetInstanceMetadata(content, instanceMetadata_, instanceId, MetadataType_Instance_Origin, 
-                                EnumerationToString(origin_.GetRequestOrigin()));
+                                MetadataType_Instance_IndexInSeries, Toolbox::StripSpaces(value->GetContent()));
+          }
+        }
 
 
-            if (hasTransferSyntax_)
-            {
-              // New in Orthanc 1.2.0
-              SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                  MetadataType_Instance_TransferSyntax,
-                                  GetTransferSyntaxUid(transferSyntax_));
-            }
+        transaction.SetResourcesContent(content);
+      }
 
-            {
-              std::string s;
 
-              if (origin_.LookupRemoteIp(s))
-              {
-                // New in Orthanc 1.4.0
-                SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                    MetadataType_Instance_RemoteIp, s);
-              }
+      // Check whether the series of this new instance is now completed
+      int64_t expectedNumberOfInstances;
+      if (ComputeExpectedNumberOfInstances(expectedNumberOfInstances, dicomSummary_))
+      {
+        SeriesStatus seriesStatus = transaction.GetSeriesStatus(status.seriesId_, expectedNumberOfInstances);
+        if (seriesStatus == SeriesStatus_Complete)
+        {
+          transaction.LogChange(status.seriesId_, ChangeType_CompletedSeries, ResourceType_Series, hashSeries_);
+        }
+      }
 
-              if (origin_.LookupCalledAet(s))
-              {
-                // New in Orthanc 1.4.0
-                SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                    MetadataType_Instance_CalledAet, s);
-              }
+      transaction.LogChange(status.seriesId_, ChangeType_NewChildInstance, ResourceType_Series, hashSeries_);
+      transaction.LogChange(status.studyId_, ChangeType_NewChildInstance, ResourceType_Study, hashStudy_);
+      transaction.LogChange(status.patientId_, ChangeType_NewChildInstance, ResourceType_Patient, hashPatient_);
 
-              if (origin_.LookupHttpUsername(s))
-              {
-                // New in Orthanc 1.4.0
-                SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                    MetadataType_Instance_HttpUsername, s);
-              }
-            }
+      // Mark the parent resources of this instance as unstable
+      transaction.GetTransactionContext().MarkAsUnstable(status.seriesId_, ResourceType_Series, hashSeries_);
+      transaction.GetTransactionContext().MarkAsUnstable(status.studyId_, ResourceType_Study, hashStudy_);
+      transaction.GetTransactionContext().MarkAsUnstable(status.patientId_, ResourceType_Patient, hashPatient_);
+      transaction.GetTransactionContext().SignalAttachmentsAdded(instanceSize);
 
-            if (hasPixelDataOffset_)
-            {
-              // New in Orthanc 1.9.1
-              SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                  MetadataType_Instance_PixelDataOffset,
-                                  boost::lexical_cast<std::string>(pixelDataOffset_));
-            }
-        
-            const DicomValue* value;
-            if ((value = dicomSummary_.TestAndGetValue(DICOM_TAG_SOP_CLASS_UID)) != NULL &&
-                !value->IsNull() &&
-                !value->IsBinary())
-            {
-              SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                  MetadataType_Instance_SopClassUid, value->GetContent());
-            }
+      storeStatus_ = StoreStatus_Success;          
+    }
+    catch (OrthancException& e)
+    {
+      if (e.GetErrorCode() == ErrorCode_DatabaseCannotSerialize)
+      {
+        throw;
+      }
+      else
+      {
+        LOG(ERROR) << "EXCEPTION [" << e.What() << "]";
+        storeStatus_ = StoreStatus_Failure;
+      }
+    }
+  }
 
 
-            if ((value = dicomSummary_.TestAndGetValue(DICOM_TAG_INSTANCE_NUMBER)) != NULL ||
-                (value = dicomSummary_.TestAndGetValue(DICOM_TAG_IMAGE_INDEX)) != NULL)
-            {
-              if (!value->IsNull() && 
-                  !value->IsBinary())
-              {
-                SetInstanceMetadata(content, instanceMetadata_, instanceId,
-                                    MetadataType_Instance_IndexInSeries, Toolbox::StripSpaces(value->GetContent()));
-              }
-            }
+  StoreStatus StatelessDatabaseOperations::Store(std::map<MetadataType, std::string>& instanceMetadata,
+                                                 const DicomMap& dicomSummary,
+                                                 const Attachments& attachments,
+                                                 const MetadataMap& metadata,
+                                                 const DicomInstanceOrigin& origin,
+                                                 bool overwrite,
+                                                 bool hasTransferSyntax,
+                                                 DicomTransferSyntax transferSyntax,
+                                                 bool hasPixelDataOffset,
+                                                 uint64_t pixelDataOffset,
+                                                 uint64_t maximumStorageSize,
+                                                 unsigned int maximumPatients)
+  {
+    StoreOperations operations(instanceMetadata, dicomSummary, attachments, metadata, origin,
+                               overwrite, hasTransferSyntax, transferSyntax, hasPixelDataOffset,
+                               pixelDataOffset, maximumStorageSize, maximumPatients);
+    Apply(operations);
+    return operations.GetStoreStatus();
+  }
 
-        
-            transaction.SetResourcesContent(content);
-          }
 
-  
-          // Check whether the series of this new instance is now completed
-          int64_t expectedNumberOfInstances;
-          if (ComputeExpectedNumberOfInstances(expectedNumberOfInstances, dicomSummary_))
-          {
-            SeriesStatus seriesStatus = transaction.GetSeriesStatus(status.seriesId_, expectedNumberOfInstances);
-            if (seriesStatus == SeriesStatus_Complete)
-            {
-              transaction.LogChange(status.seriesId_, ChangeType_CompletedSeries, ResourceType_Series, hashSeries_);
-            }
-          }
-          
-          transaction.LogChange(status.seriesId_, ChangeType_NewChildInstance, ResourceType_Series, hashSeries_);
-          transaction.LogChange(status.studyId_, ChangeType_NewChildInstance, ResourceType_Study, hashStudy_);
-          transaction.LogChange(status.patientId_, ChangeType_NewChildInstance, ResourceType_Patient, hashPatient_);
-          
-          // Mark the parent resources of this instance as unstable
-          transaction.GetTransactionContext().MarkAsUnstable(status.seriesId_, ResourceType_Series, hashSeries_);
-          transaction.GetTransactionContext().MarkAsUnstable(status.studyId_, ResourceType_Study, hashStudy_);
-          transaction.GetTransactionContext().MarkAsUnstable(status.patientId_, ResourceType_Patient, hashPatient_);
-          transaction.GetTransactionContext().SignalAttachmentsAdded(instanceSize);
+  bool StatelessDatabaseOperations::StoreBatch(const std::vector<StoreOperations*>& operations)
+  {
+    class Operations : public IReadWriteOperations
+    {
+    private:
+      const std::vector<StoreOperations*>&  operations_;
+      
+    public:
+      explicit Operations(const std::vector<StoreOperations*>& operations) :
+        operations_(operations)
+      {
+      }
 
-          storeStatus_ = StoreStatus_Success;          
-        }
-        catch (OrthancException& e)
+      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        for (size_t i = 0; i < operations_.size(); i++)
         {
-          if (e.GetErrorCode() == ErrorCode_DatabaseCannotSerialize)
-          {
-            throw;
-          }
-          else
+          assert(operations_[i] != NULL);
+          operations_[i]->Apply(transaction);
+
+          if (operations_[i]->GetStoreStatus() == StoreStatus_Failure)
           {
-            LOG(ERROR) << "EXCEPTION [" << e.What() << "]";
-            storeStatus_ = StoreStatus_Failure;
+            // Throwing an exception rolls back the whole transaction,
+            // which prevents one failing instance from leaving the
+            // other instances of the batch in a partial state
+            throw OrthancException(ErrorCode_InternalError,
+                                   "Cannot store one instance of the group", false /* don't log */);
           }
         }
       }
     };
 
+    for (size_t i = 0; i < operations.size(); i++)
+    {
+      if (operations[i] == NULL)
+      {
+        throw OrthancException(ErrorCode_NullPointer);
+      }
+    }
 
-    Operations operations(instanceMetadata, dicomSummary, attachments, metadata, origin,
-                          overwrite, hasTransferSyntax, transferSyntax, hasPixelDataOffset,
-                          pixelDataOffset, maximumStorageSize, maximumPatients);
-    Apply(operations);
-    return operations.GetStoreStatus();
+    try
+    {
+      Operations batch(operations);
+      Apply(batch);
+      return true;
+    }
+    catch (OrthancException& e)
+    {
+      LOG(INFO) << "Rolling back a group of " << operations.size()
+                << " instances, that will be stored separately: " << e.What();
+      return false;
+    }
   }
 
 
@@ -63,6 +63,11 @@ namespace Orthanc
 
       virtual void Commit() = 0;
 
+      // Invoked just before the database transaction is committed,
+      // which allows to save additional information within this
+      // transaction (new in Orthanc 1.9.6)
+      virtual void PrepareCommit(IDatabaseWrapper::ITransaction& transaction) = 0;
+
       virtual int64_t GetCompressedSizeDelta() = 0;
 
       virtual bool IsUnstableResource(int64_t id) = 0;
@@ -254,6 +259,11 @@ namespace Orthanc
         return transaction_.LookupGlobalProperty(target, property, shared);
       }
 
+      void GetStorageDeletions(std::map<std::string, FileContentType>& target)
+      {
+        transaction_.GetStorageDeletions(target);
+      }
+
       bool LookupMetadata(std::string& target,
                           int64_t& revision,
                           int64_t id,
@@ -282,6 +292,19 @@ namespace Orthanc
       {
         return transaction_.LookupResourceAndParent(id, type, parentPublicId, publicId);
       }
+
+      bool LookupResourceStatistics(uint64_t& countStudies,
+                                    uint64_t& countSeries,
+                                    uint64_t& countInstances,
+                                    uint64_t& diskSize,
+                                    uint64_t& uncompressedSize,
+                                    uint64_t& dicomDiskSize,
+                                    uint64_t& dicomUncompressedSize,
+                                    int64_t id)
+      {
+        return transaction_.LookupResourceStatistics(countStudies, countSeries, countInstances, diskSize,
+                                                     uncompressedSize, dicomDiskSize, dicomUncompressedSize, id);
+      }
     };
 
 
@@ -353,6 +376,11 @@ namespace Orthanc
         transaction_.LogExportedResource(resource);
       }
 
+      void RemoveStorageDeletions(const std::list<std::string>& uuids)
+      {
+        transaction_.RemoveStorageDeletions(uuids);
+      }
+
       void SetGlobalProperty(GlobalProperty property,
                              bool shared,
                              const std::string& value)
@@ -406,6 +434,60 @@ namespace Orthanc
 
       virtual void Apply(ReadWriteTransaction& transaction) = 0;
     };
+
+
+    /**
+     * Operations corresponding to the storage of one DICOM instance
+     * into the index. This class is publicly exposed so that several
+     * instances can be grouped into one single database transaction
+     * (cf. "StoreBatch()").
+     **/
+    class StoreOperations : public IReadWriteOperations
+    {
+    private:
+      StoreStatus                          storeStatus_;
+      std::map<MetadataType, std::string>& instanceMetadata_;
+      const DicomMap&                      dicomSummary_;
+      const Attachments&                   attachments_;
+      const MetadataMap&                   metadata_;
+      const DicomInstanceOrigin&           origin_;
+      bool                                 overwrite_;
+      bool                                 hasTransferSyntax_;
+      DicomTransferSyntax                  transferSyntax_;
+      bool                                 hasPixelDataOffset_;
+      uint64_t                             pixelDataOffset_;
+      uint64_t                             maximumStorageSize_;
+      unsigned int                         maximumPatientCount_;
+
+      // Auto-computed fields
+      bool          hasExpectedInstances_;
+      int64_t       expectedInstances_;
+      std::string   hashPatient_;
+      std::string   hashStudy_;
+      std::string   hashSeries_;
+      std::string   hashInstance_;
+
+    public:
+      StoreOperations(std::map<MetadataType, std::string>& instanceMetadata,
+                      const DicomMap& dicomSummary,
+                      const Attachments& attachments,
+                      const MetadataMap& metadata,
+                      const DicomInstanceOrigin& origin,
+                      bool overwrite,
+                      bool hasTransferSyntax,
+                      DicomTransferSyntax transferSyntax,
+                      bool hasPixelDataOffset,
+                      uint64_t pixelDataOffset,
+                      uint64_t maximumStorageSize,
+                      unsigned int maximumPatientCount);
+
+      StoreStatus GetStoreStatus() const
+      {
+        return storeStatus_;
+      }
+
+      virtual void Apply(ReadWriteTransaction& transaction) ORTHANC_OVERRIDE;
+    };
     
 
   private:
@@ -415,6 +497,7 @@ namespace Orthanc
     IDatabaseWrapper&                            db_;
     boost::shared_ptr<MainDicomTagsRegistry>     mainDicomTagsRegistry_;  // "shared_ptr" because of PImpl
     bool                                         hasFlushToDisk_;
+    bool                                         hasStorageDeletionQueue_;
 
     // Mutex to protect the configuration options
     boost::shared_mutex                          mutex_;
@@ -428,6 +511,12 @@ namespace Orthanc
     void ApplyInternal(IReadOnlyOperations* readOperations,
                        IReadWriteOperations* writeOperations);
 
+    void ExpandResourcesInternal(Json::Value& target,
+                                 const std::list<std::string>& publicIds,
+                                 bool checkLevel,
+                                 ResourceType level,
+                                 DicomToJsonFormat format);
+
   protected:
     void StandaloneRecycling(uint64_t maximumStorageSize,
                              unsigned int maximumPatientCount);
@@ -455,6 +544,11 @@ namespace Orthanc
       return hasFlushToDisk_;
     }
 
+    bool HasStorageDeletionQueue() const
+    {
+      return hasStorageDeletionQueue_;
+    }
+
     void Apply(IReadOnlyOperations& operations);
   
     void Apply(IReadWriteOperations& operations);
@@ -464,6 +558,23 @@ namespace Orthanc
                         ResourceType level,
                         DicomToJsonFormat format);
 
+    /**
+     * New in Orthanc 1.9.6: Expands a list of resources within one
+     * single read-only transaction, instead of one transaction per
+     * resource. The expanded resources are appended to the JSON array
+     * "target", in the order of "publicIds". The resources that do
+     * not exist (or whose level differs from "level") are skipped.
+     **/
+    void ExpandResources(Json::Value& target,
+                         const std::list<std::string>& publicIds,
+                         ResourceType level,
+                         DicomToJsonFormat format);
+
+    // Same as above, for resources whose level is not known
+    void ExpandResources(Json::Value& target,
+                         const std::list<std::string>& publicIds,
+                         DicomToJsonFormat format);
+
     void GetAllMetadata(std::map<MetadataType, std::string>& target,
                         const std::string& publicId,
                         ResourceType level);
@@ -606,6 +717,12 @@ namespace Orthanc
                            bool shared,
                            const std::string& value);
 
+    // Only applicable if "HasStorageDeletionQueue()" is "true"
+    void GetStorageDeletions(std::map<std::string, FileContentType>& target);
+
+    // Removes a batch of entries within one single transaction
+    void RemoveStorageDeletions(const std::list<std::string>& uuids);
+
     bool DeleteAttachment(const std::string& publicId,
                           FileContentType type,
                           bool hasRevision,
@@ -632,6 +749,16 @@ namespace Orthanc
                       uint64_t maximumStorageSize,
                       unsigned int maximumPatients);
 
+    /**
+     * Applies several "StoreOperations" inside one single read-write
+     * transaction ("group commit"). Returns "false" if the
+     * transaction was rolled back, which happens if at least one of
+     * the instances could not be stored: In such a case, the database
+     * is left unchanged, and the caller must apply each of the
+     * operations separately in order to get the individual status.
+     **/
+    bool StoreBatch(const std::vector<StoreOperations*>& operations);
+
     StoreStatus AddAttachment(int64_t& newRevision /*out*/,
                               const FileInfo& attachment,
                               const std::string& publicId,
@@ -36,12 +36,14 @@
 
 #include "OrthancConfiguration.h"
 
+#include "../../OrthancFramework/Sources/DicomFormat/DicomStreamReader.h"
 #include "../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
 #include "../../OrthancFramework/Sources/DicomParsing/Internals/DicomFrameIndex.h"
 #include "../../OrthancFramework/Sources/DicomParsing/Internals/DicomImageDecoder.h"
 #include "../../OrthancFramework/Sources/DicomParsing/ParsedDicomFile.h"
 #include "../../OrthancFramework/Sources/Logging.h"
 #include "../../OrthancFramework/Sources/OrthancException.h"
+#include "../../OrthancFramework/Sources/Toolbox.h"
 
 #include <dcmtk/dcmdata/dcfilefo.h>
 #include <dcmtk/dcmdata/dcdeftag.h>
@@ -55,6 +57,36 @@ namespace Orthanc
     const void*                       buffer_;
     size_t                            size_;
     std::unique_ptr<ParsedDicomFile>  parsed_;
+    std::unique_ptr<ParsedDicomFile>  header_;  // Tags before the pixel data
+
+    /**
+     * Only parses the tags before the pixel data, as located by
+     * "DicomStreamReader", if the full file has not been parsed yet
+     * (new in Orthanc 1.9.6). This avoids to load the pixel data into
+     * DCMTK to extract the main DICOM tags of large instances.
+     **/
+    const ParsedDicomFile& GetHeader() const
+    {
+      if (parsed_.get() != NULL)
+      {
+        return *parsed_;
+      }
+
+      if (header_.get() == NULL)
+      {
+        size_t headerSize;
+        if (LookupHeaderSize(headerSize, buffer_, size_))
+        {
+          const_cast<FromBuffer&>(*this).header_.reset(new ParsedDicomFile(buffer_, headerSize));
+        }
+        else
+        {
+          return GetParsedDicomFile();
+        }
+      }
+
+      return *header_;
+    }
 
   public:
     FromBuffer(const void* buffer,
@@ -64,6 +96,11 @@ namespace Orthanc
     {
     }
 
+    virtual void GetSummary(DicomMap& summary) const ORTHANC_OVERRIDE
+    {
+      OrthancConfiguration::DefaultExtractDicomSummary(summary, GetHeader());
+    }
+
     virtual ParsedDicomFile& GetParsedDicomFile() const ORTHANC_OVERRIDE
     {
       if (parsed_.get() == NULL)
@@ -237,6 +274,28 @@ namespace Orthanc
   }
 
 
+  bool DicomInstanceToStore::LookupHeaderSize(size_t& headerSize,
+                                              const void* buffer,
+                                              size_t size)
+  {
+    uint64_t pixelDataOffset;
+    DicomTransferSyntax transferSyntax;
+
+    if (DicomStreamReader::LookupPixelDataOffset(pixelDataOffset, transferSyntax, buffer, size) &&
+        pixelDataOffset < size &&
+        transferSyntax != DicomTransferSyntax_DeflatedLittleEndianExplicit &&
+        transferSyntax != DicomTransferSyntax_BigEndianExplicit)  // Retired, rarely used: Keep the path validated by DCMTK
+    {
+      headerSize = static_cast<size_t>(pixelDataOffset);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
   DicomInstanceToStore* DicomInstanceToStore::CreateFromParsedDicomFile(ParsedDicomFile& dicom)
   {
     return new FromParsedDicomFile(dicom);
@@ -292,6 +351,22 @@ namespace Orthanc
   }
 
 
+  const Json::Value& DicomInstanceToStore::GetSimplifiedTags() const
+  {
+    if (simplifiedTags_.get() == NULL)
+    {
+      Json::Value dicomAsJson;
+      GetDicomAsJson(dicomAsJson);
+
+      std::unique_ptr<Json::Value> simplified(new Json::Value);
+      Toolbox::SimplifyDicomAsJson(*simplified, dicomAsJson, DicomToJsonFormat_Human);
+      simplifiedTags_.reset(simplified.release());
+    }
+
+    return *simplifiedTags_;
+  }
+
+
   void DicomInstanceToStore::DatasetToJson(Json::Value& target, 
                                            DicomToJsonFormat format,
                                            DicomToJsonFlags flags,
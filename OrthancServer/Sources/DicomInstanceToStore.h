@@ -33,6 +33,7 @@
 
 #pragma once
 
+#include "../../OrthancFramework/Sources/Compatibility.h"
 #include "../../OrthancFramework/Sources/DicomFormat/DicomMap.h"
 #include "DicomInstanceOrigin.h"
 #include "ServerEnumerations.h"
@@ -59,6 +60,10 @@ namespace Orthanc
     MetadataMap          metadata_;
     DicomInstanceOrigin  origin_;
 
+    // Cache of the simplified tags, that are only computed if some
+    // listener requires them (new in Orthanc 1.9.6)
+    mutable std::unique_ptr<Json::Value>  simplifiedTags_;
+
   public:
     virtual ~DicomInstanceToStore()
     {
@@ -75,6 +80,16 @@ namespace Orthanc
 
     static DicomInstanceToStore* CreateFromDcmDataset(DcmDataset& dataset);
 
+    /**
+     * Returns the number of bytes before the pixel data, if the main
+     * DICOM tags can be extracted by only parsing these bytes. Returns
+     * "false" if the full file must be parsed, notably for deflated
+     * and big-endian transfer syntaxes (new in Orthanc 1.9.6).
+     **/
+    static bool LookupHeaderSize(size_t& headerSize,
+                                 const void* buffer,
+                                 size_t size);
+
 
  
     void SetOrigin(const DicomInstanceOrigin& origin)
@@ -119,6 +134,14 @@ namespace Orthanc
 
     virtual void GetDicomAsJson(Json::Value& dicomAsJson) const;
 
+    // The tags are computed on the first call, then cached
+    const Json::Value& GetSimplifiedTags() const;
+
+    bool HasSimplifiedTags() const
+    {
+      return simplifiedTags_.get() != NULL;
+    }
+
     virtual void DatasetToJson(Json::Value& target, 
                                DicomToJsonFormat format,
                                DicomToJsonFlags flags,
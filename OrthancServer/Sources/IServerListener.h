@@ -47,13 +47,13 @@ namespace Orthanc
     {
     }
 
+    // The simplified tags of the instance are computed on-demand by
+    // "instance.GetSimplifiedTags()" (new in Orthanc 1.9.6)
     virtual void SignalStoredInstance(const std::string& publicId,
-                                      const DicomInstanceToStore& instance,
-                                      const Json::Value& simplifiedTags) = 0;
+                                      const DicomInstanceToStore& instance) = 0;
     
     virtual void SignalChange(const ServerIndexChange& change) = 0;
 
-    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                        const Json::Value& simplified) = 0;
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance) = 0;
   };
 }
@@ -0,0 +1,294 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "PrecompiledHeadersServer.h"
+#include "JobsRegistryRecords.h"
+
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "../../OrthancFramework/Sources/Toolbox.h"
+#include "Database/StatelessDatabaseOperations.h"
+
+#include <map>
+
+
+static const char* const TYPE = "Type";
+static const char* const JOBS = "Jobs";
+static const char* const JOBS_REGISTRY = "JobsRegistry";
+
+namespace Orthanc
+{
+  static GlobalProperty GetBucketProperty(unsigned int bucket)
+  {
+    assert(bucket < JobsRegistryRecords::BUCKETS_COUNT);
+    return static_cast<GlobalProperty>(static_cast<int>(GlobalProperty_JobsRegistryBuckets) + bucket);
+  }
+
+
+  static bool ParseBucket(Json::Value& target,
+                          const std::string& serialized,
+                          unsigned int bucket)
+  {
+    if (Toolbox::ReadJson(target, serialized) &&
+        target.type() == Json::objectValue)
+    {
+      return true;
+    }
+    else
+    {
+      LOG(WARNING) << "Bucket " << bucket << " of the saved jobs registry is corrupted, ignoring it";
+      target = Json::objectValue;
+      return false;
+    }
+  }
+
+
+  unsigned int JobsRegistryRecords::GetBucket(const std::string& jobId)
+  {
+    // FNV-1a hash: This value must remain stable across versions of
+    // Orthanc, as it is stored in the database
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < jobId.size(); i++)
+    {
+      hash ^= static_cast<uint8_t>(jobId[i]);
+      hash *= 16777619u;
+    }
+
+    return hash % BUCKETS_COUNT;
+  }
+
+
+  bool JobsRegistryRecords::Load(Json::Value& registry,
+                                 bool& isLegacy)
+  {
+    class Operations : public StatelessDatabaseOperations::IReadOnlyOperations
+    {
+    private:
+      std::string               legacy_;
+      std::vector<std::string>  buckets_;
+
+    public:
+      const std::string& GetLegacy() const
+      {
+        return legacy_;
+      }
+
+      const std::vector<std::string>& GetBuckets() const
+      {
+        return buckets_;
+      }
+
+      virtual void Apply(StatelessDatabaseOperations::ReadOnlyTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        if (!transaction.LookupGlobalProperty(legacy_, GlobalProperty_JobsRegistry, false /* not shared */))
+        {
+          legacy_.clear();
+        }
+
+        buckets_.resize(BUCKETS_COUNT);
+
+        for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+        {
+          if (!transaction.LookupGlobalProperty(buckets_[i], GetBucketProperty(i), false /* not shared */))
+          {
+            buckets_[i].clear();
+          }
+        }
+      }
+    };
+
+    Operations operations;
+    index_.Apply(operations);
+
+    if (!operations.GetLegacy().empty())
+    {
+      /**
+       * The legacy global property is blanked by the first full save,
+       * so it is only non-empty if the jobs have not been migrated
+       * yet, or if an older version of Orthanc has run since then.
+       **/
+      if (Toolbox::ReadJson(registry, operations.GetLegacy()))
+      {
+        isLegacy = true;
+        return true;
+      }
+      else
+      {
+        throw OrthancException(ErrorCode_BadFileFormat, "Cannot parse the saved jobs registry");
+      }
+    }
+
+    isLegacy = false;
+
+    registry = Json::objectValue;
+    registry[TYPE] = JOBS_REGISTRY;
+    registry[JOBS] = Json::objectValue;
+
+    bool found = false;
+
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      const std::string& serialized = operations.GetBuckets() [i];
+
+      Json::Value bucket;
+      if (!serialized.empty() &&
+          ParseBucket(bucket, serialized, i))
+      {
+        Json::Value::Members members = bucket.getMemberNames();
+
+        for (size_t j = 0; j < members.size(); j++)
+        {
+          registry[JOBS][members[j]].swap(bucket[members[j]]);
+          found = true;
+        }
+      }
+    }
+
+    return found;
+  }
+
+
+  void JobsRegistryRecords::Save(const Json::Value& changes,
+                                 bool full)
+  {
+    typedef std::map<unsigned int, std::vector<std::string> >  ChangedBuckets;
+
+    class Operations : public StatelessDatabaseOperations::IReadWriteOperations
+    {
+    private:
+      const Json::Value&     changes_;
+      const ChangedBuckets&  buckets_;
+      bool                   full_;
+
+    public:
+      Operations(const Json::Value& changes,
+                 const ChangedBuckets& buckets,
+                 bool full) :
+        changes_(changes),
+        buckets_(buckets),
+        full_(full)
+      {
+      }
+
+      virtual void Apply(StatelessDatabaseOperations::ReadWriteTransaction& transaction) ORTHANC_OVERRIDE
+      {
+        for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+        {
+          ChangedBuckets::const_iterator changed = buckets_.find(i);
+
+          if (!full_ &&
+              changed == buckets_.end())
+          {
+            continue;  // This bucket is unchanged
+          }
+
+          std::string serialized;
+          bool exists = transaction.LookupGlobalProperty(serialized, GetBucketProperty(i), false /* not shared */);
+
+          Json::Value bucket = Json::objectValue;
+          if (exists &&
+              !full_ &&
+              !serialized.empty())
+          {
+            ParseBucket(bucket, serialized, i);
+          }
+
+          if (changed != buckets_.end())
+          {
+            for (size_t j = 0; j < changed->second.size(); j++)
+            {
+              const std::string& id = changed->second[j];
+
+              if (changes_[id].isNull())
+              {
+                bucket.removeMember(id);
+              }
+              else
+              {
+                bucket[id] = changes_[id];
+              }
+            }
+          }
+
+          if (bucket.empty())
+          {
+            if (exists &&
+                !serialized.empty())
+            {
+              // There is no primitive to remove a global property
+              transaction.SetGlobalProperty(GetBucketProperty(i), false /* not shared */, "");
+            }
+          }
+          else
+          {
+            Toolbox::WriteFastJson(serialized, bucket);
+            transaction.SetGlobalProperty(GetBucketProperty(i), false /* not shared */, serialized);
+          }
+        }
+
+        if (full_)
+        {
+          std::string legacy;
+          if (transaction.LookupGlobalProperty(legacy, GlobalProperty_JobsRegistry, false /* not shared */) &&
+              !legacy.empty())
+          {
+            transaction.SetGlobalProperty(GlobalProperty_JobsRegistry, false /* not shared */, "");
+          }
+        }
+      }
+    };
+
+    if (changes.type() != Json::objectValue)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    ChangedBuckets buckets;
+
+    Json::Value::Members members = changes.getMemberNames();
+    for (size_t i = 0; i < members.size(); i++)
+    {
+      buckets[GetBucket(members[i])].push_back(members[i]);
+    }
+
+    if (full ||
+        !buckets.empty())
+    {
+      Operations operations(changes, buckets, full);
+      index_.Apply(operations);
+    }
+  }
+}
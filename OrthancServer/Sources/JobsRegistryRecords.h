@@ -0,0 +1,89 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <json/value.h>
+#include <string>
+
+namespace Orthanc
+{
+  class StatelessDatabaseOperations;
+
+  /**
+   * Storage of the jobs registry in the database (new in Orthanc
+   * 1.9.6). Orthanc <= 1.9.5 was saving the full registry as one
+   * single global property, that had to be entirely rewritten each
+   * time one job had changed. The jobs are now spread over a fixed
+   * number of buckets, each of which is stored as a separate global
+   * property. Only the buckets containing a job that has changed
+   * since the last save are rewritten, and the buckets are parsed
+   * independently of each other at startup.
+   **/
+  class JobsRegistryRecords : public boost::noncopyable
+  {
+  private:
+    StatelessDatabaseOperations&  index_;
+
+  public:
+    static const unsigned int BUCKETS_COUNT = 256;
+
+    explicit JobsRegistryRecords(StatelessDatabaseOperations& index) :
+      index_(index)
+    {
+    }
+
+    static unsigned int GetBucket(const std::string& jobId);
+
+    /**
+     * Fills "registry" with the format expected by the constructor of
+     * "JobsRegistry". Returns "false" if no job was saved. If the jobs
+     * come from the global property of Orthanc <= 1.9.5, "isLegacy"
+     * is set to "true": In this case, the next save must be "full".
+     **/
+    bool Load(Json::Value& registry,
+              bool& isLegacy);
+
+    /**
+     * Applies the "changes" computed by
+     * "JobsRegistry::SerializeChanges()" in one single transaction. A
+     * "full" save rewrites all the buckets, and discards the legacy
+     * global property.
+     **/
+    void Save(const Json::Value& changes,
+              bool full);
+  };
+}
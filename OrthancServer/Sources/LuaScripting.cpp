@@ -46,6 +46,9 @@
 #include <OrthancServerResources.h>
 
 
+static const char* const ON_STORED_INSTANCE = "OnStoredInstance";
+
+
 namespace Orthanc
 {
   class LuaScripting::IEvent : public IDynamicObject
@@ -77,15 +80,13 @@ namespace Orthanc
 
     virtual void Apply(LuaScripting& that) ORTHANC_OVERRIDE
     {
-      static const char* NAME = "OnStoredInstance";
-
       LuaScripting::Lock lock(that);
 
-      if (lock.GetLua().IsExistingFunction(NAME))
+      if (lock.GetLua().IsExistingFunction(ON_STORED_INSTANCE))
       {
         that.InitializeJob();
 
-        LuaFunctionCall call(lock.GetLua(), NAME);
+        LuaFunctionCall call(lock.GetLua(), ON_STORED_INSTANCE);
         call.PushString(instanceId_);
         call.PushJson(simplifiedTags_);
         call.PushJson(metadata_);
@@ -768,19 +769,102 @@ namespace Orthanc
   }
 
 
+  class LuaScripting::FiltersPool : public boost::noncopyable
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  availableCondition_;
+    std::vector<LuaContext*>   contexts_;
+    std::vector<LuaContext*>   available_;
+
+    void Clear()
+    {
+      for (size_t i = 0; i < contexts_.size(); i++)
+      {
+        assert(contexts_[i] != NULL);
+        delete contexts_[i];
+      }
+
+      contexts_.clear();
+      available_.clear();
+    }
+
+  public:
+    FiltersPool(ServerContext& context,
+                unsigned int size)
+    {
+      try
+      {
+        // All the interpreters are initialized with the same scripts
+        for (unsigned int i = 0; i < size; i++)
+        {
+          std::unique_ptr<LuaContext> lua(new LuaContext);
+          InitializeContext(*lua, context);
+          contexts_.push_back(lua.release());
+        }
+      }
+      catch (OrthancException&)
+      {
+        Clear();
+        throw;
+      }
+
+      available_ = contexts_;
+    }
+
+    ~FiltersPool()
+    {
+      Clear();
+    }
+
+    class Accessor : public boost::noncopyable
+    {
+    private:
+      FiltersPool&  pool_;
+      LuaContext*   lua_;
+
+    public:
+      explicit Accessor(FiltersPool& pool) :
+        pool_(pool)
+      {
+        boost::mutex::scoped_lock lock(pool.mutex_);
+
+        while (pool.available_.empty())
+        {
+          pool.availableCondition_.wait(lock);
+        }
+
+        lua_ = pool.available_.back();
+        pool.available_.pop_back();
+      }
+
+      ~Accessor()
+      {
+        {
+          boost::mutex::scoped_lock lock(pool_.mutex_);
+          pool_.available_.push_back(lua_);
+        }
+
+        pool_.availableCondition_.notify_one();
+      }
+
+      LuaContext& GetLua()
+      {
+        assert(lua_ != NULL);
+        return *lua_;
+      }
+    };
+  };
+
+
   LuaScripting::LuaScripting(ServerContext& context) : 
     context_(context),
     state_(State_Setup)
   {
-    lua_.SetGlobalVariable("_ServerContext", &context);
-    lua_.RegisterFunction("RestApiGet", RestApiGet);
-    lua_.RegisterFunction("RestApiPost", RestApiPost);
-    lua_.RegisterFunction("RestApiPut", RestApiPut);
-    lua_.RegisterFunction("RestApiDelete", RestApiDelete);
-    lua_.RegisterFunction("GetOrthancConfiguration", GetOrthancConfiguration);
-
     LOG(INFO) << "Initializing Lua for the event handler";
-    LoadGlobalConfiguration();
+
+    boost::recursive_mutex::scoped_lock lock(mutex_);
+    InitializeContext(lua_, context);
   }
 
 
@@ -870,9 +954,20 @@ namespace Orthanc
 
 
   void LuaScripting::SignalStoredInstance(const std::string& publicId,
-                                          const DicomInstanceToStore& instance,
-                                          const Json::Value& simplifiedTags)
+                                          const DicomInstanceToStore& instance)
   {
+    {
+      // Don't compute the simplified tags if no Lua callback is
+      // interested in them. If the Lua context is busy, the event is
+      // enqueued anyway, in order not to slow down the ingest.
+      boost::recursive_mutex::scoped_try_lock lock(mutex_);
+      if (lock.owns_lock() &&
+          !lua_.IsExistingFunction(ON_STORED_INSTANCE))
+      {
+        return;
+      }
+    }
+
     Json::Value metadata = Json::objectValue;
 
     for (ServerIndex::MetadataMap::const_iterator 
@@ -885,7 +980,7 @@ namespace Orthanc
       }
     }
 
-    pendingEvents_.Enqueue(new OnStoredInstanceEvent(publicId, simplifiedTags, metadata, instance));
+    pendingEvents_.Enqueue(new OnStoredInstanceEvent(publicId, instance.GetSimplifiedTags(), metadata, instance));
   }
 
 
@@ -909,17 +1004,15 @@ namespace Orthanc
   }
 
 
-  bool LuaScripting::FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                            const Json::Value& simplified)
+  bool LuaScripting::FilterIncomingInstanceInternal(LuaContext& lua,
+                                                    const DicomInstanceToStore& instance)
   {
     static const char* NAME = "ReceivedInstanceFilter";
 
-    boost::recursive_mutex::scoped_lock lock(mutex_);
-
-    if (lua_.IsExistingFunction(NAME))
+    if (lua.IsExistingFunction(NAME))
     {
-      LuaFunctionCall call(lua_, NAME);
-      call.PushJson(simplified);
+      LuaFunctionCall call(lua, NAME);
+      call.PushJson(instance.GetSimplifiedTags());
 
       Json::Value origin;
       instance.GetOrigin().Format(origin);
@@ -946,27 +1039,62 @@ namespace Orthanc
   }
 
 
+  bool LuaScripting::FilterIncomingInstance(const DicomInstanceToStore& instance)
+  {
+    if (filtersPool_.get() != NULL)
+    {
+      FiltersPool::Accessor accessor(*filtersPool_);
+      return FilterIncomingInstanceInternal(accessor.GetLua(), instance);
+    }
+    else
+    {
+      boost::recursive_mutex::scoped_lock lock(mutex_);
+      return FilterIncomingInstanceInternal(lua_, instance);
+    }
+  }
+
+
+  void LuaScripting::SetFiltersPoolSize(unsigned int size)
+  {
+    if (filtersPool_.get() != NULL)
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (size > 1)
+    {
+      LOG(WARNING) << "The Lua filter of the received instances runs over " << size << " interpreters";
+      filtersPool_.reset(new FiltersPool(context_, size));
+    }
+  }
+
+
   void LuaScripting::Execute(const std::string& command)
   {
     pendingEvents_.Enqueue(new ExecuteEvent(command));
   }
 
 
-  void LuaScripting::LoadGlobalConfiguration()
+  void LuaScripting::InitializeContext(LuaContext& lua,
+                                       ServerContext& context)
   {
+    lua.SetGlobalVariable("_ServerContext", &context);
+    lua.RegisterFunction("RestApiGet", RestApiGet);
+    lua.RegisterFunction("RestApiPost", RestApiPost);
+    lua.RegisterFunction("RestApiPut", RestApiPut);
+    lua.RegisterFunction("RestApiDelete", RestApiDelete);
+    lua.RegisterFunction("GetOrthancConfiguration", GetOrthancConfiguration);
+
     OrthancConfiguration::ReaderLock configLock;
 
     {
       std::string command;
       Orthanc::ServerResources::GetFileResource(command, Orthanc::ServerResources::LUA_TOOLBOX);
-      lua_.Execute(command);
+      lua.Execute(command);
     }    
 
     std::list<std::string> luaScripts;
     configLock.GetConfiguration().GetListOfStringsParameter(luaScripts, "LuaScripts");
 
-    LuaScripting::Lock lock(*this);
-
     for (std::list<std::string>::const_iterator
            it = luaScripts.begin(); it != luaScripts.end(); ++it)
     {
@@ -975,7 +1103,7 @@ namespace Orthanc
       std::string script;
       SystemToolbox::ReadFile(script, path);
 
-      lock.GetLua().Execute(script);
+      lua.Execute(script);
     }
   }
 
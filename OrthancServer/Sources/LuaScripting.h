@@ -61,6 +61,7 @@ namespace Orthanc
     class JobEvent;
     class DeleteEvent;
     class UpdateEvent;
+    class FiltersPool;
 
     static ServerContext* GetServerContext(lua_State *state);
 
@@ -88,9 +89,16 @@ namespace Orthanc
     boost::thread            eventThread_;
     SharedMessageQueue       pendingEvents_;
 
+    // Pool of interpreters for "ReceivedInstanceFilter()" (new in Orthanc 1.9.6)
+    std::unique_ptr<FiltersPool>  filtersPool_;
+
     static void EventThread(LuaScripting* that);
 
-    void LoadGlobalConfiguration();
+    static void InitializeContext(LuaContext& lua,
+                                  ServerContext& context);
+
+    static bool FilterIncomingInstanceInternal(LuaContext& lua,
+                                               const DicomInstanceToStore& instance);
 
   public:
     class Lock : public boost::noncopyable
@@ -121,13 +129,19 @@ namespace Orthanc
     void Stop();
     
     void SignalStoredInstance(const std::string& publicId,
-                              const DicomInstanceToStore& instance,
-                              const Json::Value& simplifiedTags);
+                              const DicomInstanceToStore& instance);
 
     void SignalChange(const ServerIndexChange& change);
 
-    bool FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                const Json::Value& simplifiedTags);
+    bool FilterIncomingInstance(const DicomInstanceToStore& instance);
+
+    /**
+     * Runs "ReceivedInstanceFilter()" over a pool of "size" identical
+     * Lua interpreters, instead of the single interpreter that is
+     * protected by the mutex (new in Orthanc 1.9.6). This is only
+     * valid if the filter does not share state between its calls.
+     **/
+    void SetFiltersPoolSize(unsigned int size);
 
     void Execute(const std::string& command);
 
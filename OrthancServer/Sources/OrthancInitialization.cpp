@@ -267,6 +267,8 @@ namespace Orthanc
     static const char* const DEFAULT_ENCODING = "DefaultEncoding";
     static const char* const MALLOC_ARENA_MAX = "MallocArenaMax";
     static const char* const LOAD_PRIVATE_DICTIONARY = "LoadPrivateDictionary";
+    static const char* const LOG_ASYNC_QUEUE_SIZE = "LogAsyncQueueSize";
+    static const char* const LOG_ASYNC_OVERFLOW = "LogAsyncOverflow";
     
     OrthancConfiguration::WriterLock lock;
 
@@ -333,6 +335,34 @@ namespace Orthanc
                 << MALLOC_ARENA_MAX << "\"";
     }
 #endif
+
+    {
+      // New in Orthanc 1.9.6
+      unsigned int queueSize = lock.GetConfiguration().GetUnsignedIntegerParameter(LOG_ASYNC_QUEUE_SIZE, 0);
+      if (queueSize != 0)
+      {
+        Logging::AsyncOverflowPolicy policy;
+
+        std::string s = lock.GetConfiguration().GetStringParameter(LOG_ASYNC_OVERFLOW, "Block");
+        if (s == "Block")
+        {
+          policy = Logging::AsyncOverflowPolicy_Block;
+        }
+        else if (s == "DropInfo")
+        {
+          policy = Logging::AsyncOverflowPolicy_DropInfo;
+        }
+        else
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange,
+                                 "Configuration option \"" + std::string(LOG_ASYNC_OVERFLOW) +
+                                 "\" must be \"Block\" or \"DropInfo\", found: " + s);
+        }
+
+        LOG(WARNING) << "Asynchronous logging is enabled, with a queue of " << queueSize << " messages";
+        Logging::EnableAsynchronousMode(queueSize, policy);
+      }
+    }
   }
 
 
@@ -365,7 +395,12 @@ namespace Orthanc
     {
     }
 
-    return new SQLiteDatabaseWrapper(indexDirectory.string() + "/index");
+    std::unique_ptr<SQLiteDatabaseWrapper> database(new SQLiteDatabaseWrapper(indexDirectory.string() + "/index"));
+
+    // New option in Orthanc 1.9.6
+    database->SetReadersCount(lock.GetConfiguration().GetUnsignedIntegerParameter("SQLiteReadersCount", 0));
+
+    return database.release();
   }
 
 
@@ -380,9 +415,11 @@ namespace Orthanc
 
     public:
       FilesystemStorageWithoutDicom(const std::string& path,
-                                    bool fsyncOnWrite) :
+                                    bool fsyncOnWrite,
+                                    uint64_t memoryMapThreshold) :
         storage_(path, fsyncOnWrite)
       {
+        storage_.SetMemoryMapThreshold(memoryMapThreshold);
       }
 
       virtual void Create(const std::string& uuid,
@@ -445,6 +482,7 @@ namespace Orthanc
   {
     static const char* const SYNC_STORAGE_AREA = "SyncStorageArea";
     static const char* const STORE_DICOM = "StoreDicom";
+    static const char* const STORAGE_MEMORY_MAP_THRESHOLD = "StorageMemoryMapThreshold";
     
     OrthancConfiguration::ReaderLock lock;
 
@@ -459,14 +497,20 @@ namespace Orthanc
     // New in Orthanc 1.7.4
     bool fsyncOnWrite = lock.GetConfiguration().GetBooleanParameter(SYNC_STORAGE_AREA, true);
 
+    // New in Orthanc 1.9.6 (the option is expressed in MB)
+    uint64_t memoryMapThreshold = static_cast<uint64_t>(
+      lock.GetConfiguration().GetUnsignedIntegerParameter(STORAGE_MEMORY_MAP_THRESHOLD, 0)) * 1024 * 1024;
+
     if (lock.GetConfiguration().GetBooleanParameter(STORE_DICOM, true))
     {
-      return new FilesystemStorage(storageDirectory.string(), fsyncOnWrite);
+      std::unique_ptr<FilesystemStorage> storage(new FilesystemStorage(storageDirectory.string(), fsyncOnWrite));
+      storage->SetMemoryMapThreshold(memoryMapThreshold);
+      return storage.release();
     }
     else
     {
       LOG(WARNING) << "The DICOM files will not be stored, Orthanc running in index-only mode";
-      return new FilesystemStorageWithoutDicom(storageDirectory.string(), fsyncOnWrite);
+      return new FilesystemStorageWithoutDicom(storageDirectory.string(), fsyncOnWrite, memoryMapThreshold);
     }
   }
 
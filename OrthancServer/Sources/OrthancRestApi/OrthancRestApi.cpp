@@ -312,6 +312,7 @@ namespace Orthanc
 
 
   static const char* KEY_PERMISSIVE = "Permissive";
+  static const char* KEY_PARALLELISM = "Parallelism";
   static const char* KEY_PRIORITY = "Priority";
   static const char* KEY_SYNCHRONOUS = "Synchronous";
   static const char* KEY_ASYNCHRONOUS = "Asynchronous";
@@ -432,6 +433,11 @@ namespace Orthanc
       job->SetPermissive(false);
     }
 
+    if (body.isMember(KEY_PARALLELISM))
+    {
+      job->SetParallelism(SerializationToolbox::ReadUnsignedInteger(body, KEY_PARALLELISM));
+    }
+
     SubmitGenericJob(call, raii.release(), isDefaultSynchronous, body);
   }
 
@@ -458,7 +464,11 @@ namespace Orthanc
     DocumentSubmitGenericJob(call);
     call.GetDocumentation()
       .SetRequestField(KEY_PERMISSIVE, RestApiCallDocumentation::Type_Boolean,
-                       "If `true`, ignore errors during the individual steps of the job.", false);
+                       "If `true`, ignore errors during the individual steps of the job.", false)
+      .SetRequestField(KEY_PARALLELISM, RestApiCallDocumentation::Type_Number,
+                       "Number of threads that execute the independent steps of the job. Only "
+                       "the modification and anonymization jobs take this option into account "
+                       "(defaults to 1) (new in Orthanc 1.9.6)", false);
   }
 
 
@@ -435,6 +435,18 @@ namespace Orthanc
 
     job->SetDescription("REST API");
 
+    {
+      // New in Orthanc 1.9.6
+      OrthancConfiguration::ReaderLock lock;
+      job->SetLoaderThreads(lock.GetConfiguration().GetUnsignedIntegerParameter("ZipLoaderThreads", 3));
+      job->SetLoaderReadAhead(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("ZipLoaderReadAhead", 16),
+        static_cast<uint64_t>(lock.GetConfiguration().GetUnsignedIntegerParameter("ZipLoaderMaxMemory", 256)) * 1024 * 1024);
+      job->SetCompressionThreads(lock.GetConfiguration().GetUnsignedIntegerParameter("ZipCompressionThreads", 0));
+      job->SetStoreCompressedTransferSyntaxes(
+        lock.GetConfiguration().GetBooleanParameter("ZipStoreCompressedTransferSyntaxes", false));
+    }
+
     if (synchronous)
     {
       bool streaming;
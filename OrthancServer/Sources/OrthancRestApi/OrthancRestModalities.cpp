@@ -1683,6 +1683,9 @@ namespace Orthanc
   {
     static const char* KEY_TRANSCODE = "Transcode";
     static const char* KEY_COMPRESS = "Compress";
+    static const char* KEY_COMPRESSION_LEVEL = "CompressionLevel";
+    static const char* KEY_BATCH_SIZE = "BatchSize";
+    static const char* KEY_CONCURRENT_REQUESTS = "ConcurrentRequests";
 
     if (call.IsDocumentation())
     {
@@ -1699,6 +1702,17 @@ namespace Orthanc
                          "Transcode to the provided DICOM transfer syntax before the actual sending", false)
         .SetRequestField(KEY_COMPRESS, RestApiCallDocumentation::Type_Boolean,
                          "Whether to compress the DICOM instances using gzip before the actual sending", false)
+        .SetRequestField(KEY_COMPRESSION_LEVEL, RestApiCallDocumentation::Type_Number,
+                         "Compression level between 0 and 9, if `Compress` is `true` (defaults to 9) "
+                         "(new in Orthanc 1.9.6)", false)
+        .SetRequestField(KEY_BATCH_SIZE, RestApiCallDocumentation::Type_Number,
+                         "Number of DICOM instances that are sent within one HTTP request, as a ZIP archive. "
+                         "A value greater than 1 requires the remote peer to run Orthanc >= 1.8.2 "
+                         "(defaults to 1) (new in Orthanc 1.9.6)", false)
+        .SetRequestField(KEY_CONCURRENT_REQUESTS, RestApiCallDocumentation::Type_Number,
+                         "Number of HTTP requests that are sent in parallel to the remote peer, each of them "
+                         "containing `BatchSize` instances. A value greater than 1 requires the remote peer "
+                         "to run Orthanc >= 1.8.2 (defaults to 1) (new in Orthanc 1.9.6)", false)
         .SetUriArgument("id", "Identifier of the modality of interest");
       return;
     }
@@ -1723,6 +1737,24 @@ namespace Orthanc
     {
       job->SetCompress(SerializationToolbox::ReadBoolean(request, KEY_COMPRESS));
     }
+
+    if (request.type() == Json::objectValue)
+    {
+      if (request.isMember(KEY_COMPRESSION_LEVEL))
+      {
+        job->SetCompressionLevel(SerializationToolbox::ReadUnsignedInteger(request, KEY_COMPRESSION_LEVEL));
+      }
+
+      if (request.isMember(KEY_BATCH_SIZE))
+      {
+        job->SetBatchSize(SerializationToolbox::ReadUnsignedInteger(request, KEY_BATCH_SIZE));
+      }
+
+      if (request.isMember(KEY_CONCURRENT_REQUESTS))
+      {
+        job->SetConcurrentRequests(SerializationToolbox::ReadUnsignedInteger(request, KEY_CONCURRENT_REQUESTS));
+      }
+    }
     
     {
       OrthancConfiguration::ReaderLock lock;
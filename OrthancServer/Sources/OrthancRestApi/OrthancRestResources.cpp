@@ -144,18 +144,15 @@ namespace Orthanc
   {
     Json::Value answer = Json::arrayValue;
 
-    for (std::list<std::string>::const_iterator
-           resource = resources.begin(); resource != resources.end(); ++resource)
+    if (expand)
     {
-      if (expand)
-      {
-        Json::Value expanded;
-        if (index.ExpandResource(expanded, *resource, level, format))
-        {
-          answer.append(expanded);
-        }
-      }
-      else
+      // New in Orthanc 1.9.6: Expand all the resources within one transaction
+      index.ExpandResources(answer, resources, level, format);
+    }
+    else
+    {
+      for (std::list<std::string>::const_iterator
+             resource = resources.begin(); resource != resources.end(); ++resource)
       {
         answer.append(*resource);
       }
@@ -326,6 +323,9 @@ namespace Orthanc
         .SetDescription("Download one DICOM instance")
         .SetUriArgument("id", "Orthanc identifier of the DICOM instance of interest")
         .SetHttpHeader("Accept", "This HTTP header can be set to retrieve the DICOM instance in DICOMweb format")
+        .SetHttpHeader("Range", "Optional byte ranges of the DICOM file to be retrieved (new in Orthanc 1.9.6)")
+        .SetHttpHeader("If-None-Match", "Optional ETag of the DICOM file, to check if its content has changed (new in Orthanc 1.9.6)")
+        .SetAnswerHeader("ETag", "Identifier of the content of the DICOM file (new in Orthanc 1.9.6)")
         .AddAnswerType(MimeType_Dicom, "The DICOM instance")
         .AddAnswerType(MimeType_DicomWebJson, "The DICOM instance, in DICOMweb JSON format")
         .AddAnswerType(MimeType_DicomWebXml, "The DICOM instance, in DICOMweb XML format");
@@ -374,7 +374,38 @@ namespace Orthanc
       }
     }
 
-    context.AnswerAttachment(call.GetOutput(), publicId, FileContentType_Dicom);
+    FileInfo attachment;
+    int64_t revision;  // Ignored
+    if (!context.GetIndex().LookupAttachment(attachment, revision, publicId, FileContentType_Dicom))
+    {
+      throw OrthancException(ErrorCode_UnknownResource);
+    }
+
+    {
+      // New in Orthanc 1.9.6: The content of an attachment never
+      // changes, as a new attachment is created on each modification
+      const std::string etag = "\"" + attachment.GetUuid() + "\"";
+      call.GetOutput().GetLowLevelOutput().AddHeader("ETag", etag);
+      call.GetOutput().GetLowLevelOutput().AddHeader("Accept-Ranges", "bytes");
+
+      if (HttpToolbox::IsNoneMatch(call.GetHttpHeaders(), etag))
+      {
+        call.GetOutput().AnswerNotModified();
+        return;
+      }
+    }
+
+    std::vector<HttpToolbox::ByteRange> ranges;
+    if (HttpToolbox::LookupRange(ranges, call.GetHttpHeaders(), attachment.GetUncompressedSize()))
+    {
+      // New in Orthanc 1.9.6
+      ServerContext::AttachmentRangesReader reader(context, publicId, attachment);
+      call.GetOutput().AnswerByteRanges(EnumerationToString(MimeType_Dicom),
+                                        attachment.GetUncompressedSize(), ranges, reader);
+      return;
+    }
+
+    context.AnswerDicomFile(call.GetOutput(), publicId, attachment);
   }
 
 
@@ -1459,13 +1490,14 @@ namespace Orthanc
   }
   
 
-  static void SetAttachmentETag(const RestApiOutput& output,
-                                int64_t revision,
-                                const FileInfo& info)
+  static std::string SetAttachmentETag(const RestApiOutput& output,
+                                       int64_t revision,
+                                       const FileInfo& info)
   {
     const std::string etag = ("\"" + boost::lexical_cast<std::string>(revision) + "-" +
                               info.GetUncompressedMD5() + "\"");
     output.GetLowLevelOutput().AddHeader("ETag", etag);
+    return etag;
   }
 
 
@@ -1746,15 +1778,19 @@ namespace Orthanc
     int64_t revision;
     if (OrthancRestApi::GetIndex(call).LookupAttachment(info, revision, publicId, contentType))
     {
-      SetAttachmentETag(call.GetOutput(), revision, info);  // New in Orthanc 1.9.2
+      const std::string etag = SetAttachmentETag(call.GetOutput(), revision, info);  // New in Orthanc 1.9.2
 
+      // The "If-None-Match" header is evaluated before reading the
+      // storage area. "GetRevisionHeader()" also accepts a revision
+      // that is not surrounded by quotes.
       int64_t userRevision;
       std::string userMD5;
-      if (GetRevisionHeader(userRevision, userMD5, call, "If-None-Match") &&
-          revision == userRevision &&
-          info.GetUncompressedMD5() == userMD5)
+      if (HttpToolbox::IsNoneMatch(call.GetHttpHeaders(), etag) ||
+          (GetRevisionHeader(userRevision, userMD5, call, "If-None-Match") &&
+           revision == userRevision &&
+           info.GetUncompressedMD5() == userMD5))
       {
-        call.GetOutput().GetLowLevelOutput().SendStatus(HttpStatus_304_NotModified);
+        call.GetOutput().AnswerNotModified();
         return false;
       }
       else
@@ -1838,6 +1874,12 @@ namespace Orthanc
         .AddAnswerType(MimeType_Binary, "The attachment")
         .SetAnswerHeader("ETag", "Revision of the attachment, to be used in further `PUT` or `DELETE` operations")
         .SetHttpHeader("If-None-Match", "Optional revision of the metadata, to check if its content has changed");
+
+      if (uncompress)
+      {
+        call.GetDocumentation()
+          .SetHttpHeader("Range", "Optional byte ranges of the attachment to be retrieved (new in Orthanc 1.9.6)");
+      }
       return;
     }
 
@@ -1851,11 +1893,24 @@ namespace Orthanc
     FileInfo info;
     if (GetAttachmentInfo(info, call))
     {
-      // NB: "SetAttachmentETag()" is already invoked by "GetAttachmentInfo()"
+      // NB: "SetAttachmentETag()" is already invoked by
+      // "GetAttachmentInfo()", that has also answered "304 Not
+      // Modified" if the "If-None-Match" header matches the revision
 
       if (uncompress)
       {
-        context.AnswerAttachment(call.GetOutput(), publicId, type);
+        call.GetOutput().GetLowLevelOutput().AddHeader("Accept-Ranges", "bytes");  // New in Orthanc 1.9.6
+
+        std::vector<HttpToolbox::ByteRange> ranges;
+        if (HttpToolbox::LookupRange(ranges, call.GetHttpHeaders(), info.GetUncompressedSize()))
+        {
+          ServerContext::AttachmentRangesReader reader(context, publicId, info);
+          call.GetOutput().AnswerByteRanges(GetFileContentMime(type), info.GetUncompressedSize(), ranges, reader);
+        }
+        else
+        {
+          context.AnswerAttachment(call.GetOutput(), publicId, type);
+        }
       }
       else
       {
@@ -1863,19 +1918,7 @@ namespace Orthanc
         std::string content;
         int64_t revision;
         context.ReadAttachment(content, revision, publicId, type, false);
-
-        int64_t userRevision;
-        std::string userMD5;
-        if (GetRevisionHeader(userRevision, userMD5, call, "If-None-Match") &&
-            revision == userRevision &&
-            info.GetUncompressedMD5() == userMD5)
-        {
-          call.GetOutput().GetLowLevelOutput().SendStatus(HttpStatus_304_NotModified);
-        }
-        else
-        {
-          call.GetOutput().AnswerBuffer(content, MimeType_Binary);
-        }
+        call.GetOutput().AnswerBuffer(content, MimeType_Binary);
       }
     }
   }
@@ -2194,7 +2237,7 @@ namespace Orthanc
   }
 
 
-  template <enum CompressionType compression>
+  template <bool compress>
   static void ChangeAttachmentCompression(RestApiPostCall& call)
   {
     if (call.IsDocumentation())
@@ -2203,8 +2246,12 @@ namespace Orthanc
       std::string r = GetResourceTypeText(t, false /* plural */, false /* upper case */);
       call.GetDocumentation()
         .SetTag(GetResourceTypeText(t, true /* plural */, true /* upper case */))
-        .SetSummary(compression == CompressionType_None ? "Uncompress attachment" : "Compress attachment")
-        .SetDescription("Change the compression scheme that is used to store an attachment.")
+        .SetSummary(compress ? "Compress attachment" : "Uncompress attachment")
+        .SetDescription(compress ?
+                        "Compress an attachment, using the format and the level of compression that are set "
+                        "by the `StorageCompressionChunkSize`, `StorageCompressionLevel` and "
+                        "`StorageCompressionLevels` configuration options." :
+                        "Change the compression scheme that is used to store an attachment.")
         .SetUriArgument("id", "Orthanc identifier of the " + r + " of interest")
         .SetUriArgument("name", "The name of the attachment, or its index (cf. `UserContentType` configuration option)");
       return;
@@ -2216,7 +2263,9 @@ namespace Orthanc
     std::string name = call.GetUriComponent("name", "");
     FileContentType contentType = StringToContentType(name);
 
-    OrthancRestApi::GetContext(call).ChangeAttachmentCompression(publicId, contentType, compression);
+    ServerContext& context = OrthancRestApi::GetContext(call);
+    context.ChangeAttachmentCompression(publicId, contentType,
+                                        compress ? context.GetExplicitCompression() : CompressionType_None);
     call.GetOutput().AnswerBuffer("{}", MimeType_Json);
   }
 
@@ -2781,15 +2830,7 @@ namespace Orthanc
 
     const DicomToJsonFormat format = OrthancRestApi::GetDicomFormat(call, DicomToJsonFormat_Human);
 
-    for (std::list<std::string>::const_iterator
-           it = a.begin(); it != a.end(); ++it)
-    {
-      Json::Value resource;
-      if (OrthancRestApi::GetIndex(call).ExpandResource(resource, *it, end, format))
-      {
-        result.append(resource);
-      }
-    }
+    OrthancRestApi::GetIndex(call).ExpandResources(result, a, end, format);
 
     call.GetOutput().AnswerJson(result);
   }
@@ -3268,18 +3309,14 @@ namespace Orthanc
           }
         }
         
-        for (std::set<std::string>::const_iterator
-               it = interest.begin(); it != interest.end(); ++it)
+        std::list<std::string> tmp(interest.begin(), interest.end());
+        index.ExpandResources(answer, tmp, level, format);
+
+        if (metadata)
         {
-          Json::Value item;
-          if (index.ExpandResource(item, *it, level, format))
+          for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
           {
-            if (metadata)
-            {
-              AddMetadata(item[METADATA], index, *it, level);
-            }
-
-            answer.append(item);
+            AddMetadata(answer[i][METADATA], index, answer[i]["ID"].asString(), level);
           }
         }
       }
@@ -3289,22 +3326,25 @@ namespace Orthanc
         std::list<std::string> resources;
         SerializationToolbox::ReadListOfStrings(resources, request, "Resources");
 
-        for (std::list<std::string>::const_iterator
-               it = resources.begin(); it != resources.end(); ++it)
+        index.ExpandResources(answer, resources, format);
+
+        std::set<std::string> found;
+
+        for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
         {
-          ResourceType level;
-          Json::Value item;
-          if (index.LookupResourceType(level, *it) &&
-              index.ExpandResource(item, *it, level, format))
-          {
-            if (metadata)
-            {
-              AddMetadata(item[METADATA], index, *it, level);
-            }
+          const std::string id = answer[i]["ID"].asString();
+          found.insert(id);
 
-            answer.append(item);
+          if (metadata)
+          {
+            AddMetadata(answer[i][METADATA], index, id, StringToResourceType(answer[i]["Type"].asCString()));
           }
-          else
+        }
+
+        for (std::list<std::string>::const_iterator
+               it = resources.begin(); it != resources.end(); ++it)
+        {
+          if (found.find(*it) == found.end())
           {
             CLOG(INFO, HTTP) << "Unknown resource during a bulk content retrieval: " << *it;
           }
@@ -3437,7 +3477,7 @@ namespace Orthanc
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}", DeleteAttachment);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}", GetAttachmentOperations);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}", UploadAttachment);
-      Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/compress", ChangeAttachmentCompression<CompressionType_ZlibWithSize>);
+      Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/compress", ChangeAttachmentCompression<true>);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/compressed-data", GetAttachmentData<0>);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/compressed-md5", GetAttachmentCompressedMD5);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/compressed-size", GetAttachmentCompressedSize);
@@ -3445,7 +3485,7 @@ namespace Orthanc
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/is-compressed", IsAttachmentCompressed);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/md5", GetAttachmentMD5);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/size", GetAttachmentSize);
-      Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/uncompress", ChangeAttachmentCompression<CompressionType_None>);
+      Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/uncompress", ChangeAttachmentCompression<false>);
       Register("/" + resourceTypes[i] + "/{id}/attachments/{name}/verify-md5", VerifyAttachment);
     }
 
@@ -676,6 +676,45 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    class JobOutputRangesReader : public HttpOutput::IByteRangesReader
+    {
+    private:
+      JobsRegistry&  registry_;
+      std::string    job_;
+      std::string    key_;
+      uint64_t       totalSize_;
+
+    public:
+      JobOutputRangesReader(JobsRegistry& registry,
+                            const std::string& job,
+                            const std::string& key,
+                            uint64_t totalSize) :
+        registry_(registry),
+        job_(job),
+        key_(key),
+        totalSize_(totalSize)
+      {
+      }
+
+      virtual void ReadRange(std::string& target,
+                             uint64_t start,
+                             uint64_t end) ORTHANC_OVERRIDE
+      {
+        MimeType mime;
+        uint64_t size;
+        if (!registry_.GetJobOutputRange(target, mime, size, job_, key_, start, end) ||
+            size != totalSize_)
+        {
+          throw OrthancException(ErrorCode_InexistentItem,
+                                 "Job has no such output: " + key_);
+        }
+      }
+    };
+  }
+
+
   static void GetJobOutput(RestApiGetCall& call)
   {
     if (call.IsDocumentation())
@@ -687,6 +726,9 @@ namespace Orthanc
                         "DICOMDIR media or a ZIP archive provide such an output (with `key` equals to `archive`).")
         .SetUriArgument("id", "Identifier of the job of interest")
         .SetUriArgument("key", "Name of the output of interest")
+        .SetHttpHeader("Range", "Optional byte ranges of the output to be retrieved (new in Orthanc 1.9.6)")
+        .SetHttpHeader("If-None-Match", "Optional ETag of the output, to check if its content has changed (new in Orthanc 1.9.6)")
+        .SetAnswerHeader("ETag", "Identifier of the output, if it supports byte ranges (new in Orthanc 1.9.6)")
         .AddAnswerType(MimeType_Binary, "Content of the output of the job");
       return;
     }
@@ -694,11 +736,36 @@ namespace Orthanc
     std::string job = call.GetUriComponent("id", "");
     std::string key = call.GetUriComponent("key", "");
 
+    JobsRegistry& registry = OrthancRestApi::GetContext(call).GetJobsEngine().GetRegistry();
+
     std::string value;
     MimeType mime;
-    
-    if (OrthancRestApi::GetContext(call).GetJobsEngine().
-        GetRegistry().GetJobOutput(value, mime, job, key))
+    uint64_t totalSize;
+
+    if (registry.GetJobOutputRange(value, mime, totalSize, job, key, 0, 0))
+    {
+      // New in Orthanc 1.9.6: The output can be read by ranges (this
+      // is the case of the archives that are stored as temporary files)
+      const std::string etag = "\"" + job + "-" + key + "\"";
+      call.GetOutput().GetLowLevelOutput().AddHeader("ETag", etag);
+      call.GetOutput().GetLowLevelOutput().AddHeader("Accept-Ranges", "bytes");
+
+      if (HttpToolbox::IsNoneMatch(call.GetHttpHeaders(), etag))
+      {
+        call.GetOutput().AnswerNotModified();
+        return;
+      }
+
+      std::vector<HttpToolbox::ByteRange> ranges;
+      if (HttpToolbox::LookupRange(ranges, call.GetHttpHeaders(), totalSize))
+      {
+        JobOutputRangesReader reader(registry, job, key, totalSize);
+        call.GetOutput().AnswerByteRanges(EnumerationToString(mime), totalSize, ranges, reader);
+        return;
+      }
+    }
+
+    if (registry.GetJobOutput(value, mime, job, key))
     {
       call.GetOutput().AnswerBuffer(value, mime);
     }
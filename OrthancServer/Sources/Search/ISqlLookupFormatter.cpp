@@ -355,4 +355,47 @@ namespace Orthanc
       sql += " LIMIT " + boost::lexical_cast<std::string>(limit);
     }
   }
+
+
+  void ISqlLookupFormatter::ApplyWithSampleInstance(std::string& sql,
+                                                    ISqlLookupFormatter& formatter,
+                                                    const std::vector<DatabaseConstraint>& lookup,
+                                                    ResourceType queryLevel,
+                                                    size_t limit)
+  {
+    std::string lookupSql;
+    Apply(lookupSql, formatter, lookup, queryLevel, limit);
+
+    if (queryLevel == ResourceType_Instance)
+    {
+      sql = "SELECT publicId, publicId FROM (" + lookupSql + ")";
+    }
+    else
+    {
+      /**
+       * Correlated subquery walking down the hierarchy from the
+       * matching resource, and stopping at the first instance. The
+       * "GROUP BY" removes the duplicates that can be introduced by
+       * the joins on the lower levels, as the former
+       * "AnswerLookup()" did.
+       **/
+      const ResourceType childLevel = static_cast<ResourceType>(queryLevel + 1);
+
+      std::string sample = ("SELECT instances.publicId FROM Resources AS " +
+                            FormatLevel(childLevel));
+
+      for (int level = childLevel + 1; level <= ResourceType_Instance; level++)
+      {
+        sample += (" INNER JOIN Resources " +
+                   FormatLevel(static_cast<ResourceType>(level)) + " ON " +
+                   FormatLevel(static_cast<ResourceType>(level - 1)) + ".internalId=" +
+                   FormatLevel(static_cast<ResourceType>(level)) + ".parentId");
+      }
+
+      sample += " WHERE " + FormatLevel(childLevel) + ".parentId=lookup.internalId LIMIT 1";
+
+      sql = ("SELECT lookup.publicId, (" + sample + ") FROM (" + lookupSql +
+             ") AS lookup GROUP BY lookup.publicId");
+    }
+  }
 }
@@ -65,5 +65,18 @@ namespace Orthanc
                       const std::vector<DatabaseConstraint>& lookup,
                       ResourceType queryLevel,
                       size_t limit);
+
+    /**
+     * New in Orthanc 1.9.6: Same as "Apply()", but the generated
+     * query returns, for each matching resource, its public ID
+     * together with the public ID of one of its child instances
+     * (which is NULL if the resource has no instance). This avoids
+     * the need for a temporary table.
+     **/
+    static void ApplyWithSampleInstance(std::string& sql,
+                                        ISqlLookupFormatter& formatter,
+                                        const std::vector<DatabaseConstraint>& lookup,
+                                        ResourceType queryLevel,
+                                        size_t limit);
   };
 }
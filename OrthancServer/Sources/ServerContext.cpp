@@ -44,22 +44,27 @@
 #include "../../OrthancFramework/Sources/FileStorage/StorageAccessor.h"
 #include "../../OrthancFramework/Sources/HttpServer/FilesystemHttpSender.h"
 #include "../../OrthancFramework/Sources/HttpServer/HttpStreamTranscoder.h"
+#include "../../OrthancFramework/Sources/HttpServer/MemoryBufferHttpSender.h"
 #include "../../OrthancFramework/Sources/JobsEngine/SetOfInstancesJob.h"
 #include "../../OrthancFramework/Sources/Logging.h"
 #include "../../OrthancFramework/Sources/MetricsRegistry.h"
 #include "../Plugins/Engine/OrthancPlugins.h"
 
+#include "ChangesDispatcher.h"
+#include "JobsRegistryRecords.h"
 #include "OrthancConfiguration.h"
 #include "OrthancRestApi/OrthancRestApi.h"
 #include "Search/DatabaseLookup.h"
 #include "ServerJobs/OrthancJobUnserializer.h"
 #include "ServerToolbox.h"
 #include "StorageCommitmentReports.h"
+#include "StorageDeletionQueue.h"
 
 #include <dcmtk/dcmdata/dcfilefo.h>
 
 
 static size_t DICOM_CACHE_SIZE = 128 * 1024 * 1024;  // 128 MB
+static unsigned int DICOM_CACHE_SHARDS = 16;  // New in Orthanc 1.9.6
 
 
 /**
@@ -101,48 +106,6 @@ namespace Orthanc
   }
 
   
-  void ServerContext::ChangeThread(ServerContext* that,
-                                   unsigned int sleepDelay)
-  {
-    while (!that->done_)
-    {
-      std::unique_ptr<IDynamicObject> obj(that->pendingChanges_.Dequeue(sleepDelay));
-        
-      if (obj.get() != NULL)
-      {
-        const ServerIndexChange& change = dynamic_cast<const ServerIndexChange&>(*obj.get());
-
-        boost::shared_lock<boost::shared_mutex> lock(that->listenersMutex_);
-        for (ServerListeners::iterator it = that->listeners_.begin(); 
-             it != that->listeners_.end(); ++it)
-        {
-          try
-          {
-            try
-            {
-              it->GetListener().SignalChange(change);
-            }
-            catch (std::bad_alloc&)
-            {
-              LOG(ERROR) << "Not enough memory while signaling a change";
-            }
-            catch (...)
-            {
-              throw OrthancException(ErrorCode_InternalError);
-            }
-          }
-          catch (OrthancException& e)
-          {
-            LOG(ERROR) << "Error in the " << it->GetDescription() 
-                       << " callback while signaling a change: " << e.What()
-                       << " (code " << e.GetErrorCode() << ")";
-          }
-        }
-      }
-    }
-  }
-
-
   void ServerContext::SaveJobsThread(ServerContext* that,
                                      unsigned int sleepDelay)
   {
@@ -214,15 +177,21 @@ namespace Orthanc
   {
     if (loadJobsFromDatabase)
     {
-      std::string serialized;
-      if (index_.LookupGlobalProperty(serialized, GlobalProperty_JobsRegistry, false /* not shared */))
+      Json::Value registry;
+      bool isLegacy;
+
+      JobsRegistryRecords records(index_);
+      if (records.Load(registry, isLegacy))
       {
         LOG(WARNING) << "Reloading the jobs from the last execution of Orthanc";
 
         try
         {
           OrthancJobUnserializer unserializer(*this);
-          jobsEngine_.LoadRegistryFromString(unserializer, serialized);
+          jobsEngine_.LoadRegistryFromJson(unserializer, registry);
+
+          // The jobs saved by Orthanc <= 1.9.5 must be migrated to the buckets
+          saveAllJobs_ = isLegacy;
         }
         catch (OrthancException& e)
         {
@@ -255,17 +224,21 @@ namespace Orthanc
     
       try
       {
-        Json::Value value;
-        jobsEngine_.GetRegistry().Serialize(value);
+        // Only the jobs that have changed since the last save are serialized
+        Json::Value changes;
+        jobsEngine_.GetRegistry().SerializeChanges(changes, saveAllJobs_);
 
-        std::string serialized;
-        Toolbox::WriteFastJson(serialized, value);
+        JobsRegistryRecords records(index_);
+        records.Save(changes, saveAllJobs_);
 
-        index_.SetGlobalProperty(GlobalProperty_JobsRegistry, false /* not shared */, serialized);
+        saveAllJobs_ = false;
       }
       catch (OrthancException& e)
       {
         LOG(ERROR) << "Cannot serialize the jobs engine: " << e.What();
+
+        // The changes have been lost, rewrite all the jobs at the next attempt
+        saveAllJobs_ = true;
       }
     }
   }
@@ -287,9 +260,13 @@ namespace Orthanc
     index_(*this, database, (unitTesting ? 20 : 500)),
     area_(area),
     compressionEnabled_(false),
+    compressionChunkSize_(0),
+    compressionThreads_(1),
+    compressionLevel_(6),
+    zstdCompression_(false),
     storeMD5_(true),
     largeDicomThrottler_(1),
-    dicomCache_(DICOM_CACHE_SIZE),
+    dicomCache_(DICOM_CACHE_SIZE, DICOM_CACHE_SHARDS),
     mainLua_(*this),
     filterLua_(*this),
     luaListener_(*this),
@@ -300,9 +277,11 @@ namespace Orthanc
     done_(false),
     haveJobsChanged_(false),
     isJobsEngineUnserialized_(false),
+    saveAllJobs_(true),
     metricsRegistry_(new MetricsRegistry),
     isHttpServerSecure_(true),
     isExecuteLuaEnabled_(false),
+    avoidedDicomAsJson_(0),
     overwriteInstances_(false),
     dcmtkTranscoder_(new DcmtkTranscoder),
     isIngestTranscoding_(false),
@@ -314,6 +293,10 @@ namespace Orthanc
     try
     {
       unsigned int lossyQuality;
+      unsigned int deletionThreads;
+      unsigned int changesQueueSize;
+      ChangesOverflowPolicy changesOverflow;
+      unsigned int luaFilterInterpreters;
 
       {
         OrthancConfiguration::ReaderLock lock;
@@ -332,6 +315,13 @@ namespace Orthanc
         limitFindInstances_ = lock.GetConfiguration().GetUnsignedIntegerParameter("LimitFindInstances", 0);
         limitFindResults_ = lock.GetConfiguration().GetUnsignedIntegerParameter("LimitFindResults", 0);
 
+        // New configuration option in Orthanc 1.9.6
+        findPrefetchThreads_ = lock.GetConfiguration().GetUnsignedIntegerParameter("StorageAccessOnFindThreads", 0);
+        deletionThreads = lock.GetConfiguration().GetUnsignedIntegerParameter("StorageDeletionThreads", 0);
+        changesQueueSize = lock.GetConfiguration().GetUnsignedIntegerParameter("ChangesQueueSize", 0);
+        changesOverflow = StringToChangesOverflowPolicy(lock.GetConfiguration().GetStringParameter("ChangesQueueOverflow", "Block"));
+        luaFilterInterpreters = lock.GetConfiguration().GetUnsignedIntegerParameter("LuaFilterInterpreters", 1);
+
         // New configuration option in Orthanc 1.6.0
         storageCommitmentReports_.reset(new StorageCommitmentReports(lock.GetConfiguration().GetUnsignedIntegerParameter("StorageCommitmentReportsSize", 100)));
 
@@ -408,10 +398,31 @@ namespace Orthanc
         isUnknownSopClassAccepted_ = lock.GetConfiguration().GetBooleanParameter("UnknownSopClassAccepted", false);
       }
 
+      if (index_.HasStorageDeletionQueue())
+      {
+        // Resume the deletions that were pending at the previous shutdown
+        deletionQueue_.reset(new StorageDeletionQueue(area_, index_, *metricsRegistry_));
+        deletionQueue_->Start(deletionThreads);
+      }
+      else if (deletionThreads != 0)
+      {
+        LOG(WARNING) << "The database back-end cannot save the attachments to be removed from the storage area, "
+                     << "ignoring configuration option \"StorageDeletionThreads\"";
+      }
+
       jobsEngine_.SetThreadSleep(unitTesting ? 20 : 200);
 
+      // Each listener receives the changes through its own queue and thread
+      changesDispatcher_.reset(new ChangesDispatcher(*metricsRegistry_));
+      changesDispatcher_->SetMaxQueueSize(changesQueueSize);
+      changesDispatcher_->SetOverflowPolicy(changesOverflow);
+
       listeners_.push_back(ServerListener(luaListener_, "Lua"));
-      changeThread_ = boost::thread(ChangeThread, this, (unitTesting ? 20 : 100));
+      changesDispatcher_->AddListener(luaListener_, "Lua");
+
+      // Must be done outside of the lock on the configuration, as
+      // each interpreter of the pool reads the "LuaScripts" option
+      filterLua_.SetFiltersPoolSize(luaFilterInterpreters);
     
       dynamic_cast<DcmtkTranscoder&>(*dcmtkTranscoder_).SetLossyQuality(lossyQuality);
     }
@@ -443,13 +454,13 @@ namespace Orthanc
         listeners_.clear();
       }
 
-      done_ = true;
-
-      if (changeThread_.joinable())
+      if (changesDispatcher_.get() != NULL)
       {
-        changeThread_.join();
+        changesDispatcher_->RemoveAllListeners();
       }
 
+      done_ = true;
+
       if (saveJobsThread_.joinable())
       {
         saveJobsThread_.join();
@@ -465,6 +476,12 @@ namespace Orthanc
 
       // Do not change the order below!
       jobsEngine_.Stop();
+
+      if (deletionQueue_.get() != NULL)
+      {
+        deletionQueue_->Stop();
+      }
+
       index_.Stop();
     }
   }
@@ -481,11 +498,169 @@ namespace Orthanc
   }
 
 
+  void ServerContext::SetCompressionThreads(unsigned int threads)
+  {
+    if (threads == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      compressionThreads_ = threads;
+    }
+  }
+
+
+  void ServerContext::SetCompressionLevel(uint8_t level)
+  {
+    if (level > GetMaximumCompressionLevel())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The compression level must be between 0 and " +
+                             boost::lexical_cast<std::string>(static_cast<int>(GetMaximumCompressionLevel())));
+    }
+    else
+    {
+      compressionLevel_ = level;
+    }
+  }
+
+
+  void ServerContext::SetCompressionLevel(FileContentType type,
+                                          uint8_t level)
+  {
+    if (level > GetMaximumCompressionLevel())
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The compression level must be between 0 and " +
+                             boost::lexical_cast<std::string>(static_cast<int>(GetMaximumCompressionLevel())));
+    }
+    else
+    {
+      compressionLevels_[type] = level;
+    }
+  }
+
+
+  void ServerContext::SetZstdCompression(bool enabled)
+  {
+#if ORTHANC_ENABLE_ZSTD == 1
+    zstdCompression_ = enabled;
+#else
+    if (enabled)
+    {
+      throw OrthancException(ErrorCode_NotImplemented, "Orthanc was built without support for zstd, "
+                             "cf. the CMake option \"ENABLE_ZSTD_STORAGE_COMPRESSION\"");
+    }
+#endif
+  }
+
+
+  CompressionType ServerContext::GetExplicitCompression() const
+  {
+    if (zstdCompression_)
+    {
+      return CompressionType_Zstd;
+    }
+    else if (compressionChunkSize_ == 0)
+    {
+      return CompressionType_ZlibWithSize;
+    }
+    else
+    {
+      return CompressionType_ZlibChunked;
+    }
+  }
+
+
+  uint8_t ServerContext::GetMaximumCompressionLevel() const
+  {
+    return StorageAccessor::GetMaximumCompressionLevel(GetExplicitCompression());
+  }
+
+
+  uint8_t ServerContext::GetCompressionLevel(FileContentType type) const
+  {
+    std::map<FileContentType, uint8_t>::const_iterator found = compressionLevels_.find(type);
+
+    if (found == compressionLevels_.end())
+    {
+      return compressionLevel_;
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+
+  void ServerContext::SetupCompression(StorageAccessor& accessor,
+                                       FileContentType type) const
+  {
+    const uint8_t level = GetCompressionLevel(type);
+
+    if (level != 0)
+    {
+      accessor.SetCompressionLevel(level);
+    }
+    else if (compressionLevel_ != 0)
+    {
+      // The compression is explicitly requested for a type of
+      // attachments whose compression is disabled (cf. "/compress")
+      accessor.SetCompressionLevel(compressionLevel_);
+    }
+
+    if (compressionChunkSize_ != 0)
+    {
+      accessor.SetCompressionChunkSize(compressionChunkSize_);
+      accessor.SetCompressionThreadsCount(compressionThreads_);
+    }
+  }
+
+
+  CompressionType ServerContext::PrepareCompression(StorageAccessor& accessor,
+                                                    FileContentType type) const
+  {
+    // TODO Should we use "gzip" instead?
+    if (!compressionEnabled_ ||
+        GetCompressionLevel(type) == 0)
+    {
+      return CompressionType_None;
+    }
+    else
+    {
+      SetupCompression(accessor, type);
+      return GetExplicitCompression();
+    }
+  }
+
+
   void ServerContext::RemoveFile(const std::string& fileUuid,
                                  FileContentType type)
   {
-    StorageAccessor accessor(area_, GetMetricsRegistry());
-    accessor.Remove(fileUuid, type);
+    if (deletionQueue_.get() == NULL)
+    {
+      StorageAccessor accessor(area_, GetMetricsRegistry());
+      accessor.Remove(fileUuid, type);
+    }
+    else
+    {
+      deletionQueue_->Enqueue(fileUuid, type);
+    }
+  }
+
+
+  bool ServerContext::IsStorageDeletionAsynchronous()
+  {
+    return (deletionQueue_.get() != NULL &&
+            deletionQueue_->IsAsynchronous());
+  }
+
+
+  uint64_t ServerContext::GetAvoidedDicomAsJsonCount()
+  {
+    boost::mutex::scoped_lock lock(avoidedDicomAsJsonMutex_);
+    return avoidedDicomAsJson_;
   }
 
 
@@ -531,13 +706,8 @@ namespace Orthanc
       DicomInstanceHasher hasher(summary);
       resultPublicId = hasher.HashInstance();
 
-      Json::Value dicomAsJson;
-      dicom.GetDicomAsJson(dicomAsJson);
-      
-      Json::Value simplifiedTags;
-      Toolbox::SimplifyDicomAsJson(simplifiedTags, dicomAsJson, DicomToJsonFormat_Human);
-
-      // Test if the instance must be filtered out
+      // Test if the instance must be filtered out. The simplified
+      // tags are only computed if some listener needs them.
       bool accepted = true;
 
       {
@@ -547,7 +717,7 @@ namespace Orthanc
         {
           try
           {
-            if (!it->GetListener().FilterIncomingInstance(dicom, simplifiedTags))
+            if (!it->GetListener().FilterIncomingInstance(dicom))
             {
               accepted = false;
               break;
@@ -574,8 +744,7 @@ namespace Orthanc
       dicomCache_.Invalidate(resultPublicId);
       PublishDicomCacheMetrics();
 
-      // TODO Should we use "gzip" instead?
-      CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
+      CompressionType compression = PrepareCompression(accessor, FileContentType_Dicom);
 
       FileInfo dicomInfo = accessor.Write(dicom.GetBufferData(), dicom.GetBufferSize(), 
                                           FileContentType_Dicom, compression, storeMD5_);
@@ -583,13 +752,16 @@ namespace Orthanc
       ServerIndex::Attachments attachments;
       attachments.push_back(dicomInfo);
 
+      // The "DICOM until pixel data" attachment is not needed if the
+      // DICOM file can be read by range
       FileInfo dicomUntilPixelData;
       if (hasPixelDataOffset &&
           (!area_.HasReadRange() ||
-           compressionEnabled_))
+           (compression != CompressionType_None &&
+            compression != CompressionType_ZlibChunked)))
       {
-        dicomUntilPixelData = accessor.Write(dicom.GetBufferData(), pixelDataOffset, 
-                                             FileContentType_DicomUntilPixelData, compression, storeMD5_);
+        dicomUntilPixelData = accessor.Write(dicom.GetBufferData(), pixelDataOffset, FileContentType_DicomUntilPixelData,
+                                             PrepareCompression(accessor, FileContentType_DicomUntilPixelData), storeMD5_);
         attachments.push_back(dicomUntilPixelData);
       }
 
@@ -646,7 +818,7 @@ namespace Orthanc
         {
           try
           {
-            it->GetListener().SignalStoredInstance(resultPublicId, dicom, simplifiedTags);
+            it->GetListener().SignalStoredInstance(resultPublicId, dicom);
           }
           catch (OrthancException& e)
           {
@@ -657,6 +829,14 @@ namespace Orthanc
         }
       }
 
+      if (!dicom.HasSimplifiedTags())
+      {
+        boost::mutex::scoped_lock lock(avoidedDicomAsJsonMutex_);
+        avoidedDicomAsJson_++;
+        GetMetricsRegistry().SetValue("orthanc_store_dicom_as_json_avoided_count",
+                                      static_cast<float>(avoidedDicomAsJson_));
+      }
+
       return status;
     }
     catch (OrthancException& e)
@@ -766,6 +946,72 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    // Gives access to a buffer of the cache of DICOM files, without
+    // copying it, and keeps it alive while the answer is sent
+    class SharedStringMemoryBuffer : public IMemoryBuffer
+    {
+    private:
+      boost::shared_ptr<const std::string>  buffer_;
+
+    public:
+      explicit SharedStringMemoryBuffer(const boost::shared_ptr<const std::string>& buffer) :
+        buffer_(buffer)
+      {
+        if (buffer.get() == NULL)
+        {
+          throw OrthancException(ErrorCode_NullPointer);
+        }
+      }
+
+      virtual void MoveToString(std::string& target) ORTHANC_OVERRIDE
+      {
+        target.assign(*buffer_);  // The shared buffer is immutable
+        buffer_.reset(new std::string);
+      }
+
+      virtual const void* GetData() const ORTHANC_OVERRIDE
+      {
+        return (buffer_->empty() ? NULL : buffer_->c_str());
+      }
+
+      virtual size_t GetSize() const ORTHANC_OVERRIDE
+      {
+        return buffer_->size();
+      }
+    };
+  }
+
+
+  void ServerContext::AnswerDicomFile(RestApiOutput& output,
+                                      const std::string& instancePublicId,
+                                      const FileInfo& attachment)
+  {
+    if (attachment.GetContentType() != FileContentType_Dicom)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::shared_ptr<const std::string> cached;
+    if (LookupDicomInCache(cached, instancePublicId) &&
+        cached->size() == attachment.GetUncompressedSize())
+    {
+      // Answer from the cache of DICOM files, without reading and
+      // uncompressing the attachment, and without copying the buffer
+      MemoryBufferHttpSender sender(new SharedStringMemoryBuffer(cached));
+      sender.SetContentType(MimeType_Dicom);
+      sender.SetContentFilename(attachment.GetUuid() + ".dcm");
+      output.AnswerStream(sender);
+    }
+    else
+    {
+      StorageAccessor accessor(area_, GetMetricsRegistry());
+      accessor.AnswerFile(output, attachment, MimeType_Dicom);
+    }
+  }
+
+
   void ServerContext::ChangeAttachmentCompression(const std::string& resourceId,
                                                   FileContentType attachmentType,
                                                   CompressionType compression)
@@ -791,6 +1037,7 @@ namespace Orthanc
     std::string content;
 
     StorageAccessor accessor(area_, GetMetricsRegistry());
+    SetupCompression(accessor, attachmentType);
     accessor.Read(content, attachment);
 
     FileInfo modified = accessor.Write(content.empty() ? NULL : content.c_str(),
@@ -900,32 +1147,27 @@ namespace Orthanc
       if (hasPixelDataOffset &&
           area_.HasReadRange() &&
           index_.LookupAttachment(attachment, revision, instancePublicId, FileContentType_Dicom) &&
-          attachment.GetCompressionType() == CompressionType_None)
+          (attachment.GetCompressionType() == CompressionType_None ||
+           attachment.GetCompressionType() == CompressionType_ZlibChunked))
       {
         /**
          * CASE 2: The pixel data offset is known, AND that a range read
          * can be used to retrieve the truncated DICOM file. Note that
          * this case cannot be used if "StorageCompression" option is
-         * "true".
+         * "true" and "StorageCompressionChunkSize" is "0".
          **/
       
-        std::unique_ptr<IMemoryBuffer> dicom;
-        {
-          MetricsRegistry::Timer timer(GetMetricsRegistry(), "orthanc_storage_read_range_duration_ms");
-          dicom.reset(area_.ReadRange(attachment.GetUuid(), FileContentType_Dicom, 0, pixelDataOffset));
-        }
+        std::string dicom;
 
-        if (dicom.get() == NULL)
-        {
-          throw OrthancException(ErrorCode_InternalError);
-        }
-        else
         {
-          assert(dicom->GetSize() == pixelDataOffset);
-          ParsedDicomFile parsed(dicom->GetData(), dicom->GetSize());
-          OrthancConfiguration::DefaultDicomDatasetToJson(result, parsed, ignoreTagLength);
-          InjectEmptyPixelData(result);
+          StorageAccessor accessor(area_, GetMetricsRegistry());
+          accessor.ReadRange(dicom, attachment, 0, pixelDataOffset);
         }
+
+        assert(dicom.size() == pixelDataOffset);
+        ParsedDicomFile parsed(dicom);
+        OrthancConfiguration::DefaultDicomDatasetToJson(result, parsed, ignoreTagLength);
+        InjectEmptyPixelData(result);
       }
       else if (ignoreTagLength.empty() &&
                index_.LookupAttachment(attachment, revision, instancePublicId, FileContentType_DicomAsJson))
@@ -981,8 +1223,19 @@ namespace Orthanc
             index_.OverwriteMetadata(instancePublicId, MetadataType_Instance_PixelDataOffset,
                                      boost::lexical_cast<std::string>(pixelDataOffset));
 
+            /**
+             * The truncated DICOM file must be stored as a standalone
+             * attachment if CASE 2 cannot apply to the DICOM file
+             * that is actually stored, whatever the current
+             * configuration of the compression.
+             **/
+            FileInfo dicomAttachment;
+            int64_t dicomRevision;  // ignored
+
             if (!area_.HasReadRange() ||
-                compressionEnabled_)
+                !index_.LookupAttachment(dicomAttachment, dicomRevision, instancePublicId, FileContentType_Dicom) ||
+                (dicomAttachment.GetCompressionType() != CompressionType_None &&
+                 dicomAttachment.GetCompressionType() != CompressionType_ZlibChunked))
             {
               int64_t newRevision;
               AddAttachment(newRevision, instancePublicId, FileContentType_DicomUntilPixelData,
@@ -1007,8 +1260,39 @@ namespace Orthanc
   void ServerContext::ReadDicom(std::string& dicom,
                                 const std::string& instancePublicId)
   {
-    int64_t revision;
-    ReadAttachment(dicom, revision, instancePublicId, FileContentType_Dicom, true /* uncompress */);
+    boost::shared_ptr<const std::string> cached;
+    if (dicomCache_.LookupBuffer(cached, instancePublicId))
+    {
+      assert(cached.get() != NULL);
+      dicom.assign(*cached);  // Avoids reading and uncompressing the attachment
+    }
+    else
+    {
+      int64_t revision;
+      ReadAttachment(dicom, revision, instancePublicId, FileContentType_Dicom, true /* uncompress */);
+    }
+  }
+
+
+  void ServerContext::ReadDicom(boost::shared_ptr<const std::string>& dicom,
+                                const std::string& instancePublicId)
+  {
+    if (!dicomCache_.LookupBuffer(dicom, instancePublicId))
+    {
+      std::unique_ptr<std::string> content(new std::string);
+
+      int64_t revision;
+      ReadAttachment(*content, revision, instancePublicId, FileContentType_Dicom, true /* uncompress */);
+
+      dicom.reset(content.release());
+    }
+  }
+
+
+  bool ServerContext::LookupDicomInCache(boost::shared_ptr<const std::string>& dicom,
+                                         const std::string& instancePublicId)
+  {
+    return dicomCache_.LookupBuffer(dicom, instancePublicId);
   }
     
 
@@ -1030,7 +1314,8 @@ namespace Orthanc
 
     std::string s;
 
-    if (attachment.GetCompressionType() == CompressionType_None &&
+    if ((attachment.GetCompressionType() == CompressionType_None ||
+         attachment.GetCompressionType() == CompressionType_ZlibChunked) &&
         index_.LookupMetadata(s, revision, instancePublicId, ResourceType_Instance,
                               MetadataType_Instance_PixelDataOffset) &&
         !s.empty())
@@ -1039,9 +1324,8 @@ namespace Orthanc
       {
         uint64_t pixelDataOffset = boost::lexical_cast<uint64_t>(s);
 
-        std::unique_ptr<IMemoryBuffer> buffer(
-          area_.ReadRange(attachment.GetUuid(), attachment.GetContentType(), 0, pixelDataOffset));
-        buffer->MoveToString(dicom);
+        StorageAccessor accessor(area_, GetMetricsRegistry());
+        accessor.ReadRange(dicom, attachment, 0, pixelDataOffset);
         return true;   // Success
       }
       catch (boost::bad_lexical_cast&)
@@ -1087,6 +1371,72 @@ namespace Orthanc
   }
 
 
+  ServerContext::AttachmentRangesReader::AttachmentRangesReader(ServerContext& context,
+                                                                const std::string& instancePublicId,
+                                                                const FileInfo& attachment) :
+    context_(context),
+    attachment_(attachment),
+    useReadRange_(false)
+  {
+    boost::shared_ptr<const std::string> cached;
+    if (attachment.GetContentType() == FileContentType_Dicom &&
+        context.dicomCache_.LookupBuffer(cached, instancePublicId) &&
+        cached->size() == attachment.GetUncompressedSize())
+    {
+      // The DICOM file is available in the cache of parsed DICOM files
+      content_ = cached;
+    }
+    else if ((attachment.GetCompressionType() == CompressionType_None ||
+              attachment.GetCompressionType() == CompressionType_ZlibChunked) &&
+             context.area_.HasReadRange())
+    {
+      // Only read the requested bytes (or the requested compressed
+      // chunks) from the storage area
+      useReadRange_ = true;
+    }
+  }
+
+
+  void ServerContext::AttachmentRangesReader::ReadRange(std::string& target,
+                                                        uint64_t start,
+                                                        uint64_t end)
+  {
+    if (start > end ||
+        end > attachment_.GetUncompressedSize())
+    {
+      throw OrthancException(ErrorCode_BadRange);
+    }
+
+    if (useReadRange_)
+    {
+      StorageAccessor accessor(context_.area_, context_.GetMetricsRegistry());
+      accessor.ReadRange(target, attachment_, start, end);
+      return;
+    }
+
+    if (content_.get() == NULL)
+    {
+      // The attachment is compressed, or the storage area does not
+      // support range reads: Read the full attachment, only once
+      std::unique_ptr<std::string> content(new std::string);
+
+      {
+        StorageAccessor accessor(context_.area_, context_.GetMetricsRegistry());
+        accessor.Read(*content, attachment_);
+      }
+
+      if (content->size() != attachment_.GetUncompressedSize())
+      {
+        throw OrthancException(ErrorCode_CorruptedFile);
+      }
+
+      content_.reset(content.release());
+    }
+
+    target.assign(*content_, start, end - start);
+  }
+
+
   ServerContext::DicomCacheLocker::DicomCacheLocker(ServerContext& context,
                                                     const std::string& instancePublicId) :
     context_(context),
@@ -1101,18 +1451,23 @@ namespace Orthanc
       // Throttle to avoid loading several large DICOM files simultaneously
       largeDicomLocker_.reset(new Semaphore::Locker(context.largeDicomThrottler_));
       
-      std::string content;
-      context_.ReadDicom(content, instancePublicId);
+      std::unique_ptr<std::string> content(new std::string);
+
+      int64_t revision;
+      context_.ReadAttachment(*content, revision, instancePublicId, FileContentType_Dicom, true /* uncompress */);
 
       // Release the throttle if loading "small" DICOM files (under
       // 50MB, which is an arbitrary value)
-      if (content.size() < 50 * 1024 * 1024)
+      if (content->size() < 50 * 1024 * 1024)
       {
         largeDicomLocker_.reset(NULL);
       }
       
-      dicom_.reset(new ParsedDicomFile(content));
-      dicomSize_ = content.size();
+      dicom_.reset(new ParsedDicomFile(*content));
+
+      // The raw buffer is kept in the cache together with the parsed
+      // file, without copying it (new in Orthanc 1.9.6)
+      buffer_.reset(content.release());
     }
 
     assert(accessor_.get() != NULL ||
@@ -1126,7 +1481,7 @@ namespace Orthanc
     {
       try
       {
-        context_.dicomCache_.Acquire(instancePublicId_, dicom_.release(), dicomSize_);
+        context_.dicomCache_.Acquire(instancePublicId_, dicom_.release(), buffer_);
         context_.PublishDicomCacheMetrics();
       }
       catch (OrthancException&)
@@ -1149,6 +1504,21 @@ namespace Orthanc
     }
   }
 
+
+  const boost::shared_ptr<const std::string>& ServerContext::DicomCacheLocker::GetBuffer() const
+  {
+    if (dicom_.get() != NULL)
+    {
+      assert(buffer_.get() != NULL);
+      return buffer_;
+    }
+    else
+    {
+      assert(accessor_.get() != NULL);
+      return accessor_->GetBuffer();
+    }
+  }
+
   
   void ServerContext::SetStoreMD5ForAttachments(bool storeMD5)
   {
@@ -1168,10 +1538,9 @@ namespace Orthanc
   {
     LOG(INFO) << "Adding attachment " << EnumerationToString(attachmentType) << " to resource " << resourceId;
     
-    // TODO Should we use "gzip" instead?
-    CompressionType compression = (compressionEnabled_ ? CompressionType_ZlibWithSize : CompressionType_None);
-
     StorageAccessor accessor(area_, GetMetricsRegistry());
+    CompressionType compression = PrepareCompression(accessor, attachmentType);
+
     FileInfo attachment = accessor.Write(data, size, attachmentType, compression, storeMD5_);
 
     try
@@ -1221,13 +1590,38 @@ namespace Orthanc
       PublishDicomCacheMetrics();
     }
     
-    pendingChanges_.Enqueue(change.Clone());
+    if (changesDispatcher_.get() != NULL)
+    {
+      changesDispatcher_->Enqueue(change);
+    }
   }
 
 
 #if ORTHANC_ENABLE_PLUGINS == 1
+  void ServerContext::RemovePluginsChangeListeners()
+  {
+    if (plugins_ != NULL &&
+        changesDispatcher_.get() != NULL)
+    {
+      // Not protected by "listenersMutex_", as the threads of the
+      // listeners must be joined
+      OrthancPlugins::OnChangeListeners listeners;
+      plugins_->GetOnChangeListeners(listeners);
+
+      for (OrthancPlugins::OnChangeListeners::const_iterator
+             it = listeners.begin(); it != listeners.end(); ++it)
+      {
+        assert(it->first != NULL);
+        changesDispatcher_->RemoveListener(*it->first);
+      }
+    }
+  }
+
+
   void ServerContext::SetPlugins(OrthancPlugins& plugins)
   {
+    RemovePluginsChangeListeners();
+
     boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
 
     plugins_ = &plugins;
@@ -1236,11 +1630,28 @@ namespace Orthanc
     listeners_.clear();
     listeners_.push_back(ServerListener(luaListener_, "Lua"));
     listeners_.push_back(ServerListener(plugins, "plugin"));
+
+    if (changesDispatcher_.get() != NULL)
+    {
+      // One queue per OnChange callback, so that a slow plugin does
+      // not delay the others
+      OrthancPlugins::OnChangeListeners listeners;
+      plugins.GetOnChangeListeners(listeners);
+
+      for (OrthancPlugins::OnChangeListeners::const_iterator
+             it = listeners.begin(); it != listeners.end(); ++it)
+      {
+        assert(it->first != NULL);
+        changesDispatcher_->AddListener(*it->first, it->second);
+      }
+    }
   }
 
 
   void ServerContext::ResetPlugins()
   {
+    RemovePluginsChangeListeners();
+
     boost::unique_lock<boost::shared_mutex> lock(listenersMutex_);
 
     plugins_ = NULL;
@@ -1288,6 +1699,206 @@ namespace Orthanc
   }
 
 
+  namespace
+  {
+    /**
+     * Bounded pipeline that reads and decodes the "DICOM-as-JSON" of
+     * the candidate instances of a lookup on a pool of worker
+     * threads, ahead of the loop in "ServerContext::ApplyInternal()"
+     * that consumes them sequentially. At most "window" decoded
+     * instances are kept in memory, and the results are consumed in
+     * the original order of the candidates, which keeps the answers
+     * deterministic (new in Orthanc 1.9.6).
+     **/
+    class DicomAsJsonPrefetcher : public boost::noncopyable
+    {
+    private:
+      enum State
+      {
+        State_Waiting,
+        State_Reading,
+        State_Done,
+        State_Failure
+      };
+
+      struct Slot
+      {
+        State                               state_;
+        std::unique_ptr<Json::Value>        dicomAsJson_;
+        std::unique_ptr<OrthancException>   error_;
+
+        Slot() :
+          state_(State_Waiting)
+        {
+        }
+      };
+
+      ServerContext&                    context_;
+      const std::vector<std::string>&   instances_;
+      size_t                            window_;
+      boost::mutex                      mutex_;
+      boost::condition_variable         workerCondition_;
+      boost::condition_variable         consumerCondition_;
+      std::vector<Slot>                 slots_;
+      size_t                            nextToRead_;
+      size_t                            nextToConsume_;
+      bool                              done_;
+      std::vector<boost::thread*>       workers_;
+
+      static void Worker(DicomAsJsonPrefetcher* that)
+      {
+        for (;;)
+        {
+          size_t index;
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+
+            while (!that->done_ &&
+                   that->nextToRead_ < that->instances_.size() &&
+                   that->nextToRead_ >= that->nextToConsume_ + that->window_)
+            {
+              that->workerCondition_.wait(lock);
+            }
+
+            if (that->done_ ||
+                that->nextToRead_ >= that->instances_.size())
+            {
+              return;
+            }
+
+            index = that->nextToRead_;
+            that->nextToRead_++;
+            that->slots_[index].state_ = State_Reading;
+          }
+
+          std::unique_ptr<Json::Value> dicomAsJson(new Json::Value);
+          std::unique_ptr<OrthancException> error;
+
+          try
+          {
+            that->context_.ReadDicomAsJson(*dicomAsJson, that->instances_[index]);
+          }
+          catch (OrthancException& e)
+          {
+            error.reset(new OrthancException(e));
+          }
+          catch (...)
+          {
+            error.reset(new OrthancException(ErrorCode_InternalError));
+          }
+
+          {
+            boost::mutex::scoped_lock lock(that->mutex_);
+            
+            Slot& slot = that->slots_[index];
+            if (error.get() == NULL)
+            {
+              slot.state_ = State_Done;
+              slot.dicomAsJson_.reset(dicomAsJson.release());
+            }
+            else
+            {
+              slot.state_ = State_Failure;
+              slot.error_.reset(error.release());
+            }
+          }
+
+          that->consumerCondition_.notify_all();
+        }
+      }
+
+    public:
+      DicomAsJsonPrefetcher(ServerContext& context,
+                            const std::vector<std::string>& instances,
+                            unsigned int threads) :
+        context_(context),
+        instances_(instances),
+        window_(4 * static_cast<size_t>(threads)),
+        slots_(instances.size()),
+        nextToRead_(0),
+        nextToConsume_(0),
+        done_(false)
+      {
+        if (threads == 0)
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange);
+        }
+
+        workers_.resize(std::min(static_cast<size_t>(threads), instances.size()));
+
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+          workers_[i] = new boost::thread(Worker, this);
+        }
+      }
+
+      ~DicomAsJsonPrefetcher()
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          done_ = true;
+        }
+
+        workerCondition_.notify_all();
+
+        for (size_t i = 0; i < workers_.size(); i++)
+        {
+          if (workers_[i] != NULL)
+          {
+            if (workers_[i]->joinable())
+            {
+              workers_[i]->join();
+            }
+
+            delete workers_[i];
+          }
+        }
+      }
+
+      // The candidates must be consumed in increasing order. The
+      // caller takes the ownership of the returned object.
+      Json::Value* Consume(size_t index)
+      {
+        std::unique_ptr<Json::Value> result;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+
+          if (index != nextToConsume_ ||
+              index >= slots_.size())
+          {
+            throw OrthancException(ErrorCode_BadSequenceOfCalls);
+          }
+
+          Slot& slot = slots_[index];
+          while (slot.state_ == State_Waiting ||
+                 slot.state_ == State_Reading)
+          {
+            consumerCondition_.wait(lock);
+          }
+
+          nextToConsume_++;
+
+          if (slot.state_ == State_Failure)
+          {
+            OrthancException error(*slot.error_);
+            slot.error_.reset(NULL);
+            throw error;
+          }
+          else
+          {
+            result.reset(slot.dicomAsJson_.release());
+          }
+        }
+
+        workerCondition_.notify_all();
+        return result.release();
+      }
+    };
+  }
+
+
   void ServerContext::ApplyInternal(ILookupVisitor& visitor,
                                     const DatabaseLookup& lookup,
                                     ResourceType queryLevel,
@@ -1320,6 +1931,24 @@ namespace Orthanc
     size_t skipped = 0;
 
     const bool isDicomAsJsonNeeded = visitor.IsDicomAsJsonNeeded();
+
+    const bool isStorageAccessNeeded = (findStorageAccessMode_ == FindStorageAccessMode_DiskOnLookupAndAnswer &&
+                                        !lookup.HasOnlyMainDicomTags());
+
+    /**
+     * New in Orthanc 1.9.6: If the storage area must be read to
+     * filter the candidates, prefetch and decode the "DICOM-as-JSON"
+     * of the upcoming candidates in parallel. On exit (including an
+     * early exit because of "limit"), the destructor of the
+     * prefetcher stops its workers.
+     **/
+    std::unique_ptr<DicomAsJsonPrefetcher> prefetcher;
+    if (isStorageAccessNeeded &&
+        findPrefetchThreads_ > 0 &&
+        instances.size() > 1)
+    {
+      prefetcher.reset(new DicomAsJsonPrefetcher(*this, instances, findPrefetchThreads_));
+    }
     
     for (size_t i = 0; i < instances.size(); i++)
     {
@@ -1331,9 +1960,7 @@ namespace Orthanc
       bool hasOnlyMainDicomTags;
       DicomMap dicom;
       
-      if (findStorageAccessMode_ == FindStorageAccessMode_DatabaseOnly ||
-          findStorageAccessMode_ == FindStorageAccessMode_DiskOnAnswer ||
-          lookup.HasOnlyMainDicomTags())
+      if (!isStorageAccessNeeded)
       {
         // Case (1): The main DICOM tags, as stored in the database,
         // are sufficient to look for match
@@ -1374,8 +2001,15 @@ namespace Orthanc
       {
         // Case (2): Need to read the "DICOM-as-JSON" attachment from
         // the storage area
-        dicomAsJson.reset(new Json::Value);
-        ReadDicomAsJson(*dicomAsJson, instances[i]);
+        if (prefetcher.get() != NULL)
+        {
+          dicomAsJson.reset(prefetcher->Consume(i));
+        }
+        else
+        {
+          dicomAsJson.reset(new Json::Value);
+          ReadDicomAsJson(*dicomAsJson, instances[i]);
+        }
 
         dicom.FromDicomAsJson(*dicomAsJson);
 
@@ -1817,14 +2451,32 @@ namespace Orthanc
     if (HasPlugins() &&
         GetPlugins().HasCustomImageDecoder())
     {
-      // TODO: Store the raw buffer in the DicomCacheLocker
-      std::string dicomContent;
-      ReadDicom(dicomContent, publicId);
+      /**
+       * The raw buffer is taken from the cache of DICOM files, which
+       * avoids reading and uncompressing the attachment for each
+       * frame of a multi-frame image. The buffer is immutable, so the
+       * lock on the cache can be released before calling the plugin.
+       **/
+      boost::shared_ptr<const std::string> dicomContent;
+
+      try
+      {
+        ServerContext::DicomCacheLocker locker(*this, publicId);
+        dicomContent = locker.GetBuffer();
+      }
+      catch (OrthancException&)
+      {
+        // The file cannot be parsed by DCMTK, but maybe by the plugin
+        ReadDicom(dicomContent, publicId);
+      }
+
+      assert(dicomContent.get() != NULL);
       
       std::unique_ptr<ImageAccessor> decoded;
       try
       {
-        decoded.reset(GetPlugins().Decode(dicomContent.c_str(), dicomContent.size(), frameIndex));
+        decoded.reset(GetPlugins().Decode(dicomContent->empty() ? NULL : dicomContent->c_str(),
+                                          dicomContent->size(), frameIndex));
       }
       catch (OrthancException& e)
       {
@@ -43,11 +43,13 @@
 #include "../../OrthancFramework/Sources/DicomParsing/DicomModification.h"
 #include "../../OrthancFramework/Sources/DicomParsing/IDicomTranscoder.h"
 #include "../../OrthancFramework/Sources/DicomParsing/ParsedDicomCache.h"
+#include "../../OrthancFramework/Sources/HttpServer/HttpOutput.h"
 #include "../../OrthancFramework/Sources/MultiThreading/Semaphore.h"
 
 
 namespace Orthanc
 {
+  class ChangesDispatcher;
   class DicomInstanceToStore;
   class IStorageArea;
   class JobsEngine;
@@ -58,7 +60,9 @@ namespace Orthanc
   class SetOfInstancesJob;
   class SharedArchive;
   class SharedMessageQueue;
+  class StorageAccessor;
   class StorageCommitmentReports;
+  class StorageDeletionQueue;
   
   
   /**
@@ -107,10 +111,9 @@ namespace Orthanc
       }
 
       virtual void SignalStoredInstance(const std::string& publicId,
-                                        const DicomInstanceToStore& instance,
-                                        const Json::Value& simplifiedTags) ORTHANC_OVERRIDE
+                                        const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
       {
-        context_.mainLua_.SignalStoredInstance(publicId, instance, simplifiedTags);
+        context_.mainLua_.SignalStoredInstance(publicId, instance);
       }
     
       virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE
@@ -118,10 +121,9 @@ namespace Orthanc
         context_.mainLua_.SignalChange(change);
       }
 
-      virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance,
-                                          const Json::Value& simplified) ORTHANC_OVERRIDE
+      virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
       {
-        return context_.filterLua_.FilterIncomingInstance(instance, simplified);
+        return context_.filterLua_.FilterIncomingInstance(instance);
       }
     };
     
@@ -153,9 +155,6 @@ namespace Orthanc
     typedef std::list<ServerListener>  ServerListeners;
 
 
-    static void ChangeThread(ServerContext* that,
-                             unsigned int sleepDelay);
-
     static void SaveJobsThread(ServerContext* that,
                                unsigned int sleepDelay);
 
@@ -171,6 +170,11 @@ namespace Orthanc
     IStorageArea& area_;
 
     bool compressionEnabled_;
+    size_t compressionChunkSize_;        // New in Orthanc 1.9.6
+    unsigned int compressionThreads_;    // New in Orthanc 1.9.6
+    uint8_t compressionLevel_;           // New in Orthanc 1.9.6
+    std::map<FileContentType, uint8_t> compressionLevels_;  // New in Orthanc 1.9.6
+    bool zstdCompression_;               // New in Orthanc 1.9.6
     bool storeMD5_;
 
     Semaphore largeDicomThrottler_;  // New in Orthanc 1.9.0 (notably for very large DICOM files in WSI)
@@ -198,8 +202,7 @@ namespace Orthanc
     bool done_;
     bool haveJobsChanged_;
     bool isJobsEngineUnserialized_;
-    SharedMessageQueue  pendingChanges_;
-    boost::thread  changeThread_;
+    bool saveAllJobs_;  // New in Orthanc 1.9.6
     boost::thread  saveJobsThread_;
         
     std::unique_ptr<SharedArchive>  queryRetrieveArchive_;
@@ -209,13 +212,21 @@ namespace Orthanc
     FindStorageAccessMode findStorageAccessMode_;
     unsigned int limitFindInstances_;
     unsigned int limitFindResults_;
+    unsigned int findPrefetchThreads_;  // New in Orthanc 1.9.6
 
     std::unique_ptr<MetricsRegistry>  metricsRegistry_;
     bool isHttpServerSecure_;
     bool isExecuteLuaEnabled_;
+
+    // Number of stored instances whose DICOM-as-JSON was not
+    // needed by any listener (new in Orthanc 1.9.6)
+    boost::mutex avoidedDicomAsJsonMutex_;
+    uint64_t avoidedDicomAsJson_;
     bool overwriteInstances_;
 
     std::unique_ptr<StorageCommitmentReports>  storageCommitmentReports_;
+    std::unique_ptr<StorageDeletionQueue>      deletionQueue_;  // New in Orthanc 1.9.6
+    std::unique_ptr<ChangesDispatcher>         changesDispatcher_;  // New in Orthanc 1.9.6
 
     bool transcodeDicomProtocol_;
     std::unique_ptr<IDicomTranscoder>  dcmtkTranscoder_;
@@ -243,10 +254,28 @@ namespace Orthanc
 
     void PublishDicomCacheMetrics();
 
+#if ORTHANC_ENABLE_PLUGINS == 1
+    void RemovePluginsChangeListeners();
+#endif
+
+    // Configures the level and the chunks of the compression of
+    // one type of attachments
+    void SetupCompression(StorageAccessor& accessor,
+                          FileContentType type) const;
+
+    // Returns the compression to be applied to new attachments, and
+    // configures the accessor accordingly
+    CompressionType PrepareCompression(StorageAccessor& accessor,
+                                       FileContentType type) const;
+
     // This method must only be called from "ServerIndex"!
     void RemoveFile(const std::string& fileUuid,
                     FileContentType type);
 
+    // If "true", the files given to "RemoveFile()" must have been
+    // saved in the database transaction that has deleted them
+    bool IsStorageDeletionAsynchronous();
+
     // This DicomModification object is intended to be used as a
     // "rules engine" when de-identifying logs for C-Find, C-Get, and
     // C-Move queries (new in Orthanc 1.8.2)
@@ -261,7 +290,7 @@ namespace Orthanc
       std::string                                  instancePublicId_;
       std::unique_ptr<ParsedDicomCache::Accessor>  accessor_;
       std::unique_ptr<ParsedDicomFile>             dicom_;
-      size_t                                       dicomSize_;
+      boost::shared_ptr<const std::string>         buffer_;
       std::unique_ptr<Semaphore::Locker>           largeDicomLocker_;
 
     public:
@@ -271,6 +300,34 @@ namespace Orthanc
       ~DicomCacheLocker();
 
       ParsedDicomFile& GetDicom() const;
+
+      // The raw DICOM file, as read from the storage area (new in
+      // Orthanc 1.9.6). It can be used after the locker is released.
+      const boost::shared_ptr<const std::string>& GetBuffer() const;
+    };
+
+    /**
+     * Reads byte ranges of the uncompressed content of an attachment
+     * (new in Orthanc 1.9.6). If neither the cache of DICOM files nor
+     * the storage area can serve the ranges, the full attachment is
+     * read once, on the first call to "ReadRange()".
+     **/
+    class AttachmentRangesReader : public HttpOutput::IByteRangesReader
+    {
+    private:
+      ServerContext&                        context_;
+      FileInfo                              attachment_;
+      boost::shared_ptr<const std::string>  content_;
+      bool                                  useReadRange_;
+
+    public:
+      AttachmentRangesReader(ServerContext& context,
+                             const std::string& instancePublicId,
+                             const FileInfo& attachment);
+
+      virtual void ReadRange(std::string& target,
+                             uint64_t start,
+                             uint64_t end) ORTHANC_OVERRIDE;
     };
 
     ServerContext(IDatabaseWrapper& database,
@@ -295,6 +352,70 @@ namespace Orthanc
       return compressionEnabled_;
     }
 
+    // Size of the independently compressed chunks of the attachments
+    // if compression is enabled. "0" means that the attachments are
+    // compressed as a whole, using the format of Orthanc <= 1.9.5.
+    void SetCompressionChunkSize(size_t size)
+    {
+      compressionChunkSize_ = size;
+    }
+
+    size_t GetCompressionChunkSize() const
+    {
+      return compressionChunkSize_;
+    }
+
+    void SetCompressionThreads(unsigned int threads);
+
+    unsigned int GetCompressionThreads() const
+    {
+      return compressionThreads_;
+    }
+
+    // Level between 1 (fastest) and "GetMaximumCompressionLevel()"
+    // (highest compression), "0" meaning that the attachments are not
+    // compressed, except for the types that override this level. The
+    // codec must be chosen first, as the maximum level depends on it.
+    void SetCompressionLevel(uint8_t level);
+
+    // Overrides the compression level for one type of attachments,
+    // "0" meaning that such attachments are never compressed
+    void SetCompressionLevel(FileContentType type,
+                             uint8_t level);
+
+    // 9 for zlib, "ZSTD_maxCLevel()" for zstd
+    uint8_t GetMaximumCompressionLevel() const;
+
+    uint8_t GetCompressionLevel(FileContentType type) const;
+
+    // Use zstd instead of zlib to compress the new attachments, in
+    // which case the chunk size is ignored. Throws if Orthanc was
+    // built without support for zstd.
+    void SetZstdCompression(bool enabled);
+
+    bool IsZstdCompression() const
+    {
+      return zstdCompression_;
+    }
+
+    // Format of the attachments that are compressed through the REST
+    // API, even if "StorageCompression" is disabled
+    CompressionType GetExplicitCompression() const;
+
+    // Number of threads reading the storage area during the
+    // filtering of find operations (0 means sequential reads)
+    void SetFindPrefetchThreads(unsigned int threads)
+    {
+      findPrefetchThreads_ = threads;
+    }
+
+    unsigned int GetFindPrefetchThreads() const
+    {
+      return findPrefetchThreads_;
+    }
+
+    uint64_t GetAvoidedDicomAsJsonCount();
+
     bool AddAttachment(int64_t& newRevision,
                        const std::string& resourceId,
                        FileContentType attachmentType,
@@ -312,6 +433,12 @@ namespace Orthanc
                           const std::string& resourceId,
                           FileContentType content);
 
+    // Answer the DICOM file of an instance, directly from the cache
+    // of DICOM files if it is available there (new in Orthanc 1.9.6)
+    void AnswerDicomFile(RestApiOutput& output,
+                         const std::string& instancePublicId,
+                         const FileInfo& attachment);
+
     void ChangeAttachmentCompression(const std::string& resourceId,
                                      FileContentType attachmentType,
                                      CompressionType compression);
@@ -325,6 +452,14 @@ namespace Orthanc
 
     void ReadDicom(std::string& dicom,
                    const std::string& instancePublicId);
+
+    // Zero-copy version, that is served from the cache of DICOM files
+    // if possible (new in Orthanc 1.9.6)
+    void ReadDicom(boost::shared_ptr<const std::string>& dicom,
+                   const std::string& instancePublicId);
+
+    bool LookupDicomInCache(boost::shared_ptr<const std::string>& dicom,
+                            const std::string& instancePublicId);
     
     bool ReadDicomUntilPixelData(std::string& dicom,
                                  const std::string& instancePublicId);
@@ -241,6 +241,29 @@ namespace Orthanc
   }
 
 
+  ChangesOverflowPolicy StringToChangesOverflowPolicy(const std::string& value)
+  {
+    if (value == "Block")
+    {
+      return ChangesOverflowPolicy_Block;
+    }
+    else if (value == "DropOldest")
+    {
+      return ChangesOverflowPolicy_DropOldest;
+    }
+    else if (value == "DropNewest")
+    {
+      return ChangesOverflowPolicy_DropNewest;
+    }
+    else
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "Configuration option \"ChangesQueueOverflow\" "
+                             "should be \"Block\", \"DropOldest\" or \"DropNewest\": " + value);
+    }
+  }
+
+
   Verbosity StringToVerbosity(const std::string& str)
   {
     if (str == "default")
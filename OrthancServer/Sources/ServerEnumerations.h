@@ -88,6 +88,14 @@ namespace Orthanc
     FindStorageAccessMode_DiskOnLookupAndAnswer
   };
 
+  // New in Orthanc 1.9.6
+  enum ChangesOverflowPolicy
+  {
+    ChangesOverflowPolicy_Block,       // Slow down the producer of the changes
+    ChangesOverflowPolicy_DropOldest,
+    ChangesOverflowPolicy_DropNewest
+  };
+
   enum StoreInstanceMode
   {
     StoreInstanceMode_Default,
@@ -129,8 +137,10 @@ namespace Orthanc
     GlobalProperty_AnonymizationSequence = 3,
     GlobalProperty_JobsRegistry = 5,
     GlobalProperty_GetTotalSizeIsFast = 6,      // New in Orthanc 1.5.2
+    GlobalProperty_ResourceStatisticsAreFast = 8,  // New in Orthanc 1.9.6
     GlobalProperty_Modalities = 20,             // New in Orthanc 1.5.0
     GlobalProperty_Peers = 21,                  // New in Orthanc 1.5.0
+    GlobalProperty_JobsRegistryBuckets = 512,   // New in Orthanc 1.9.6 (512 to 767, cf. "JobsRegistryRecords")
 
     // Reserved values for internal use by the database plugins
     GlobalProperty_DatabasePatchLevel = 4,
@@ -222,6 +232,8 @@ namespace Orthanc
 
   BuiltinDecoderTranscoderOrder StringToBuiltinDecoderTranscoderOrder(const std::string& str);
 
+  ChangesOverflowPolicy StringToChangesOverflowPolicy(const std::string& str);
+
   Verbosity StringToVerbosity(const std::string& str);
 
   std::string EnumerationToString(FileContentType type);
@@ -39,6 +39,7 @@
 #endif
 
 #include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
 #include "../../OrthancFramework/Sources/Toolbox.h"
 
 #include "OrthancConfiguration.h"
@@ -46,6 +47,8 @@
 #include "ServerIndexChange.h"
 #include "ServerToolbox.h"
 
+#include <algorithm>
+
 
 static const uint64_t MEGA_BYTES = 1024 * 1024;
 
@@ -217,10 +220,29 @@ namespace Orthanc
       // deleted because of recycling.
       CommitFilesToRemove();
       
-      // Send all the pending changes to the Orthanc plugins
+      // Send all the pending changes to the Orthanc plugins. This is
+      // done once the database transaction has released its lock, as
+      // the dispatcher of the changes might apply back-pressure.
       CommitChanges();
     }
 
+    virtual void PrepareCommit(IDatabaseWrapper::ITransaction& transaction) ORTHANC_OVERRIDE
+    {
+      // If the files are removed by background threads, they are
+      // saved in the transaction that deletes them, so that their
+      // removal can be resumed if Orthanc stops in the meantime
+      if (!pendingFilesToRemove_.empty() &&
+          context_.IsStorageDeletionAsynchronous())
+      {
+        for (std::list<FileToRemove>::const_iterator 
+               it = pendingFilesToRemove_.begin();
+             it != pendingFilesToRemove_.end(); ++it)
+        {
+          transaction.EnqueueStorageDeletion(it->GetUuid(), it->GetContentType());
+        }
+      }
+    }
+
     virtual int64_t GetCompressedSizeDelta() ORTHANC_OVERRIDE
     {
       return (static_cast<int64_t>(sizeOfAddedAttachments_) -
@@ -286,6 +308,98 @@ namespace Orthanc
   };
 
 
+  class ServerIndex::PendingStore : public boost::noncopyable
+  {
+  public:
+    enum State
+    {
+      State_Pending,
+      State_Done,
+      State_RolledBack
+    };
+    
+  private:
+    StoreOperations&  operations_;
+    State             state_;
+
+  public:
+    explicit PendingStore(StoreOperations& operations) :
+      operations_(operations),
+      state_(State_Pending)
+    {
+    }
+
+    StoreOperations& GetOperations() const
+    {
+      return operations_;
+    }
+
+    State GetState() const
+    {
+      return state_;
+    }
+
+    void SetState(State state)
+    {
+      state_ = state;
+    }
+  };
+
+
+  /**
+   * Role of the leader of the group commit. The destructor is also
+   * invoked if the leader throws an exception: It rolls back the
+   * instances of the batch that are still pending, and hands over the
+   * leadership, so that the followers never wait forever.
+   **/
+  class ServerIndex::StoreLeader : public boost::noncopyable
+  {
+  private:
+    ServerIndex&                  that_;
+    boost::mutex::scoped_lock&    lock_;
+    std::vector<PendingStore*>&   batch_;
+
+  public:
+    StoreLeader(ServerIndex& that,
+                boost::mutex::scoped_lock& lock,
+                std::vector<PendingStore*>& batch) :
+      that_(that),
+      lock_(lock),
+      batch_(batch)
+    {
+      assert(lock_.owns_lock());
+      that_.hasStoreLeader_ = true;
+    }
+
+    ~StoreLeader()
+    {
+      try
+      {
+        if (!lock_.owns_lock())
+        {
+          lock_.lock();
+        }
+      }
+      catch (...)
+      {
+        LOG(ERROR) << "Cannot lock the queue of the group commit";
+      }
+
+      for (size_t i = 0; i < batch_.size(); i++)
+      {
+        assert(batch_[i] != NULL);
+        if (batch_[i]->GetState() == PendingStore::State_Pending)
+        {
+          batch_[i]->SetState(PendingStore::State_RolledBack);
+        }
+      }
+
+      that_.hasStoreLeader_ = false;
+      that_.storeCondition_.notify_all();
+    }
+  };
+
+
   void ServerIndex::FlushThread(ServerIndex* that,
                                 unsigned int threadSleepGranularityMilliseconds)
   {
@@ -331,9 +445,13 @@ namespace Orthanc
                            IDatabaseWrapper& db,
                            unsigned int threadSleepGranularityMilliseconds) :
     StatelessDatabaseOperations(db),
+    context_(context),
     done_(false),
     maximumStorageSize_(0),
-    maximumPatients_(0)
+    maximumPatients_(0),
+    hasStoreLeader_(false),
+    groupCommitWindow_(0),
+    groupCommitMaxBatch_(1)
   {
     SetTransactionContextFactory(new TransactionContextFactory(context));
 
@@ -420,6 +538,26 @@ namespace Orthanc
   }
 
 
+  void ServerIndex::SetStoreGroupCommit(unsigned int window,
+                                        unsigned int maxBatch)
+  {
+    boost::mutex::scoped_lock lock(monitoringMutex_);
+    groupCommitWindow_ = window;
+    groupCommitMaxBatch_ = maxBatch;
+
+    if (window == 0 ||
+        maxBatch <= 1)
+    {
+      LOG(INFO) << "Group commit of the incoming instances is disabled";
+    }
+    else
+    {
+      LOG(WARNING) << "Group commit of the incoming instances is enabled (window = "
+                   << window << "ms, at most " << maxBatch << " instances per transaction)";
+    }
+  }
+
+
   void ServerIndex::UnstableResourcesMonitorThread(ServerIndex* that,
                                                    unsigned int threadSleepGranularityMilliseconds)
   {
@@ -520,6 +658,44 @@ namespace Orthanc
   }
 
 
+  bool ServerIndex::ProcessStoreBatch(std::vector<PendingStore*>& batch)
+  {
+    std::vector<StoreOperations*> operations;
+    operations.reserve(batch.size());
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+      assert(batch[i] != NULL);
+      operations.push_back(&batch[i]->GetOperations());
+    }
+
+    try
+    {
+      MetricsRegistry& registry = context_.GetMetricsRegistry();
+      registry.SetValue("orthanc_store_group_commit_size", static_cast<float>(batch.size()),
+                        MetricsType_MaxOver10Seconds);
+      
+      MetricsRegistry::Timer timer(registry, "orthanc_store_group_commit_duration_ms");
+      return StoreBatch(operations);
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Error while storing a group of instances: " << e.What();
+      return false;
+    }
+    catch (std::exception& e)
+    {
+      LOG(ERROR) << "Error while storing a group of instances: " << e.what();
+      return false;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception while storing a group of instances";
+      return false;
+    }
+  }
+
+
   StoreStatus ServerIndex::Store(std::map<MetadataType, std::string>& instanceMetadata,
                                  const DicomMap& dicomSummary,
                                  const ServerIndex::Attachments& attachments,
@@ -533,16 +709,132 @@ namespace Orthanc
   {
     uint64_t maximumStorageSize;
     unsigned int maximumPatients;
+    unsigned int groupCommitWindow;
+    unsigned int groupCommitMaxBatch;
     
     {
       boost::mutex::scoped_lock lock(monitoringMutex_);
       maximumStorageSize = maximumStorageSize_;
       maximumPatients = maximumPatients_;
+      groupCommitWindow = groupCommitWindow_;
+      groupCommitMaxBatch = groupCommitMaxBatch_;
     }
 
-    return StatelessDatabaseOperations::Store(
+    StoreOperations operations(
       instanceMetadata, dicomSummary, attachments, metadata, origin, overwrite, hasTransferSyntax,
       transferSyntax, hasPixelDataOffset, pixelDataOffset, maximumStorageSize, maximumPatients);
+
+    if (groupCommitWindow == 0 ||
+        groupCommitMaxBatch <= 1)
+    {
+      Apply(operations);
+      return operations.GetStoreStatus();
+    }
+
+    /**
+     * Group commit: The first thread that finds no active leader
+     * becomes the leader. It waits for at most "groupCommitWindow"
+     * milliseconds for other threads to enqueue their instances, then
+     * stores the whole group in one single database transaction,
+     * while the other threads (the followers) are sleeping. The
+     * changes and the recycled files are signaled by the leader, once
+     * the transaction is committed.
+     **/
+    
+    PendingStore pending(operations);
+
+    {
+      boost::mutex::scoped_lock lock(storeMutex_);
+      pendingStores_.push_back(&pending);
+      storeCondition_.notify_all();  // Wake up the leader, if it waits for a full group
+
+      try
+      {
+        while (pending.GetState() == PendingStore::State_Pending)
+        {
+          if (hasStoreLeader_)
+          {
+            storeCondition_.wait(lock);
+          }
+          else
+          {
+            std::vector<PendingStore*> batch;
+            StoreLeader leader(*this, lock, batch);
+
+            const boost::system_time timeout = (boost::get_system_time() +
+                                                boost::posix_time::milliseconds(groupCommitWindow));
+            while (pendingStores_.size() < groupCommitMaxBatch &&
+                   !done_)
+            {
+              if (!storeCondition_.timed_wait(lock, timeout))
+              {
+                break;
+              }
+            }
+
+            batch.reserve(groupCommitMaxBatch);
+
+            while (!pendingStores_.empty() &&
+                   batch.size() < groupCommitMaxBatch)
+            {
+              batch.push_back(pendingStores_.front());
+              pendingStores_.pop_front();
+            }
+
+            // Don't hold the mutex while accessing the database, so that
+            // other threads can enqueue the next group in the meantime
+            lock.unlock();
+            const bool success = ProcessStoreBatch(batch);
+            lock.lock();
+
+            for (size_t i = 0; i < batch.size(); i++)
+            {
+              batch[i]->SetState(success ? PendingStore::State_Done : PendingStore::State_RolledBack);
+            }
+
+            // The destructor of "leader" wakes up the followers
+          }
+        }
+      }
+      catch (...)
+      {
+        // Never leave a dangling pointer to "pending" in the queue, or
+        // in the batch of the current leader
+        boost::this_thread::disable_interruption disabled;
+
+        if (!lock.owns_lock())
+        {
+          lock.lock();
+        }
+
+        std::deque<PendingStore*>::iterator found =
+          std::find(pendingStores_.begin(), pendingStores_.end(), &pending);
+
+        if (found != pendingStores_.end())
+        {
+          pendingStores_.erase(found);
+        }
+        else
+        {
+          while (pending.GetState() == PendingStore::State_Pending)
+          {
+            storeCondition_.wait(lock);
+          }
+        }
+
+        throw;
+      }
+    }
+
+    if (pending.GetState() == PendingStore::State_RolledBack)
+    {
+      // The group could not be stored as a whole, which is notably
+      // the case if one of the instances is not accepted by the
+      // database: Fallback to one transaction for this instance
+      Apply(operations);
+    }
+
+    return operations.GetStoreStatus();
   }
 
   
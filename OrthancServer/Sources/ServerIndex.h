@@ -37,6 +37,7 @@
 #include "../../OrthancFramework/Sources/Cache/LeastRecentlyUsedIndex.h"
 
 #include <boost/thread.hpp>
+#include <deque>
 
 namespace Orthanc
 {
@@ -48,7 +49,10 @@ namespace Orthanc
     class TransactionContext;
     class TransactionContextFactory;
     class UnstableResourcePayload;
+    class PendingStore;
+    class StoreLeader;
 
+    ServerContext& context_;
     bool done_;
     boost::mutex monitoringMutex_;
     boost::thread flushThread_;
@@ -59,6 +63,14 @@ namespace Orthanc
     uint64_t     maximumStorageSize_;
     unsigned int maximumPatients_;
 
+    // Group commit of the incoming instances (new in Orthanc 1.9.6)
+    boost::mutex               storeMutex_;
+    boost::condition_variable  storeCondition_;
+    std::deque<PendingStore*>  pendingStores_;
+    bool                       hasStoreLeader_;
+    unsigned int               groupCommitWindow_;    // In milliseconds, "0" means disabled
+    unsigned int               groupCommitMaxBatch_;
+
     static void FlushThread(ServerIndex* that,
                             unsigned int threadSleep);
 
@@ -71,6 +83,9 @@ namespace Orthanc
 
     bool IsUnstableResource(int64_t id);
 
+    // Returns "false" if the batch must be rolled back, never throws
+    bool ProcessStoreBatch(std::vector<PendingStore*>& batch);
+
   public:
     ServerIndex(ServerContext& context,
                 IDatabaseWrapper& database,
@@ -86,6 +101,11 @@ namespace Orthanc
     // "count == 0" means no limit on the number of patients
     void SetMaximumPatientCount(unsigned int count);
 
+    // "window == 0" or "maxBatch <= 1" disables the group commit,
+    // i.e. each instance is stored in its own database transaction
+    void SetStoreGroupCommit(unsigned int window /* in milliseconds */,
+                             unsigned int maxBatch);
+
     StoreStatus Store(std::map<MetadataType, std::string>& instanceMetadata,
                       const DicomMap& dicomSummary,
                       const Attachments& attachments,
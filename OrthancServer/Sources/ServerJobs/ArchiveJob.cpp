@@ -36,6 +36,7 @@
 
 #include "../../../OrthancFramework/Sources/Cache/SharedArchive.h"
 #include "../../../OrthancFramework/Sources/Compression/HierarchicalZipWriter.h"
+#include "../../../OrthancFramework/Sources/DicomFormat/DicomStreamReader.h"
 #include "../../../OrthancFramework/Sources/DicomParsing/DicomDirWriter.h"
 #include "../../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
@@ -44,8 +45,9 @@
 #include "../ServerContext.h"
 
 #include <stdio.h>
-#include <thread>
-#include <atomic>
+#include <boost/iostreams/device/array.hpp>
+#include <boost/iostreams/stream.hpp>
+#include <boost/thread.hpp>
 
 #if defined(_MSC_VER)
 #define snprintf _snprintf
@@ -63,8 +65,6 @@ static const char* const KEY_UNCOMPRESSED_SIZE = "UncompressedSize";
 static const char* const KEY_ARCHIVE_SIZE = "ArchiveSize";
 static const char* const KEY_TRANSCODE = "Transcode";
 
-static const int NB_THREAD = 3;
-
 
 namespace Orthanc
 {
@@ -92,6 +92,98 @@ namespace Orthanc
   }
 
 
+  static bool IsUncompressedTransferSyntax(DicomTransferSyntax transferSyntax)
+  {
+    return (transferSyntax == DicomTransferSyntax_LittleEndianImplicit ||
+            transferSyntax == DicomTransferSyntax_LittleEndianExplicit ||
+            transferSyntax == DicomTransferSyntax_BigEndianExplicit);
+  }
+
+
+  namespace
+  {
+    // Only reads the meta-header of a DICOM file (new in Orthanc 1.9.6)
+    class TransferSyntaxVisitor : public DicomStreamReader::IVisitor
+    {
+    private:
+      bool                 hasTransferSyntax_;
+      DicomTransferSyntax  transferSyntax_;
+
+    public:
+      TransferSyntaxVisitor() :
+        hasTransferSyntax_(false),
+        transferSyntax_(DicomTransferSyntax_LittleEndianImplicit)
+      {
+      }
+
+      virtual void VisitMetaHeaderTag(const DicomTag& tag,
+                                      const ValueRepresentation& vr,
+                                      const std::string& value) ORTHANC_OVERRIDE
+      {
+      }
+
+      virtual void VisitTransferSyntax(DicomTransferSyntax transferSyntax) ORTHANC_OVERRIDE
+      {
+        hasTransferSyntax_ = true;
+        transferSyntax_ = transferSyntax;
+      }
+
+      virtual bool VisitDatasetTag(const DicomTag& tag,
+                                   const ValueRepresentation& vr,
+                                   const std::string& value,
+                                   bool isLittleEndian,
+                                   uint64_t fileOffset) ORTHANC_OVERRIDE
+      {
+        return false;  // Stop as soon as the dataset is reached
+      }
+
+      bool IsCompressedTransferSyntax() const
+      {
+        return (hasTransferSyntax_ &&
+                !IsUncompressedTransferSyntax(transferSyntax_));
+      }
+    };
+  }
+
+
+  static bool IsCompressedDicom(const std::string& dicom)
+  {
+    TransferSyntaxVisitor visitor;
+
+    try
+    {
+      boost::iostreams::array_source source(dicom.c_str(), dicom.size());
+      boost::iostreams::stream<boost::iostreams::array_source> stream(source);
+
+      DicomStreamReader reader(stream);
+      reader.Consume(visitor);
+    }
+    catch (OrthancException&)
+    {
+      // Not a valid DICOM file, the information collected so far is used
+    }
+
+    return visitor.IsCompressedTransferSyntax();
+  }
+
+
+  static void OpenInstanceFile(HierarchicalZipWriter& writer,
+                               const std::string& filename,
+                               bool store)
+  {
+    if (store)
+    {
+      // There is no need to deflate an instance whose pixel data is
+      // already compressed, which saves much CPU time
+      writer.OpenFile(filename.c_str(), 0 /* method "Stored" */);
+    }
+    else
+    {
+      writer.OpenFile(filename.c_str());
+    }
+  }
+
+
   class ArchiveJob::ResourceIdentifiers : public boost::noncopyable
   {
   private:
@@ -362,6 +454,306 @@ namespace Orthanc
 
 
 
+  class ArchiveJob::InstanceLoader : public boost::noncopyable
+  {
+  protected:
+    ServerContext&  context_;
+
+  public:
+    explicit InstanceLoader(ServerContext& context) :
+      context_(context)
+    {
+    }
+
+    virtual ~InstanceLoader()
+    {
+    }
+
+    // Returns "false" if the instance has been removed in the meantime
+    virtual bool GetDicom(std::string& dicom,
+                          const std::string& instanceId) = 0;
+
+    virtual void Clear()
+    {
+    }
+  };
+
+
+  class ArchiveJob::SynchronousInstanceLoader : public InstanceLoader
+  {
+  public:
+    explicit SynchronousInstanceLoader(ServerContext& context) :
+      InstanceLoader(context)
+    {
+    }
+
+    virtual bool GetDicom(std::string& dicom,
+                          const std::string& instanceId) ORTHANC_OVERRIDE
+    {
+      try
+      {
+        context_.ReadDicom(dicom, instanceId);
+        return true;
+      }
+      catch (OrthancException&)
+      {
+        return false;
+      }
+    }
+  };
+
+
+  /**
+   * Producer/consumer pipeline that reads the instances ahead of the
+   * ZIP writer (new in Orthanc 1.9.6). The instances are read in the
+   * order of the archive by a pool of worker threads. The workers
+   * sleep on a condition variable as soon as "readAhead" instances
+   * are buffered, or if the buffered instances would exceed
+   * "maxMemory" bytes (at least one instance is always read, in order
+   * to make progress on very large instances).
+   **/
+  class ArchiveJob::ThreadedInstanceLoader : public InstanceLoader
+  {
+  private:
+    struct Slot
+    {
+      std::string  instanceId_;
+      uint64_t     expectedSize_;
+      bool         isReady_;
+      bool         success_;
+      std::string  dicom_;
+      std::string  error_;  // Unexpected error in the worker, reported to the consumer
+    };
+
+    boost::mutex                 mutex_;
+    boost::condition_variable    workersCondition_;
+    boost::condition_variable    consumerCondition_;
+    std::vector<Slot>            slots_;
+    size_t                       nextToLoad_;
+    size_t                       nextToConsume_;
+    unsigned int                 readAhead_;
+    uint64_t                     maxMemory_;
+    uint64_t                     bufferedMemory_;
+    bool                         done_;
+    std::vector<boost::thread*>  workers_;
+
+    bool CanLoadNext() const
+    {
+      // WARNING: "mutex_" must be locked
+      if (nextToLoad_ >= slots_.size() ||
+          nextToLoad_ - nextToConsume_ >= readAhead_)
+      {
+        return false;
+      }
+      else
+      {
+        return (nextToLoad_ == nextToConsume_ ||
+                bufferedMemory_ + slots_[nextToLoad_].expectedSize_ <= maxMemory_);
+      }
+    }
+
+    static void Worker(ThreadedInstanceLoader* that)
+    {
+      for (;;)
+      {
+        size_t index;
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+
+          while (!that->done_ &&
+                 that->nextToLoad_ < that->slots_.size() &&
+                 !that->CanLoadNext())
+          {
+            that->workersCondition_.wait(lock);
+          }
+
+          if (that->done_ ||
+              that->nextToLoad_ >= that->slots_.size())
+          {
+            return;
+          }
+
+          index = that->nextToLoad_;
+          that->nextToLoad_++;
+          that->bufferedMemory_ += that->slots_[index].expectedSize_;
+        }
+
+        // The identifier of the slot is never modified once the workers are started
+        std::string dicom;
+        std::string error;
+        bool success = false;
+
+        try
+        {
+          that->context_.ReadDicom(dicom, that->slots_[index].instanceId_);
+          success = true;
+        }
+        catch (OrthancException&)
+        {
+          // The instance was removed after the job was issued
+        }
+        catch (std::exception& e)
+        {
+          error = e.what();
+        }
+        catch (...)
+        {
+          error = "Native exception";
+        }
+
+        if (!error.empty())
+        {
+          LOG(ERROR) << "Error while loading instance " << that->slots_[index].instanceId_
+                     << " for an archive: " << error;
+        }
+
+        {
+          boost::mutex::scoped_lock lock(that->mutex_);
+          Slot& slot = that->slots_[index];
+          slot.dicom_.swap(dicom);
+          slot.error_.swap(error);
+          slot.success_ = success;
+          slot.isReady_ = true;
+        }
+
+        that->consumerCondition_.notify_all();
+      }
+    }
+
+  public:
+    ThreadedInstanceLoader(ServerContext& context,
+                           unsigned int readAhead,
+                           uint64_t maxMemory) :
+      InstanceLoader(context),
+      nextToLoad_(0),
+      nextToConsume_(0),
+      readAhead_(readAhead),
+      maxMemory_(maxMemory),
+      bufferedMemory_(0),
+      done_(false)
+    {
+      if (readAhead == 0)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    virtual ~ThreadedInstanceLoader()
+    {
+      Clear();
+    }
+
+    void AddInstance(const std::string& instanceId,
+                     uint64_t expectedSize)
+    {
+      if (!workers_.empty())
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      Slot slot;
+      slot.instanceId_ = instanceId;
+      slot.expectedSize_ = expectedSize;
+      slot.isReady_ = false;
+      slot.success_ = false;
+      slots_.push_back(slot);
+    }
+
+    void Start(unsigned int threads)
+    {
+      if (threads == 0 ||
+          !workers_.empty())
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+
+      workers_.resize(threads);
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        workers_[i] = new boost::thread(Worker, this);
+      }
+    }
+
+    virtual bool GetDicom(std::string& dicom,
+                          const std::string& instanceId) ORTHANC_OVERRIDE
+    {
+      bool success;
+      std::string error;
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+
+        if (nextToConsume_ >= slots_.size() ||
+            slots_[nextToConsume_].instanceId_ != instanceId)
+        {
+          // The instances must be consumed in the order of the archive
+          throw OrthancException(ErrorCode_InternalError);
+        }
+
+        Slot& slot = slots_[nextToConsume_];
+
+        while (!done_ &&
+               !slot.isReady_)
+        {
+          consumerCondition_.wait(lock);
+        }
+
+        if (!slot.isReady_)
+        {
+          throw OrthancException(ErrorCode_BadSequenceOfCalls, "The loader of the archive has been stopped");
+        }
+
+        dicom.clear();
+        dicom.swap(slot.dicom_);
+        success = slot.success_;
+        error.swap(slot.error_);
+
+        assert(bufferedMemory_ >= slot.expectedSize_);
+        bufferedMemory_ -= slot.expectedSize_;
+        nextToConsume_++;
+      }
+
+      workersCondition_.notify_all();
+
+      if (!error.empty())
+      {
+        throw OrthancException(ErrorCode_InternalError, "Cannot load instance " + instanceId +
+                               " for the archive: " + error);
+      }
+
+      return success;
+    }
+
+    virtual void Clear() ORTHANC_OVERRIDE
+    {
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = true;
+      }
+
+      workersCondition_.notify_all();
+      consumerCondition_.notify_all();
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        if (workers_[i] != NULL)
+        {
+          if (workers_[i]->joinable())
+          {
+            workers_[i]->join();
+          }
+
+          delete workers_[i];
+        }
+      }
+
+      workers_.clear();
+    }
+  };
+
+
   class ArchiveJob::ZipCommands : public boost::noncopyable
   {
   private:
@@ -378,44 +770,61 @@ namespace Orthanc
       Type          type_;
       std::string   filename_;
       std::string   instanceId_;
+      uint64_t      uncompressedSize_;
 
     public:
       explicit Command(Type type) :
-        type_(type)
+        type_(type),
+        uncompressedSize_(0)
       {
         assert(type_ == Type_CloseDirectory);
       }
-        
+
       Command(Type type,
               const std::string& filename) :
         type_(type),
-        filename_(filename)
+        filename_(filename),
+        uncompressedSize_(0)
       {
         assert(type_ == Type_OpenDirectory);
       }
-        
+
       Command(Type type,
               const std::string& filename,
-              const std::string& instanceId) :
+              const std::string& instanceId,
+              uint64_t uncompressedSize) :
         type_(type),
         filename_(filename),
-        instanceId_(instanceId)
+        instanceId_(instanceId),
+        uncompressedSize_(uncompressedSize)
       {
         assert(type_ == Type_WriteInstance);
       }
 
-      bool IsWriteInstance(){
+      bool IsWriteInstance() const
+      {
         return type_ == Type_WriteInstance;
       }
-        
+
+      const std::string& GetInstanceId() const
+      {
+        assert(type_ == Type_WriteInstance);
+        return instanceId_;
+      }
+
+      uint64_t GetUncompressedSize() const
+      {
+        return uncompressedSize_;
+      }
+
       void Apply(HierarchicalZipWriter& writer,
                  ServerContext& context,
+                 InstanceLoader& loader,
                  DicomDirWriter* dicomDir,
                  const std::string& dicomDirFolder,
                  bool transcode,
                  DicomTransferSyntax transferSyntax,
-                 bool reading,
-                 std::string& content) const
+                 bool storeCompressed) const
       {
         switch (type_)
         {
@@ -429,74 +838,64 @@ namespace Orthanc
 
           case Type_WriteInstance:
           {
-            if (reading)
+            std::string content;
+
+            if (!loader.GetDicom(content, instanceId_))
             {
-              try
-              {
-                context.ReadDicom(content, instanceId_);
-              }
-              catch (OrthancException& e)
-              {
-                LOG(WARNING) << "An instance was removed after the job was issued: " << instanceId_;
-                return;
-              }
+              LOG(WARNING) << "An instance was removed after the job was issued: " << instanceId_;
+              return;
             }
-            else
-            {
-              //boost::this_thread::sleep(boost::posix_time::milliseconds(300));
 
-              writer.OpenFile(filename_.c_str());
+            bool transcodeSuccess = false;
 
-              bool transcodeSuccess = false;
+            std::unique_ptr<ParsedDicomFile> parsed;
 
-              std::unique_ptr<ParsedDicomFile> parsed;
-              
-              if (transcode)
-              {
-                // New in Orthanc 1.7.0
-                std::set<DicomTransferSyntax> syntaxes;
-                syntaxes.insert(transferSyntax);
+            if (transcode)
+            {
+              // New in Orthanc 1.7.0
+              std::set<DicomTransferSyntax> syntaxes;
+              syntaxes.insert(transferSyntax);
 
-                IDicomTranscoder::DicomImage source, transcoded;
-                source.SetExternalBuffer(content);
+              IDicomTranscoder::DicomImage source, transcoded;
+              source.SetExternalBuffer(content);
 
-                if (context.Transcode(transcoded, source, syntaxes, true /* allow new SOP instance UID */))
-                {
-                  writer.Write(transcoded.GetBufferData(), transcoded.GetBufferSize());
-
-                  if (dicomDir != NULL)
-                  {
-                    std::unique_ptr<ParsedDicomFile> tmp(transcoded.ReleaseAsParsedDicomFile());
-                    dicomDir->Add(dicomDirFolder, filename_, *tmp);
-                  }
-                  
-                  transcodeSuccess = true;
-                }
-                else
+              if (context.Transcode(transcoded, source, syntaxes, true /* allow new SOP instance UID */))
+              {
+                OpenInstanceFile(writer, filename_, storeCompressed &&
+                                 !IsUncompressedTransferSyntax(transferSyntax));
+                writer.Write(transcoded.GetBufferData(), transcoded.GetBufferSize());
+
+                if (dicomDir != NULL)
                 {
-                  LOG(INFO) << "Cannot transcode instance " << instanceId_
-                            << " to transfer syntax: " << GetTransferSyntaxUid(transferSyntax);
+                  std::unique_ptr<ParsedDicomFile> tmp(transcoded.ReleaseAsParsedDicomFile());
+                  dicomDir->Add(dicomDirFolder, filename_, *tmp);
                 }
-              }
 
-              if (!transcodeSuccess)
+                transcodeSuccess = true;
+              }
+              else
               {
-                writer.Write(content);
+                LOG(INFO) << "Cannot transcode instance " << instanceId_
+                          << " to transfer syntax: " << GetTransferSyntaxUid(transferSyntax);
+              }
+            }
 
-                if (dicomDir != NULL)
-                {
-                  if (parsed.get() == NULL)
-                  {
-                    parsed.reset(new ParsedDicomFile(content));
-                  }
+            if (!transcodeSuccess)
+            {
+              OpenInstanceFile(writer, filename_, storeCompressed && IsCompressedDicom(content));
+              writer.Write(content);
 
-                  dicomDir->Add(dicomDirFolder, filename_, *parsed);
+              if (dicomDir != NULL)
+              {
+                if (parsed.get() == NULL)
+                {
+                  parsed.reset(new ParsedDicomFile(content));
                 }
+
+                dicomDir->Add(dicomDirFolder, filename_, *parsed);
               }
-             
-            }        
-            
-              
+            }
+
             break;
           }
 
@@ -505,37 +904,38 @@ namespace Orthanc
         }
       }
     };
-      
+
     std::deque<Command*>  commands_;
     uint64_t              uncompressedSize_;
     unsigned int          instancesCount_;
 
-      
+
     void ApplyInternal(HierarchicalZipWriter& writer,
                        ServerContext& context,
+                       InstanceLoader& loader,
                        size_t index,
                        DicomDirWriter* dicomDir,
                        const std::string& dicomDirFolder,
                        bool transcode,
                        DicomTransferSyntax transferSyntax,
-                       bool reading,
-                       std::string& content) const
+                       bool storeCompressed) const
     {
       if (index >= commands_.size())
       {
         throw OrthancException(ErrorCode_ParameterOutOfRange);
       }
 
-      commands_[index]->Apply(writer, context, dicomDir, dicomDirFolder, transcode, transferSyntax, reading, content);
+      commands_[index]->Apply(writer, context, loader, dicomDir, dicomDirFolder,
+                              transcode, transferSyntax, storeCompressed);
     }
-      
+
   public:
     ZipCommands() :
       uncompressedSize_(0),
       instancesCount_(0)
     {
     }
-      
+
     ~ZipCommands()
     {
       for (std::deque<Command*>::iterator it = commands_.begin();
@@ -546,11 +946,6 @@ namespace Orthanc
       }
     }
 
-    bool CommandIsWriteInstance(size_t index)
-    {
-      return commands_[index]->IsWriteInstance();
-    }
-
     size_t GetSize() const
     {
       return commands_.size();
@@ -566,32 +961,47 @@ namespace Orthanc
       return uncompressedSize_;
     }
 
+    // Register the instances to be read, in the order of the archive
+    void PrepareLoader(ThreadedInstanceLoader& loader) const
+    {
+      for (std::deque<Command*>::const_iterator it = commands_.begin();
+           it != commands_.end(); ++it)
+      {
+        assert(*it != NULL);
+        if ((*it)->IsWriteInstance())
+        {
+          loader.AddInstance((*it)->GetInstanceId(), (*it)->GetUncompressedSize());
+        }
+      }
+    }
+
     // "media" flavor (with DICOMDIR)
     void Apply(HierarchicalZipWriter& writer,
                ServerContext& context,
+               InstanceLoader& loader,
                size_t index,
                DicomDirWriter& dicomDir,
                const std::string& dicomDirFolder,
                bool transcode,
                DicomTransferSyntax transferSyntax,
-               bool reading,
-               std::string& content) const
+               bool storeCompressed) const
     {
-      ApplyInternal(writer, context, index, &dicomDir, dicomDirFolder, transcode, transferSyntax, reading, content);
+      ApplyInternal(writer, context, loader, index, &dicomDir, dicomDirFolder,
+                    transcode, transferSyntax, storeCompressed);
     }
 
     // "archive" flavor (without DICOMDIR)
     void Apply(HierarchicalZipWriter& writer,
                ServerContext& context,
+               InstanceLoader& loader,
                size_t index,
                bool transcode,
                DicomTransferSyntax transferSyntax,
-               bool reading,
-               std::string& content) const
+               bool storeCompressed) const
     {
-      ApplyInternal(writer, context, index, NULL, "", transcode, transferSyntax, reading, content);
+      ApplyInternal(writer, context, loader, index, NULL, "", transcode, transferSyntax, storeCompressed);
     }
-      
+
     void AddOpenDirectory(const std::string& filename)
     {
       commands_.push_back(new Command(Type_OpenDirectory, filename));
@@ -606,7 +1016,7 @@ namespace Orthanc
                           const std::string& instanceId,
                           uint64_t uncompressedSize)
     {
-      commands_.push_back(new Command(Type_WriteInstance, filename, instanceId));
+      commands_.push_back(new Command(Type_WriteInstance, filename, instanceId, uncompressedSize));
       instancesCount_ ++;
       uncompressedSize_ += uncompressedSize;
     }
@@ -616,8 +1026,8 @@ namespace Orthanc
       return IsZip64Required(GetUncompressedSize(), GetInstancesCount());
     }
   };
-    
-    
+
+
 
   class ArchiveJob::ArchiveIndexVisitor : public IArchiveVisitor
   {
@@ -808,9 +1218,9 @@ namespace Orthanc
       }
     }
 
-    bool CurrentCommandIsWriteInstance(size_t index)
+    void PrepareLoader(ThreadedInstanceLoader& loader) const
     {
-      return commands_.CommandIsWriteInstance(index);
+      commands_.PrepareLoader(loader);
     }
 
     void SetOutputFile(const std::string& path)
@@ -842,6 +1252,18 @@ namespace Orthanc
       }
     }
 
+    void SetCompressionThreads(unsigned int threads)
+    {
+      if (zip_.get() == NULL)
+      {
+        throw OrthancException(ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        zip_->SetCompressionThreads(threads);
+      }
+    }
+
     void CancelStream()
     {
       if (zip_.get() == NULL)
@@ -884,10 +1306,10 @@ namespace Orthanc
     }
 
     void RunStep(size_t index,
+                 InstanceLoader& loader,
                  bool transcode,
                  DicomTransferSyntax transferSyntax,
-                 bool reading,
-                 std::string& content)
+                 bool storeCompressed)
     {
       if (index > commands_.GetSize())
       {
@@ -897,35 +1319,35 @@ namespace Orthanc
       {
         throw OrthancException(ErrorCode_BadSequenceOfCalls);
       }
-      else if (index != commands_.GetSize())
+      else if (index == commands_.GetSize())
       {
+        // Last step: Add the DICOMDIR
         if (isMedia_)
         {
           assert(dicomDir_.get() != NULL);
-          commands_.Apply(*zip_, context_, index, *dicomDir_,
-                          MEDIA_IMAGES_FOLDER, transcode, transferSyntax, reading, content);
+          std::string s;
+          dicomDir_->Encode(s);
+
+          zip_->OpenFile("DICOMDIR");
+          zip_->Write(s);
+        }
+      }
+      else
+      {
+        if (isMedia_)
+        {
+          assert(dicomDir_.get() != NULL);
+          commands_.Apply(*zip_, context_, loader, index, *dicomDir_,
+                          MEDIA_IMAGES_FOLDER, transcode, transferSyntax, storeCompressed);
         }
         else
         {
           assert(dicomDir_.get() == NULL);
-          commands_.Apply(*zip_, context_, index, transcode, transferSyntax, reading, content);
+          commands_.Apply(*zip_, context_, loader, index, transcode, transferSyntax, storeCompressed);
         }
       }
     }
 
-    void LastStep()
-    {
-      if (isMedia_)
-      {
-        assert(dicomDir_.get() != NULL);
-        std::string s;
-        dicomDir_->Encode(s);
-
-        zip_->OpenFile("DICOMDIR");
-        zip_->Write(s);
-      }
-    }
-
     unsigned int GetInstancesCount() const
     {
       return commands_.GetInstancesCount();
@@ -937,18 +1359,6 @@ namespace Orthanc
     }
   };
   
-  struct Threads
-  {
-    std::thread        thread;
-    bool               boolRead;
-    std::string        content;
-    std::atomic<bool>  threadFinished;
-    int                threadCurrentStep;
-  };
-  
-  Threads threads_[NB_THREAD];
-  int threadsActive_;
-
   ArchiveJob::ArchiveJob(ServerContext& context,
                          bool isMedia,
                          bool enableExtendedSopClass) :
@@ -961,18 +1371,23 @@ namespace Orthanc
     uncompressedSize_(0),
     archiveSize_(0),
     transcode_(false),
-    transferSyntax_(DicomTransferSyntax_LittleEndianImplicit)
+    transferSyntax_(DicomTransferSyntax_LittleEndianImplicit),
+    loaderThreads_(0),
+    loaderReadAhead_(16),
+    loaderMaxMemory_(256 * MEGA_BYTES),
+    compressionThreads_(0),
+    storeCompressed_(false)
   {
-    threadsActive_ = 0;
-    for (int i = 0; i < NB_THREAD; i++)
-    {
-      threads_[i].threadFinished = true;
-    }
   }
 
   
   ArchiveJob::~ArchiveJob()
   {
+    if (instanceLoader_.get() != NULL)
+    {
+      instanceLoader_->Clear();
+    }
+
     if (!mediaArchiveId_.empty())
     {
       context_.GetMediaArchive().Remove(mediaArchiveId_);
@@ -1042,6 +1457,64 @@ namespace Orthanc
   }
 
   
+  void ArchiveJob::SetLoaderThreads(unsigned int threads)
+  {
+    if (writer_.get() != NULL)   // Already started
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      loaderThreads_ = threads;
+    }
+  }
+
+
+  void ArchiveJob::SetLoaderReadAhead(unsigned int instancesCount,
+                                      uint64_t maxMemory)
+  {
+    if (writer_.get() != NULL)   // Already started
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (instancesCount == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      loaderReadAhead_ = instancesCount;
+      loaderMaxMemory_ = maxMemory;
+    }
+  }
+
+  
+  void ArchiveJob::SetCompressionThreads(unsigned int threads)
+  {
+    if (writer_.get() != NULL)   // Already started
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      compressionThreads_ = threads;
+    }
+  }
+
+
+  void ArchiveJob::SetStoreCompressedTransferSyntaxes(bool store)
+  {
+    if (writer_.get() != NULL)   // Already started
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      storeCompressed_ = store;
+    }
+  }
+
+  
   void ArchiveJob::Reset()
   {
     throw OrthancException(ErrorCode_BadSequenceOfCalls,
@@ -1084,8 +1557,24 @@ namespace Orthanc
         writer_->AcquireOutputStream(synchronousTarget_.release());
       }
 
+      writer_->SetCompressionThreads(compressionThreads_);
+
       instancesCount_ = writer_->GetInstancesCount();
       uncompressedSize_ = writer_->GetUncompressedSize();
+
+      if (loaderThreads_ == 0)
+      {
+        // Backward compatibility with Orthanc <= 1.9.5
+        instanceLoader_.reset(new SynchronousInstanceLoader(context_));
+      }
+      else
+      {
+        std::unique_ptr<ThreadedInstanceLoader> loader(
+          new ThreadedInstanceLoader(context_, loaderReadAhead_, loaderMaxMemory_));
+        writer_->PrepareLoader(*loader);
+        loader->Start(loaderThreads_);
+        instanceLoader_.reset(loader.release());
+      }
     }
   }
 
@@ -1118,6 +1607,11 @@ namespace Orthanc
 
   void ArchiveJob::FinalizeTarget()
   {
+    if (instanceLoader_.get() != NULL)
+    {
+      instanceLoader_->Clear();
+    }
+
     if (writer_.get() != NULL)
     {
       writer_->Close();  // Flush all the results
@@ -1133,17 +1627,11 @@ namespace Orthanc
     }
   }
 
-  //method run by thread, read only DICOM
-  void ArchiveJob::RunStepReadInstance(const int numThread)
-  {
-    writer_->RunStep(threads_[numThread].threadCurrentStep, transcode_, transferSyntax_, threads_[numThread].boolRead, threads_[numThread].content);
-    threads_[numThread].threadFinished = true;
-  }
-  
 
   JobStepResult ArchiveJob::Step(const std::string& jobId)
   {
     assert(writer_.get() != NULL);
+    assert(instanceLoader_.get() != NULL);
 
     if (writer_->GetStepsCount() == 0)
     {
@@ -1151,62 +1639,10 @@ namespace Orthanc
       return JobStepResult::Success();
     }
     else
-    {      
+    {
       try
       {
-        if (currentStep_ != writer_->GetStepsCount() - 1)
-        {
-          //If it is a Command to open / close a directory, we wait for the end of the active thread and we launch the step
-          if (!writer_->CurrentCommandIsWriteInstance(currentStep_))
-          {
-            for (int i = 0; i < threadsActive_; i++)
-            {
-              bool err = EndThreadIndexOf(i);
-              if(!err)
-              {
-                std::cout << "Error reading / writing the dicom via the thread\n";
-              }
-            }
-            writer_->RunStep(currentStep_, transcode_, transferSyntax_, threads_[threadsActive_].boolRead, threads_[threadsActive_].content);
-            threadsActive_ = 0;
-          }
-          else
-          {
-            //if the thread queue is not full we complete it
-            if (threadsActive_ < NB_THREAD)
-            {
-              threads_[threadsActive_].threadFinished = false;
-              threads_[threadsActive_].boolRead = true;
-              threads_[threadsActive_].threadCurrentStep = currentStep_;
-              threads_[threadsActive_].thread = std::thread(&ArchiveJob::RunStepReadInstance, this, threadsActive_);
-              threadsActive_++;
-            }
-            else
-            {
-              //if not, we loop until we find a terminated thread, we write the instance and start a new one
-              int threadFound = false;
-              int i = 0;
-              while (!threadFound)
-              {
-                if (threads_[i].threadFinished)
-                {
-                  bool err = EndThreadIndexOf(i);
-                  if(!err)
-                  {
-                    std::cout << "Error reading / writing the dicom via the thread\n";
-                  }
-                  // launch dicom reading thread
-                  threads_[i].threadFinished = false;
-                  threads_[i].threadCurrentStep = currentStep_;
-                  threads_[i].thread = std::thread(&ArchiveJob::RunStepReadInstance, this, i);
-                  threadFound = true;
-                }
-                i++;
-                i = i%3;
-              }
-            }
-          }
-        }
+        writer_->RunStep(currentStep_, *instanceLoader_, transcode_, transferSyntax_, storeCompressed_);
       }
       catch (Orthanc::OrthancException& e)
       {
@@ -1214,22 +1650,6 @@ namespace Orthanc
         writer_->CancelStream();
         throw;
       }
-      
-      //If this is the last step, we wait for all the threads to end
-      if (currentStep_ == writer_->GetStepsCount() - 1)
-      {
-        for (int i = 0; i < threadsActive_; i++)
-        {
-          bool err = EndThreadIndexOf(i);
-          if(!err)
-          {
-            std::cout << "Error reading / writing the dicom via the thread\n";
-          }
-        }   
-        //Run last step ADD DICOMDIR
-        writer_->LastStep();
-        threadsActive_ = 0;
-      }
 
       currentStep_ ++;
 
@@ -1246,18 +1666,6 @@ namespace Orthanc
     }
   }
 
-  bool ArchiveJob::EndThreadIndexOf(const int threadNumber)
-  {
-    //end of dicom reading
-    threads_[threadNumber].thread.join();
-    //writing dicom
-    threads_[threadNumber].boolRead = false;
-    writer_->RunStep(threads_[threadNumber].threadCurrentStep, transcode_, transferSyntax_, threads_[threadNumber].boolRead, threads_[threadNumber].content);
-    threads_[threadNumber].boolRead = true;
-    threads_[threadNumber].content = "";
-    return true;
-  }
-
 
   void ArchiveJob::Stop(JobStopReason reason)
   {
@@ -1270,6 +1678,13 @@ namespace Orthanc
         reason == JobStopReason_Failure ||
         reason == JobStopReason_Retry)
     {
+      // Stop the threads that read the instances ahead of the writer
+      if (instanceLoader_.get() != NULL)
+      {
+        instanceLoader_->Clear();
+        instanceLoader_.reset();
+      }
+
       writer_->CancelStream();
       
       // First delete the writer, as it holds a reference to "(a)synchronousTarget_", cf. (*)
@@ -1356,4 +1771,44 @@ namespace Orthanc
       return false;
     }
   }
+
+
+  bool ArchiveJob::GetOutputRange(std::string& output,
+                                  MimeType& mime,
+                                  uint64_t& totalSize,
+                                  const std::string& key,
+                                  uint64_t start,
+                                  uint64_t end)
+  {
+    if (key == "archive" &&
+        !mediaArchiveId_.empty())
+    {
+      SharedArchive::Accessor accessor(context_.GetMediaArchive(), mediaArchiveId_);
+
+      if (accessor.IsValid())
+      {
+        const DynamicTemporaryFile& f = dynamic_cast<DynamicTemporaryFile&>(accessor.GetItem());
+        totalSize = f.GetFile().GetFileSize();
+
+        if (start > end ||
+            end > totalSize)
+        {
+          throw OrthancException(ErrorCode_BadRange);
+        }
+
+        // Only the requested range is read from the temporary file
+        f.GetFile().ReadRange(output, start, end, true /* throw if overflow */);
+        mime = MimeType_Zip;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+    else
+    {
+      return false;
+    }
+  }
 }
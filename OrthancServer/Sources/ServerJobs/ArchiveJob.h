@@ -51,8 +51,11 @@ namespace Orthanc
     class ArchiveIndex;
     class ArchiveIndexVisitor;
     class IArchiveVisitor;
+    class InstanceLoader;
     class MediaIndexVisitor;
     class ResourceIdentifiers;
+    class SynchronousInstanceLoader;
+    class ThreadedInstanceLoader;
     class ZipCommands;
     class ZipWriterIterator;
     
@@ -75,6 +78,14 @@ namespace Orthanc
     bool                 transcode_;
     DicomTransferSyntax  transferSyntax_;
 
+    // New in Orthanc 1.9.6
+    unsigned int                       loaderThreads_;
+    unsigned int                       loaderReadAhead_;
+    uint64_t                           loaderMaxMemory_;
+    boost::shared_ptr<InstanceLoader>  instanceLoader_;
+    unsigned int                       compressionThreads_;
+    bool                               storeCompressed_;
+
     void FinalizeTarget();
     
   public:
@@ -97,14 +108,42 @@ namespace Orthanc
 
     void SetTranscode(DicomTransferSyntax transferSyntax);
 
+    // Number of threads reading the instances ahead of the ZIP writer
+    // (if "0", the instances are read by the thread running the job)
+    void SetLoaderThreads(unsigned int threads);
+
+    unsigned int GetLoaderThreads() const
+    {
+      return loaderThreads_;
+    }
+
+    // Maximum number of instances, and of bytes, that are buffered by
+    // the loader threads
+    void SetLoaderReadAhead(unsigned int instancesCount,
+                            uint64_t maxMemory);
+
+    // Number of threads deflating the files of the ZIP archive (if
+    // "0", the files are deflated by the thread running the job)
+    void SetCompressionThreads(unsigned int threads);
+
+    unsigned int GetCompressionThreads() const
+    {
+      return compressionThreads_;
+    }
+
+    // Store the instances whose transfer syntax is compressed without
+    // deflating them once again
+    void SetStoreCompressedTransferSyntaxes(bool store);
+
+    bool IsStoreCompressedTransferSyntaxes() const
+    {
+      return storeCompressed_;
+    }
+
     virtual void Reset() ORTHANC_OVERRIDE;
 
     virtual void Start() ORTHANC_OVERRIDE;
     
-    virtual void RunStepReadInstance(const int numThread);
-    
-    virtual bool EndThreadIndexOf(const int threadNumber);
-
     virtual JobStepResult Step(const std::string& jobId) ORTHANC_OVERRIDE;
 
     virtual void Stop(JobStopReason reason) ORTHANC_OVERRIDE;
@@ -123,5 +162,12 @@ namespace Orthanc
     virtual bool GetOutput(std::string& output,
                            MimeType& mime,
                            const std::string& key) ORTHANC_OVERRIDE;
+
+    virtual bool GetOutputRange(std::string& output,
+                                MimeType& mime,
+                                uint64_t& totalSize,
+                                const std::string& key,
+                                uint64_t start,
+                                uint64_t end) ORTHANC_OVERRIDE;
   };
 }
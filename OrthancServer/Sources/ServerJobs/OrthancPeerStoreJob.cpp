@@ -35,37 +35,20 @@
 #include "OrthancPeerStoreJob.h"
 
 #include "../../../OrthancFramework/Sources/Compression/GzipCompressor.h"
+#include "../../../OrthancFramework/Sources/Compression/ZipWriter.h"
 #include "../../../OrthancFramework/Sources/Logging.h"
 #include "../../../OrthancFramework/Sources/SerializationToolbox.h"
 #include "../ServerContext.h"
 
+#include <boost/thread.hpp>
 #include <dcmtk/dcmdata/dcfilefo.h>
 
 
 namespace Orthanc
 {
-  bool OrthancPeerStoreJob::HandleInstance(const std::string& instance)
+  bool OrthancPeerStoreJob::ReadInstance(std::string& target,
+                                         const std::string& instance)
   {
-    //boost::this_thread::sleep(boost::posix_time::milliseconds(500));
-
-    if (client_.get() == NULL)
-    {
-      client_.reset(new HttpClient(peer_, "instances"));
-      client_->SetMethod(HttpMethod_Post);
-
-      if (compress_)
-      {
-        client_->AddHeader("Expect", "");
-        client_->AddHeader("Content-Encoding", "gzip");
-      }
-    }
-      
-    LOG(INFO) << "Sending instance " << instance << " to peer \"" 
-              << peer_.GetUrl() << "\"";
-
-    // Lifetime of "body" must exceed the call to "client_->Apply()" because of "SetExternalBody()"
-    std::string body;
-
     try
     {
       if (transcode_)
@@ -81,45 +64,415 @@ namespace Orthanc
 
         if (context_.Transcode(transcoded, source, syntaxes, true))
         {
-          body.assign(reinterpret_cast<const char*>(transcoded.GetBufferData()),
-                      transcoded.GetBufferSize());
+          target.assign(reinterpret_cast<const char*>(transcoded.GetBufferData()),
+                        transcoded.GetBufferSize());
         }
         else
         {
-          body.swap(dicom);
+          target.swap(dicom);
         }
       }
       else
       {
-        context_.ReadDicom(body, instance);
+        context_.ReadDicom(target, instance);
       }
+
+      return true;
     }
     catch (OrthancException& e)
     {
       LOG(WARNING) << "An instance was removed after the job was issued: " << instance;
       return false;
     }
+  }
+
+
+  HttpClient* OrthancPeerStoreJob::CreateInstanceClient() const
+  {
+    std::unique_ptr<HttpClient> client(new HttpClient(peer_, "instances"));
+    client->SetMethod(HttpMethod_Post);
+
+    if (compress_)
+    {
+      client->AddHeader("Expect", "");
+      client->AddHeader("Content-Encoding", "gzip");
+    }
+
+    return client.release();
+  }
 
-    // Lifetime of "compressedBody" must exceed the call to "client_->Apply()" because of "SetExternalBody()"
+
+  bool OrthancPeerStoreJob::SendInstance(uint64_t& size,
+                                         HttpClient& client,
+                                         const std::string& dicom) const
+  {
+    // Lifetime of "compressedBody" must exceed the call to "client.Apply()" because of "SetExternalBody()"
     std::string compressedBody;
 
     if (compress_)
     {
       GzipCompressor compressor;
-      compressor.SetCompressionLevel(9);  // Max compression level
-      IBufferCompressor::Compress(compressedBody, compressor, body);
+      compressor.SetCompressionLevel(compressionLevel_);
+      IBufferCompressor::Compress(compressedBody, compressor, dicom);
 
-      client_->SetExternalBody(compressedBody);
-      size_ += compressedBody.size();
+      client.SetExternalBody(compressedBody);
+      size = compressedBody.size();
     }
     else
     {
-      client_->SetExternalBody(body);
-      size_ += body.size();
+      client.SetExternalBody(dicom);
+      size = dicom.size();
     }
 
     std::string answer;
-    if (client_->Apply(answer))
+    return client.Apply(answer);
+  }
+
+
+  class OrthancPeerStoreJob::Batch : public boost::noncopyable
+  {
+  private:
+    OrthancPeerStoreJob&         that_;
+    size_t                       firstPosition_;
+    std::vector<std::string>     instances_;
+    std::vector<bool>            success_;
+    std::unique_ptr<HttpClient>  client_;
+    std::unique_ptr<HttpClient>  instanceClient_;  // To send the instances one by one
+    uint64_t                     size_;
+    bool                         hasError_;
+    ErrorCode                    errorCode_;
+    std::string                  errorDetails_;
+    boost::thread                thread_;
+
+    void SendArchive()
+    {
+      // Pack the instances into a ZIP archive, in the order of the job
+      std::string archive;
+      std::vector<size_t> packed;  // Index of the instances in the archive
+
+      {
+        ZipWriter writer;
+        writer.SetMemoryOutput(archive, false /* no ZIP64 */);
+        writer.Open();
+
+        for (size_t i = 0; i < instances_.size(); i++)
+        {
+          std::string dicom;
+          if (that_.ReadInstance(dicom, instances_[i]))
+          {
+            writer.OpenFile((instances_[i] + ".dcm").c_str(),
+                            that_.compress_ ? that_.compressionLevel_ : static_cast<uint8_t>(0));
+            writer.Write(dicom);
+            packed.push_back(i);
+          }
+        }
+
+        writer.Close();
+      }
+
+      if (packed.empty())
+      {
+        return;  // All the instances were removed
+      }
+
+      LOG(INFO) << "Sending " << packed.size() << " instances to peer \""
+                << that_.peer_.GetUrl() << "\" as a ZIP archive of " << archive.size() << " bytes";
+
+      size_ = archive.size();
+
+      Json::Value answer;
+      client_->SetExternalBody(archive);
+
+      if (!client_->Apply(answer))
+      {
+        LOG(WARNING) << "Cannot send a ZIP archive to the peer (make sure that the version of "
+                     << "the remote Orthanc server is >= 1.8.2), sending the instances one by one";
+      }
+      else if (answer.type() != Json::arrayValue ||
+               answer.size() != packed.size())
+      {
+        // The peer answers with one item per DICOM file, in the order
+        // of the archive, but it skips the files it cannot parse: The
+        // answers cannot be matched with the instances
+        LOG(WARNING) << "The peer has not answered one item per instance of the ZIP archive, "
+                     << "sending the instances one by one";
+      }
+      else
+      {
+        for (Json::Value::ArrayIndex i = 0; i < answer.size(); i++)
+        {
+          static const char* const STATUS = "Status";
+
+          success_[packed[i]] = (answer[i].type() == Json::objectValue &&
+                                 answer[i].isMember(STATUS) &&
+                                 answer[i][STATUS].type() == Json::stringValue &&
+                                 answer[i][STATUS].asString() != "Failure");
+        }
+
+        return;
+      }
+
+      SendOneByOne(packed);
+    }
+
+    void SendOneByOne(const std::vector<size_t>& packed)
+    {
+      if (instanceClient_.get() == NULL)
+      {
+        instanceClient_.reset(that_.CreateInstanceClient());
+      }
+
+      for (size_t i = 0; i < packed.size(); i++)
+      {
+        std::string dicom;
+        if (that_.ReadInstance(dicom, instances_[packed[i]]))
+        {
+          uint64_t size;
+          success_[packed[i]] = that_.SendInstance(size, *instanceClient_, dicom);
+          size_ += size;
+        }
+      }
+    }
+
+    static void Worker(Batch* that)
+    {
+      try
+      {
+        that->SendArchive();
+      }
+      catch (OrthancException& e)
+      {
+        that->hasError_ = true;
+        that->errorCode_ = e.GetErrorCode();
+        that->errorDetails_ = e.HasDetails() ? e.GetDetails() : "";
+      }
+      catch (...)
+      {
+        that->hasError_ = true;
+        that->errorCode_ = ErrorCode_InternalError;
+        that->errorDetails_ = "Native exception while sending a ZIP archive to the peer";
+      }
+    }
+
+  public:
+    Batch(OrthancPeerStoreJob& that,
+          size_t firstPosition,
+          HttpClient* client /* takes ownership */) :
+      that_(that),
+      firstPosition_(firstPosition),
+      client_(client),
+      size_(0),
+      hasError_(false),
+      errorCode_(ErrorCode_Success)
+    {
+      if (client == NULL)
+      {
+        throw OrthancException(ErrorCode_NullPointer);
+      }
+    }
+
+    ~Batch()
+    {
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+    }
+
+    void AddInstance(const std::string& instance)
+    {
+      instances_.push_back(instance);
+      success_.push_back(false);
+    }
+
+    void Start()
+    {
+      thread_ = boost::thread(Worker, this);
+    }
+
+    bool Contains(size_t position) const
+    {
+      return (position >= firstPosition_ &&
+              position < firstPosition_ + instances_.size());
+    }
+
+    size_t GetLastPosition() const
+    {
+      assert(!instances_.empty());
+      return firstPosition_ + instances_.size() - 1;
+    }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+
+    // Returns whether the instance at the given position was stored by the peer
+    bool Wait(size_t position)
+    {
+      assert(Contains(position));
+
+      if (thread_.joinable())
+      {
+        thread_.join();
+      }
+
+      if (hasError_)
+      {
+        throw OrthancException(errorCode_, errorDetails_);
+      }
+      else
+      {
+        return success_[position - firstPosition_];
+      }
+    }
+
+    HttpClient* ReleaseClient()
+    {
+      assert(!thread_.joinable());
+      return client_.release();
+    }
+  };
+
+
+  void OrthancPeerStoreJob::SubmitBatch()
+  {
+    assert(nextPosition_ < GetInstancesCount());
+
+    std::unique_ptr<HttpClient> client;
+
+    if (idleClients_.empty())
+    {
+      client.reset(new HttpClient(peer_, "instances"));
+      client->SetMethod(HttpMethod_Post);
+      client->AddHeader("Expect", "");
+      client->AddHeader("Content-Type", EnumerationToString(MimeType_Zip));
+    }
+    else
+    {
+      client.reset(idleClients_.back());
+      idleClients_.pop_back();
+    }
+
+    std::unique_ptr<Batch> batch(new Batch(*this, nextPosition_, client.release()));
+
+    for (unsigned int i = 0; i < batchSize_ && nextPosition_ < GetInstancesCount(); i++)
+    {
+      batch->AddInstance(GetInstance(nextPosition_));
+      nextPosition_++;
+    }
+
+    batch->Start();
+    batches_.push_back(batch.release());
+  }
+
+
+  void OrthancPeerStoreJob::ClearBatches()
+  {
+    for (std::deque<Batch*>::iterator it = batches_.begin(); it != batches_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;  // Waits for the HTTP request to complete
+    }
+
+    for (size_t i = 0; i < idleClients_.size(); i++)
+    {
+      assert(idleClients_[i] != NULL);
+      delete idleClients_[i];
+    }
+
+    batches_.clear();
+    idleClients_.clear();
+    nextPosition_ = 0;
+  }
+
+
+  bool OrthancPeerStoreJob::HandleBatchedInstance(const std::string& instance)
+  {
+    const size_t position = GetPosition();
+    assert(GetInstance(position) == instance);
+
+    if (batches_.empty() ?
+        nextPosition_ != position :
+        !batches_.front()->Contains(position))
+    {
+      // The job was restarted or resumed at another position
+      ClearBatches();
+      nextPosition_ = position;
+    }
+
+    // Keep "concurrentRequests_" HTTP requests in flight
+    while (batches_.size() < concurrentRequests_ &&
+           nextPosition_ < GetInstancesCount())
+    {
+      SubmitBatch();
+    }
+
+    assert(!batches_.empty() &&
+           batches_.front()->Contains(position));
+
+    const bool isLast = (position == batches_.front()->GetLastPosition());
+    bool success;
+
+    try
+    {
+      success = batches_.front()->Wait(position);
+    }
+    catch (OrthancException&)
+    {
+      if (isLast)
+      {
+        delete batches_.front();
+        batches_.pop_front();
+      }
+
+      throw;
+    }
+
+    if (isLast)
+    {
+      // All the instances of this batch have been handled, recycle its connection
+      std::unique_ptr<Batch> batch(batches_.front());
+      batches_.pop_front();
+
+      size_ += batch->GetSize();
+      idleClients_.push_back(batch->ReleaseClient());
+    }
+
+    return success;
+  }
+
+
+  bool OrthancPeerStoreJob::HandleInstance(const std::string& instance)
+  {
+    //boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+
+    if (IsBatched())
+    {
+      return HandleBatchedInstance(instance);
+    }
+
+    if (client_.get() == NULL)
+    {
+      client_.reset(CreateInstanceClient());
+    }
+      
+    LOG(INFO) << "Sending instance " << instance << " to peer \"" 
+              << peer_.GetUrl() << "\"";
+
+    // Lifetime of "body" must exceed the call to "SendInstance()" because of "SetExternalBody()"
+    std::string body;
+
+    if (!ReadInstance(body, instance))
+    {
+      return false;
+    }
+
+    uint64_t size;
+    const bool success = SendInstance(size, *client_, body);
+    size_ += size;
+
+    if (success)
     {
       return true;
     }
@@ -224,9 +577,62 @@ namespace Orthanc
   }
 
 
+  void OrthancPeerStoreJob::SetBatchSize(unsigned int size)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (size == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      batchSize_ = size;
+    }
+  }
+
+
+  void OrthancPeerStoreJob::SetConcurrentRequests(unsigned int count)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (count == 0)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      concurrentRequests_ = count;
+    }
+  }
+
+
+  void OrthancPeerStoreJob::SetCompressionLevel(unsigned int level)
+  {
+    if (IsStarted())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+    else if (level > 9)
+    {
+      throw OrthancException(ErrorCode_ParameterOutOfRange,
+                             "The compression level must be between 0 and 9");
+    }
+    else
+    {
+      compressionLevel_ = static_cast<uint8_t>(level);
+    }
+  }
+
+
   void OrthancPeerStoreJob::Stop(JobStopReason reason)   // For pausing jobs
   {
     client_.reset(NULL);
+    ClearBatches();
   }
 
 
@@ -240,6 +646,9 @@ namespace Orthanc
                     false /* don't include passwords */);
     value["Peer"] = v;
     value["Compress"] = compress_;
+    value["CompressionLevel"] = static_cast<unsigned int>(compressionLevel_);
+    value["BatchSize"] = batchSize_;
+    value["ConcurrentRequests"] = concurrentRequests_;
     
     if (transcode_)
     {
@@ -256,11 +665,18 @@ namespace Orthanc
   static const char* TRANSCODE = "Transcode";
   static const char* COMPRESS = "Compress";
   static const char* SIZE = "Size";
+  static const char* BATCH_SIZE = "BatchSize";
+  static const char* CONCURRENT_REQUESTS = "ConcurrentRequests";
+  static const char* COMPRESSION_LEVEL = "CompressionLevel";
 
   OrthancPeerStoreJob::OrthancPeerStoreJob(ServerContext& context,
                                            const Json::Value& serialized) :
     SetOfInstancesJob(serialized),
-    context_(context)
+    context_(context),
+    batchSize_(1),
+    concurrentRequests_(1),
+    compressionLevel_(9),
+    nextPosition_(0)
   {
     assert(serialized.type() == Json::objectValue);
     peer_ = WebServiceParameters(serialized[PEER]);
@@ -292,6 +708,27 @@ namespace Orthanc
     {
       size_ = 0;
     }
+
+    if (serialized.isMember(BATCH_SIZE))
+    {
+      SetBatchSize(SerializationToolbox::ReadUnsignedInteger(serialized, BATCH_SIZE));
+    }
+
+    if (serialized.isMember(CONCURRENT_REQUESTS))
+    {
+      SetConcurrentRequests(SerializationToolbox::ReadUnsignedInteger(serialized, CONCURRENT_REQUESTS));
+    }
+
+    if (serialized.isMember(COMPRESSION_LEVEL))
+    {
+      SetCompressionLevel(SerializationToolbox::ReadUnsignedInteger(serialized, COMPRESSION_LEVEL));
+    }
+  }
+
+
+  OrthancPeerStoreJob::~OrthancPeerStoreJob()
+  {
+    ClearBatches();
   }
 
 
@@ -315,6 +752,9 @@ namespace Orthanc
 
       target[COMPRESS] = compress_;
       target[SIZE] = boost::lexical_cast<std::string>(size_);
+      target[BATCH_SIZE] = batchSize_;
+      target[CONCURRENT_REQUESTS] = concurrentRequests_;
+      target[COMPRESSION_LEVEL] = static_cast<unsigned int>(compressionLevel_);
       
       return true;
     }
@@ -37,7 +37,9 @@
 #include "../../../OrthancFramework/Sources/JobsEngine/SetOfInstancesJob.h"
 #include "../../../OrthancFramework/Sources/HttpClient.h"
 
+#include <deque>
 #include <stdint.h>
+#include <vector>
 
 
 namespace Orthanc
@@ -47,6 +49,8 @@ namespace Orthanc
   class OrthancPeerStoreJob : public SetOfInstancesJob
   {
   private:
+    class Batch;
+
     ServerContext&               context_;
     WebServiceParameters         peer_;
     std::unique_ptr<HttpClient>  client_;
@@ -55,6 +59,36 @@ namespace Orthanc
     bool                         compress_;
     uint64_t                     size_;
 
+    // New in Orthanc 1.9.6: Batched transfers as ZIP archives
+    unsigned int                 batchSize_;
+    unsigned int                 concurrentRequests_;
+    uint8_t                      compressionLevel_;
+    std::deque<Batch*>           batches_;        // Batches in flight, in the order of the instances
+    size_t                       nextPosition_;   // First instance that is not part of a batch yet
+    std::vector<HttpClient*>     idleClients_;    // Clients whose connection can be reused
+
+    bool IsBatched() const
+    {
+      return (batchSize_ > 1 ||
+              concurrentRequests_ > 1);
+    }
+
+    bool ReadInstance(std::string& target,
+                      const std::string& instance);
+
+    HttpClient* CreateInstanceClient() const;
+
+    // Returns "false" if the peer has rejected the instance
+    bool SendInstance(uint64_t& size /* out: number of bytes sent */,
+                      HttpClient& client,
+                      const std::string& dicom) const;
+
+    void SubmitBatch();
+
+    void ClearBatches();
+
+    bool HandleBatchedInstance(const std::string& instance);
+
   protected:
     virtual bool HandleInstance(const std::string& instance) ORTHANC_OVERRIDE;
     
@@ -66,13 +100,19 @@ namespace Orthanc
       transcode_(false),
       transferSyntax_(DicomTransferSyntax_LittleEndianExplicit),  // Dummy value
       compress_(false),
-      size_(0)
+      size_(0),
+      batchSize_(1),
+      concurrentRequests_(1),
+      compressionLevel_(9),
+      nextPosition_(0)
     {
     }
 
     OrthancPeerStoreJob(ServerContext& context,
                         const Json::Value& serialize);
 
+    virtual ~OrthancPeerStoreJob();
+
     void SetPeer(const WebServiceParameters& peer);
 
     const WebServiceParameters& GetPeer() const
@@ -100,6 +140,33 @@ namespace Orthanc
 
     void SetCompress(bool compress);
 
+    // Number of instances that are sent within one single HTTP
+    // request, packed as a ZIP archive. The peer must run Orthanc >=
+    // 1.8.2 if this value is greater than 1, otherwise the instances
+    // of each batch are sent one by one.
+    void SetBatchSize(unsigned int size);
+
+    unsigned int GetBatchSize() const
+    {
+      return batchSize_;
+    }
+
+    // Number of batches that are prepared and sent in parallel
+    void SetConcurrentRequests(unsigned int count);
+
+    unsigned int GetConcurrentRequests() const
+    {
+      return concurrentRequests_;
+    }
+
+    // Compression level of gzip, or of the ZIP archives if batched
+    void SetCompressionLevel(unsigned int level);
+
+    uint8_t GetCompressionLevel() const
+    {
+      return compressionLevel_;
+    }
+
     virtual void Stop(JobStopReason reason) ORTHANC_OVERRIDE;   // For pausing jobs
 
     virtual void GetJobType(std::string& target) ORTHANC_OVERRIDE
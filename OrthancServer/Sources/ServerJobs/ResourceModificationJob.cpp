@@ -214,7 +214,11 @@ namespace Orthanc
      * Compute the resulting DICOM instance.
      **/
 
-    modification_->Apply(*modified);
+    {
+      // The UID mapping of "DicomModification" is shared by all the instances
+      boost::mutex::scoped_lock lock(mutex_);
+      modification_->Apply(*modified);
+    }
 
     const std::string modifiedUid = IDicomTranscoder::GetSopInstanceUid(modified->GetDcmtkObject());
     
@@ -304,7 +308,10 @@ namespace Orthanc
      **/
     // assert(modifiedInstance == modifiedHasher.HashInstance());
 
-    output_->Update(modifiedHasher);
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      output_->Update(modifiedHasher);
+    }
 
     return true;
   }
@@ -61,6 +61,7 @@ namespace Orthanc
     class SingleOutput;
     class MultipleOutputs;
     
+    boost::mutex                        mutex_;   // Protects "modification_" and "output_" in parallel mode
     std::unique_ptr<DicomModification>  modification_;
     boost::shared_ptr<IOutput>          output_;
     bool                                isAnonymization_;
@@ -70,6 +71,11 @@ namespace Orthanc
 
   protected:
     virtual bool HandleInstance(const std::string& instance) ORTHANC_OVERRIDE;
+
+    virtual bool IsHandleInstanceThreadSafe() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
     
   public:
     explicit ResourceModificationJob(ServerContext& context);
@@ -0,0 +1,361 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PrecompiledHeadersServer.h"
+#include "StorageDeletionQueue.h"
+
+#include "../../OrthancFramework/Sources/FileStorage/StorageAccessor.h"
+#include "../../OrthancFramework/Sources/Logging.h"
+#include "../../OrthancFramework/Sources/MetricsRegistry.h"
+#include "../../OrthancFramework/Sources/OrthancException.h"
+#include "Database/StatelessDatabaseOperations.h"
+
+#include <algorithm>
+
+
+namespace Orthanc
+{
+  // Maximum number of files that are removed by one worker before
+  // their entries are removed from the database by one transaction
+  static const size_t BATCH_SIZE = 64;
+
+
+  void StorageDeletionQueue::PopBatch(std::vector<PendingFile>& target)
+  {
+    // WARNING: "mutex_" must be locked
+    target.clear();
+    target.reserve(std::min(pending_.size(), BATCH_SIZE));
+
+    while (!pending_.empty() &&
+           target.size() < BATCH_SIZE)
+    {
+      target.push_back(pending_.front());
+      pending_.pop_front();
+    }
+  }
+
+
+  void StorageDeletionQueue::Worker(StorageDeletionQueue* that)
+  {
+    for (;;)
+    {
+      std::vector<PendingFile> files;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (that->pending_.empty() &&
+               !that->done_)
+        {
+          that->pendingCondition_.wait(lock);
+        }
+
+        if (that->done_)
+        {
+          return;  // The remaining files are still saved in the database
+        }
+
+        that->PopBatch(files);
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+          that->active_[files[i].uuid_] = files[i].type_;
+        }
+
+        that->PublishMetrics();
+      }
+
+      that->RemoveSaved(files);
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+          that->active_.erase(files[i].uuid_);
+        }
+
+        that->PublishMetrics();
+      }
+
+      that->doneCondition_.notify_all();
+    }
+  }
+
+
+  void StorageDeletionQueue::RemoveNow(const std::string& uuid,
+                                       FileContentType type)
+  {
+    try
+    {
+      StorageAccessor accessor(area_, metrics_);
+      accessor.Remove(uuid, type);
+    }
+    catch (OrthancException& e)
+    {
+      LOG(ERROR) << "Unable to remove an attachment from the storage area: "
+                 << uuid << " (type: " << EnumerationToString(type) << "): " << e.What();
+    }
+  }
+
+
+  void StorageDeletionQueue::RemoveSaved(const std::vector<PendingFile>& files)
+  {
+    std::list<std::string> uuids;
+
+    for (size_t i = 0; i < files.size(); i++)
+    {
+      RemoveNow(files[i].uuid_, files[i].type_);
+      uuids.push_back(files[i].uuid_);
+    }
+
+    try
+    {
+      index_.RemoveStorageDeletions(uuids);
+    }
+    catch (OrthancException& e)
+    {
+      // Removing a file twice is harmless: The removal will be
+      // replayed at the next start of Orthanc
+      LOG(ERROR) << "Cannot remove " << uuids.size() << " attachment(s) from the queue "
+                 << "of the deletions in the database: " << e.What();
+    }
+  }
+
+
+  void StorageDeletionQueue::PublishMetrics()
+  {
+    // WARNING: "mutex_" must be locked
+    metrics_.SetValue("orthanc_storage_deletion_queue_size",
+                      static_cast<float>(pending_.size() + active_.size()));
+  }
+
+
+  void StorageDeletionQueue::Load()
+  {
+    std::map<std::string, FileContentType> saved;
+    index_.GetStorageDeletions(saved);
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      for (std::map<std::string, FileContentType>::const_iterator
+             it = saved.begin(); it != saved.end(); ++it)
+      {
+        PendingFile file;
+        file.uuid_ = it->first;
+        file.type_ = it->second;
+        pending_.push_back(file);
+      }
+
+      PublishMetrics();
+    }
+
+    if (!saved.empty())
+    {
+      LOG(WARNING) << "Resuming the deletion of " << saved.size()
+                   << " attachment(s) from the last execution of Orthanc";
+    }
+  }
+
+
+  StorageDeletionQueue::StorageDeletionQueue(IStorageArea& area,
+                                             StatelessDatabaseOperations& index,
+                                             MetricsRegistry& metrics) :
+    area_(area),
+    index_(index),
+    metrics_(metrics),
+    done_(true)
+  {
+  }
+
+
+  StorageDeletionQueue::~StorageDeletionQueue()
+  {
+    if (!workers_.empty())
+    {
+      LOG(ERROR) << "INTERNAL ERROR: StorageDeletionQueue::Stop() should be invoked manually";
+      Stop();
+    }
+  }
+
+
+  void StorageDeletionQueue::Start(unsigned int threads)
+  {
+    if (!workers_.empty())
+    {
+      throw OrthancException(ErrorCode_BadSequenceOfCalls);
+    }
+
+    Load();
+
+    if (threads == 0)
+    {
+      // Synchronous mode: Flush the deletions from the last execution
+      for (;;)
+      {
+        std::vector<PendingFile> files;
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (pending_.empty())
+          {
+            break;
+          }
+
+          PopBatch(files);
+          PublishMetrics();
+        }
+
+        RemoveSaved(files);
+      }
+    }
+    else
+    {
+      LOG(WARNING) << "Attachments are removed from the storage area by " << threads << " thread(s)";
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        done_ = false;
+      }
+
+      workers_.resize(threads);
+
+      for (size_t i = 0; i < workers_.size(); i++)
+      {
+        workers_[i] = new boost::thread(Worker, this);
+      }
+    }
+  }
+
+
+  void StorageDeletionQueue::Stop()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (done_)
+      {
+        return;
+      }
+
+      done_ = true;
+    }
+
+    pendingCondition_.notify_all();
+    doneCondition_.notify_all();
+
+    for (size_t i = 0; i < workers_.size(); i++)
+    {
+      if (workers_[i] != NULL)
+      {
+        if (workers_[i]->joinable())
+        {
+          workers_[i]->join();
+        }
+
+        delete workers_[i];
+      }
+    }
+
+    workers_.clear();
+
+    size_t count;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      count = pending_.size();
+      pending_.clear();
+      PublishMetrics();
+    }
+
+    if (count > 0)
+    {
+      LOG(WARNING) << "The deletion of " << count << " attachment(s) will be resumed at the next start of Orthanc";
+    }
+  }
+
+
+  bool StorageDeletionQueue::IsAsynchronous()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return !done_;
+  }
+
+
+  void StorageDeletionQueue::Enqueue(const std::string& uuid,
+                                     FileContentType type)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (!done_)
+      {
+        PendingFile file;
+        file.uuid_ = uuid;
+        file.type_ = type;
+        pending_.push_back(file);
+        PublishMetrics();
+      }
+      else
+      {
+        lock.unlock();
+
+        // No worker is running, synchronous removal
+        RemoveNow(uuid, type);
+        return;
+      }
+    }
+
+    pendingCondition_.notify_one();
+  }
+
+
+  size_t StorageDeletionQueue::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return pending_.size() + active_.size();
+  }
+
+
+  void StorageDeletionQueue::WaitEmpty()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    while (!done_ &&
+           (!pending_.empty() || !active_.empty()))
+    {
+      doneCondition_.wait(lock);
+    }
+  }
+}
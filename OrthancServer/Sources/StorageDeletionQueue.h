@@ -0,0 +1,127 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2021 Osimis S.A., Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * In addition, as a special exception, the copyright holders of this
+ * program give permission to link the code of its release with the
+ * OpenSSL project's "OpenSSL" library (or with modified versions of it
+ * that use the same license as the "OpenSSL" library), and distribute
+ * the linked executables. You must obey the GNU General Public License
+ * in all respects for all of the code used other than "OpenSSL". If you
+ * modify file(s) with this exception, you may extend this exception to
+ * your version of the file(s), but you are not obligated to do so. If
+ * you do not wish to do so, delete this exception statement from your
+ * version. If you delete this exception statement from all source files
+ * in the program, then also delete it here.
+ * 
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "../../OrthancFramework/Sources/FileStorage/IStorageArea.h"
+
+#include <boost/thread.hpp>
+#include <deque>
+#include <map>
+#include <vector>
+
+namespace Orthanc
+{
+  class MetricsRegistry;
+  class StatelessDatabaseOperations;
+
+  /**
+   * Queue of the attachments that must be removed from the storage
+   * area, once the database transaction that has deleted them has
+   * been committed (new in Orthanc 1.9.6). The files are removed by a
+   * pool of worker threads, which avoids blocking the REST calls or
+   * the ingest that triggered the deletion (e.g. because of
+   * recycling). The attachments are saved in the database by the
+   * transaction that deletes them (cf. "EnqueueStorageDeletion()"),
+   * and are removed from the database once their file is gone, so
+   * that the pending deletions survive a crash or a restart of
+   * Orthanc. If no worker is started, the files are synchronously
+   * removed, as in Orthanc <= 1.9.5.
+   **/
+  class StorageDeletionQueue : public boost::noncopyable
+  {
+  private:
+    typedef std::map<std::string, FileContentType>  ActiveFiles;
+
+    struct PendingFile
+    {
+      std::string      uuid_;
+      FileContentType  type_;
+    };
+
+    IStorageArea&                 area_;
+    StatelessDatabaseOperations&  index_;
+    MetricsRegistry&              metrics_;
+
+    boost::mutex                  mutex_;
+    boost::condition_variable     pendingCondition_;
+    boost::condition_variable     doneCondition_;
+    std::deque<PendingFile>       pending_;
+    ActiveFiles                   active_;  // Files being removed by the workers
+    bool                          done_;
+    std::vector<boost::thread*>   workers_;
+
+    static void Worker(StorageDeletionQueue* that);
+
+    void RemoveNow(const std::string& uuid,
+                   FileContentType type);
+
+    // Removes the files, then their entries in the database within
+    // one single transaction
+    void RemoveSaved(const std::vector<PendingFile>& files);
+
+    // Pops at most "BATCH_SIZE" files from "pending_" ("mutex_" must be locked)
+    void PopBatch(std::vector<PendingFile>& target);
+
+    void PublishMetrics();  // "mutex_" must be locked
+
+    void Load();
+
+  public:
+    StorageDeletionQueue(IStorageArea& area,
+                         StatelessDatabaseOperations& index,
+                         MetricsRegistry& metrics);
+
+    ~StorageDeletionQueue();
+
+    // Reloads the pending deletions from the database, then starts
+    // the workers (if "threads == 0", the deletions are synchronous)
+    void Start(unsigned int threads);
+
+    // The pending deletions are resumed at the next start
+    void Stop();
+
+    // Whether the workers are running, in which case the enqueued
+    // files must have been saved in the database
+    bool IsAsynchronous();
+
+    void Enqueue(const std::string& uuid,
+                 FileContentType type);
+
+    size_t GetSize();
+
+    // Wait until all the pending deletions are done (for unit tests)
+    void WaitEmpty();
+  };
+}
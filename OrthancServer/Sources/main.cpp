@@ -44,6 +44,9 @@
 #include "../../OrthancFramework/Sources/HttpServer/HttpServer.h"
 #include "../../OrthancFramework/Sources/Logging.h"
 #include "../../OrthancFramework/Sources/Lua/LuaFunctionCall.h"
+#include "../../OrthancFramework/Sources/MappedFileMemoryBuffer.h"
+#include "../../OrthancFramework/Sources/StringMemoryBuffer.h"
+#include "../../OrthancFramework/Sources/TemporaryFile.h"
 #include "../Plugins/Engine/OrthancPlugins.h"
 #include "Database/SQLiteDatabaseWrapper.h"
 #include "EmbeddedResourceHttpHandler.h"
@@ -76,10 +79,13 @@ class OrthancStoreRequestHandler : public IStoreRequestHandler
 {
 private:
   ServerContext& context_;
+  bool           streaming_;
 
 public:
-  explicit OrthancStoreRequestHandler(ServerContext& context) :
-    context_(context)
+  OrthancStoreRequestHandler(ServerContext& context,
+                             bool streaming) :
+    context_(context),
+    streaming_(streaming)
   {
   }
 
@@ -100,6 +106,54 @@ public:
       context_.Store(id, *toStore, StoreInstanceMode_Default);
     }
   }
+
+
+  virtual TemporaryFile* CreateStreamingFile() ORTHANC_OVERRIDE
+  {
+    if (streaming_)
+    {
+      OrthancConfiguration::ReaderLock lock;
+      return lock.GetConfiguration().CreateTemporaryFile();
+    }
+    else
+    {
+      return NULL;
+    }
+  }
+
+
+  virtual void HandleFile(TemporaryFile& dicom,
+                          const std::string& remoteIp,
+                          const std::string& remoteAet,
+                          const std::string& calledAet) ORTHANC_OVERRIDE
+  {
+    // The received file is mapped in memory if possible, which
+    // avoids to copy it into the heap
+    std::unique_ptr<IMemoryBuffer> buffer;
+
+    if (MappedFileMemoryBuffer::IsSupported())
+    {
+      buffer.reset(new MappedFileMemoryBuffer(dicom.GetPath()));
+    }
+    else
+    {
+      std::string content;
+      dicom.Read(content);
+      buffer.reset(StringMemoryBuffer::CreateFromSwap(content));
+    }
+
+    if (buffer->GetSize() > 0)
+    {
+      std::unique_ptr<DicomInstanceToStore> toStore(
+        DicomInstanceToStore::CreateFromBuffer(buffer->GetData(), buffer->GetSize()));
+
+      toStore->SetOrigin(DicomInstanceOrigin::FromDicomProtocol
+                         (remoteIp.c_str(), remoteAet.c_str(), calledAet.c_str()));
+
+      std::string id;
+      context_.Store(id, *toStore, StoreInstanceMode_Default);
+    }
+  }
 };
 
 
@@ -214,7 +268,14 @@ public:
 
   virtual IStoreRequestHandler* ConstructStoreRequestHandler() ORTHANC_OVERRIDE
   {
-    return new OrthancStoreRequestHandler(context_);
+    bool streaming;
+
+    {
+      OrthancConfiguration::ReaderLock lock;
+      streaming = lock.GetConfiguration().GetBooleanParameter("DicomStreamingStore", false);
+    }
+
+    return new OrthancStoreRequestHandler(context_, streaming);
   }
 
   virtual IFindRequestHandler* ConstructFindRequestHandler() ORTHANC_OVERRIDE
@@ -1214,8 +1275,15 @@ static bool StartDicomServer(ServerContext& context,
       // New option in Orthanc 1.9.3
       dicomServer.SetRemoteCertificateRequired(
         lock.GetConfiguration().GetBooleanParameter(KEY_DICOM_TLS_REMOTE_CERTIFICATE_REQUIRED, true));
+
+      // New options in Orthanc 1.9.6
+      dicomServer.SetThreadsCount(lock.GetConfiguration().GetUnsignedIntegerParameter("DicomThreadsCount", 16));
+      dicomServer.SetMaximumPendingAssociations(
+        lock.GetConfiguration().GetUnsignedIntegerParameter("DicomMaximumPendingAssociations", 0));
     }
 
+    dicomServer.SetMetricsRegistry(context.GetMetricsRegistry());
+
 #if ORTHANC_ENABLE_PLUGINS == 1
     if (plugins != NULL)
     {
@@ -1484,6 +1552,72 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     OrthancConfiguration::ReaderLock lock;
 
     context.SetCompressionEnabled(lock.GetConfiguration().GetBooleanParameter("StorageCompression", false));
+
+    // New options in Orthanc 1.9.6
+    context.SetCompressionChunkSize(
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StorageCompressionChunkSize", 0) * 1024);
+    context.SetCompressionThreads(
+      std::max(1u, lock.GetConfiguration().GetUnsignedIntegerParameter("StorageCompressionThreads", 1)));
+
+    // The codec must be known before the levels, whose maximum depends on it
+    {
+      const std::string codec = lock.GetConfiguration().GetStringParameter("StorageCompressionCodec", "zlib");
+      if (codec == "zstd")
+      {
+        context.SetZstdCompression(true);
+      }
+      else if (codec != "zlib")
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange, "Bad value for configuration option "
+                               "\"StorageCompressionCodec\" (must be \"zlib\" or \"zstd\")");
+      }
+    }
+
+    const unsigned int maximumLevel = context.GetMaximumCompressionLevel();
+
+    {
+      // Validate the level before its conversion to "uint8_t", which
+      // would otherwise silently wrap values such as "257"
+      const unsigned int level = lock.GetConfiguration().GetUnsignedIntegerParameter("StorageCompressionLevel", 6);
+      if (level > maximumLevel)
+      {
+        throw OrthancException(ErrorCode_ParameterOutOfRange, "Bad value for configuration option "
+                               "\"StorageCompressionLevel\" (must be an integer between 0 and " +
+                               boost::lexical_cast<std::string>(maximumLevel) + " for this codec)");
+      }
+
+      context.SetCompressionLevel(static_cast<uint8_t>(level));
+    }
+
+    static const char* const STORAGE_COMPRESSION_LEVELS = "StorageCompressionLevels";
+
+    if (lock.GetJson().type() == Json::objectValue &&
+        lock.GetJson().isMember(STORAGE_COMPRESSION_LEVELS))
+    {
+      const Json::Value& levels = lock.GetJson()[STORAGE_COMPRESSION_LEVELS];
+
+      if (levels.type() != Json::objectValue)
+      {
+        throw OrthancException(ErrorCode_BadParameterType, "The configuration option \"" +
+                               std::string(STORAGE_COMPRESSION_LEVELS) + "\" must be an object");
+      }
+
+      Json::Value::Members members = levels.getMemberNames();
+      for (size_t i = 0; i < members.size(); i++)
+      {
+        const Json::Value& level = levels[members[i]];
+        if (!level.isUInt() ||
+            level.asUInt() > maximumLevel)
+        {
+          throw OrthancException(ErrorCode_ParameterOutOfRange, "Bad compression level for attachments \"" +
+                                 members[i] + "\" (must be an integer between 0 and " +
+                                 boost::lexical_cast<std::string>(maximumLevel) + " for this codec)");
+        }
+
+        context.SetCompressionLevel(StringToContentType(members[i]), static_cast<uint8_t>(level.asUInt()));
+      }
+    }
+
     context.SetStoreMD5ForAttachments(lock.GetConfiguration().GetBooleanParameter("StoreMD5ForAttachments", true));
 
     // New option in Orthanc 1.4.2
@@ -1507,6 +1641,11 @@ static bool ConfigureServerContext(IDatabaseWrapper& database,
     {
       context.GetIndex().SetMaximumStorageSize(0);
     }
+
+    // New options in Orthanc 1.9.6
+    context.GetIndex().SetStoreGroupCommit(
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StoreGroupCommitWindow", 0),
+      lock.GetConfiguration().GetUnsignedIntegerParameter("StoreGroupCommitMaxBatch", 64));
   }
 
   {
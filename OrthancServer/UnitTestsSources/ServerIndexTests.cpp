@@ -35,19 +35,27 @@
 #include <gtest/gtest.h>
 
 #include "../../OrthancFramework/Sources/Compatibility.h"
+#include "../../OrthancFramework/Sources/DicomParsing/FromDcmtkBridge.h"
 #include "../../OrthancFramework/Sources/FileStorage/FilesystemStorage.h"
 #include "../../OrthancFramework/Sources/FileStorage/MemoryStorageArea.h"
 #include "../../OrthancFramework/Sources/Images/Image.h"
 #include "../../OrthancFramework/Sources/Logging.h"
 
+#include "../Sources/ChangesDispatcher.h"
 #include "../Sources/Database/SQLiteDatabaseWrapper.h"
+#include "../Sources/JobsRegistryRecords.h"
 #include "../Sources/OrthancConfiguration.h"
 #include "../Sources/Search/DatabaseLookup.h"
 #include "../Sources/ServerContext.h"
 #include "../Sources/ServerToolbox.h"
+#include "../Sources/StorageDeletionQueue.h"
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <ctype.h>
+#include <string.h>
 #include <algorithm>
+#include <stack>
 
 using namespace Orthanc;
 
@@ -476,6 +484,222 @@ TEST_F(DatabaseWrapperTest, Upward)
 }
 
 
+static void CheckResourceStatistics(SQLiteDatabaseWrapper::UnitTestsTransaction& transaction,
+                                    int64_t id,
+                                    uint64_t expectedStudies,
+                                    uint64_t expectedSeries,
+                                    uint64_t expectedInstances,
+                                    uint64_t expectedDiskSize,
+                                    uint64_t expectedUncompressedSize,
+                                    uint64_t expectedDicomDiskSize)
+{
+  uint64_t studies, series, instances, diskSize, uncompressedSize, dicomDiskSize, dicomUncompressedSize;
+  ASSERT_TRUE(transaction.LookupResourceStatistics(studies, series, instances, diskSize, uncompressedSize,
+                                                   dicomDiskSize, dicomUncompressedSize, id));
+  ASSERT_EQ(expectedStudies, studies);
+  ASSERT_EQ(expectedSeries, series);
+  ASSERT_EQ(expectedInstances, instances);
+  ASSERT_EQ(expectedDiskSize, diskSize);
+  ASSERT_EQ(expectedUncompressedSize, uncompressedSize);
+  ASSERT_EQ(expectedDicomDiskSize, dicomDiskSize);
+  ASSERT_EQ(expectedDicomDiskSize, dicomUncompressedSize);  // No compression of DICOM files in this test
+}
+
+
+TEST_F(DatabaseWrapperTest, ResourceStatistics)
+{
+  int64_t a[] = {
+    transaction_->CreateResource("a", ResourceType_Patient),   // 0
+    transaction_->CreateResource("b", ResourceType_Study),     // 1
+    transaction_->CreateResource("c", ResourceType_Series),    // 2
+    transaction_->CreateResource("d", ResourceType_Instance),  // 3
+    transaction_->CreateResource("e", ResourceType_Instance),  // 4
+    transaction_->CreateResource("f", ResourceType_Study),     // 5
+    transaction_->CreateResource("g", ResourceType_Series),    // 6
+    transaction_->CreateResource("h", ResourceType_Instance)   // 7
+  };
+
+  // The order of the attachments must not matter
+  transaction_->AttachChild(a[2], a[3]);
+  transaction_->AttachChild(a[1], a[2]);
+  transaction_->AttachChild(a[0], a[1]);
+  transaction_->AttachChild(a[2], a[4]);
+  transaction_->AttachChild(a[6], a[7]);
+  transaction_->AttachChild(a[0], a[5]);
+  transaction_->AttachChild(a[5], a[6]);
+
+  transaction_->AddAttachment(a[3], FileInfo("d1", FileContentType_Dicom, 10, "md5"), 0);
+  transaction_->AddAttachment(a[4], FileInfo("e1", FileContentType_Dicom, 20, "md5"), 0);
+  transaction_->AddAttachment(a[4], FileInfo("e2", FileContentType_DicomAsJson, 100, "md5",
+                                             CompressionType_ZlibWithSize, 30, "compressedMD5"), 0);
+  transaction_->AddAttachment(a[7], FileInfo("h1", FileContentType_Dicom, 40, "md5"), 0);
+  transaction_->AddAttachment(a[1], FileInfo("b1", FileContentType_DicomUntilPixelData, 5, "md5"), 0);
+
+  CheckResourceStatistics(*transaction_, a[0], 2, 2, 3, 105, 175, 70);
+  CheckResourceStatistics(*transaction_, a[1], 0, 1, 2, 65, 135, 30);
+  CheckResourceStatistics(*transaction_, a[2], 0, 0, 2, 60, 130, 30);
+  CheckResourceStatistics(*transaction_, a[4], 0, 0, 0, 50, 120, 20);
+  CheckResourceStatistics(*transaction_, a[5], 0, 1, 1, 40, 40, 40);
+
+  transaction_->DeleteAttachment(a[4], FileContentType_DicomAsJson);
+  CheckResourceStatistics(*transaction_, a[0], 2, 2, 3, 75, 75, 70);
+  CheckResourceStatistics(*transaction_, a[2], 0, 0, 2, 30, 30, 30);
+
+  // Deleting the last instance of "f" also deletes "g" and "f"
+  transaction_->DeleteResource(a[7]);
+  CheckResourceStatistics(*transaction_, a[0], 1, 1, 2, 35, 35, 30);
+
+  transaction_->DeleteResource(a[3]);
+  CheckResourceStatistics(*transaction_, a[0], 1, 1, 1, 25, 25, 20);
+  CheckResourceStatistics(*transaction_, a[1], 0, 1, 1, 25, 25, 20);
+
+  CheckTableRecordCount(4, "Resources");
+  CheckTableRecordCount(4, "ResourceStatistics");
+}
+
+
+// Walks the tree of resources, as done by "GetResourceStatistics()"
+// if the database does not maintain the statistics, only counting
+// the descendants of "id", not "id" itself
+static void WalkResourceStatistics(SQLiteDatabaseWrapper::UnitTestsTransaction& transaction,
+                                   std::vector<uint64_t>& target,
+                                   int64_t id)
+{
+  target.clear();
+  target.resize(7, 0);
+
+  std::stack<int64_t> toExplore;
+  toExplore.push(id);
+
+  while (!toExplore.empty())
+  {
+    int64_t resource = toExplore.top();
+    toExplore.pop();
+
+    if (resource != id)
+    {
+      switch (transaction.GetResourceType(resource))
+      {
+        case ResourceType_Study:
+          target[0]++;
+          break;
+
+        case ResourceType_Series:
+          target[1]++;
+          break;
+
+        case ResourceType_Instance:
+          target[2]++;
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    std::set<FileContentType> f;
+    transaction.ListAvailableAttachments(f, resource);
+
+    for (std::set<FileContentType>::const_iterator it = f.begin(); it != f.end(); ++it)
+    {
+      FileInfo attachment;
+      int64_t revision;
+      ASSERT_TRUE(transaction.LookupAttachment(attachment, revision, resource, *it));
+
+      target[3] += attachment.GetCompressedSize();
+      target[4] += attachment.GetUncompressedSize();
+
+      if (attachment.GetContentType() == FileContentType_Dicom)
+      {
+        target[5] += attachment.GetCompressedSize();
+        target[6] += attachment.GetUncompressedSize();
+      }
+    }
+
+    std::list<int64_t> children;
+    transaction.GetChildrenInternalId(children, resource);
+    for (std::list<int64_t>::const_iterator it = children.begin(); it != children.end(); ++it)
+    {
+      toExplore.push(*it);
+    }
+  }
+}
+
+
+static void CheckResourceStatisticsAgainstWalk(SQLiteDatabaseWrapper::UnitTestsTransaction& transaction,
+                                               const int64_t* ids,
+                                               size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    std::vector<uint64_t> expected;
+    WalkResourceStatistics(transaction, expected, ids[i]);
+
+    std::vector<uint64_t> actual(7);
+    ASSERT_TRUE(transaction.LookupResourceStatistics(actual[0], actual[1], actual[2], actual[3], actual[4],
+                                                     actual[5], actual[6], ids[i]));
+    ASSERT_EQ(expected, actual);
+  }
+}
+
+
+TEST_F(DatabaseWrapperTest, ResourceStatisticsMigration)
+{
+  transaction_->RemoveResourceStatistics();
+
+  // Fill the database without the triggers of the statistics
+  int64_t a[] = {
+    transaction_->CreateResource("a", ResourceType_Patient),   // 0
+    transaction_->CreateResource("b", ResourceType_Study),     // 1
+    transaction_->CreateResource("c", ResourceType_Series),    // 2
+    transaction_->CreateResource("d", ResourceType_Instance),  // 3
+    transaction_->CreateResource("e", ResourceType_Instance),  // 4
+    transaction_->CreateResource("f", ResourceType_Study),     // 5
+    transaction_->CreateResource("g", ResourceType_Series),    // 6
+    transaction_->CreateResource("h", ResourceType_Instance),  // 7
+    transaction_->CreateResource("i", ResourceType_Patient),   // 8 (without children)
+    transaction_->CreateResource("j", ResourceType_Series),    // 9 (without parent)
+    transaction_->CreateResource("k", ResourceType_Instance)   // 10
+  };
+
+  transaction_->AttachChild(a[0], a[1]);
+  transaction_->AttachChild(a[1], a[2]);
+  transaction_->AttachChild(a[2], a[3]);
+  transaction_->AttachChild(a[2], a[4]);
+  transaction_->AttachChild(a[0], a[5]);
+  transaction_->AttachChild(a[5], a[6]);
+  transaction_->AttachChild(a[6], a[7]);
+  transaction_->AttachChild(a[9], a[10]);
+
+  transaction_->AddAttachment(a[3], FileInfo("d1", FileContentType_Dicom, 10, "md5"), 0);
+  transaction_->AddAttachment(a[4], FileInfo("e1", FileContentType_Dicom, 200, "md5",
+                                             CompressionType_ZlibWithSize, 20, "compressedMD5"), 0);
+  transaction_->AddAttachment(a[4], FileInfo("e2", FileContentType_DicomAsJson, 100, "md5",
+                                             CompressionType_ZlibWithSize, 30, "compressedMD5"), 0);
+  transaction_->AddAttachment(a[7], FileInfo("h1", FileContentType_Dicom, 40, "md5"), 0);
+  transaction_->AddAttachment(a[1], FileInfo("b1", FileContentType_DicomUntilPixelData, 5, "md5"), 0);
+  transaction_->AddAttachment(a[0], FileInfo("a1", FileContentType_Dicom, 7, "md5"), 0);
+  transaction_->AddAttachment(a[10], FileInfo("k1", FileContentType_Dicom, 3, "md5"), 0);
+
+  std::string s;
+  ASSERT_FALSE(transaction_->LookupGlobalProperty(s, GlobalProperty_ResourceStatisticsAreFast, true));
+
+  transaction_->InstallResourceStatistics();
+
+  ASSERT_TRUE(transaction_->LookupGlobalProperty(s, GlobalProperty_ResourceStatisticsAreFast, true));
+  ASSERT_EQ("1", s);
+
+  const size_t count = sizeof(a) / sizeof(int64_t);
+  CheckTableRecordCount(static_cast<uint32_t>(count), "ResourceStatistics");
+  CheckResourceStatisticsAgainstWalk(*transaction_, a, count);
+
+  // The triggers are installed together with the migrated rows
+  transaction_->AddAttachment(a[3], FileInfo("d2", FileContentType_DicomAsJson, 50, "md5"), 0);
+  transaction_->DeleteResource(a[7]);
+  CheckResourceStatisticsAgainstWalk(*transaction_, a, 5);
+}
+
+
 TEST_F(DatabaseWrapperTest, PatientRecycling)
 {
   std::vector<int64_t> patients;
@@ -642,6 +866,58 @@ TEST(ServerIndex, Sequence)
 }
 
 
+TEST(SQLiteDatabaseWrapper, ReadersPool)
+{
+  const std::string path = "UnitTestsStorage";
+  FilesystemStorage storage(path);  // Creates the directory if need be
+
+  SystemToolbox::RemoveFile(path + "/readers-index");
+  SystemToolbox::RemoveFile(path + "/readers-index-wal");
+  SystemToolbox::RemoveFile(path + "/readers-index-shm");
+
+  TestDatabaseListener listener;
+  SQLiteDatabaseWrapper db(path + "/readers-index");
+  db.SetReadersCount(2);
+  db.Open();
+  ASSERT_THROW(db.SetReadersCount(4), OrthancException);
+
+  {
+    std::unique_ptr<SQLiteDatabaseWrapper::UnitTestsTransaction> writer(
+      dynamic_cast<SQLiteDatabaseWrapper::UnitTestsTransaction*>(
+        db.StartTransaction(TransactionType_ReadWrite, listener)));
+    writer->CreateResource("patient", ResourceType_Patient);
+
+    {
+      // The readers are not blocked by the active writer, and don't
+      // see its uncommitted changes
+      std::unique_ptr<IDatabaseWrapper::ITransaction> reader(
+        db.StartTransaction(TransactionType_ReadOnly, listener));
+      ASSERT_EQ(0u, reader->GetResourcesCount(ResourceType_Patient));
+      reader->Commit(0);
+    }
+
+    writer->Commit(0);
+  }
+
+  {
+    // Two read-only transactions can be simultaneously active
+    std::unique_ptr<IDatabaseWrapper::ITransaction> reader1(
+      db.StartTransaction(TransactionType_ReadOnly, listener));
+    std::unique_ptr<IDatabaseWrapper::ITransaction> reader2(
+      db.StartTransaction(TransactionType_ReadOnly, listener));
+    ASSERT_EQ(1u, reader1->GetResourcesCount(ResourceType_Patient));
+    ASSERT_EQ(1u, reader2->GetResourcesCount(ResourceType_Patient));
+    reader1->Commit(0);
+    reader2->Commit(0);
+  }
+
+  db.Close();
+
+  SQLiteDatabaseWrapper inMemory;
+  ASSERT_THROW(inMemory.SetReadersCount(2), OrthancException);
+}
+
+
 TEST_F(DatabaseWrapperTest, LookupIdentifier)
 {
   int64_t a[] = {
@@ -701,6 +977,184 @@ TEST_F(DatabaseWrapperTest, LookupIdentifier)
 }
 
 
+namespace
+{
+  class LookupBenchmark : public boost::noncopyable
+  {
+  private:
+    SQLiteDatabaseWrapper::UnitTestsTransaction&  transaction_;
+    std::vector<DatabaseConstraint>               lookup_;
+    ResourceType                                  level_;
+    size_t                                        limit_;
+
+    static void Check(const std::list<std::string>& resources,
+                      const std::list<std::string>& instances,
+                      ResourceType level)
+    {
+      ASSERT_EQ(resources.size(), instances.size());
+
+      std::list<std::string>::const_iterator instance = instances.begin();
+      for (std::list<std::string>::const_iterator resource = resources.begin();
+           resource != resources.end(); ++resource, ++instance)
+      {
+        // The public IDs are built hierarchically, cf. below
+        if (level == ResourceType_Instance)
+        {
+          ASSERT_EQ(*resource, *instance);
+        }
+        else
+        {
+          ASSERT_EQ(0u, instance->find(*resource + "-"));
+        }
+      }
+    }
+
+  public:
+    LookupBenchmark(SQLiteDatabaseWrapper::UnitTestsTransaction& transaction,
+                    ResourceType level,
+                    size_t limit) :
+      transaction_(transaction),
+      level_(level),
+      limit_(limit)
+    {
+    }
+
+    void AddConstraint(const DicomTag& tag,
+                       const std::string& value,
+                       ResourceType tagLevel,
+                       DicomTagType tagType)
+    {
+      const bool isWildcard = (value.find('*') != std::string::npos);
+      DicomTagConstraint c(tag, isWildcard ? ConstraintType_Wildcard : ConstraintType_Equal, value, true, true);
+      lookup_.push_back(c.ConvertToDatabaseConstraint(tagLevel, tagType));
+    }
+    
+    void Run(size_t expectedCount)
+    {
+      std::list<std::string> oldResources, oldInstances, newResources, newInstances;
+
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      transaction_.ApplyLookupResourcesWithTemporaryTable(oldResources, &oldInstances, lookup_, level_, limit_);
+      const boost::posix_time::ptime middle = boost::posix_time::microsec_clock::universal_time();
+      transaction_.ApplyLookupResources(newResources, &newInstances, lookup_, level_, limit_);
+      const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+      LOG(WARNING) << "Lookup at the " << EnumerationToString(level_) << " level with "
+                   << expectedCount << " results: temporary table in "
+                   << (middle - start).total_milliseconds() << "ms, streaming in "
+                   << (end - middle).total_milliseconds() << "ms";
+
+      ASSERT_EQ(expectedCount, oldResources.size());
+      Check(oldResources, oldInstances, level_);
+      Check(newResources, newInstances, level_);
+
+      // The order of the resources is not specified by the SQL queries
+      oldResources.sort();
+      newResources.sort();
+      ASSERT_EQ(oldResources, newResources);
+
+      // Without the sample instances, the duplicates are not removed
+      transaction_.ApplyLookupResourcesWithTemporaryTable(oldResources, NULL, lookup_, level_, limit_);
+      transaction_.ApplyLookupResources(newResources, NULL, lookup_, level_, limit_);
+      oldResources.sort();
+      newResources.sort();
+      ASSERT_EQ(oldResources, newResources);
+    }
+  };
+}
+
+
+TEST_F(DatabaseWrapperTest, LookupStreaming)
+{
+  /**
+   * Synthetic index. Setting these constants to "100, 10, 10, 100"
+   * benchmarks the lookups on an index with 1M instances (this takes
+   * minutes, and is thus not the default).
+   **/
+  static const unsigned int COUNT_PATIENTS = 10;
+  static const unsigned int COUNT_STUDIES = 4;
+  static const unsigned int COUNT_SERIES = 5;
+  static const unsigned int COUNT_INSTANCES = 10;
+
+  for (unsigned int patient = 0; patient < COUNT_PATIENTS; patient++)
+  {
+    const std::string patientId = "p" + boost::lexical_cast<std::string>(patient);
+    int64_t a = transaction_->CreateResource(patientId, ResourceType_Patient);
+    transaction_->SetIdentifierTag(a, DICOM_TAG_PATIENT_ID, ServerToolbox::NormalizeIdentifier(patientId));
+
+    for (unsigned int study = 0; study < COUNT_STUDIES; study++)
+    {
+      const std::string studyId = patientId + "-s" + boost::lexical_cast<std::string>(study);
+      int64_t b = transaction_->CreateResource(studyId, ResourceType_Study);
+      transaction_->AttachChild(a, b);
+      transaction_->SetIdentifierTag(b, DICOM_TAG_STUDY_INSTANCE_UID, ServerToolbox::NormalizeIdentifier(studyId));
+
+      for (unsigned int series = 0; series < COUNT_SERIES; series++)
+      {
+        const std::string seriesId = studyId + "-r" + boost::lexical_cast<std::string>(series);
+        int64_t c = transaction_->CreateResource(seriesId, ResourceType_Series);
+        transaction_->AttachChild(b, c);
+        transaction_->SetIdentifierTag(c, DICOM_TAG_SERIES_INSTANCE_UID, ServerToolbox::NormalizeIdentifier(seriesId));
+        transaction_->SetMainDicomTag(c, DICOM_TAG_MODALITY, (series % 2 == 0) ? "CT" : "MR");
+
+        for (unsigned int instance = 0; instance < COUNT_INSTANCES; instance++)
+        {
+          const std::string instanceId = seriesId + "-i" + boost::lexical_cast<std::string>(instance);
+          int64_t d = transaction_->CreateResource(instanceId, ResourceType_Instance);
+          transaction_->AttachChild(c, d);
+          transaction_->SetIdentifierTag(d, DICOM_TAG_SOP_INSTANCE_UID, ServerToolbox::NormalizeIdentifier(instanceId));
+        }
+      }
+    }
+  }
+
+  const size_t countCT = (COUNT_SERIES + 1) / 2;  // Number of CT series in each study
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Patient, 0);
+    benchmark.AddConstraint(DICOM_TAG_PATIENT_ID, "*", ResourceType_Patient, DicomTagType_Identifier);
+    benchmark.Run(COUNT_PATIENTS);
+  }
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Study, 0);
+    benchmark.AddConstraint(DICOM_TAG_PATIENT_ID, "p1", ResourceType_Patient, DicomTagType_Identifier);
+    benchmark.Run(COUNT_STUDIES);
+  }
+
+  {
+    // Constraint on a lower level: Checks that the duplicates are removed
+    LookupBenchmark benchmark(*transaction_, ResourceType_Study, 0);
+    benchmark.AddConstraint(DICOM_TAG_MODALITY, "CT", ResourceType_Series, DicomTagType_Main);
+    benchmark.Run(COUNT_PATIENTS * COUNT_STUDIES);
+  }
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Series, 0);
+    benchmark.AddConstraint(DICOM_TAG_MODALITY, "CT", ResourceType_Series, DicomTagType_Main);
+    benchmark.Run(COUNT_PATIENTS * COUNT_STUDIES * countCT);
+  }
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Series, 3);
+    benchmark.AddConstraint(DICOM_TAG_MODALITY, "CT", ResourceType_Series, DicomTagType_Main);
+    benchmark.Run(3);
+  }
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Instance, 0);
+    benchmark.AddConstraint(DICOM_TAG_SOP_INSTANCE_UID, "p2-*", ResourceType_Instance, DicomTagType_Identifier);
+    benchmark.Run(COUNT_STUDIES * COUNT_SERIES * COUNT_INSTANCES);
+  }
+
+  {
+    LookupBenchmark benchmark(*transaction_, ResourceType_Instance, 5);
+    benchmark.AddConstraint(DICOM_TAG_SOP_INSTANCE_UID, "*", ResourceType_Instance, DicomTagType_Identifier);
+    benchmark.Run(5);
+  }
+}
+
+
 TEST(ServerIndex, AttachmentRecycling)
 {
   const std::string path = "UnitTestsStorage";
@@ -802,6 +1256,111 @@ TEST(ServerIndex, AttachmentRecycling)
 }
 
 
+namespace
+{
+  class GroupCommitWorker : public boost::noncopyable
+  {
+  private:
+    ServerIndex&  index_;
+    DicomMap      summary_;
+    StoreStatus   status_;
+
+  public:
+    GroupCommitWorker(ServerIndex& index,
+                      const std::string& id) :
+      index_(index),
+      status_(StoreStatus_Failure)
+    {
+      summary_.SetValue(DICOM_TAG_PATIENT_ID, "patient", false);
+      summary_.SetValue(DICOM_TAG_STUDY_INSTANCE_UID, "study", false);
+      summary_.SetValue(DICOM_TAG_SERIES_INSTANCE_UID, "series", false);
+      summary_.SetValue(DICOM_TAG_SOP_INSTANCE_UID, "instance-" + id, false);
+    }
+
+    StoreStatus GetStatus() const
+    {
+      return status_;
+    }
+
+    void operator() ()
+    {
+      std::map<MetadataType, std::string> instanceMetadata;
+      ServerIndex::Attachments attachments;
+      ServerIndex::MetadataMap metadata;
+      status_ = index_.Store(instanceMetadata, summary_, attachments, metadata,
+                             DicomInstanceOrigin::FromPlugins(), false /* don't overwrite */,
+                             false, DicomTransferSyntax_LittleEndianExplicit, false, 0);
+    }
+  };
+}
+
+
+TEST(ServerIndex, GroupCommit)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+  ServerIndex& index = context.GetIndex();
+
+  index.SetStoreGroupCommit(50 /* ms */, 4);
+
+  // The last worker is a duplicate of the first one
+  std::vector<std::string> ids;
+  for (unsigned int i = 0; i < 10; i++)
+  {
+    ids.push_back(boost::lexical_cast<std::string>(i));
+  }
+  ids.push_back("0");
+
+  std::vector<GroupCommitWorker*> workers;
+  boost::thread_group threads;
+
+  for (size_t i = 0; i < ids.size(); i++)
+  {
+    workers.push_back(new GroupCommitWorker(index, ids[i]));
+  }
+
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    threads.create_thread(boost::ref(*workers[i]));
+  }
+
+  threads.join_all();
+
+  unsigned int success = 0;
+  unsigned int alreadyStored = 0;
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    if (workers[i]->GetStatus() == StoreStatus_Success)
+    {
+      success++;
+    }
+    else if (workers[i]->GetStatus() == StoreStatus_AlreadyStored)
+    {
+      alreadyStored++;
+    }
+
+    delete workers[i];
+  }
+
+  ASSERT_EQ(10u, success);
+  ASSERT_EQ(1u, alreadyStored);
+
+  uint64_t diskSize, uncompressedSize, countPatients, countStudies, countSeries, countInstances;
+  index.GetGlobalStatistics(diskSize, uncompressedSize, countPatients, 
+                            countStudies, countSeries, countInstances);
+  ASSERT_EQ(1u, countPatients);
+  ASSERT_EQ(1u, countStudies);
+  ASSERT_EQ(1u, countSeries);
+  ASSERT_EQ(10u, countInstances);
+
+  context.Stop();
+  db.Close();
+}
+
+
 TEST(ServerIndex, NormalizeIdentifier)
 {
   ASSERT_EQ("H^L.LO", ServerToolbox::NormalizeIdentifier("   Hé^l.LO  %_  "));
@@ -1046,3 +1605,682 @@ TEST(ServerIndex, DicomUntilPixelData)
     }
   }
 }
+
+
+namespace
+{
+  class CollectingVisitor : public ServerContext::ILookupVisitor
+  {
+  private:
+    std::vector<std::string>  instances_;
+    bool                      complete_;
+
+  public:
+    CollectingVisitor() :
+      complete_(false)
+    {
+    }
+
+    virtual bool IsDicomAsJsonNeeded() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual void MarkAsComplete() ORTHANC_OVERRIDE
+    {
+      complete_ = true;
+    }
+
+    virtual void Visit(const std::string& publicId,
+                       const std::string& instanceId,
+                       const DicomMap& mainDicomTags,
+                       const Json::Value* dicomAsJson) ORTHANC_OVERRIDE
+    {
+      ASSERT_TRUE(dicomAsJson != NULL);
+      ASSERT_EQ("042Y", (*dicomAsJson) ["0010,1010"] ["Value"].asString());
+      instances_.push_back(instanceId);
+    }
+
+    const std::vector<std::string>& GetInstances() const
+    {
+      return instances_;
+    }
+
+    bool IsComplete() const
+    {
+      return complete_;
+    }
+  };
+}
+
+
+TEST(ServerIndex, FindPrefetch)
+{
+  static const DicomTag PATIENT_AGE(0x0010, 0x1010);  // Not a main DICOM tag
+  
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    ParsedDicomFile dicom(true);
+    dicom.ReplacePlainString(PATIENT_AGE, (i % 2 == 0) ? "042Y" : "017Y");
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    std::string id;
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, *toStore, StoreInstanceMode_Default));
+  }
+
+  DatabaseLookup lookup;
+  lookup.AddRestConstraint(PATIENT_AGE, "042Y", true, true);
+  ASSERT_FALSE(lookup.HasOnlyMainDicomTags());
+
+  CollectingVisitor sequential;
+  context.SetFindPrefetchThreads(0);
+  context.Apply(sequential, lookup, ResourceType_Instance, 0, 0);
+  ASSERT_TRUE(sequential.IsComplete());
+  ASSERT_EQ(10u, sequential.GetInstances().size());
+
+  for (unsigned int threads = 1; threads <= 8; threads *= 2)
+  {
+    context.SetFindPrefetchThreads(threads);
+
+    CollectingVisitor all;
+    context.Apply(all, lookup, ResourceType_Instance, 0, 0);
+    ASSERT_TRUE(all.IsComplete());
+    ASSERT_EQ(sequential.GetInstances(), all.GetInstances());  // Same order
+
+    CollectingVisitor range;
+    context.Apply(range, lookup, ResourceType_Instance, 3, 4);
+    ASSERT_FALSE(range.IsComplete());
+    ASSERT_EQ(4u, range.GetInstances().size());
+
+    for (size_t i = 0; i < 4; i++)
+    {
+      ASSERT_EQ(sequential.GetInstances() [i + 3], range.GetInstances() [i]);
+    }
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, ExpandResources)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  std::list<std::string> instances;
+  
+  for (unsigned int i = 0; i < 5; i++)
+  {
+    ParsedDicomFile dicom(true);
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    std::string id;
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, *toStore, StoreInstanceMode_Default));
+    instances.push_back(id);
+  }
+
+  // Unknown resource, and resource at another level: Both skipped
+  instances.push_back("nope");
+
+  std::string series;
+  ASSERT_TRUE(context.GetIndex().LookupParent(series, instances.front()));
+  instances.push_back(series);
+
+  Json::Value expanded = Json::arrayValue;
+  context.GetIndex().ExpandResources(expanded, instances, ResourceType_Instance, DicomToJsonFormat_Human);
+  ASSERT_EQ(Json::arrayValue, expanded.type());
+  ASSERT_EQ(5u, expanded.size());
+
+  std::list<std::string>::const_iterator it = instances.begin();
+  for (Json::Value::ArrayIndex i = 0; i < expanded.size(); i++, ++it)
+  {
+    Json::Value single;
+    ASSERT_TRUE(context.GetIndex().ExpandResource(single, *it, ResourceType_Instance, DicomToJsonFormat_Human));
+    ASSERT_EQ(single.toStyledString(), expanded[i].toStyledString());
+  }
+
+  // Without checking the level, the series is also expanded
+  expanded = Json::arrayValue;
+  context.GetIndex().ExpandResources(expanded, instances, DicomToJsonFormat_Human);
+  ASSERT_EQ(6u, expanded.size());
+  ASSERT_EQ("Series", expanded[5]["Type"].asString());
+  ASSERT_EQ(series, expanded[5]["ID"].asString());
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, StorageDeletionQueue)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  ASSERT_TRUE(context.GetIndex().HasStorageDeletionQueue());
+
+  std::vector<std::string> files;
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    files.push_back(Toolbox::GenerateUuid());
+    storage.Create(files.back(), "hello", 5, FileContentType_Dicom);
+  }
+
+  {
+    // Deletions pending from a previous execution of Orthanc, as
+    // saved by the transactions that have deleted the attachments
+    TestDatabaseListener listener;
+    std::unique_ptr<IDatabaseWrapper::ITransaction> transaction(
+      db.StartTransaction(TransactionType_ReadWrite, listener));
+
+    for (size_t i = 0; i < 10; i++)
+    {
+      transaction->EnqueueStorageDeletion(files[i], FileContentType_Dicom);
+    }
+
+    transaction->Commit(0);
+  }
+
+  std::map<std::string, FileContentType> saved;
+  context.GetIndex().GetStorageDeletions(saved);
+  ASSERT_EQ(10u, saved.size());
+
+  {
+    StorageDeletionQueue queue(storage, context.GetIndex(), context.GetMetricsRegistry());
+    ASSERT_FALSE(queue.IsAsynchronous());
+    queue.Start(4);
+    ASSERT_TRUE(queue.IsAsynchronous());
+
+    for (size_t i = 10; i < files.size(); i++)
+    {
+      queue.Enqueue(files[i], FileContentType_Dicom);
+    }
+
+    queue.WaitEmpty();
+    ASSERT_EQ(0u, queue.GetSize());
+    queue.Stop();
+    ASSERT_FALSE(queue.IsAsynchronous());
+
+    // Once stopped, the removals are synchronous
+    std::string s = Toolbox::GenerateUuid();
+    storage.Create(s, "hello", 5, FileContentType_Dicom);
+    queue.Enqueue(s, FileContentType_Dicom);
+    ASSERT_THROW(std::unique_ptr<IMemoryBuffer>(storage.Read(s, FileContentType_Dicom)), OrthancException);
+  }
+
+  for (size_t i = 0; i < files.size(); i++)
+  {
+    ASSERT_THROW(std::unique_ptr<IMemoryBuffer>(storage.Read(files[i], FileContentType_Dicom)), OrthancException);
+  }
+
+  // The entries are removed from the database, once their file is gone
+  context.GetIndex().GetStorageDeletions(saved);
+  ASSERT_TRUE(saved.empty());
+
+  {
+    // The entries of a transaction that is rolled back are discarded
+    TestDatabaseListener listener;
+    std::unique_ptr<IDatabaseWrapper::ITransaction> transaction(
+      db.StartTransaction(TransactionType_ReadWrite, listener));
+    transaction->EnqueueStorageDeletion(files[0], FileContentType_Dicom);
+    transaction->Rollback();
+  }
+
+  context.GetIndex().GetStorageDeletions(saved);
+  ASSERT_TRUE(saved.empty());
+
+  {
+    // The entries are removed by batches
+    TestDatabaseListener listener;
+    std::unique_ptr<IDatabaseWrapper::ITransaction> transaction(
+      db.StartTransaction(TransactionType_ReadWrite, listener));
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      transaction->EnqueueStorageDeletion(files[i], FileContentType_Dicom);
+    }
+
+    transaction->Commit(0);
+  }
+
+  std::list<std::string> batch;
+  context.GetIndex().RemoveStorageDeletions(batch);  // No-op
+  batch.push_back(files[0]);
+  batch.push_back(files[2]);
+  batch.push_back(Toolbox::GenerateUuid());  // Unknown entries are ignored
+  context.GetIndex().RemoveStorageDeletions(batch);
+
+  context.GetIndex().GetStorageDeletions(saved);
+  ASSERT_EQ(1u, saved.size());
+  ASSERT_TRUE(saved.find(files[1]) != saved.end());
+
+  context.Stop();
+  db.Close();
+}
+
+
+namespace
+{
+  class GateListener : public IServerListener
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  condition_;
+    bool                       isOpen_;
+    bool                       isEntered_;
+    unsigned int               count_;
+
+  public:
+    explicit GateListener(bool isOpen) :
+      isOpen_(isOpen),
+      isEntered_(false),
+      count_(0)
+    {
+    }
+
+    virtual void SignalStoredInstance(const std::string& publicId,
+                                      const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
+    {
+    }
+
+    virtual void SignalChange(const ServerIndexChange& change) ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isEntered_ = true;
+      condition_.notify_all();
+
+      while (!isOpen_)
+      {
+        condition_.wait(lock);
+      }
+
+      count_++;
+      condition_.notify_all();
+    }
+
+    virtual bool FilterIncomingInstance(const DicomInstanceToStore& instance) ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    void Open()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      isOpen_ = true;
+      condition_.notify_all();
+    }
+
+    void WaitEntered()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!isEntered_)
+      {
+        condition_.wait(lock);
+      }
+    }
+
+    void WaitCount(unsigned int count)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (count_ < count)
+      {
+        condition_.wait(lock);
+      }
+    }
+
+    unsigned int GetCount()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return count_;
+    }
+  };
+}
+
+
+TEST(ServerIndex, ChangesDispatcher)
+{
+  MetricsRegistry metrics;
+  const ServerIndexChange change(ChangeType_NewInstance, ResourceType_Instance, "instance");
+
+  {
+    GateListener fast(true), slow(false);
+
+    ChangesDispatcher dispatcher(metrics);
+    dispatcher.AddListener(fast, "Fast");
+    dispatcher.AddListener(slow, "Slow");
+    ASSERT_THROW(dispatcher.AddListener(fast, "Fast"), OrthancException);
+    ASSERT_THROW(dispatcher.SetMaxQueueSize(10), OrthancException);
+
+    for (unsigned int i = 0; i < 100; i++)
+    {
+      dispatcher.Enqueue(change);
+    }
+
+    // The slow listener does not delay the fast one
+    fast.WaitCount(100);
+    ASSERT_EQ(0u, slow.GetCount());
+
+    slow.Open();
+    dispatcher.WaitEmpty();
+    ASSERT_EQ(100u, fast.GetCount());
+    ASSERT_EQ(100u, slow.GetCount());
+    ASSERT_EQ(0u, dispatcher.GetPendingCount());
+  }
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    GateListener listener(false);
+
+    ChangesDispatcher dispatcher(metrics);
+    dispatcher.SetMaxQueueSize(10);
+    dispatcher.SetOverflowPolicy(i == 0 ? ChangesOverflowPolicy_DropNewest : ChangesOverflowPolicy_DropOldest);
+    dispatcher.AddListener(listener, "Gate");
+
+    dispatcher.Enqueue(change);
+    listener.WaitEntered();
+
+    for (unsigned int j = 0; j < 100; j++)
+    {
+      dispatcher.Enqueue(change);
+    }
+
+    ASSERT_EQ(10u, dispatcher.GetPendingCount());
+
+    listener.Open();
+    dispatcher.WaitEmpty();
+    ASSERT_EQ(11u, listener.GetCount());
+  }
+}
+
+
+TEST(ServerIndex, JobsRegistryRecords)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  JobsRegistryRecords records(context.GetIndex());
+
+  // The buckets are part of the database format
+  ASSERT_EQ(JobsRegistryRecords::GetBucket("hello"), JobsRegistryRecords::GetBucket("hello"));
+  ASSERT_GT(JobsRegistryRecords::BUCKETS_COUNT, JobsRegistryRecords::GetBucket("hello"));
+
+  {
+    // Registry saved by Orthanc <= 1.9.5
+    Json::Value legacy;
+    legacy["Type"] = "JobsRegistry";
+    legacy["Jobs"]["a"] = "job-a";
+    context.GetIndex().SetGlobalProperty(GlobalProperty_JobsRegistry, false, legacy.toStyledString());
+  }
+
+  Json::Value registry;
+  bool isLegacy;
+  ASSERT_TRUE(records.Load(registry, isLegacy));
+  ASSERT_TRUE(isLegacy);
+  ASSERT_EQ("job-a", registry["Jobs"]["a"].asString());
+
+  Json::Value changes;
+  for (unsigned int i = 0; i < 1000; i++)
+  {
+    changes["job-" + boost::lexical_cast<std::string>(i)] = i;
+  }
+
+  records.Save(changes, true /* full, discards the legacy registry */);
+
+  ASSERT_TRUE(records.Load(registry, isLegacy));
+  ASSERT_FALSE(isLegacy);
+  ASSERT_EQ("JobsRegistry", registry["Type"].asString());
+  ASSERT_EQ(1000u, registry["Jobs"].size());
+  ASSERT_EQ(42, registry["Jobs"]["job-42"].asInt());
+
+  changes = Json::objectValue;
+  changes["job-42"] = Json::nullValue;
+  changes["job-43"] = 4343;
+  changes["nope"] = Json::nullValue;
+  records.Save(changes, false);
+
+  ASSERT_TRUE(records.Load(registry, isLegacy));
+  ASSERT_FALSE(isLegacy);
+  ASSERT_EQ(999u, registry["Jobs"].size());
+  ASSERT_FALSE(registry["Jobs"].isMember("job-42"));
+  ASSERT_EQ(4343, registry["Jobs"]["job-43"].asInt());
+  ASSERT_EQ(44, registry["Jobs"]["job-44"].asInt());
+
+  records.Save(Json::objectValue, true);
+  ASSERT_FALSE(records.Load(registry, isLegacy));
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, LazySimplifiedTags)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  ASSERT_EQ(0u, context.GetAvoidedDicomAsJsonCount());
+
+  {
+    ParsedDicomFile dicom(true);
+    dicom.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "HELLO");
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+
+    // No Lua script and no plugin: The simplified tags are not needed
+    std::string id;
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, *toStore, StoreInstanceMode_Default));
+    ASSERT_FALSE(toStore->HasSimplifiedTags());
+    ASSERT_EQ(1u, context.GetAvoidedDicomAsJsonCount());
+
+    const Json::Value& tags = toStore->GetSimplifiedTags();
+    ASSERT_TRUE(toStore->HasSimplifiedTags());
+    ASSERT_EQ("HELLO", tags["PatientName"].asString());
+    ASSERT_EQ(&tags, &toStore->GetSimplifiedTags());  // Cached
+  }
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, SummaryFromHeader)
+{
+  // Create a dummy 16x16 image
+  Image image(PixelFormat_Grayscale8, 16, 16, false);
+  for (unsigned int y = 0; y < image.GetHeight(); y++)
+  {
+    memset(image.GetRow(y), 128, image.GetWidth());
+  }
+
+  const DicomTransferSyntax syntaxes[] = {
+    DicomTransferSyntax_LittleEndianImplicit,
+    DicomTransferSyntax_LittleEndianExplicit,
+    DicomTransferSyntax_BigEndianExplicit,
+    DicomTransferSyntax_DeflatedLittleEndianExplicit
+  };
+
+  for (size_t i = 0; i < sizeof(syntaxes) / sizeof(DicomTransferSyntax); i++)
+  {
+    std::string buffer;
+
+    {
+      ParsedDicomFile dicom(true);
+      dicom.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "HELLO");
+      dicom.ReplacePlainString(DICOM_TAG_STUDY_DESCRIPTION, "WORLD");
+      dicom.EmbedImage(image);
+      ASSERT_TRUE(FromDcmtkBridge::Transcode(dicom.GetDcmtkObject(), syntaxes[i], NULL));
+      dicom.SaveToMemoryBuffer(buffer);
+    }
+
+    size_t headerSize;
+    if (syntaxes[i] == DicomTransferSyntax_BigEndianExplicit ||
+        syntaxes[i] == DicomTransferSyntax_DeflatedLittleEndianExplicit)
+    {
+      // Fallback to the parsing of the full file
+      ASSERT_FALSE(DicomInstanceToStore::LookupHeaderSize(headerSize, buffer.c_str(), buffer.size()));
+    }
+    else
+    {
+      ASSERT_TRUE(DicomInstanceToStore::LookupHeaderSize(headerSize, buffer.c_str(), buffer.size()));
+      ASSERT_LT(headerSize + 16u * 16u, buffer.size());
+    }
+
+    Json::Value expected;
+
+    {
+      ParsedDicomFile full(buffer);
+      DicomMap summary;
+      OrthancConfiguration::DefaultExtractDicomSummary(summary, full);
+      summary.Serialize(expected);
+    }
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromBuffer(buffer));
+
+    DicomMap summary;
+    toStore->GetSummary(summary);
+
+    Json::Value actual;
+    summary.Serialize(actual);
+    ASSERT_EQ(expected.toStyledString(), actual.toStyledString());
+    std::string s;
+    ASSERT_TRUE(summary.LookupStringValue(s, DICOM_TAG_PATIENT_NAME, false));
+    ASSERT_EQ("HELLO", s);
+    ASSERT_TRUE(summary.LookupStringValue(s, DICOM_TAG_STUDY_DESCRIPTION, false));
+    ASSERT_EQ("WORLD", s);
+  }
+}
+
+
+TEST(ServerIndex, DicomCacheBuffer)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  std::string id;
+
+  {
+    ParsedDicomFile dicom(true);
+    dicom.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "HELLO");
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, *toStore, StoreInstanceMode_Default));
+  }
+
+  std::string reference;
+  context.ReadDicom(reference, id);
+
+  boost::shared_ptr<const std::string> buffer;
+  ASSERT_FALSE(context.LookupDicomInCache(buffer, id));
+
+  context.ReadDicom(buffer, id);  // Not in the cache, read from the storage area
+  ASSERT_EQ(reference, *buffer);
+  ASSERT_FALSE(context.LookupDicomInCache(buffer, id));
+
+  const std::string* raw = NULL;
+
+  {
+    ServerContext::DicomCacheLocker locker(context, id);
+    ASSERT_EQ(reference, *locker.GetBuffer());
+    raw = locker.GetBuffer().get();
+  }
+
+  {
+    // The raw buffer is shared with the cache, without copy
+    ServerContext::DicomCacheLocker locker(context, id);
+    ASSERT_EQ(raw, locker.GetBuffer().get());
+  }
+
+  ASSERT_TRUE(context.LookupDicomInCache(buffer, id));
+  ASSERT_EQ(raw, buffer.get());
+
+  buffer.reset();
+  context.ReadDicom(buffer, id);
+  ASSERT_EQ(raw, buffer.get());
+
+  std::string s;
+  context.ReadDicom(s, id);
+  ASSERT_EQ(reference, s);
+
+  context.Stop();
+  db.Close();
+}
+
+
+TEST(ServerIndex, AttachmentRangesReader)
+{
+  MemoryStorageArea storage;
+  SQLiteDatabaseWrapper db;   // The SQLite DB is in memory
+  db.Open();
+  ServerContext context(db, storage, true /* running unit tests */, 10);
+  context.SetupJobsEngine(true, false);
+
+  std::string id;
+
+  {
+    ParsedDicomFile dicom(true);
+    dicom.ReplacePlainString(DICOM_TAG_PATIENT_NAME, "HELLO");
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+    toStore->SetOrigin(DicomInstanceOrigin::FromPlugins());
+    ASSERT_EQ(StoreStatus_Success, context.Store(id, *toStore, StoreInstanceMode_Default));
+  }
+
+  std::string reference;
+  context.ReadDicom(reference, id);
+  ASSERT_GT(reference.size(), 200u);
+
+  FileInfo attachment;
+  int64_t revision;
+  ASSERT_TRUE(context.GetIndex().LookupAttachment(attachment, revision, id, FileContentType_Dicom));
+  ASSERT_EQ(reference.size(), attachment.GetUncompressedSize());
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    if (i == 1)
+    {
+      // Read the ranges from the cache of DICOM files
+      ServerContext::DicomCacheLocker locker(context, id);
+    }
+
+    ServerContext::AttachmentRangesReader reader(context, id, attachment);
+
+    std::string part;
+    reader.ReadRange(part, 128, 132);
+    ASSERT_EQ("DICM", part);
+    reader.ReadRange(part, 0, 1);
+    ASSERT_EQ(reference.substr(0, 1), part);
+    reader.ReadRange(part, reference.size() - 10, reference.size());
+    ASSERT_EQ(reference.substr(reference.size() - 10), part);
+
+    ASSERT_THROW(reader.ReadRange(part, 0, reference.size() + 1), OrthancException);
+  }
+
+  context.Stop();
+  db.Close();
+}
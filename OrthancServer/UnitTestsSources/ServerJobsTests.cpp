@@ -35,7 +35,9 @@
 #include <gtest/gtest.h>
 
 #include "../../OrthancFramework/Sources/Compatibility.h"
+#include "../../OrthancFramework/Sources/Compression/ZipReader.h"
 #include "../../OrthancFramework/Sources/FileStorage/MemoryStorageArea.h"
+#include "../../OrthancFramework/Sources/HttpServer/HttpServer.h"
 #include "../../OrthancFramework/Sources/JobsEngine/Operations/LogJobOperation.h"
 #include "../../OrthancFramework/Sources/Logging.h"
 #include "../../OrthancFramework/Sources/SerializationToolbox.h"
@@ -791,12 +793,21 @@ TEST_F(OrthancJobsSerialization, Jobs)
     ASSERT_TRUE(tmp.GetPeer().IsPkcs11Enabled());
     ASSERT_FALSE(tmp.IsTranscode());
     ASSERT_THROW(tmp.GetTransferSyntax(), OrthancException);
+    ASSERT_EQ(1u, tmp.GetBatchSize());
+    ASSERT_EQ(1u, tmp.GetConcurrentRequests());
+    ASSERT_EQ(9u, tmp.GetCompressionLevel());
   }
 
   {
     OrthancPeerStoreJob job(GetContext());
     ASSERT_THROW(job.SetTranscode("nope"), OrthancException);
     job.SetTranscode("1.2.840.10008.1.2.4.50");
+    ASSERT_THROW(job.SetBatchSize(0), OrthancException);
+    ASSERT_THROW(job.SetConcurrentRequests(0), OrthancException);
+    ASSERT_THROW(job.SetCompressionLevel(10), OrthancException);
+    job.SetBatchSize(50);
+    job.SetConcurrentRequests(4);
+    job.SetCompressionLevel(1);
     
     ASSERT_TRUE(CheckIdempotentSetOfInstances(unserializer, job));
     ASSERT_TRUE(job.Serialize(s));
@@ -813,6 +824,9 @@ TEST_F(OrthancJobsSerialization, Jobs)
     ASSERT_FALSE(tmp.GetPeer().IsPkcs11Enabled());
     ASSERT_TRUE(tmp.IsTranscode());
     ASSERT_EQ(DicomTransferSyntax_JPEGProcess1, tmp.GetTransferSyntax());
+    ASSERT_EQ(50u, tmp.GetBatchSize());
+    ASSERT_EQ(4u, tmp.GetConcurrentRequests());
+    ASSERT_EQ(1u, tmp.GetCompressionLevel());
   }
 
   // ResourceModificationJob
@@ -1088,6 +1102,309 @@ TEST_F(OrthancJobsSerialization, Jobs)
 
 
 
+TEST_F(OrthancJobsSerialization, ArchiveLoader)
+{
+  std::list<std::string> instances;
+  for (unsigned int i = 0; i < 10; i++)
+  {
+    std::string id;
+    ASSERT_TRUE(CreateInstance(id));
+    instances.push_back(id);
+  }
+
+  std::string reference;
+
+  for (unsigned int threads = 0; threads <= 4; threads += 2)
+  {
+    for (unsigned int readAhead = 1; readAhead <= 8; readAhead *= 2)
+    {
+      std::string zip;
+
+      {
+        ArchiveJob job(GetContext(), false, false);
+        job.AcquireSynchronousTarget(new ZipWriter::MemoryStream(zip));
+        job.SetLoaderThreads(threads);
+        job.SetLoaderReadAhead(readAhead, (readAhead == 1 ? 1 /* one single byte */ : 1024 * 1024));
+
+        for (std::list<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+        {
+          job.AddResource(*it);
+        }
+
+        job.Start();
+
+        for (;;)
+        {
+          JobStepResult result = job.Step("");
+          if (result.GetCode() == JobStepCode_Success)
+          {
+            break;
+          }
+
+          ASSERT_EQ(JobStepCode_Continue, result.GetCode());
+        }
+      }
+
+      if (threads == 0 &&
+          readAhead == 1)
+      {
+        reference = zip;
+      }
+      else
+      {
+        ASSERT_EQ(reference.size(), zip.size());
+      }
+    }
+  }
+
+  ASSERT_FALSE(reference.empty());
+
+  {
+    // Cancel the job while the loader threads are reading ahead
+    std::string zip;
+    ArchiveJob job(GetContext(), false, false);
+    job.AcquireSynchronousTarget(new ZipWriter::MemoryStream(zip));
+    job.SetLoaderThreads(4);
+    job.SetLoaderReadAhead(4, 1024 * 1024);
+
+    for (std::list<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      job.AddResource(*it);
+    }
+
+    job.Start();
+    ASSERT_EQ(JobStepCode_Continue, job.Step("").GetCode());
+    ASSERT_EQ(JobStepCode_Continue, job.Step("").GetCode());
+    job.Stop(JobStopReason_Canceled);
+  }
+
+  {
+    // Parallel deflate of the files of the archive
+    std::string zip;
+
+    {
+      ArchiveJob job(GetContext(), false, false);
+      job.AcquireSynchronousTarget(new ZipWriter::MemoryStream(zip));
+      job.SetCompressionThreads(2);
+      job.SetStoreCompressedTransferSyntaxes(true);
+
+      for (std::list<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+      {
+        job.AddResource(*it);
+      }
+
+      job.Start();
+
+      while (job.Step("").GetCode() == JobStepCode_Continue)
+      {
+      }
+    }
+
+    std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(zip));
+    ASSERT_EQ(instances.size(), reader->GetFilesCount());
+  }
+}
+
+
+namespace
+{
+  // Stub of the "/instances" route of a peer, that rejects the DICOM
+  // files containing "BAD" and skips them in the answer to the
+  // upload of a ZIP archive, like Orthanc does for "BadFileFormat"
+  class PeerStub : public IHttpHandler
+  {
+  private:
+    boost::mutex  mutex_;
+    unsigned int  zipRequests_;
+    unsigned int  instanceRequests_;
+    unsigned int  received_;
+
+    static bool IsBad(const std::string& dicom)
+    {
+      return dicom.find("BAD") != std::string::npos;
+    }
+
+  public:
+    PeerStub() :
+      zipRequests_(0),
+      instanceRequests_(0),
+      received_(0)
+    {
+    }
+
+    unsigned int GetZipRequests() const
+    {
+      return zipRequests_;
+    }
+
+    unsigned int GetInstanceRequests() const
+    {
+      return instanceRequests_;
+    }
+
+    unsigned int GetReceived() const
+    {
+      return received_;
+    }
+
+    virtual bool CreateChunkedRequestReader(std::unique_ptr<IChunkedRequestReader>& target,
+                                            RequestOrigin origin,
+                                            const char* remoteIp,
+                                            const char* username,
+                                            HttpMethod method,
+                                            const UriComponents& uri,
+                                            const HttpToolbox::Arguments& headers) ORTHANC_OVERRIDE
+    {
+      return false;
+    }
+
+    virtual bool Handle(HttpOutput& output,
+                        RequestOrigin origin,
+                        const char* remoteIp,
+                        const char* username,
+                        HttpMethod method,
+                        const UriComponents& uri,
+                        const HttpToolbox::Arguments& headers,
+                        const HttpToolbox::GetArguments& getArguments,
+                        const void* bodyData,
+                        size_t bodySize) ORTHANC_OVERRIDE
+    {
+      if (method != HttpMethod_Post ||
+          uri.size() != 1 ||
+          uri[0] != "instances")
+      {
+        return false;
+      }
+
+      boost::mutex::scoped_lock lock(mutex_);
+
+      HttpToolbox::Arguments::const_iterator contentType = headers.find("content-type");
+
+      if (contentType != headers.end() &&
+          contentType->second == EnumerationToString(MimeType_Zip))
+      {
+        zipRequests_++;
+
+        Json::Value answer = Json::arrayValue;
+
+        std::unique_ptr<ZipReader> reader(ZipReader::CreateFromMemory(bodyData, bodySize));
+
+        std::string filename, content;
+        while (reader->ReadNextFile(filename, content))
+        {
+          if (!IsBad(content))
+          {
+            Json::Value item;
+            item["Status"] = "Success";
+            answer.append(item);
+            received_++;
+          }
+        }
+
+        output.SetContentType(MimeType_Json);
+        output.Answer(answer.toStyledString());
+      }
+      else
+      {
+        instanceRequests_++;
+
+        if (IsBad(std::string(reinterpret_cast<const char*>(bodyData), bodySize)))
+        {
+          output.SendStatus(HttpStatus_400_BadRequest);
+        }
+        else
+        {
+          Json::Value item;
+          item["Status"] = "Success";
+          received_++;
+
+          output.SetContentType(MimeType_Json);
+          output.Answer(item.toStyledString());
+        }
+      }
+
+      return true;
+    }
+  };
+}
+
+
+TEST_F(OrthancJobsSerialization, OrthancPeerStoreJobBatches)
+{
+  std::vector<std::string> instances;
+  for (unsigned int i = 0; i < 4; i++)
+  {
+    ParsedDicomFile dicom(true);
+    dicom.Replace(DICOM_TAG_PATIENT_NAME, std::string(i == 2 ? "BAD" : "JODOGNE"),
+                  false, DicomReplaceMode_InsertIfAbsent, "");
+
+    std::unique_ptr<DicomInstanceToStore> toStore(DicomInstanceToStore::CreateFromParsedDicomFile(dicom));
+
+    std::string id;
+    ASSERT_EQ(StoreStatus_Success, GetContext().Store(id, *toStore, StoreInstanceMode_Default));
+    instances.push_back(id);
+  }
+
+  PeerStub stub;
+  HttpServer server;
+  server.SetPortNumber(5001);
+  server.Register(stub);
+  server.Start();
+
+  WebServiceParameters peer;
+  peer.SetUrl("http://localhost:5001/");
+
+  {
+    // The answer to the ZIP archive matches its content
+    OrthancPeerStoreJob job(GetContext());
+    job.SetPeer(peer);
+    job.SetBatchSize(10);
+    job.AddInstance(instances[0]);
+    job.AddInstance(instances[1]);
+    job.AddInstance(instances[3]);
+    job.Start();
+
+    while (job.Step("").GetCode() == JobStepCode_Continue)
+    {
+    }
+
+    ASSERT_TRUE(job.GetFailedInstances().empty());
+    ASSERT_EQ(1u, stub.GetZipRequests());
+    ASSERT_EQ(0u, stub.GetInstanceRequests());
+    ASSERT_EQ(3u, stub.GetReceived());
+  }
+
+  {
+    // The peer skips the bad instance in its answer to the ZIP
+    // archive: The instances of the batch are sent one by one, and
+    // only the bad instance fails
+    OrthancPeerStoreJob job(GetContext());
+    job.SetPeer(peer);
+    job.SetBatchSize(10);
+    job.SetPermissive(true);
+
+    for (size_t i = 0; i < instances.size(); i++)
+    {
+      job.AddInstance(instances[i]);
+    }
+
+    job.Start();
+
+    while (job.Step("").GetCode() == JobStepCode_Continue)
+    {
+    }
+
+    ASSERT_EQ(1u, job.GetFailedInstances().size());
+    ASSERT_TRUE(job.IsFailedInstance(instances[2]));
+    ASSERT_EQ(2u, stub.GetZipRequests());
+    ASSERT_EQ(4u, stub.GetInstanceRequests());
+    ASSERT_EQ(3u + 3u /* from the ZIP archive */ + 3u /* one by one */, stub.GetReceived());
+  }
+
+  server.Stop();
+}
+
+
 TEST_F(OrthancJobsSerialization, DicomAssociationParameters)
 {
   Json::Value v;